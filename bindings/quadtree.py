@@ -1,14 +1,53 @@
 from ctypes import *
+import tempfile
 import unittest
+try:
+    import numpy
+except ImportError:
+    numpy = None
 
 class Quadtree:
     class _QuadtreeStruct(Structure):
         pass
     class _QueryResultStruct(Structure):
         _fields_ = [("number_of_ids", c_int),
-                    ("ids", POINTER(c_long))]
+                    ("ids", POINTER(c_long)),
+                    ("capacity", c_int)]
+    class _BatchResultStruct(Structure):
+        _fields_ = [("number_of_points", c_int),
+                    ("offsets", POINTER(c_int)),
+                    ("number_of_ids", c_int),
+                    ("ids", POINTER(c_long)),
+                    ("offsets_capacity", c_int),
+                    ("ids_capacity", c_int),
+                    ("scratch", c_void_p)]
+    class _NearestResultStruct(Structure):
+        _fields_ = [("number_of_ids", c_int),
+                    ("ids", POINTER(c_long)),
+                    ("distances", POINTER(c_double)),
+                    ("capacity", c_int),
+                    ("scratch", c_void_p)]
+    _IngestErrorHandler = CFUNCTYPE(None, c_long, c_int, c_char_p, c_void_p)
+    class _IngestOptionsStruct(Structure):
+        pass
+    _IngestOptionsStruct._fields_ = [("format", c_int),
+                                     ("origin_x", c_double),
+                                     ("origin_y", c_double),
+                                     ("scale_x", c_double),
+                                     ("scale_y", c_double),
+                                     ("skip_lines", c_long),
+                                     ("max_record_length", c_long),
+                                     ("error_handler", _IngestErrorHandler),
+                                     ("context", c_void_p)]
+    class _IngestStatsStruct(Structure):
+        _fields_ = [("number_of_records", c_long),
+                    ("number_of_polygons", c_long),
+                    ("number_of_errors", c_long)]
+    _INGEST_FORMATS = {"wkt": 0, "geojson": 1, "csv": 2}
     _QuadtreePtr = POINTER(_QuadtreeStruct)
     _QueryResultPtr = POINTER(_QueryResultStruct)
+    _BatchResultPtr = POINTER(_BatchResultStruct)
+    _NearestResultPtr = POINTER(_NearestResultStruct)
 
     _lib = CDLL("../libquadtree.so")
     _lib.quadtree_create.argtypes = [c_int, c_int, c_int, c_int]
@@ -18,12 +57,40 @@ class Quadtree:
     _lib.quadtree_add.argtypes = [_QuadtreePtr, c_long, c_int,
                                  POINTER(c_int), POINTER(c_int)]
     _lib.quadtree_add.restype = c_int
+    _lib.quadtree_add_batch.argtypes = [_QuadtreePtr, c_int, POINTER(c_long), POINTER(c_int),
+                                        POINTER(c_int), POINTER(c_int)]
+    _lib.quadtree_add_batch.restype = c_int
     _lib.quadtree_query.argtypes = [_QuadtreePtr, c_int, c_int, _QueryResultPtr]
     _lib.quadtree_query.restype = c_int
+    _lib.quadtree_query_rect.argtypes = [_QuadtreePtr, c_int, c_int, c_int, c_int,
+                                         _QueryResultPtr]
+    _lib.quadtree_query_rect.restype = c_int
+    _lib.quadtree_query_nearest.argtypes = [_QuadtreePtr, c_int, c_int, c_int, c_double,
+                                            _NearestResultPtr]
+    _lib.quadtree_query_nearest.restype = c_int
+    _lib.quadtree_nearest_result_allocate.argtypes = []
+    _lib.quadtree_nearest_result_allocate.restype = _NearestResultPtr
+    _lib.quadtree_nearest_result_free.argtypes = [_NearestResultPtr]
+    _lib.quadtree_nearest_result_free.restype = None
     _lib.quadtree_remove.argtypes = [_QuadtreePtr, c_long]
     _lib.quadtree_remove.restype = c_int
     _lib.quadtree_query_result_allocate.argtypes = []
     _lib.quadtree_query_result_allocate.restype = _QueryResultPtr
+    _lib.quadtree_query_batch.argtypes = [_QuadtreePtr, c_int, POINTER(c_int),
+                                          POINTER(c_int), _BatchResultPtr]
+    _lib.quadtree_query_batch.restype = c_int
+    _lib.quadtree_query_batch_xy.argtypes = [_QuadtreePtr, c_int, POINTER(c_int),
+                                             _BatchResultPtr]
+    _lib.quadtree_query_batch_xy.restype = c_int
+    _lib.quadtree_batch_result_allocate.argtypes = []
+    _lib.quadtree_batch_result_allocate.restype = _BatchResultPtr
+    _lib.quadtree_batch_result_free.argtypes = [_BatchResultPtr]
+    _lib.quadtree_batch_result_free.restype = None
+    _lib.quadtree_ingest_options_initialize.argtypes = [POINTER(_IngestOptionsStruct)]
+    _lib.quadtree_ingest_options_initialize.restype = None
+    _lib.quadtree_ingest.argtypes = [_QuadtreePtr, c_int, POINTER(_IngestOptionsStruct),
+                                     POINTER(_IngestStatsStruct)]
+    _lib.quadtree_ingest.restype = c_int
 
     _QUADTREE_SUCCESS = c_int.in_dll(_lib, "QUADTREE_SUCCESS").value
     _QUADTREE_ERROR = c_int.in_dll(_lib, "QUADTREE_ERROR").value
@@ -32,6 +99,8 @@ class Quadtree:
 
     def __init__(self, bounding_box):
         self.__query_result = 0
+        self.__batch_result = 0
+        self.__nearest_result = 0
         self.__quadtree = Quadtree._lib.quadtree_create(bounding_box[0], bounding_box[1],
                                                        bounding_box[2], bounding_box[3])
         if not self.__quadtree:
@@ -39,11 +108,21 @@ class Quadtree:
         self.__query_result = Quadtree._lib.quadtree_query_result_allocate()
         if not self.__query_result:
             raise MemoryError("Could not create quadtree query result")
+        self.__batch_result = Quadtree._lib.quadtree_batch_result_allocate()
+        if not self.__batch_result:
+            raise MemoryError("Could not create quadtree batch result")
+        self.__nearest_result = Quadtree._lib.quadtree_nearest_result_allocate()
+        if not self.__nearest_result:
+            raise MemoryError("Could not create quadtree nearest result")
         self.__bounding_box = bounding_box
 
     def __del__(self):
         Quadtree._lib.quadtree_destroy(self.__quadtree)
         Quadtree._lib.quadtree_query_result_free(self.__query_result)
+        if self.__batch_result:
+            Quadtree._lib.quadtree_batch_result_free(self.__batch_result)
+        if self.__nearest_result:
+            Quadtree._lib.quadtree_nearest_result_free(self.__nearest_result)
 
     def add(self, polygon_id, polygon_points):
         INT_ARRAY = c_int * len(polygon_points)
@@ -65,13 +144,142 @@ class Quadtree:
         result = self.__query_result.contents
         return list(result.ids[i] for i in range(result.number_of_ids))
 
+    def query_rect(self, rect):
+        """Returns the sorted ids of the polygons overlapping rect.
+
+        rect is given as (left, bottom, width, height).  A rect that
+        misses the bounding box yields an empty list."""
+        return_code = Quadtree._lib.quadtree_query_rect(self.__quadtree, rect[0], rect[1],
+                                                        rect[2], rect[3], self.__query_result)
+        if return_code == Quadtree._QUADTREE_ERROR_OUT_OF_BOUNDS:
+            return []
+        self._handle_errors(return_code)
+        result = self.__query_result.contents
+        return result.ids[:result.number_of_ids]
+
+    def query_nearest(self, point, k=1, max_distance=-1):
+        """Returns a list of up to k (id, distance) pairs, nearest first.
+
+        The distance is 0 for polygons containing the point.  Polygons
+        farther away than max_distance are ignored unless it is
+        negative."""
+        self._handle_errors(Quadtree._lib.quadtree_query_nearest(self.__quadtree,
+                                                                point[0], point[1], k,
+                                                                max_distance,
+                                                                self.__nearest_result))
+        result = self.__nearest_result.contents
+        return list((result.ids[i], result.distances[i]) for i in range(result.number_of_ids))
+
+    def query_batch(self, points):
+        """Returns a list with the list of ids for each of the points.
+
+        Points outside of the bounding box yield an empty list."""
+        INT_ARRAY = c_int * len(points)
+        xs, ys = INT_ARRAY(), INT_ARRAY()
+        for i, point in enumerate(points):
+            xs[i] = point[0]
+            ys[i] = point[1]
+        return_code = Quadtree._lib.quadtree_query_batch(self.__quadtree, len(points),
+                                                         xs, ys, self.__batch_result)
+        if return_code != Quadtree._QUADTREE_ERROR_OUT_OF_BOUNDS:
+            self._handle_errors(return_code)
+        result = self.__batch_result.contents
+        ids = result.ids[:result.number_of_ids]
+        offsets = result.offsets[:result.number_of_points + 1]
+        return [ids[offsets[i]:offsets[i + 1]] for i in range(len(points))]
+
+    def add_arrays(self, ids, offsets, xs, ys):
+        """Adds len(ids) polygons with a single C call.
+
+        The corners of polygon i are xs[offsets[i]:offsets[i + 1]] and
+        ys[offsets[i]:offsets[i + 1]].  xs and ys are handed to the C
+        library as they are if they are contiguous int32 NumPy arrays
+        and converted once otherwise.  Like every call through ctypes
+        the work is done without holding the GIL.  Requires NumPy."""
+        ids = Quadtree._as_array(ids, c_long)
+        offsets = Quadtree._as_array(offsets, c_int)
+        xs = Quadtree._as_array(xs, c_int)
+        ys = Quadtree._as_array(ys, c_int)
+        if len(offsets) != len(ids) + 1 or len(xs) != len(ys) or \
+           (len(ids) > 0 and (offsets[0] != 0 or offsets[-1] > len(xs))):
+            raise ValueError("offsets do not match ids and coordinates")
+        counts = numpy.diff(offsets).astype(numpy.intc)
+        if (counts < 0).any():
+            raise ValueError("offsets must not decrease")
+        self._handle_errors(Quadtree._lib.quadtree_add_batch(self.__quadtree, len(ids),
+                                                            Quadtree._pointer(ids, c_long),
+                                                            Quadtree._pointer(counts, c_int),
+                                                            Quadtree._pointer(xs, c_int),
+                                                            Quadtree._pointer(ys, c_int)))
+
+    def query_arrays(self, points):
+        """Looks up all points of an (N, 2) array with a single C call.
+
+        Returns the arrays offsets and ids where the ids of the polygons
+        containing points[i] are ids[offsets[i]:offsets[i + 1]].  Points
+        outside of the bounding box yield no ids.  An int32 array in
+        the default C order is handed to the C library as it is; other
+        arrays are converted to that layout once.  Like every call
+        through ctypes the work is done without holding the GIL.
+        Requires NumPy."""
+        points = Quadtree._as_array(points, c_int).reshape((-1, 2))
+        return_code = Quadtree._lib.quadtree_query_batch_xy(self.__quadtree, len(points),
+                                                            Quadtree._pointer(points, c_int),
+                                                            self.__batch_result)
+        if return_code != Quadtree._QUADTREE_ERROR_OUT_OF_BOUNDS:
+            self._handle_errors(return_code)
+        result = self.__batch_result.contents
+        # the batch result is reused by the next query so it is copied
+        return (Quadtree._copy_array(result.offsets, result.number_of_points + 1, c_int),
+                Quadtree._copy_array(result.ids, result.number_of_ids, c_long))
+
+    @staticmethod
+    def _as_array(values, ctype):
+        if numpy is None:
+            raise ImportError("NumPy is required for the array functions")
+        return numpy.ascontiguousarray(values, dtype=ctype)
+
+    @staticmethod
+    def _pointer(array, ctype):
+        return array.ctypes.data_as(POINTER(ctype))
+
+    @staticmethod
+    def _copy_array(pointer, length, ctype):
+        if length == 0 or not pointer:
+            return numpy.zeros(0, dtype=ctype)
+        return numpy.ctypeslib.as_array(pointer, shape=(length,)).copy()
+
+    def ingest(self, file, format="wkt", origin=(0, 0), scale=(1, 1), skip_lines=0):
+        """Adds the polygons of every record of file in one C call.
+
+        file is an open file or a file descriptor and format one of
+        "wkt", "geojson" or "csv".  Coordinates are mapped to
+        round((x - origin[0]) * scale[0]) and likewise for y.  Returns
+        the number of polygons added and a list of (line number,
+        message) pairs for the records that were skipped."""
+        errors = []
+        def handle_error(line_number, error_code, message, context):
+            errors.append((line_number, message.decode()))
+        options = Quadtree._IngestOptionsStruct()
+        Quadtree._lib.quadtree_ingest_options_initialize(byref(options))
+        options.format = Quadtree._INGEST_FORMATS[format]
+        options.origin_x, options.origin_y = origin
+        options.scale_x, options.scale_y = scale
+        options.skip_lines = skip_lines
+        options.error_handler = Quadtree._IngestErrorHandler(handle_error)
+        stats = Quadtree._IngestStatsStruct()
+        fd = file if isinstance(file, int) else file.fileno()
+        self._handle_errors(Quadtree._lib.quadtree_ingest(self.__quadtree, fd,
+                                                         byref(options), byref(stats)))
+        return stats.number_of_polygons, errors
+
     def _handle_errors(self, return_code):
         if return_code == Quadtree._QUADTREE_SUCCESS:
             pass
         elif return_code == Quadtree._QUADTREE_ERROR_OUT_OF_MEMORY:
             raise MemoryError("quadtree lib ran out of memory")
         elif return_code == Quadtree._QUADTREE_ERROR_OUT_OF_BOUNDS:
-            raise RuntimeError("Out of bounds. Current bounding box: " + self.__bounding_box)
+            raise RuntimeError("Out of bounds. Current bounding box: " + str(self.__bounding_box))
         else:
             raise RuntimeError("quadtree lib failed with error code: " + str(return_code))
 
@@ -108,6 +316,75 @@ class TestQuadtree(unittest.TestCase):
         self.assertEquals([id1, id2], sorted(quadtree.query((5, 5))))
         self.assertEquals([], quadtree.query((500, 500)))
 
+    def testBatchQuery(self):
+        quadtree = Quadtree([0, 0, 800, 600])
+        id1 = 37
+        id2 = 42
+        quadtree.add(id1, [(0, 0), (800, 0), (0, 600)])
+        quadtree.add(id2, [(3, 3), (800, 0), (0, 600)])
+        points = [(0, 0), (5, 5), (500, 500), (5000, 5)]
+        result = quadtree.query_batch(points)
+        self.assertEqual([[id1], [id1, id2], [], []],
+                         [sorted(ids) for ids in result])
+
+    @unittest.skipIf(numpy is None, "NumPy is not installed")
+    def testArrays(self):
+        quadtree = Quadtree([0, 0, 800, 600])
+        quadtree.add_arrays([37, 42], [0, 3, 6],
+                            numpy.array([0, 800, 0, 3, 800, 0], dtype=numpy.int32),
+                            numpy.array([0, 0, 600, 3, 0, 600], dtype=numpy.int32))
+        quadtree.add_arrays([43], [0, 3], [500, 700, 700], [500, 500, 590])
+        points = numpy.array([(0, 0), (5, 5), (650, 510), (5000, 5)], dtype=numpy.int32)
+        offsets, ids = quadtree.query_arrays(points)
+        self.assertEqual([0, 1, 3, 4, 4], offsets.tolist())
+        self.assertEqual([[37], [37, 42], [43], []],
+                         [sorted(ids[offsets[i]:offsets[i + 1]].tolist()) for i in range(4)])
+        self.assertEqual(offsets.tolist(), quadtree.query_arrays(numpy.asfortranarray(points))[0].tolist())
+        offsets, ids = quadtree.query_arrays(numpy.zeros((0, 2), dtype=numpy.int32))
+        self.assertEqual([0], offsets.tolist())
+        self.assertEqual(0, len(ids))
+        with self.assertRaises(ValueError):
+            quadtree.add_arrays([1, 2], [0, 3], [0, 1, 2], [0, 1, 2])
+        with self.assertRaises(RuntimeError):
+            quadtree.add_arrays([1], [0, 3], [0, -5, 0], [0, 0, 10])
+        self.assertEqual([37], quadtree.query((0, 0)))
+
+    def testRectQuery(self):
+        quadtree = Quadtree([0, 0, 800, 600])
+        id1 = 37
+        id2 = 42
+        quadtree.add(id1, [(0, 0), (800, 0), (0, 600)])
+        quadtree.add(id2, [(500, 500), (700, 500), (700, 590)])
+        self.assertEqual([id1, id2], quadtree.query_rect((0, 0, 800, 600)))
+        self.assertEqual([id2], quadtree.query_rect((600, 500, 50, 50)))
+        self.assertEqual([], quadtree.query_rect((900, 0, 10, 10)))
+
+    def testNearestQuery(self):
+        quadtree = Quadtree([0, 0, 800, 600])
+        id1 = 37
+        id2 = 42
+        quadtree.add(id1, [(0, 0), (100, 0), (0, 100)])
+        quadtree.add(id2, [(500, 500), (700, 500), (700, 590)])
+        self.assertEqual([(id1, 0.0)], quadtree.query_nearest((10, 10)))
+        nearest = quadtree.query_nearest((700, 600), 2)
+        self.assertEqual([id2, id1], [polygon_id for polygon_id, _ in nearest])
+        self.assertEqual(10.0, nearest[0][1])
+        self.assertAlmostEqual(1200 / 2 ** 0.5, nearest[1][1])
+        self.assertEqual([(id2, 10.0)], quadtree.query_nearest((700, 600), 2, 100))
+
+    def testIngest(self):
+        quadtree = Quadtree([0, 0, 800, 600])
+        with tempfile.TemporaryFile() as f:
+            f.write(b"37 POLYGON ((0 0, 80 0, 0 60, 0 0))\n"
+                    b"42 POLYGON ((0 0, 900 0, 0 60))\n"
+                    b"43 POLYGON ((0 0\n")
+            f.seek(0)
+            number_of_polygons, errors = quadtree.ingest(f, scale=(10, 10))
+        self.assertEqual(1, number_of_polygons)
+        self.assertEqual([2, 3], [line_number for line_number, _ in errors])
+        self.assertEqual([37], quadtree.query((10, 10)))
+        self.assertEqual([], quadtree.query((700, 500)))
+
     def testRemoval(self):
         quadtree = Quadtree([0, 0, 800, 600])
         id1 = 37
@@ -0,0 +1,185 @@
+#include "edges.h"
+
+#include <stdlib.h>
+
+/* aim for this many edges per bucket */
+#define EDGES_PER_BUCKET (4)
+/* an edge goes into at most this many buckets of its level */
+#define MAX_EDGE_COPIES (4)
+
+static void lq_edge_initialize(lq_edge_t *edge, int xi, int yi, int xj, int yj) {
+    edge->x = xi;
+    edge->y = yi;
+    edge->dx = (long long) xj - xi;
+    edge->dy = (long long) yj - yi;
+    if (edge->dy < 0) {
+        edge->dx = -edge->dx;
+        edge->dy = -edge->dy;
+        edge->y_low = yj;
+        edge->y_high = yi;
+    } else {
+        edge->y_low = yi;
+        edge->y_high = yj;
+    }
+}
+
+/* Finds the level of edge and the first of the at most MAX_EDGE_COPIES
+ * buckets it goes into, counting the buckets of all levels. */
+static size_t lq_edge_index_place(const lq_edge_index_t *index, const lq_edge_t *edge, int *number_of_buckets) {
+    int level;
+    long long first_row = (long long) edge->y_low - index->y_min;
+    long long last_row = (long long) edge->y_high - 1 - index->y_min;
+    for (level = 0; level < index->number_of_levels - 1; ++level) {
+        if ((last_row >> (index->shift + level)) - (first_row >> (index->shift + level)) < MAX_EDGE_COPIES) {
+            break;
+        }
+    }
+    *number_of_buckets = (int) ((last_row >> (index->shift + level)) - (first_row >> (index->shift + level))) + 1;
+    return index->level_firsts[level] + (size_t) (first_row >> (index->shift + level));
+}
+
+/* Builds the index of the polygon with the n corners xs and ys.  No
+ * edge is copied more than MAX_EDGE_COPIES times and the levels
+ * together have at most about two buckets per EDGES_PER_BUCKET
+ * corners, so the index stays linear in n whatever the shape of the
+ * polygon. */
+lq_edge_index_t* lq_edge_index_create(int n, int *xs, int *ys) {
+    int i, j, b, level;
+    size_t first_bucket, number_of_edges;
+    long long height;
+    lq_edge_t edge;
+    lq_edge_index_t *index = (lq_edge_index_t*) calloc(1, sizeof(lq_edge_index_t));
+    if (index == NULL) {
+        return NULL;
+    }
+    index->y_min = ys[0];
+    index->y_max = ys[0];
+    for (i = 1; i < n; ++i) {
+        if (ys[i] < index->y_min) {
+            index->y_min = ys[i];
+        }
+        if (ys[i] > index->y_max) {
+            index->y_max = ys[i];
+        }
+    }
+    /* the smallest power of 2 bucket height giving at most n /
+     * EDGES_PER_BUCKET buckets on the lowest level.  The highest level
+     * has a single bucket. */
+    height = (long long) index->y_max - index->y_min;
+    while ((height >> index->shift) * EDGES_PER_BUCKET > n) {
+        index->shift++;
+    }
+    index->level_firsts[0] = 0;
+    for (level = 0; level == 0 || (height >> (index->shift + level - 1)) > 0; ++level) {
+        index->level_firsts[level + 1] = index->level_firsts[level] + (int) (height >> (index->shift + level)) + 1;
+    }
+    index->number_of_levels = level;
+    index->number_of_buckets = index->level_firsts[level];
+    index->bucket_starts = (size_t*) calloc(index->number_of_buckets + 1, sizeof(size_t));
+    if (index->bucket_starts == NULL) {
+        free(index);
+        return NULL;
+    }
+    /* count the edges of every bucket, then place them */
+    for (i = 0, j = n - 1; i < n; j = i++) {
+        lq_edge_initialize(&edge, xs[i], ys[i], xs[j], ys[j]);
+        if (edge.dy == 0) {
+            continue;
+        }
+        first_bucket = lq_edge_index_place(index, &edge, &b);
+        for (; b > 0; --b) {
+            index->bucket_starts[first_bucket + b]++;
+        }
+    }
+    for (b = 0; b < index->number_of_buckets; ++b) {
+        index->bucket_starts[b + 1] += index->bucket_starts[b];
+    }
+    number_of_edges = index->bucket_starts[index->number_of_buckets];
+    index->edges = (lq_edge_t*) malloc((number_of_edges > 0 ? number_of_edges : 1) * sizeof(lq_edge_t));
+    if (index->edges == NULL) {
+        free(index->bucket_starts);
+        free(index);
+        return NULL;
+    }
+    for (i = 0, j = n - 1; i < n; j = i++) {
+        lq_edge_initialize(&edge, xs[i], ys[i], xs[j], ys[j]);
+        if (edge.dy == 0) {
+            continue;
+        }
+        first_bucket = lq_edge_index_place(index, &edge, &b);
+        for (; b > 0; --b) {
+            index->edges[index->bucket_starts[first_bucket + b - 1]++] = edge;
+        }
+    }
+    /* filling advanced every start to the start of the next bucket */
+    for (b = index->number_of_buckets; b > 0; --b) {
+        index->bucket_starts[b] = index->bucket_starts[b - 1];
+    }
+    index->bucket_starts[0] = 0;
+    /* queries need not look at the empty levels on top */
+    while (index->number_of_levels > 1 &&
+           index->bucket_starts[index->level_firsts[index->number_of_levels - 1]] == number_of_edges) {
+        index->number_of_levels--;
+    }
+    return index;
+}
+
+void lq_edge_index_destroy(lq_edge_index_t *index) {
+    if (index != NULL) {
+        free(index->bucket_starts);
+        free(index->edges);
+        free(index);
+    }
+}
+
+/* the number of bytes allocated for index */
+size_t lq_edge_index_size(const lq_edge_index_t *index) {
+    size_t number_of_edges = index->bucket_starts[index->number_of_buckets];
+    return sizeof(lq_edge_index_t) + (index->number_of_buckets + 1) * sizeof(size_t) +
+           (number_of_edges > 0 ? number_of_edges : 1) * sizeof(lq_edge_t);
+}
+
+/* the number of edges lq_edge_index_contains() tests for a point in
+ * row py */
+size_t lq_edge_index_bucket_size(const lq_edge_index_t *index, int py) {
+    int level;
+    size_t bucket, size = 0;
+    if (py < index->y_min || py >= index->y_max) {
+        return 0;
+    }
+    for (level = 0; level < index->number_of_levels; ++level) {
+        bucket = index->level_firsts[level] + (size_t) (((long long) py - index->y_min) >> (index->shift + level));
+        size += index->bucket_starts[bucket + 1] - index->bucket_starts[bucket];
+    }
+    return size;
+}
+
+/* Same result as point_in_polygon() without a division.  The original
+ * test is px - x < trunc(a / dy) with a = dx * (py - y) and dy > 0.
+ * For a >= 0 the quotient is truncated downwards which makes this
+ * px - x + 1 <= a / dy, for a < 0 it is truncated upwards which makes
+ * it px - x < a / dy.  Both sides are multiplied by dy.  Edges on the
+ * higher levels often do not straddle row py, so the tests are combined
+ * without branches. */
+int lq_edge_index_contains(const lq_edge_index_t *index, int px, int py) {
+    int level;
+    size_t i, end, bucket;
+    int inside = 0;
+    const lq_edge_t *edge;
+    if (py < index->y_min || py >= index->y_max) {
+        return 0;
+    }
+    for (level = 0; level < index->number_of_levels; ++level) {
+        bucket = index->level_firsts[level] + (size_t) (((long long) py - index->y_min) >> (index->shift + level));
+        end = index->bucket_starts[bucket + 1];
+        for (i = index->bucket_starts[bucket]; i < end; ++i) {
+            long long a, d;
+            edge = &index->edges[i];
+            a = edge->dx * ((long long) py - edge->y);
+            d = (long long) px - edge->x;
+            inside ^= (edge->y_low <= py) & (py < edge->y_high) &
+                      (d * edge->dy + (a >= 0 ? edge->dy : 0) <= a - (a < 0));
+        }
+    }
+    return inside;
+}
@@ -0,0 +1,48 @@
+#ifndef __EDGES_H__
+#define __EDGES_H__
+
+#include <stddef.h>
+
+/* An edge of a polygon prepared for point_in_polygon style crossing
+ * tests.  It straddles the horizontal line through a point if
+ * y_low <= py < y_high.  (x, y) is the corner the original test
+ * measures from and dy is made positive by negating dx and dy
+ * together, which does not change their quotient. */
+typedef struct {
+    int y_low;
+    int y_high;
+    int x;
+    int y;
+    long long dx;
+    long long dy;
+} lq_edge_t;
+
+/* the most levels an index of int coordinates can have */
+#define EDGE_INDEX_MAX_LEVELS (34)
+
+/* The non-horizontal edges of a polygon bucketed by y on several
+ * levels.  Bucket b of level l covers the rows
+ * y_min + (b << (shift + l)) up to y_min + ((b + 1) << (shift + l)),
+ * so every level has buckets twice as high as the one below.  An edge
+ * is kept on the lowest level where it straddles rows of only a few
+ * buckets and a copy of it goes into each of them.  The buckets of
+ * level l are level_firsts[l] up to level_firsts[l + 1].  Queries skip
+ * the empty levels on top, so number_of_buckets may count more. */
+typedef struct {
+    int y_min;
+    int y_max;
+    int shift;
+    int number_of_levels;
+    int number_of_buckets;
+    int level_firsts[EDGE_INDEX_MAX_LEVELS + 1];
+    size_t *bucket_starts;
+    lq_edge_t *edges;
+} lq_edge_index_t;
+
+lq_edge_index_t* lq_edge_index_create(int n, int *xs, int *ys);
+void lq_edge_index_destroy(lq_edge_index_t *index);
+size_t lq_edge_index_size(const lq_edge_index_t *index);
+size_t lq_edge_index_bucket_size(const lq_edge_index_t *index, int py);
+int lq_edge_index_contains(const lq_edge_index_t *index, int px, int py);
+
+#endif /* __EDGES_H__ */
@@ -0,0 +1,231 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "epoch.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Every thread that ever read a quadtree with concurrent readers owns
+ * a record in a global list.  epoch is 0 while the thread is not
+ * reading and depth counts nested reads, e.g. a query started from the
+ * visitor of another one.  Records are never freed so that writers can
+ * walk the list without locks; the record of a thread that exited is
+ * taken over by the next thread that starts reading.  A pinned record
+ * belongs to a snapshot instead of a thread, see lq_epoch_pin(). */
+struct lq_epoch_reader_type {
+    unsigned long epoch;
+    int depth;
+    int in_use;
+    int pinned;
+    struct lq_epoch_reader_type *next;
+};
+
+/* starts at 1 since an epoch of 0 marks readers that are not reading
+ * and memory that was retired in the current epoch */
+static unsigned long lq_epoch_global = 1;
+static lq_epoch_reader_t *lq_epoch_readers = NULL;
+static int lq_epoch_number_of_pins = 0;
+/* initial-exec for the same reason as the call counters of quadtree.c */
+static __thread lq_epoch_reader_t *lq_epoch_reader __attribute__((tls_model("initial-exec"))) = NULL;
+static pthread_once_t lq_epoch_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t lq_epoch_key;
+static int lq_epoch_key_created = 0;
+
+static void lq_epoch_thread_exit(void *reader) {
+    __atomic_store_n(&((lq_epoch_reader_t*) reader)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void lq_epoch_create_key(void) {
+    lq_epoch_key_created = pthread_key_create(&lq_epoch_key, lq_epoch_thread_exit) == 0;
+}
+
+/* takes over a record nobody uses or adds a new one to the list */
+static lq_epoch_reader_t* lq_epoch_claim(void) {
+    lq_epoch_reader_t *reader;
+    int expected;
+    for (reader = __atomic_load_n(&lq_epoch_readers, __ATOMIC_ACQUIRE); reader != NULL; reader = reader->next) {
+        expected = 0;
+        if (__atomic_load_n(&reader->in_use, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&reader->in_use, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (reader == NULL) {
+        reader = (lq_epoch_reader_t*) calloc(1, sizeof(lq_epoch_reader_t));
+        if (reader == NULL) {
+            return NULL;
+        }
+        reader->in_use = 1;
+        reader->next = __atomic_load_n(&lq_epoch_readers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&lq_epoch_readers, &reader->next, reader, 0,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    return reader;
+}
+
+static lq_epoch_reader_t* lq_epoch_register(void) {
+    lq_epoch_reader_t *reader;
+    pthread_once(&lq_epoch_key_once, lq_epoch_create_key);
+    reader = lq_epoch_claim();
+    if (reader == NULL) {
+        return NULL;
+    }
+    /* without the key the record stays with the thread for good */
+    if (lq_epoch_key_created) {
+        pthread_setspecific(lq_epoch_key, reader);
+    }
+    lq_epoch_reader = reader;
+    return reader;
+}
+
+/* Makes the calling thread a reader until the matching call of
+ * lq_epoch_leave().  Returns -1 if the thread could not be registered
+ * for lack of memory. */
+int lq_epoch_enter(void) {
+    lq_epoch_reader_t *reader = lq_epoch_reader;
+    if (reader == NULL && (reader = lq_epoch_register()) == NULL) {
+        return -1;
+    }
+    if (reader->depth++ == 0) {
+        __atomic_store_n(&reader->epoch, __atomic_load_n(&lq_epoch_global, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        /* pairs with the fence of lq_epoch_advance(): either the writer
+         * sees this epoch or this reader sees what the writer unlinked */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    return 0;
+}
+
+void lq_epoch_leave(void) {
+    lq_epoch_reader_t *reader = lq_epoch_reader;
+    if (--reader->depth == 0) {
+        __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/* Holds on to the current epoch until lq_epoch_unpin() like a reader
+ * that never leaves, so that nothing retired from now on is freed.
+ * Since the epoch is global this also holds back the memory retired by
+ * writers of other quadtrees.  Returns NULL for lack of memory. */
+lq_epoch_reader_t* lq_epoch_pin(void) {
+    lq_epoch_reader_t *pin = lq_epoch_claim();
+    if (pin == NULL) {
+        return NULL;
+    }
+    __atomic_store_n(&pin->pinned, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&lq_epoch_number_of_pins, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&pin->epoch, __atomic_load_n(&lq_epoch_global, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return pin;
+}
+
+/* may be called from any thread */
+void lq_epoch_unpin(lq_epoch_reader_t *pin) {
+    __atomic_store_n(&pin->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&pin->pinned, 0, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&lq_epoch_number_of_pins, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&pin->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/* Starts a new epoch and returns the one that ended.  Everything the
+ * calling writer unlinked so far belongs to the epoch that ended. */
+static unsigned long lq_epoch_advance(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_fetch_add(&lq_epoch_global, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Waits until every reader that may still see memory unlinked before
+ * the call has left.  The reads of the calling thread itself and pins
+ * are not waited for. */
+void lq_epoch_synchronize(void) {
+    unsigned long ended = lq_epoch_advance();
+    unsigned long epoch;
+    lq_epoch_reader_t *reader;
+    for (reader = __atomic_load_n(&lq_epoch_readers, __ATOMIC_ACQUIRE); reader != NULL; reader = reader->next) {
+        if (reader == lq_epoch_reader || __atomic_load_n(&reader->pinned, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        for (;;) {
+            epoch = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+            if (epoch == 0 || epoch > ended) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+void lq_epoch_limbo_initialize(lq_epoch_limbo_t *limbo) {
+    limbo->retired = NULL;
+    limbo->number_of_retired = 0;
+    limbo->retired_capacity = 0;
+}
+
+/* frees everything in the limbo.  No reader may be left. */
+void lq_epoch_limbo_destroy(lq_epoch_limbo_t *limbo, void *context) {
+    size_t i;
+    for (i = 0; i < limbo->number_of_retired; ++i) {
+        limbo->retired[i].free(context, limbo->retired[i].object);
+    }
+    free(limbo->retired);
+    lq_epoch_limbo_initialize(limbo);
+}
+
+/* Hands object to the limbo once it can no longer be reached from the
+ * tree.  free is called with context and object when no reader can
+ * see it anymore.  If the limbo cannot grow the writer waits for the
+ * readers and frees object right away.  A pin cannot be waited for, so
+ * while there is one such an object is never freed. */
+void lq_epoch_retire(lq_epoch_limbo_t *limbo, void *object, lq_epoch_free_t free_object, void *context) {
+    size_t capacity;
+    lq_epoch_retired_t *retired;
+    if (limbo->number_of_retired == limbo->retired_capacity) {
+        capacity = limbo->retired_capacity < 64 ? 64 : 2 * limbo->retired_capacity;
+        retired = (lq_epoch_retired_t*) realloc(limbo->retired, capacity * sizeof(lq_epoch_retired_t));
+        if (retired == NULL) {
+            if (__atomic_load_n(&lq_epoch_number_of_pins, __ATOMIC_RELAXED) > 0) {
+                return;
+            }
+            lq_epoch_synchronize();
+            free_object(context, object);
+            return;
+        }
+        limbo->retired = retired;
+        limbo->retired_capacity = capacity;
+    }
+    limbo->retired[limbo->number_of_retired].object = object;
+    limbo->retired[limbo->number_of_retired].free = free_object;
+    limbo->retired[limbo->number_of_retired].epoch = 0;
+    limbo->number_of_retired++;
+}
+
+/* Ends the current epoch, which everything retired since the last call
+ * belongs to, and frees what was retired before the oldest epoch a
+ * reader is still in.  Called by the writer after every change. */
+void lq_epoch_reclaim(lq_epoch_limbo_t *limbo, void *context) {
+    size_t i, number_of_freed;
+    unsigned long ended, oldest, epoch;
+    lq_epoch_reader_t *reader;
+    if (limbo->number_of_retired == 0) {
+        return;
+    }
+    ended = lq_epoch_advance();
+    for (i = limbo->number_of_retired; i > 0 && limbo->retired[i - 1].epoch == 0; --i) {
+        limbo->retired[i - 1].epoch = ended;
+    }
+    oldest = ended + 1;
+    for (reader = __atomic_load_n(&lq_epoch_readers, __ATOMIC_ACQUIRE); reader != NULL; reader = reader->next) {
+        epoch = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    for (number_of_freed = 0; number_of_freed < limbo->number_of_retired &&
+                              limbo->retired[number_of_freed].epoch < oldest; ++number_of_freed) {
+        limbo->retired[number_of_freed].free(context, limbo->retired[number_of_freed].object);
+    }
+    limbo->number_of_retired -= number_of_freed;
+    memmove(limbo->retired, limbo->retired + number_of_freed, limbo->number_of_retired * sizeof(lq_epoch_retired_t));
+}
@@ -0,0 +1,42 @@
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <stddef.h>
+
+/* Epoch based reclamation lets queries read a quadtree without locks
+ * while a single writer changes it.  Readers announce the global
+ * epoch they started in with lq_epoch_enter() and withdraw it with
+ * lq_epoch_leave().  The writer unlinks memory from the tree and
+ * retires it into its limbo instead of freeing it.  lq_epoch_reclaim()
+ * frees what was retired before the oldest epoch a reader is still in,
+ * since no reader can reach it anymore. */
+
+typedef void (*lq_epoch_free_t)(void *context, void *object);
+
+typedef struct lq_epoch_reader_type lq_epoch_reader_t;
+
+typedef struct {
+    void *object;
+    lq_epoch_free_t free;
+    unsigned long epoch;
+} lq_epoch_retired_t;
+
+/* the memory a writer retired, oldest first */
+typedef struct {
+    lq_epoch_retired_t *retired;
+    size_t number_of_retired;
+    size_t retired_capacity;
+} lq_epoch_limbo_t;
+
+int lq_epoch_enter(void);
+void lq_epoch_leave(void);
+void lq_epoch_synchronize(void);
+lq_epoch_reader_t* lq_epoch_pin(void);
+void lq_epoch_unpin(lq_epoch_reader_t *pin);
+
+void lq_epoch_limbo_initialize(lq_epoch_limbo_t *limbo);
+void lq_epoch_limbo_destroy(lq_epoch_limbo_t *limbo, void *context);
+void lq_epoch_retire(lq_epoch_limbo_t *limbo, void *object, lq_epoch_free_t free, void *context);
+void lq_epoch_reclaim(lq_epoch_limbo_t *limbo, void *context);
+
+#endif /* __EPOCH_H__ */
@@ -0,0 +1,121 @@
+#include "idmap.h"
+
+#include <stdlib.h>
+
+#define MIN_CAPACITY (16)
+
+static size_t lq_idmap_slot(const lq_idmap_t *map, long key) {
+    unsigned long long hash = (unsigned long long) key * 0x9e3779b97f4a7c15ull;
+    return (size_t) (hash ^ (hash >> 32)) & (map->capacity - 1);
+}
+
+static int lq_idmap_resize(lq_idmap_t *map, size_t capacity) {
+    size_t i;
+    lq_idmap_entry_t *old_entries = map->entries;
+    size_t old_capacity = map->capacity;
+    lq_idmap_entry_t *entries = (lq_idmap_entry_t*) calloc(capacity, sizeof(lq_idmap_entry_t));
+    if (entries == NULL) {
+        return -1;
+    }
+    map->entries = entries;
+    map->capacity = capacity;
+    for (i = 0; i < old_capacity; ++i) {
+        if (old_entries[i].value != NULL) {
+            size_t slot = lq_idmap_slot(map, old_entries[i].key);
+            while (entries[slot].value != NULL) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            entries[slot] = old_entries[i];
+        }
+    }
+    free(old_entries);
+    return 0;
+}
+
+void lq_idmap_initialize(lq_idmap_t *map) {
+    map->entries = NULL;
+    map->capacity = 0;
+    map->size = 0;
+}
+
+void lq_idmap_destroy(lq_idmap_t *map) {
+    free(map->entries);
+    lq_idmap_initialize(map);
+}
+
+void* lq_idmap_get(const lq_idmap_t *map, long key) {
+    size_t slot;
+    if (map->size == 0) {
+        return NULL;
+    }
+    slot = lq_idmap_slot(map, key);
+    while (map->entries[slot].value != NULL) {
+        if (map->entries[slot].key == key) {
+            return map->entries[slot].value;
+        }
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    return NULL;
+}
+
+/* inserts or replaces the value for key.  Returns 0 on success and -1
+ * if the map could not grow.  Replacing a value never fails. */
+int lq_idmap_put(lq_idmap_t *map, long key, void *value) {
+    size_t slot;
+    if (map->size > 0) {
+        slot = lq_idmap_slot(map, key);
+        while (map->entries[slot].value != NULL) {
+            if (map->entries[slot].key == key) {
+                map->entries[slot].value = value;
+                return 0;
+            }
+            slot = (slot + 1) & (map->capacity - 1);
+        }
+    }
+    /* keep the load factor below 1/2 */
+    if (2 * (map->size + 1) > map->capacity) {
+        if (lq_idmap_resize(map, map->capacity < MIN_CAPACITY ? MIN_CAPACITY : 2 * map->capacity) != 0) {
+            return -1;
+        }
+    }
+    slot = lq_idmap_slot(map, key);
+    while (map->entries[slot].value != NULL) {
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    map->entries[slot].key = key;
+    map->entries[slot].value = value;
+    map->size++;
+    return 0;
+}
+
+/* removes key from the map and returns its value or NULL if it was
+ * not in the map */
+void* lq_idmap_remove(lq_idmap_t *map, long key) {
+    size_t slot, next;
+    void *value;
+    if (map->size == 0) {
+        return NULL;
+    }
+    slot = lq_idmap_slot(map, key);
+    while (map->entries[slot].value != NULL && map->entries[slot].key != key) {
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    if (map->entries[slot].value == NULL) {
+        return NULL;
+    }
+    value = map->entries[slot].value;
+    /* move back every following entry of the cluster that would
+     * otherwise no longer be reachable from its home slot */
+    next = (slot + 1) & (map->capacity - 1);
+    while (map->entries[next].value != NULL) {
+        size_t home = lq_idmap_slot(map, map->entries[next].key);
+        if (((next - home) & (map->capacity - 1)) >= ((next - slot) & (map->capacity - 1))) {
+            map->entries[slot] = map->entries[next];
+            slot = next;
+        }
+        next = (next + 1) & (map->capacity - 1);
+    }
+    map->entries[slot].value = NULL;
+    map->size--;
+    return value;
+}
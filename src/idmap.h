@@ -0,0 +1,26 @@
+#ifndef __IDMAP_H__
+#define __IDMAP_H__
+
+#include <stddef.h>
+
+typedef struct {
+    long key;
+    void *value;
+} lq_idmap_entry_t;
+
+/* Open addressing hash map from long keys to non-NULL pointers using
+ * linear probing.  Removal shifts the following entries back instead
+ * of leaving tombstones so lookups never degrade under churn. */
+typedef struct {
+    lq_idmap_entry_t *entries;
+    size_t capacity;
+    size_t size;
+} lq_idmap_t;
+
+void lq_idmap_initialize(lq_idmap_t *map);
+void lq_idmap_destroy(lq_idmap_t *map);
+void* lq_idmap_get(const lq_idmap_t *map, long key);
+int lq_idmap_put(lq_idmap_t *map, long key, void *value);
+void* lq_idmap_remove(lq_idmap_t *map, long key);
+
+#endif /* __IDMAP_H__ */
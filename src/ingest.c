@@ -0,0 +1,730 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "ingest.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INGEST_CHUNK_SIZE (65536)
+#define MIN_LINE_CAPACITY (256)
+#define MIN_PARTS_CAPACITY (4)
+#define MIN_POINTS_CAPACITY (64)
+/* deeper JSON documents are rejected instead of exhausting the stack */
+#define MAX_JSON_DEPTH (64)
+
+int lq_ingest_reader_initialize(lq_ingest_reader_t *reader, int fd, size_t max_line_length) {
+    reader->fd = fd;
+    reader->chunk = (char*) malloc(INGEST_CHUNK_SIZE);
+    reader->chunk_position = 0;
+    reader->chunk_size = 0;
+    reader->line = (char*) malloc(MIN_LINE_CAPACITY);
+    reader->line_length = 0;
+    reader->line_capacity = MIN_LINE_CAPACITY;
+    reader->max_line_length = max_line_length;
+    reader->line_number = 0;
+    reader->end_of_input = 0;
+    if (reader->chunk == NULL || reader->line == NULL) {
+        lq_ingest_reader_destroy(reader);
+        return -1;
+    }
+    reader->line[0] = '\0';
+    return 0;
+}
+
+void lq_ingest_reader_destroy(lq_ingest_reader_t *reader) {
+    free(reader->chunk);
+    free(reader->line);
+    reader->chunk = NULL;
+    reader->line = NULL;
+}
+
+static int lq_ingest_reader_append(lq_ingest_reader_t *reader, const char *bytes, size_t length) {
+    if (reader->line_length + length >= reader->line_capacity) {
+        size_t capacity = reader->line_capacity;
+        char *line;
+        while (reader->line_length + length >= capacity) {
+            capacity *= 2;
+        }
+        line = (char*) realloc(reader->line, capacity);
+        if (line == NULL) {
+            return -1;
+        }
+        reader->line = line;
+        reader->line_capacity = capacity;
+    }
+    memcpy(reader->line + reader->line_length, bytes, length);
+    reader->line_length += length;
+    return 0;
+}
+
+/* Reads the next line into reader->line without its line break.
+ * Lines longer than max_line_length are skipped up to their end and
+ * reported as LQ_INGEST_LINE_TOO_LONG so the caller can go on with
+ * the following line. */
+int lq_ingest_reader_next(lq_ingest_reader_t *reader) {
+    int consumed_bytes = 0;
+    int too_long = 0;
+    reader->line_length = 0;
+    for (;;) {
+        char *start, *newline;
+        size_t length;
+        if (reader->chunk_position == reader->chunk_size) {
+            ssize_t number_of_bytes;
+            if (reader->end_of_input) {
+                if (!consumed_bytes) {
+                    return LQ_INGEST_END;
+                }
+                break;
+            }
+            do {
+                number_of_bytes = read(reader->fd, reader->chunk, INGEST_CHUNK_SIZE);
+            } while (number_of_bytes < 0 && errno == EINTR);
+            if (number_of_bytes < 0) {
+                return LQ_INGEST_READ_ERROR;
+            }
+            if (number_of_bytes == 0) {
+                reader->end_of_input = 1;
+            }
+            reader->chunk_position = 0;
+            reader->chunk_size = (size_t) number_of_bytes;
+            continue;
+        }
+        consumed_bytes = 1;
+        start = reader->chunk + reader->chunk_position;
+        newline = (char*) memchr(start, '\n', reader->chunk_size - reader->chunk_position);
+        length = newline != NULL ? (size_t) (newline - start) : reader->chunk_size - reader->chunk_position;
+        reader->chunk_position += newline != NULL ? length + 1 : length;
+        if (!too_long) {
+            if (reader->line_length + length > reader->max_line_length) {
+                too_long = 1;
+            } else if (lq_ingest_reader_append(reader, start, length) != 0) {
+                return LQ_INGEST_NO_MEMORY;
+            }
+        }
+        if (newline != NULL) {
+            break;
+        }
+    }
+    reader->line_number++;
+    if (too_long) {
+        reader->line_length = 0;
+    } else if (reader->line_length > 0 && reader->line[reader->line_length - 1] == '\r') {
+        reader->line_length--;
+    }
+    reader->line[reader->line_length] = '\0';
+    return too_long ? LQ_INGEST_LINE_TOO_LONG : LQ_INGEST_LINE;
+}
+
+void lq_ingest_record_initialize(lq_ingest_record_t *record) {
+    memset(record, 0, sizeof(lq_ingest_record_t));
+}
+
+void lq_ingest_record_destroy(lq_ingest_record_t *record) {
+    free(record->part_sizes);
+    free(record->xs);
+    free(record->ys);
+    free(record->grid_xs);
+    free(record->grid_ys);
+    lq_ingest_record_initialize(record);
+}
+
+static void lq_ingest_record_reset(lq_ingest_record_t *record) {
+    record->id = 0;
+    record->number_of_parts = 0;
+    record->number_of_points = 0;
+    record->error = NULL;
+}
+
+static int lq_ingest_syntax_error(lq_ingest_record_t *record, const char *message) {
+    record->error = message;
+    return LQ_INGEST_SYNTAX_ERROR;
+}
+
+static int lq_ingest_record_start_part(lq_ingest_record_t *record) {
+    if (record->number_of_parts == record->parts_capacity) {
+        int capacity = record->parts_capacity < MIN_PARTS_CAPACITY ? MIN_PARTS_CAPACITY : 2 * record->parts_capacity;
+        int *part_sizes = (int*) realloc(record->part_sizes, capacity * sizeof(int));
+        if (part_sizes == NULL) {
+            return LQ_INGEST_NO_MEMORY;
+        }
+        record->part_sizes = part_sizes;
+        record->parts_capacity = capacity;
+    }
+    record->part_sizes[record->number_of_parts++] = 0;
+    return LQ_INGEST_RECORD;
+}
+
+static int lq_ingest_record_add_point(lq_ingest_record_t *record, double x, double y) {
+    if (record->number_of_points == record->points_capacity) {
+        int capacity = record->points_capacity < MIN_POINTS_CAPACITY ? MIN_POINTS_CAPACITY : 2 * record->points_capacity;
+        double *xs, *ys;
+        int *grid_xs, *grid_ys;
+        /* each array keeps whatever capacity it got so a failure
+         * leaves the record consistent */
+        if ((xs = (double*) realloc(record->xs, capacity * sizeof(double))) != NULL) {
+            record->xs = xs;
+        }
+        if ((ys = (double*) realloc(record->ys, capacity * sizeof(double))) != NULL) {
+            record->ys = ys;
+        }
+        if ((grid_xs = (int*) realloc(record->grid_xs, capacity * sizeof(int))) != NULL) {
+            record->grid_xs = grid_xs;
+        }
+        if ((grid_ys = (int*) realloc(record->grid_ys, capacity * sizeof(int))) != NULL) {
+            record->grid_ys = grid_ys;
+        }
+        if (xs == NULL || ys == NULL || grid_xs == NULL || grid_ys == NULL) {
+            return LQ_INGEST_NO_MEMORY;
+        }
+        record->points_capacity = capacity;
+    }
+    record->xs[record->number_of_points] = x;
+    record->ys[record->number_of_points] = y;
+    record->number_of_points++;
+    record->part_sizes[record->number_of_parts - 1]++;
+    return LQ_INGEST_RECORD;
+}
+
+/* drops the corner closing the current part and checks what is left */
+static int lq_ingest_record_end_part(lq_ingest_record_t *record) {
+    int *size = &record->part_sizes[record->number_of_parts - 1];
+    int first = record->number_of_points - *size;
+    int last = record->number_of_points - 1;
+    if (*size > 1 && record->xs[first] == record->xs[last] && record->ys[first] == record->ys[last]) {
+        (*size)--;
+        record->number_of_points--;
+    }
+    if (*size < 3) {
+        return lq_ingest_syntax_error(record, "a ring needs at least three corners");
+    }
+    return LQ_INGEST_RECORD;
+}
+
+/* Maps the coordinates of the record onto the integer grid of a
+ * quadtree by rounding (x - origin_x) * scale_x to the nearest
+ * integer.  Returns -1 if a coordinate does not fit into an int. */
+int lq_ingest_record_quantize(lq_ingest_record_t *record, double origin_x, double origin_y, double scale_x, double scale_y) {
+    int i;
+    for (i = 0; i < record->number_of_points; ++i) {
+        double x = floor((record->xs[i] - origin_x) * scale_x + 0.5);
+        double y = floor((record->ys[i] - origin_y) * scale_y + 0.5);
+        /* written so that NaN fails as well */
+        if (!(x >= INT_MIN && x <= INT_MAX && y >= INT_MIN && y <= INT_MAX)) {
+            return -1;
+        }
+        record->grid_xs[i] = (int) x;
+        record->grid_ys[i] = (int) y;
+    }
+    return 0;
+}
+
+static const char* lq_ingest_skip_space(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        ++p;
+    }
+    return p;
+}
+
+static int lq_ingest_parse_number(const char **p, double *value) {
+    char *end;
+    *value = strtod(*p, &end);
+    if (end == *p) {
+        return -1;
+    }
+    *p = end;
+    return 0;
+}
+
+static int lq_ingest_parse_id(const char **p, long *id) {
+    char *end;
+    errno = 0;
+    *id = strtol(*p, &end, 10);
+    if (end == *p || errno == ERANGE) {
+        return -1;
+    }
+    *p = end;
+    return 0;
+}
+
+/* consumes keyword if it is next in p, ignoring case */
+static int lq_ingest_match_keyword(const char **p, const char *keyword) {
+    const char *q = *p;
+    while (*keyword != '\0') {
+        if (toupper((unsigned char) *q) != *keyword) {
+            return 0;
+        }
+        ++q;
+        ++keyword;
+    }
+    if (isalnum((unsigned char) *q)) {
+        return 0;
+    }
+    *p = q;
+    return 1;
+}
+
+/* (x y, x y, ...) where every corner may come with z and m values */
+static int lq_ingest_wkt_ring(lq_ingest_record_t *record, const char **p) {
+    int status;
+    double x, y, ignored;
+    *p = lq_ingest_skip_space(*p);
+    if (**p != '(') {
+        return lq_ingest_syntax_error(record, "expected '('");
+    }
+    ++*p;
+    if ((status = lq_ingest_record_start_part(record)) != LQ_INGEST_RECORD) {
+        return status;
+    }
+    for (;;) {
+        if (lq_ingest_parse_number(p, &x) != 0 || lq_ingest_parse_number(p, &y) != 0) {
+            return lq_ingest_syntax_error(record, "expected a coordinate");
+        }
+        *p = lq_ingest_skip_space(*p);
+        while (**p != ',' && **p != ')') {
+            if (lq_ingest_parse_number(p, &ignored) != 0) {
+                return lq_ingest_syntax_error(record, "expected ',' or ')'");
+            }
+            *p = lq_ingest_skip_space(*p);
+        }
+        if ((status = lq_ingest_record_add_point(record, x, y)) != LQ_INGEST_RECORD) {
+            return status;
+        }
+        if (**p == ')') {
+            ++*p;
+            return lq_ingest_record_end_part(record);
+        }
+        ++*p;
+    }
+}
+
+static int lq_ingest_wkt_polygon(lq_ingest_record_t *record, const char **p) {
+    int status;
+    *p = lq_ingest_skip_space(*p);
+    if (**p != '(') {
+        return lq_ingest_syntax_error(record, "expected '('");
+    }
+    ++*p;
+    if ((status = lq_ingest_wkt_ring(record, p)) != LQ_INGEST_RECORD) {
+        return status;
+    }
+    *p = lq_ingest_skip_space(*p);
+    if (**p == ',') {
+        return lq_ingest_syntax_error(record, "polygons with holes are not supported");
+    }
+    if (**p != ')') {
+        return lq_ingest_syntax_error(record, "expected ')'");
+    }
+    ++*p;
+    return LQ_INGEST_RECORD;
+}
+
+static int lq_ingest_wkt_multipolygon(lq_ingest_record_t *record, const char **p) {
+    int status;
+    *p = lq_ingest_skip_space(*p);
+    if (**p != '(') {
+        return lq_ingest_syntax_error(record, "expected '('");
+    }
+    ++*p;
+    for (;;) {
+        if ((status = lq_ingest_wkt_polygon(record, p)) != LQ_INGEST_RECORD) {
+            return status;
+        }
+        *p = lq_ingest_skip_space(*p);
+        if (**p == ')') {
+            ++*p;
+            return LQ_INGEST_RECORD;
+        }
+        if (**p != ',') {
+            return lq_ingest_syntax_error(record, "expected ',' or ')'");
+        }
+        ++*p;
+    }
+}
+
+/* Parses "<id> <geometry>" where geometry is a POLYGON or MULTIPOLYGON
+ * in well-known text.  The id may be followed by ',' or ';' and the
+ * geometry may be quoted, which covers two column CSV files as well.
+ * Blank lines and lines starting with '#' are skipped. */
+int lq_ingest_parse_wkt(lq_ingest_record_t *record, const char *line) {
+    int status, multi, quoted;
+    const char *p = lq_ingest_skip_space(line);
+    if (*p == '\0' || *p == '#') {
+        return LQ_INGEST_SKIP;
+    }
+    lq_ingest_record_reset(record);
+    if (lq_ingest_parse_id(&p, &record->id) != 0) {
+        return lq_ingest_syntax_error(record, "expected an integer id");
+    }
+    p = lq_ingest_skip_space(p);
+    if (*p == ',' || *p == ';') {
+        p = lq_ingest_skip_space(p + 1);
+    }
+    quoted = *p == '"';
+    if (quoted) {
+        p = lq_ingest_skip_space(p + 1);
+    }
+    if (lq_ingest_match_keyword(&p, "MULTIPOLYGON")) {
+        multi = 1;
+    } else if (lq_ingest_match_keyword(&p, "POLYGON")) {
+        multi = 0;
+    } else {
+        return lq_ingest_syntax_error(record, "expected POLYGON or MULTIPOLYGON");
+    }
+    p = lq_ingest_skip_space(p);
+    if (!lq_ingest_match_keyword(&p, "ZM") && !lq_ingest_match_keyword(&p, "Z")) {
+        lq_ingest_match_keyword(&p, "M");
+    }
+    p = lq_ingest_skip_space(p);
+    if (lq_ingest_match_keyword(&p, "EMPTY")) {
+        return lq_ingest_syntax_error(record, "empty geometry");
+    }
+    status = multi ? lq_ingest_wkt_multipolygon(record, &p) : lq_ingest_wkt_polygon(record, &p);
+    if (status != LQ_INGEST_RECORD) {
+        return status;
+    }
+    p = lq_ingest_skip_space(p);
+    if (quoted) {
+        if (*p != '"') {
+            return lq_ingest_syntax_error(record, "expected '\"'");
+        }
+        p = lq_ingest_skip_space(p + 1);
+    }
+    if (*p != '\0') {
+        return lq_ingest_syntax_error(record, "unexpected text after the geometry");
+    }
+    return LQ_INGEST_RECORD;
+}
+
+/* Parses "<id>,<x0>,<y0>,<x1>,<y1>,..." describing a single polygon.
+ * Blank lines and lines starting with '#' are skipped. */
+int lq_ingest_parse_csv(lq_ingest_record_t *record, const char *line) {
+    int status;
+    double x, y;
+    const char *p = lq_ingest_skip_space(line);
+    if (*p == '\0' || *p == '#') {
+        return LQ_INGEST_SKIP;
+    }
+    lq_ingest_record_reset(record);
+    if (lq_ingest_parse_id(&p, &record->id) != 0) {
+        return lq_ingest_syntax_error(record, "expected an integer id");
+    }
+    if ((status = lq_ingest_record_start_part(record)) != LQ_INGEST_RECORD) {
+        return status;
+    }
+    for (;;) {
+        p = lq_ingest_skip_space(p);
+        if (*p == '\0') {
+            break;
+        }
+        if (*p != ',') {
+            return lq_ingest_syntax_error(record, "expected ','");
+        }
+        ++p;
+        if (lq_ingest_parse_number(&p, &x) != 0) {
+            return lq_ingest_syntax_error(record, "expected a coordinate");
+        }
+        p = lq_ingest_skip_space(p);
+        if (*p != ',') {
+            return lq_ingest_syntax_error(record, "expected an x and a y coordinate for every corner");
+        }
+        ++p;
+        if (lq_ingest_parse_number(&p, &y) != 0) {
+            return lq_ingest_syntax_error(record, "expected a coordinate");
+        }
+        if ((status = lq_ingest_record_add_point(record, x, y)) != LQ_INGEST_RECORD) {
+            return status;
+        }
+    }
+    return lq_ingest_record_end_part(record);
+}
+
+/* where the members of a GeoJSON object we care about start */
+typedef struct {
+    const char *type;
+    const char *id;
+    const char *geometry;
+    const char *coordinates;
+} lq_json_members_t;
+
+/* p points at the opening '"'.  Returns the position behind the
+ * closing one or NULL. */
+static const char* lq_json_skip_string(const char *p) {
+    for (++p; *p != '"'; ++p) {
+        if (*p == '\0') {
+            return NULL;
+        }
+        if (*p == '\\' && *++p == '\0') {
+            return NULL;
+        }
+    }
+    return p + 1;
+}
+
+static int lq_json_is_string(const char *p, const char *value) {
+    size_t length = strlen(value);
+    return p[0] == '"' && strncmp(p + 1, value, length) == 0 && p[1 + length] == '"';
+}
+
+static const char* lq_json_scan_object(const char *p, lq_json_members_t *members, int depth);
+
+/* returns the position behind the value starting at p or NULL if it is
+ * not valid */
+static const char* lq_json_skip_value(const char *p, int depth) {
+    const char *start;
+    p = lq_ingest_skip_space(p);
+    switch (*p) {
+    case '"':
+        return lq_json_skip_string(p);
+    case '{':
+        return lq_json_scan_object(p, NULL, depth);
+    case '[':
+        if (depth >= MAX_JSON_DEPTH) {
+            return NULL;
+        }
+        p = lq_ingest_skip_space(p + 1);
+        if (*p == ']') {
+            return p + 1;
+        }
+        for (;;) {
+            if ((p = lq_json_skip_value(p, depth + 1)) == NULL) {
+                return NULL;
+            }
+            p = lq_ingest_skip_space(p);
+            if (*p == ']') {
+                return p + 1;
+            }
+            if (*p != ',') {
+                return NULL;
+            }
+            ++p;
+        }
+    default:
+        /* numbers, true, false and null */
+        start = p;
+        while (isalnum((unsigned char) *p) || *p == '-' || *p == '+' || *p == '.') {
+            ++p;
+        }
+        return p == start ? NULL : p;
+    }
+}
+
+/* p points at '{'.  Remembers where the values of the members in
+ * lq_json_members_t start if members is not NULL and returns the
+ * position behind the closing '}' or NULL if the object is not valid. */
+static const char* lq_json_scan_object(const char *p, lq_json_members_t *members, int depth) {
+    if (depth >= MAX_JSON_DEPTH) {
+        return NULL;
+    }
+    p = lq_ingest_skip_space(p + 1);
+    if (*p == '}') {
+        return p + 1;
+    }
+    for (;;) {
+        const char *key = p;
+        if (*p != '"' || (p = lq_json_skip_string(p)) == NULL) {
+            return NULL;
+        }
+        p = lq_ingest_skip_space(p);
+        if (*p != ':') {
+            return NULL;
+        }
+        p = lq_ingest_skip_space(p + 1);
+        if (members != NULL) {
+            if (lq_json_is_string(key, "type")) {
+                members->type = p;
+            } else if (lq_json_is_string(key, "id")) {
+                members->id = p;
+            } else if (lq_json_is_string(key, "geometry")) {
+                members->geometry = p;
+            } else if (lq_json_is_string(key, "coordinates")) {
+                members->coordinates = p;
+            }
+        }
+        if ((p = lq_json_skip_value(p, depth + 1)) == NULL) {
+            return NULL;
+        }
+        p = lq_ingest_skip_space(p);
+        if (*p == '}') {
+            return p + 1;
+        }
+        if (*p != ',') {
+            return NULL;
+        }
+        p = lq_ingest_skip_space(p + 1);
+    }
+}
+
+/* the id of a feature is an integer or a string holding one */
+static int lq_json_parse_id(const char *value, long *id) {
+    const char *p = value + (*value == '"');
+    char *end;
+    errno = 0;
+    *id = strtol(p, &end, 10);
+    if (end == p || errno == ERANGE) {
+        return -1;
+    }
+    if (*value == '"') {
+        return *end == '"' ? 0 : -1;
+    }
+    end = (char*) lq_ingest_skip_space(end);
+    return *end == ',' || *end == '}' ? 0 : -1;
+}
+
+/* [[x, y], [x, y], ...] where every position may have more than two
+ * coordinates.  The arrays are known to be valid JSON already. */
+static int lq_json_ring(lq_ingest_record_t *record, const char **p) {
+    int status;
+    double x, y;
+    *p = lq_ingest_skip_space(*p);
+    if (**p != '[') {
+        return lq_ingest_syntax_error(record, "expected a ring of positions");
+    }
+    *p = lq_ingest_skip_space(*p + 1);
+    if ((status = lq_ingest_record_start_part(record)) != LQ_INGEST_RECORD) {
+        return status;
+    }
+    while (**p == '[') {
+        ++*p;
+        if (lq_ingest_parse_number(p, &x) != 0) {
+            return lq_ingest_syntax_error(record, "expected a position");
+        }
+        *p = lq_ingest_skip_space(*p);
+        if (**p != ',') {
+            return lq_ingest_syntax_error(record, "expected a position");
+        }
+        ++*p;
+        if (lq_ingest_parse_number(p, &y) != 0) {
+            return lq_ingest_syntax_error(record, "expected a position");
+        }
+        *p = lq_ingest_skip_space(*p);
+        while (**p == ',') {
+            if ((*p = lq_json_skip_value(*p + 1, 0)) == NULL) {
+                return lq_ingest_syntax_error(record, "expected a position");
+            }
+            *p = lq_ingest_skip_space(*p);
+        }
+        if (**p != ']') {
+            return lq_ingest_syntax_error(record, "expected a position");
+        }
+        *p = lq_ingest_skip_space(*p + 1);
+        if ((status = lq_ingest_record_add_point(record, x, y)) != LQ_INGEST_RECORD) {
+            return status;
+        }
+        if (**p == ',') {
+            *p = lq_ingest_skip_space(*p + 1);
+        }
+    }
+    if (**p != ']') {
+        return lq_ingest_syntax_error(record, "expected a position");
+    }
+    ++*p;
+    return lq_ingest_record_end_part(record);
+}
+
+static int lq_json_polygon(lq_ingest_record_t *record, const char **p) {
+    int status;
+    *p = lq_ingest_skip_space(*p);
+    if (**p != '[') {
+        return lq_ingest_syntax_error(record, "expected an array of rings");
+    }
+    ++*p;
+    if ((status = lq_json_ring(record, p)) != LQ_INGEST_RECORD) {
+        return status;
+    }
+    *p = lq_ingest_skip_space(*p);
+    if (**p == ',') {
+        return lq_ingest_syntax_error(record, "polygons with holes are not supported");
+    }
+    if (**p != ']') {
+        return lq_ingest_syntax_error(record, "expected ']'");
+    }
+    ++*p;
+    return LQ_INGEST_RECORD;
+}
+
+static int lq_json_multipolygon(lq_ingest_record_t *record, const char **p) {
+    int status;
+    *p = lq_ingest_skip_space(*p);
+    if (**p != '[') {
+        return lq_ingest_syntax_error(record, "expected an array of polygons");
+    }
+    ++*p;
+    for (;;) {
+        if ((status = lq_json_polygon(record, p)) != LQ_INGEST_RECORD) {
+            return status;
+        }
+        *p = lq_ingest_skip_space(*p);
+        if (**p == ']') {
+            ++*p;
+            return LQ_INGEST_RECORD;
+        }
+        if (**p != ',') {
+            return lq_ingest_syntax_error(record, "expected ',' or ']'");
+        }
+        ++*p;
+    }
+}
+
+/* Parses a GeoJSON Feature with an integer id, or a string holding
+ * one, and a Polygon or MultiPolygon geometry.  Every line holds one
+ * feature as in newline delimited GeoJSON and GeoJSON text sequences;
+ * a trailing ',' is ignored so that the features of a
+ * FeatureCollection written one per line can be read as well.  Blank
+ * lines are skipped. */
+int lq_ingest_parse_geojson(lq_ingest_record_t *record, const char *line) {
+    lq_json_members_t feature, geometry;
+    const char *p = lq_ingest_skip_space(line);
+    /* record separator of RFC 8142 text sequences */
+    if (*p == '\x1e') {
+        p = lq_ingest_skip_space(p + 1);
+    }
+    if (*p == '\0') {
+        return LQ_INGEST_SKIP;
+    }
+    lq_ingest_record_reset(record);
+    if (*p != '{') {
+        return lq_ingest_syntax_error(record, "expected a JSON object");
+    }
+    memset(&feature, 0, sizeof(lq_json_members_t));
+    if ((p = lq_json_scan_object(p, &feature, 0)) == NULL) {
+        return lq_ingest_syntax_error(record, "malformed JSON");
+    }
+    p = lq_ingest_skip_space(p);
+    if (*p == ',') {
+        p = lq_ingest_skip_space(p + 1);
+    }
+    if (*p != '\0') {
+        return lq_ingest_syntax_error(record, "unexpected text after the feature");
+    }
+    if (feature.id == NULL) {
+        return lq_ingest_syntax_error(record, "feature without id");
+    }
+    if (lq_json_parse_id(feature.id, &record->id) != 0) {
+        return lq_ingest_syntax_error(record, "the id is not an integer");
+    }
+    if (feature.type != NULL && lq_json_is_string(feature.type, "Feature")) {
+        if (feature.geometry == NULL || *feature.geometry != '{') {
+            return lq_ingest_syntax_error(record, "feature without geometry");
+        }
+        memset(&geometry, 0, sizeof(lq_json_members_t));
+        lq_json_scan_object(feature.geometry, &geometry, 0);
+    } else {
+        geometry = feature;
+    }
+    if (geometry.coordinates == NULL || geometry.type == NULL) {
+        return lq_ingest_syntax_error(record, "geometry without type or coordinates");
+    }
+    p = geometry.coordinates;
+    if (lq_json_is_string(geometry.type, "Polygon")) {
+        return lq_json_polygon(record, &p);
+    }
+    if (lq_json_is_string(geometry.type, "MultiPolygon")) {
+        return lq_json_multipolygon(record, &p);
+    }
+    return lq_ingest_syntax_error(record, "the geometry is not a Polygon or MultiPolygon");
+}
@@ -0,0 +1,67 @@
+#ifndef __INGEST_H__
+#define __INGEST_H__
+
+#include <stddef.h>
+
+/* results of lq_ingest_reader_next() */
+#define LQ_INGEST_END (0)
+#define LQ_INGEST_LINE (1)
+#define LQ_INGEST_LINE_TOO_LONG (2)
+#define LQ_INGEST_READ_ERROR (-1)
+#define LQ_INGEST_NO_MEMORY (-2)
+
+/* results of the lq_ingest_parse_*() functions */
+#define LQ_INGEST_RECORD (0)
+#define LQ_INGEST_SKIP (1)
+#define LQ_INGEST_SYNTAX_ERROR (-1)
+/* LQ_INGEST_NO_MEMORY */
+
+/* Splits the bytes read from a file descriptor into lines.  The input
+ * is read in chunks of a fixed size and only the current line is kept
+ * in memory, so the memory needed is bounded by the longest line and
+ * not by the size of the input. */
+typedef struct {
+    int fd;
+    char *chunk;
+    size_t chunk_position;
+    size_t chunk_size;
+    char *line;
+    size_t line_length;
+    size_t line_capacity;
+    size_t max_line_length;
+    long line_number;
+    int end_of_input;
+} lq_ingest_reader_t;
+
+/* One parsed record: a polygon or the parts of a multipolygon given
+ * by the corners of their outer rings.  The first part_sizes[0]
+ * corners belong to the first part and so on.  The closing corner
+ * that repeats the first one is dropped. */
+typedef struct {
+    long id;
+    int number_of_parts;
+    int parts_capacity;
+    int *part_sizes;
+    int number_of_points;
+    int points_capacity;
+    double *xs;
+    double *ys;
+    int *grid_xs;
+    int *grid_ys;
+    /* what was wrong with the last record that did not parse */
+    const char *error;
+} lq_ingest_record_t;
+
+int lq_ingest_reader_initialize(lq_ingest_reader_t *reader, int fd, size_t max_line_length);
+void lq_ingest_reader_destroy(lq_ingest_reader_t *reader);
+int lq_ingest_reader_next(lq_ingest_reader_t *reader);
+
+void lq_ingest_record_initialize(lq_ingest_record_t *record);
+void lq_ingest_record_destroy(lq_ingest_record_t *record);
+int lq_ingest_record_quantize(lq_ingest_record_t *record, double origin_x, double origin_y, double scale_x, double scale_y);
+
+int lq_ingest_parse_wkt(lq_ingest_record_t *record, const char *line);
+int lq_ingest_parse_geojson(lq_ingest_record_t *record, const char *line);
+int lq_ingest_parse_csv(lq_ingest_record_t *record, const char *line);
+
+#endif /* __INGEST_H__ */
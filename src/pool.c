@@ -0,0 +1,116 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_OBJECTS_PER_SLAB (32)
+#define MAX_OBJECTS_PER_SLAB (4096)
+
+/* every object is aligned to the strictest of these */
+typedef union {
+    long l;
+    double d;
+    void *p;
+} lq_pool_align_t;
+
+struct lq_pool_slab_type {
+    struct lq_pool_slab_type *next;
+    lq_pool_align_t objects[1];
+};
+
+void lq_pool_initialize(lq_pool_t *pool, size_t object_size) {
+    size_t alignment = sizeof(lq_pool_align_t);
+    if (object_size < sizeof(void*)) {
+        object_size = sizeof(void*);
+    }
+    pool->object_size = (object_size + alignment - 1) / alignment * alignment;
+    pool->next_slab_capacity = MIN_OBJECTS_PER_SLAB;
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->next_object = NULL;
+    pool->slab_end = NULL;
+    pool->number_of_objects = 0;
+    pool->number_of_reserved_bytes = 0;
+}
+
+void* lq_pool_allocate(lq_pool_t *pool) {
+    void *object;
+    if (pool->free_list != NULL) {
+        object = pool->free_list;
+        pool->free_list = *((void**) object);
+    } else {
+        if (pool->next_object == pool->slab_end) {
+            size_t slab_size = offsetof(lq_pool_slab_t, objects) +
+                               pool->next_slab_capacity * pool->object_size;
+            lq_pool_slab_t *slab = (lq_pool_slab_t*) malloc(slab_size);
+            if (slab == NULL) {
+                return NULL;
+            }
+            slab->next = pool->slabs;
+            pool->slabs = slab;
+            pool->next_object = (char*) slab->objects;
+            pool->slab_end = pool->next_object + pool->next_slab_capacity * pool->object_size;
+            pool->number_of_reserved_bytes += slab_size;
+            if (pool->next_slab_capacity < MAX_OBJECTS_PER_SLAB) {
+                pool->next_slab_capacity *= 2;
+            }
+        }
+        object = pool->next_object;
+        pool->next_object += pool->object_size;
+    }
+    memset(object, 0, pool->object_size);
+    pool->number_of_objects++;
+    return object;
+}
+
+void lq_pool_free(lq_pool_t *pool, void *object) {
+    if (object == NULL) {
+        return;
+    }
+    *((void**) object) = pool->free_list;
+    pool->free_list = object;
+    pool->number_of_objects--;
+}
+
+void lq_pool_destroy(lq_pool_t *pool) {
+    lq_pool_slab_t *slab = pool->slabs;
+    while (slab != NULL) {
+        lq_pool_slab_t *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->next_object = NULL;
+    pool->slab_end = NULL;
+    pool->number_of_objects = 0;
+    pool->number_of_reserved_bytes = 0;
+    pool->next_slab_capacity = MIN_OBJECTS_PER_SLAB;
+}
+
+/* Moves all slabs and free objects of other into pool so that they
+ * are released together with pool.  Both pools must have the same
+ * object size.  other is left empty.  The unused rest of the slab
+ * other was carving objects from is not reused. */
+void lq_pool_merge(lq_pool_t *pool, lq_pool_t *other) {
+    lq_pool_slab_t *last_slab = other->slabs;
+    void **last_object = (void**) other->free_list;
+    if (last_slab != NULL) {
+        while (last_slab->next != NULL) {
+            last_slab = last_slab->next;
+        }
+        last_slab->next = pool->slabs;
+        pool->slabs = other->slabs;
+    }
+    if (last_object != NULL) {
+        while (*last_object != NULL) {
+            last_object = (void**) *last_object;
+        }
+        *last_object = pool->free_list;
+        pool->free_list = other->free_list;
+    }
+    pool->number_of_objects += other->number_of_objects;
+    pool->number_of_reserved_bytes += other->number_of_reserved_bytes;
+    other->slabs = NULL;
+    lq_pool_destroy(other);
+}
@@ -0,0 +1,30 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stddef.h>
+
+typedef struct lq_pool_slab_type lq_pool_slab_t;
+
+/* A pool hands out fixed-size, zero initialized objects carved from
+ * large slabs.  Freed objects go onto a free-list and are reused by
+ * later allocations.  All slabs are released at once by
+ * lq_pool_destroy() regardless of how many objects are still in use.
+ */
+typedef struct {
+    size_t object_size;
+    size_t next_slab_capacity;
+    lq_pool_slab_t *slabs;
+    void *free_list;
+    char *next_object;
+    char *slab_end;
+    size_t number_of_objects;
+    size_t number_of_reserved_bytes;
+} lq_pool_t;
+
+void lq_pool_initialize(lq_pool_t *pool, size_t object_size);
+void* lq_pool_allocate(lq_pool_t *pool);
+void lq_pool_free(lq_pool_t *pool, void *object);
+void lq_pool_destroy(lq_pool_t *pool);
+void lq_pool_merge(lq_pool_t *pool, lq_pool_t *other);
+
+#endif /* __POOL_H__ */
@@ -1,11 +1,28 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "quadtree.h"
 
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "utils.h"
+#include "pool.h"
+#include "workers.h"
+#include "idmap.h"
+#include "edges.h"
+#include "ingest.h"
+#include "epoch.h"
 #include "testutils.h"
 
 #define FIRST_QUADRANT  (0)
@@ -14,8 +31,34 @@
 #define FOURTH_QUADRANT (3)
 #define NUMBER_OF_QUADRANTS (4)
 
-#define MAX_DEPTH (15)
-#define MIN_SIZE (4)
+/* the defaults of quadtree_config_t */
+#define DEFAULT_MAX_DEPTH (15)
+#define DEFAULT_MIN_SIZE (4)
+
+#define CHUNKS_PER_WORKER (16)
+#define MIN_CHUNK_SIZE (256)
+#define MAX_CHUNK_SIZE (16384)
+
+#define TASKS_PER_WORKER (16)
+/* runs of at least MIN_RUN_SIZE points in the same leaf are tested
+ * polygon by polygon, at most MAX_RUN_SIZE points at a time */
+#define MIN_RUN_SIZE (8)
+#define MAX_RUN_SIZE (256)
+/* smaller polygons do not get an edge index */
+#define EDGE_INDEX_MIN_POINTS (16)
+
+/* the largest width and height of a polygon with compact corners */
+#define COMPACT_MAX_EXTENT (0xffff)
+
+/* see lq_snapshot_header_t */
+#define SNAPSHOT_MAGIC "LQQTSNAP"
+#define SNAPSHOT_VERSION (1)
+#define SNAPSHOT_BYTE_ORDER (0x01020304)
+
+#define DEFAULT_MAX_RECORD_LENGTH (16L << 20)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 
 
@@ -30,6 +73,36 @@ static void LOG_DEBUG(char *format, ...) {
 #define LOG_DEBUG(...)
 #endif
 
+/* Counting the work of a call goes to counters of the calling thread
+ * which are added to the counters of the quadtree once the call is
+ * done, so that concurrent queries only share one atomic addition per
+ * counter and call.  Worker tasks collect their counters into their
+ * parallel call, which restores them on the calling thread, see
+ * quadtree_query_batch_parallel(). */
+#ifdef QUADTREE_COUNTERS
+/* the initial-exec model spares a call to __tls_get_addr() per count,
+ * which the general model of a shared library would make */
+static __thread quadtree_counters_t lq_call_counters __attribute__((tls_model("initial-exec")));
+static void lq_counters_add(quadtree_counters_t *target, quadtree_counters_t *source) {
+    __atomic_add_fetch(&target->nodes_visited, source->nodes_visited, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&target->entries_scanned, source->entries_scanned, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&target->point_in_polygon_calls, source->point_in_polygon_calls, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&target->edges_tested, source->edges_tested, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&target->allocations, source->allocations, __ATOMIC_RELAXED);
+}
+#define COUNT(counter, amount) (lq_call_counters.counter += (amount))
+#define COUNTERS_BEGIN() memset(&lq_call_counters, 0, sizeof(quadtree_counters_t))
+#define COUNTERS_COLLECT(target) lq_counters_add((target), &lq_call_counters)
+#define COUNTERS_RESTORE(source) (lq_call_counters = *(source))
+#define COUNTERS_END(quadtree) COUNTERS_COLLECT(&(quadtree)->counters)
+#else
+#define COUNT(counter, amount)
+#define COUNTERS_BEGIN()
+#define COUNTERS_COLLECT(target)
+#define COUNTERS_RESTORE(source)
+#define COUNTERS_END(quadtree)
+#endif
+
 
 /************
  * Typedefs *
@@ -44,59 +117,525 @@ typedef struct {
     int width;
 } lq_rect_t;
 
-typedef struct {
+/* The corners are kept in one of two ways.  Polygons whose bounding
+ * box is less than 2^16 wide and high keep points, pairs of 16 bit
+ * offsets from (min_x, min_y), and xs and ys are NULL.  Other polygons
+ * keep xs and ys which share a single allocation of
+ * 2 * number_of_points ints, and points is NULL.  ref_count is the
+ * number of entries that refer to the polygon.  A point can only be
+ * inside of the polygon if min_x <= x < max_x and min_y <= y < max_y.
+ * updating is set while quadtree_update() places the polygon anew, see
+ * lq_quadtree_node_put_polygon(). */
+typedef struct lq_polygon_type {
     long id;
     int number_of_points;
+    int ref_count;
+    bool updating;
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
     int *xs;
     int *ys;
+    unsigned short *points;
+    lq_edge_index_t *edge_index;
+    struct lq_polygon_node_type *entries;
+    struct lq_polygon_type *next_with_same_id;
 } lq_polygon_t;
 
+/* An entry places a polygon into a node.  It sits at index in the
+ * arrays of its owner node and is part of the doubly linked list of
+ * entries of its polygon (next_sibling/previous_sibling).  The latter
+ * lets quadtree_remove() find every node holding a polygon without
+ * searching the tree.  covered is set if the polygon covers the whole
+ * node.  During quadtree_update() the entries of the old shape are
+ * stale until the new shape is found to need them, too. */
 typedef struct lq_polygon_node_type {
     lq_polygon_t *p;
-    int *ref_count;
-    struct lq_polygon_node_type *next;
+    int index;
+    bool covered;
+    bool stale;
+    struct lq_quadtree_node_type *owner;
+    struct lq_polygon_node_type *next_sibling;
+    struct lq_polygon_node_type *previous_sibling;
 } lq_polygon_node_t;
 
+/* The entries of a node are kept in an array.  It is followed by
+ * arrays of their polygons and of the bounding boxes of the polygons,
+ * one per side, so that a query can reject most polygons of a leaf
+ * without touching them or their entries.  All six arrays share one
+ * allocation of entries_capacity elements each, which keeps the node
+ * itself small.  The allocation starts with a lq_node_header_t.
+ * parent is NULL for the root.  version is bumped whenever the node is
+ * split or collapsed, see lq_quadtree_node_load().  history keeps what
+ * snapshots saw of the node before the writer changed it, newest
+ * first, and preserved_generation is the generation of the newest
+ * snapshot it was kept for, see lq_quadtree_node_preserve().  The
+ * envelope contains the bounding boxes of all polygons ever held by
+ * the node or below it, see lq_quadtree_node_extend_envelope(). */
 typedef struct lq_quadtree_node_type {
     struct lq_quadtree_node_type *children[4];
+    struct lq_quadtree_node_type *parent;
     int depth;
-    lq_rect_t *bounding_box;
-    lq_polygon_node_t *polygons;
+    lq_rect_t bounding_box;
+    int envelope_min_x;
+    int envelope_min_y;
+    int envelope_max_x;
+    int envelope_max_y;
     int number_of_polygons;
+    int entries_capacity;
+    lq_polygon_node_t **entries;
+    unsigned int version;
+    struct lq_node_history_type *history;
+    unsigned long preserved_generation;
 } lq_quadtree_node_t;
 
+/* What the snapshots from generation back to the generation of the
+ * next record saw of a node: its children and, for a leaf, its arrays
+ * with the number of entries at the time.  Records never change once
+ * they are published, except for next when the record after them is
+ * dropped, see lq_quadtree_node_preserve().  The arrays and nodes they
+ * refer to are retired after the snapshots were taken and thus stay
+ * alive as long as the snapshots do. */
+typedef struct lq_node_history_type {
+    unsigned long generation;
+    struct lq_quadtree_node_type *children[4];
+    lq_polygon_node_t **entries;
+    int number_of_polygons;
+    struct lq_node_history_type *next;
+} lq_node_history_t;
+
+/* Precedes the arrays of a node.  Queries take the number of entries
+ * from here instead of from the node so that they always get it
+ * together with the arrays it belongs to, see
+ * lq_quadtree_node_load_arrays(). */
+typedef struct {
+    int number_of_polygons;
+    int capacity;
+} lq_node_header_t;
+
+#define NODE_HEADER(entries) ((lq_node_header_t*) (entries) - 1)
+
+/* the arrays following the entries of a node, see
+ * lq_quadtree_node_arrays() */
+typedef struct {
+    lq_polygon_t **polygons;
+    int *min_xs;
+    int *min_ys;
+    int *max_xs;
+    int *max_ys;
+} lq_node_arrays_t;
+
+/* Placing a polygon keeps the edges that enter the current node on a
+ * stack.  The children of a node are only tested against the edges of
+ * the node, see classify_polygon_edges_rectangle().  Lists on the
+ * stack are referred to by offset since the stack may be moved when it
+ * grows. */
 typedef struct {
+    int *edges;
+    int capacity;
+    int size;
+} lq_edge_stack_t;
+
+/* A snapshot reads the tree as it was at generation.  ref_count counts
+ * its handles and drops to 0 on any thread; the snapshot then stays in
+ * the list of its quadtree until the writer frees it.  number_of_changes
+ * is that of the quadtree when the snapshot was taken.  pin keeps
+ * everything the writer retires from then on, see lq_epoch_pin(). */
+typedef struct lq_snapshot_type {
+    struct lq_quadtree_type *quadtree;
+    unsigned long generation;
+    unsigned long number_of_changes;
+    int ref_count;
+    lq_epoch_reader_t *pin;
+    struct lq_snapshot_type *next;
+} lq_snapshot_t;
+
+/* nodes, polygon list entries and polygon headers are carved from
+ * per-tree pools so that building a tree does not hit malloc for
+ * every single object and destroying it releases them in bulk.  With
+ * concurrent readers or snapshots the nodes, arrays and polygons the
+ * writer takes out of the tree wait in limbo until no query can see
+ * them anymore, see lq_quadtree_retire().
+ * Changes hold write_lock, which keeps snapshots from being taken
+ * halfway through them.  snapshots is oldest first.  While a change
+ * runs snapshot_generation is the generation of the newest live
+ * snapshot or 0 if there is none.  Snapshots up to broken_generation
+ * lost part of what they saw for lack of memory. */
+typedef struct lq_quadtree_type {
     lq_quadtree_node_t *root;
+    lq_pool_t node_pool;
+    lq_pool_t polygon_node_pool;
+    lq_pool_t polygon_pool;
+    lq_idmap_t polygons_by_id;
+    lq_edge_stack_t edge_stack;
+    quadtree_config_t config;
+    bool use_edge_index;
+    quadtree_counters_t counters;
+    lq_epoch_limbo_t limbo;
+    pthread_mutex_t write_lock;
+    lq_snapshot_t *snapshots;
+    unsigned long last_generation;
+    unsigned long snapshot_generation;
+    unsigned long number_of_changes;
+    unsigned long broken_generation;
 } lq_quadtree_t;
 
+typedef struct {
+    unsigned long long key;
+    int index;
+} lq_batch_key_t;
+
+/* working memory of batch queries.  Hangs off the batch result so
+ * that it is reused across batches. */
+typedef struct {
+    lq_batch_key_t *keys;
+    lq_batch_key_t *sorted_keys;
+    int keys_capacity;
+    int sorted_keys_capacity;
+    int *starts;
+    int starts_capacity;
+    int *owners;
+    int owners_capacity;
+    long *hits;
+    int number_of_hits;
+    int hits_capacity;
+    int *run_xs;
+    int run_xs_capacity;
+    int *run_ys;
+    int run_ys_capacity;
+    unsigned char *inside;
+    int inside_capacity;
+    /* the keys a worker sorts in a pass of a parallel batch query and
+     * where it puts those with each digit */
+    int keys_begin;
+    int keys_end;
+    int positions[256];
+} lq_batch_scratch_t;
+
+typedef struct {
+    double distance;
+    lq_quadtree_node_t *node;
+} lq_nearest_node_t;
+
+/* working memory of nearest queries: a binary min-heap of the nodes
+ * still to be searched ordered by their distance bound and the
+ * polygons found so far, which go along with the distances of the
+ * result.  Hangs off the nearest result so that it is reused across
+ * queries.  All distances are squared until the search is done. */
+typedef struct {
+    lq_nearest_node_t *heap;
+    int number_of_nodes;
+    int heap_capacity;
+    lq_polygon_t **polygons;
+    int polygons_capacity;
+} lq_nearest_scratch_t;
+
+/* every worker has its own scratch memory so that workers never
+ * contend for anything but the next chunk of points */
+typedef struct {
+    lq_workers_t *workers;
+    lq_batch_scratch_t *scratches;
+} lq_worker_pool_t;
+
+typedef struct {
+    lq_quadtree_t *quadtree;
+    lq_worker_pool_t *worker_pool;
+    int number_of_points;
+    int *xs;
+    int *ys;
+    quadtree_batch_result_t *batch_result;
+    lq_batch_key_t *keys;
+    lq_batch_key_t *sorted_keys;
+    int number_of_keys;
+    int key_bits;
+    int shift;
+    int chunk_size;
+    int number_of_chunks;
+    int next_chunk;
+    int error_code;
+    quadtree_counters_t counters;
+} lq_parallel_batch_t;
+
+/* a polygon colliding with a node that quadtree_build() builds.  Like
+ * quadtree_add() the children of the node are only tested against the
+ * number_of_edges edges at first_edge of the edge stack of the worker
+ * that enter the node.  Polygons covering the node have none. */
+typedef struct {
+    lq_polygon_t *polygon;
+    int first_edge;
+    int number_of_edges;
+} lq_build_item_t;
+
+/* the corner of a child of the node being built that no edge of a
+ * polygon enters and whether it is inside the polygon.  The corners of
+ * other children in the same row are derived from it, see
+ * lq_build_filter(). */
+typedef struct {
+    int x;
+    int y;
+    int inside;
+} lq_build_probe_t;
+
+/* a subtree that quadtree_build() still has to build together with
+ * the polygons colliding with it.  The first number_of_covering of
+ * them cover the whole node.  The edges of the polygons start at
+ * first_edge of the task edges. */
+typedef struct {
+    lq_quadtree_node_t *node;
+    int first_polygon;
+    int number_of_polygons;
+    int number_of_covering;
+    int first_edge;
+    int number_of_edges;
+} lq_build_task_t;
+
+/* every worker allocates from its own pools; they are merged into the
+ * pools of the quadtree once the build succeeded */
+typedef struct {
+    lq_pool_t node_pool;
+    lq_pool_t polygon_node_pool;
+    lq_build_item_t *stack;
+    int stack_capacity;
+    lq_edge_stack_t edges;
+} lq_build_worker_t;
+
+typedef struct {
+    lq_quadtree_t *quadtree;
+    const quadtree_config_t *config;
+    lq_build_worker_t *workers;
+    int task_depth;
+    lq_build_task_t *tasks;
+    int number_of_tasks;
+    int tasks_capacity;
+    lq_build_item_t *task_polygons;
+    int number_of_task_polygons;
+    int task_polygons_capacity;
+    lq_edge_stack_t task_edges;
+    int next_task;
+    int error_code;
+    quadtree_counters_t counters;
+} lq_build_t;
+
+/* A frozen quadtree is a single block of memory without any pointers:
+ * a header followed by the arrays of nodes, entries, the bounding
+ * boxes of the entries and coordinates.
+ * The four children of an inner node are stored next to each other in
+ * the order of the quadrants so only the index of the first child is
+ * needed.  The rects of the nodes are not stored but recomputed while
+ * descending from the root. */
+typedef struct {
+    int left;
+    int bottom;
+    int width;
+    int height;
+    int number_of_nodes;
+    int number_of_entries;
+    int number_of_points;
+    int reserved;
+} lq_frozen_header_t;
+
+/* inner nodes have number_of_entries == -1 and first is the index of
+ * their first child.  For leaves first is the index of their first
+ * entry. */
+typedef struct {
+    int first;
+    int number_of_entries;
+} lq_frozen_node_t;
+
+/* the corners of the polygon are xs[first_point] up to but excluding
+ * xs[first_point + number_of_points] and likewise for ys */
+typedef struct {
+    long id;
+    int first_point;
+    int number_of_points;
+} lq_frozen_entry_t;
+
+/* memory is either allocated or, for a loaded snapshot, points into
+ * the read-only mapping of the file */
+typedef struct {
+    void *memory;
+    size_t size;
+    void *mapping;
+    size_t mapping_size;
+    lq_frozen_header_t *header;
+    lq_frozen_node_t *nodes;
+    lq_frozen_entry_t *entries;
+    int *min_xs;
+    int *min_ys;
+    int *max_xs;
+    int *max_ys;
+    int *xs;
+    int *ys;
+} lq_frozen_quadtree_t;
+
+/* A snapshot file is this header followed by the memory of a frozen
+ * quadtree which is used in place once the file is mapped.  The
+ * header is a multiple of 8 bytes long so the frozen quadtree is as
+ * aligned as the mapping.  Snapshots are only read on machines with
+ * the same byte order and size of long as the writer.  checksum covers
+ * the frozen quadtree, see lq_checksum(). */
+typedef struct {
+    char magic[8];
+    int version;
+    int byte_order;
+    int long_size;
+    int reserved;
+    unsigned long long size;
+    unsigned long long checksum;
+} lq_snapshot_header_t;
+
+/* state of quadtree_freeze() while filling the arrays */
+typedef struct {
+    lq_frozen_quadtree_t *frozen;
+    lq_idmap_t first_points;
+    int *polygon_first_points;
+    int next_node;
+    int next_entry;
+} lq_freeze_t;
+
 /************************
  * Forward declarations *
  ************************/
 
-static lq_quadtree_node_t* lq_quadtree_node_allocate();
-static void lq_quadtree_node_free(lq_quadtree_node_t *node);
-static void lq_quadtree_node_clear_polygons(lq_quadtree_node_t *node);
+static lq_quadtree_node_t* lq_quadtree_node_allocate(lq_quadtree_t *quadtree);
+static void lq_quadtree_node_free(lq_quadtree_t *quadtree, lq_quadtree_node_t *node);
+static void lq_quadtree_node_clear_polygons(lq_quadtree_t *quadtree, lq_quadtree_node_t *node);
+static void lq_quadtree_node_release_entries(lq_quadtree_t *quadtree, lq_quadtree_node_t *node);
+static void lq_quadtree_node_free_arrays(lq_quadtree_node_t *node);
 static void lq_quadtree_node_initialize(lq_quadtree_node_t *node, int left, int bottom, int width, int height, int depth);
-static int lq_quadtree_node_query(lq_quadtree_node_t *node, int x, int y, quadtree_query_result_t *query_result);
-static lq_quadtree_node_t* lq_quadtree_node_find_leaf(lq_quadtree_node_t *node, int x, int y);
-static int lq_quadtree_node_put_polygon(lq_quadtree_node_t *node, lq_polygon_node_t *polygon);
-static void lq_quadtree_node_remove(lq_quadtree_node_t *node, long id);
-static int lq_quadtree_node_populate_children(lq_quadtree_node_t *node);
-static void lq_quadtree_node_add_polygon(lq_quadtree_node_t *node, lq_polygon_node_t *polygon);
-static int lq_quadtree_node_add_polygons(lq_quadtree_node_t *node, lq_polygon_node_t *polygons);
-
-static lq_polygon_node_t* lq_polygon_node_allocate();
-static lq_polygon_node_t* lq_polygon_node_clone(lq_polygon_node_t *polygon);
-static void lq_polygon_node_free(lq_polygon_node_t *polygon);
-static int lq_polygon_node_initialize(lq_polygon_node_t *polygon, long id, int number_of_points, int *xs, int *ys);
-
-static lq_rect_t* lq_rect_allocate();
-static void lq_rect_free(lq_rect_t *rect);
+static int lq_quadtree_node_query(lq_quadtree_node_t *node, unsigned long generation, int x, int y, quadtree_query_result_t *query_result);
+static void lq_quadtree_node_visit(lq_quadtree_node_t *node, int x, int y, quadtree_query_visitor_t visitor, void *context);
+static int lq_quadtree_node_query_rect(lq_quadtree_node_t *node, unsigned long generation, lq_rect_t *window, bool covered, quadtree_query_result_t *query_result);
+static int lq_quadtree_query_rect(lq_quadtree_t *quadtree, unsigned long generation, int left, int bottom, int width, int height, quadtree_query_result_t *query_result);
+static int lq_quadtree_query_nearest(lq_quadtree_t *quadtree, unsigned long generation, int x, int y, int k, double max_distance, quadtree_nearest_result_t *nearest_result);
+static void lq_node_arrays_query_nearest(lq_node_arrays_t *arrays, int number_of_polygons, int x, int y, int k, double max_distance, quadtree_nearest_result_t *nearest_result);
+static double lq_quadtree_node_squared_distance_bound(lq_quadtree_node_t *node, int x, int y);
+static int lq_quadtree_query_batch(lq_quadtree_t *quadtree, int number_of_points, int *xs, int *ys, int stride, quadtree_batch_result_t *batch_result);
+static int lq_quadtree_query_points(lq_quadtree_t *quadtree, int number_of_points, int *xs, int *ys, int stride, int *counts, int *starts, lq_batch_scratch_t *scratch);
+static int lq_quadtree_batch_keys(lq_quadtree_t *quadtree, int key_bits, int begin, int end, int *xs, int *ys, int stride, int *counts, int *starts, lq_batch_key_t *keys);
+static int lq_quadtree_query_sorted(lq_quadtree_t *quadtree, lq_batch_key_t *keys, int number_of_keys, int *xs, int *ys, int stride, int *counts, int *starts, lq_batch_scratch_t *scratch);
+static int lq_quadtree_query_run(lq_node_arrays_t *arrays, int number_of_polygons, lq_batch_key_t *keys, int number_of_points, int *xs, int *ys, int stride, int *counts, int *starts, lq_batch_scratch_t *scratch);
+static lq_quadtree_node_t* lq_quadtree_node_find_leaf(lq_quadtree_node_t *node, int x, int y, lq_node_arrays_t *arrays, int *number_of_polygons);
+static int lq_quadtree_node_load(lq_quadtree_node_t *node, lq_quadtree_node_t **children, lq_node_arrays_t *arrays);
+static lq_quadtree_node_t* lq_quadtree_node_find_leaf_at(lq_quadtree_node_t *node, unsigned long generation, int x, int y, lq_node_arrays_t *arrays, int *number_of_polygons);
+static int lq_quadtree_node_load_at(lq_quadtree_node_t *node, unsigned long generation, lq_quadtree_node_t **children, lq_node_arrays_t *arrays);
+static int lq_quadtree_node_load_arrays(lq_quadtree_node_t *node, lq_node_arrays_t *arrays);
+static int lq_quadtree_add(lq_quadtree_t *quadtree, long id, int number_of_polygon_points, int *xs, int *ys, lq_polygon_t **added);
+static int lq_quadtree_build(lq_quadtree_t *quadtree, int number_of_polygons, long ids[], int counts[], int xs[], int ys[], lq_worker_pool_t *worker_pool);
+static int lq_quadtree_put_polygon(lq_quadtree_t *quadtree, lq_polygon_t *polygon);
+static int lq_quadtree_node_put_polygon(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, lq_polygon_t *polygon,
+                                        int classification, int first_edge, int number_of_edges);
+static int lq_edge_stack_reserve(lq_edge_stack_t *stack, int size);
+static int lq_quadtree_node_populate_children(lq_quadtree_t *quadtree, lq_quadtree_node_t *node);
+static void lq_quadtree_node_compact(lq_quadtree_t *quadtree, lq_quadtree_node_t *node);
+static void lq_quadtree_node_reset_envelope(lq_quadtree_node_t *node);
+static void lq_quadtree_node_get_stats(lq_quadtree_node_t *node, quadtree_stats_t *stats);
+static bool lq_quadtree_node_collapse(lq_quadtree_t *quadtree, lq_quadtree_node_t *node);
+static void lq_quadtree_node_collapse_upwards(lq_quadtree_t *quadtree, lq_quadtree_node_t *node);
+static bool lq_quadtree_node_has_empty_children(lq_quadtree_node_t *node);
+static int lq_quadtree_node_initialize_child(lq_quadtree_node_t *node, int quadrant, lq_quadtree_node_t *child);
+static int lq_quadtree_node_reserve(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, int number_of_polygons);
+static int lq_quadtree_node_add_polygon(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, lq_polygon_node_t *polygon);
+static void lq_quadtree_node_extend_envelope(lq_quadtree_node_t *node, lq_polygon_t *polygon);
+static void lq_quadtree_node_unlink_polygon(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, lq_polygon_node_t *polygon);
+static int lq_quadtree_node_add_polygons(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, lq_quadtree_node_t *source);
+static lq_polygon_node_t* lq_quadtree_node_find_entry(lq_quadtree_node_t *node, lq_polygon_t *polygon);
+static lq_node_arrays_t lq_quadtree_node_arrays(lq_quadtree_node_t *node);
+static lq_node_arrays_t lq_node_arrays_at(lq_polygon_node_t **entries, int capacity);
+static lq_polygon_node_t** lq_node_arrays_copy(lq_polygon_node_t **source, int number_of_polygons, int capacity);
+static bool lq_quadtree_node_is_at_limit(const quadtree_config_t *config, lq_quadtree_node_t *node);
+static bool lq_quadtree_node_has_room(const quadtree_config_t *config, lq_quadtree_node_t *node, lq_polygon_t *polygon);
+static bool lq_config_leaf_fits(const quadtree_config_t *config, int number_of_partial, long number_of_points);
+static bool lq_node_arrays_box_contains(lq_node_arrays_t *arrays, int index, int x, int y);
+
+static lq_polygon_node_t* lq_polygon_node_create(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, lq_polygon_t *polygon);
+static void lq_polygon_node_free(lq_quadtree_t *quadtree, lq_polygon_node_t *polygon);
+static void lq_polygon_node_refresh_box(lq_polygon_node_t *polygon);
+static lq_polygon_t* lq_polygon_create(lq_quadtree_t *quadtree, long id, int number_of_points, int *xs, int *ys);
+static int lq_polygon_set_coordinates(lq_quadtree_t *quadtree, lq_polygon_t *polygon, int number_of_points, int *xs, int *ys);
+static void lq_polygon_release(lq_quadtree_t *quadtree, lq_polygon_t *polygon);
+static void lq_polygon_free_coordinates(lq_polygon_t *polygon);
+static int lq_polygon_contains(lq_polygon_t *polygon, int x, int y);
+static int lq_polygon_classify_edges(lq_polygon_t *polygon, int number_of_edges, const int *edges,
+                                     int *entering, int *number_of_entering, lq_rect_t *rect);
+static void lq_polygon_get_coordinates(lq_polygon_t *polygon, int *xs, int *ys);
+static int lq_polygon_classify(lq_polygon_t *polygon, lq_rect_t *rect);
+static int lq_polygon_find_entering_edges(lq_polygon_t *polygon, int number_of_edges, const int *edges,
+                                          int *entering, lq_rect_t *rect);
+static int lq_polygon_contains_in_row(lq_polygon_t *polygon, int x, int y, int reference_x, int reference_inside,
+                                      int number_of_edges, const int *edges);
+static bool lq_polygon_intersects_window(lq_node_arrays_t *arrays, int index, lq_rect_t *window);
+static double lq_polygon_squared_distance(lq_polygon_t *polygon, int x, int y);
+static double lq_node_arrays_box_squared_distance(lq_node_arrays_t *arrays, int index, int x, int y);
+static void lq_polygon_remove_entries(lq_quadtree_t *quadtree, lq_polygon_t *polygon);
+static void lq_quadtree_forget_polygon(lq_quadtree_t *quadtree, lq_polygon_t *polygon);
+
+static int lq_quadtree_read_begin(lq_quadtree_t *quadtree);
+static void lq_quadtree_read_end(lq_quadtree_t *quadtree);
+static void lq_quadtree_write_begin(lq_quadtree_t *quadtree);
+static void lq_quadtree_write_end(lq_quadtree_t *quadtree);
+static bool lq_quadtree_is_shared(lq_quadtree_t *quadtree);
+static void lq_quadtree_sweep_snapshots(lq_quadtree_t *quadtree);
+static bool lq_quadtree_has_snapshot_between(lq_quadtree_t *quadtree, unsigned long older, unsigned long newer);
+static void lq_quadtree_node_preserve(lq_quadtree_t *quadtree, lq_quadtree_node_t *node);
+static void lq_quadtree_snapshots_break(lq_quadtree_t *quadtree);
+static int lq_snapshot_is_broken(lq_snapshot_t *snapshot);
+static void lq_quadtree_retire(lq_quadtree_t *quadtree, void *object, lq_epoch_free_t free_object);
+static void lq_retired_node_free(void *context, void *object);
+static void lq_retired_history_free(void *context, void *object);
+static void lq_node_history_free(lq_quadtree_node_t *node);
+static void lq_retired_arrays_free(void *context, void *object);
+static void lq_retired_polygon_free(void *context, void *object);
+static void lq_retired_edge_index_free(void *context, void *object);
+
 static void lq_rect_initialize(lq_rect_t *rect, int rx, int ry, int rw, int rh);
 static int lq_rect_get_quadrant(lq_rect_t *rect, int x, int y);
 static bool lq_rect_point_is_in_bounds(lq_rect_t *rect, int x, int y);
+static int lq_rect_key_bits(lq_rect_t *rect);
+static unsigned long long lq_rect_key(lq_rect_t *rect, int key_bits, int x, int y);
+
+static void lq_batch_keys_sort(lq_batch_key_t **keys, lq_batch_key_t **tmp, int number_of_keys, int key_bits);
+static void lq_batch_scratch_release(lq_batch_scratch_t *scratch);
+static int lq_batch_result_prepare(quadtree_batch_result_t *batch_result, int number_of_points);
+static int lq_batch_result_sum_offsets(quadtree_batch_result_t *batch_result, int number_of_points);
+static int lq_parallel_batch_share(lq_parallel_batch_t *batch, int worker_index, int n);
+static void lq_parallel_batch_count(lq_parallel_batch_t *batch, lq_batch_scratch_t *scratch);
+static void lq_parallel_batch_positions(lq_parallel_batch_t *batch);
+static void lq_parallel_batch_keys_task(int worker_index, void *context);
+static void lq_parallel_batch_count_task(int worker_index, void *context);
+static void lq_parallel_batch_scatter_task(int worker_index, void *context);
+static void lq_parallel_batch_query_task(int worker_index, void *context);
+static void lq_parallel_batch_copy_task(int worker_index, void *context);
+static int lq_nearest_result_prepare(quadtree_nearest_result_t *nearest_result, int k);
+static double lq_nearest_result_limit(quadtree_nearest_result_t *nearest_result, int k, double max_distance);
+static bool lq_nearest_result_contains(quadtree_nearest_result_t *nearest_result, lq_polygon_t *polygon);
+static void lq_nearest_result_insert(quadtree_nearest_result_t *nearest_result, int k, lq_polygon_t *polygon, double distance);
+static int lq_nearest_heap_push(lq_nearest_scratch_t *scratch, lq_quadtree_node_t *node, double distance);
+static lq_nearest_node_t lq_nearest_heap_pop(lq_nearest_scratch_t *scratch);
+
+static int lq_build_node(lq_build_t *build, lq_build_worker_t *worker, lq_quadtree_node_t *node, int first, int number_of_polygons, int number_of_covering);
+static void lq_build_filter(lq_build_worker_t *worker, lq_build_item_t *polygon, lq_rect_t *rect, lq_build_probe_t *probes, int *number_of_probes, lq_build_item_t *destination, int *number_of_polygons, int *number_of_covering);
+static int lq_build_add_task(lq_build_t *build, lq_build_worker_t *worker, lq_quadtree_node_t *node, lq_build_item_t *polygons, int number_of_polygons, int number_of_covering);
+static int lq_build_task_compare(const void *a, const void *b);
+static void lq_build_task(int worker_index, void *context);
+
+static void lq_freeze_count(lq_quadtree_node_t *node, int *number_of_nodes, int *number_of_entries);
+static void lq_freeze_node(lq_freeze_t *freeze, lq_quadtree_node_t *node, int index);
+static void lq_frozen_layout(lq_frozen_quadtree_t *frozen);
+static bool lq_frozen_is_valid(lq_frozen_quadtree_t *frozen);
+static const lq_frozen_node_t* lq_frozen_find_leaf(lq_frozen_quadtree_t *frozen, int x, int y);
+static size_t lq_frozen_size(const lq_frozen_header_t *header);
+static unsigned long long lq_checksum(const void *memory, size_t size);
+static void lq_snapshot_header_initialize(lq_snapshot_header_t *header, lq_frozen_quadtree_t *frozen);
+
+static int lq_reserve(void **buffer, int *capacity, int size, size_t element_size);
 
 static void lq_quadtree_query_result_reset(quadtree_query_result_t *query_results);
+static int lq_quadtree_query_result_reserve(quadtree_query_result_t *query_result, int number_of_ids);
+static int lq_quadtree_query_result_append_unique(quadtree_query_result_t *query_result, long id);
+static void lq_quadtree_query_result_make_unique(quadtree_query_result_t *query_result);
+static int lq_compare_ids(const void *a, const void *b);
 
 
 /*******************
@@ -104,15 +643,41 @@ static void lq_quadtree_query_result_reset(quadtree_query_result_t *query_result
  *******************/
 
 quadtree_t quadtree_create(int left, int bottom, int width, int height) {
+    quadtree_config_t config;
+    quadtree_config_initialize(&config);
+    return quadtree_create_ex(left, bottom, width, height, &config);
+}
+
+void quadtree_config_initialize(quadtree_config_t *config) {
+    config->max_depth = DEFAULT_MAX_DEPTH;
+    config->min_size = DEFAULT_MIN_SIZE;
+    config->max_leaf_entries = 0;
+    config->max_leaf_points = 0;
+    config->concurrent_readers = 0;
+}
+
+quadtree_t quadtree_create_ex(int left, int bottom, int width, int height, const quadtree_config_t *config) {
     if (height <= 0 || width <= 0) {
         return NULL;
     }
+    if (config->max_depth < 0 || config->min_size < 1 ||
+        config->max_leaf_entries < 0 || config->max_leaf_points < 0) {
+        return NULL;
+    }
     lq_quadtree_t *quadtree = (lq_quadtree_t*) calloc(1, sizeof(lq_quadtree_t));
     if (quadtree == NULL) {
         return NULL;
     }
-    lq_quadtree_node_t *root = lq_quadtree_node_allocate();
+    quadtree->config = *config;
+    pthread_mutex_init(&quadtree->write_lock, NULL);
+    lq_epoch_limbo_initialize(&quadtree->limbo);
+    lq_pool_initialize(&quadtree->node_pool, sizeof(lq_quadtree_node_t));
+    lq_pool_initialize(&quadtree->polygon_node_pool, sizeof(lq_polygon_node_t));
+    lq_pool_initialize(&quadtree->polygon_pool, sizeof(lq_polygon_t));
+    lq_idmap_initialize(&quadtree->polygons_by_id);
+    lq_quadtree_node_t *root = lq_quadtree_node_allocate(quadtree);
     if (root == NULL) {
+        pthread_mutex_destroy(&quadtree->write_lock);
         free(quadtree);
         return NULL;
     }
@@ -122,400 +687,2995 @@ quadtree_t quadtree_create(int left, int bottom, int width, int height) {
 }
 
 void quadtree_destroy(quadtree_t qt) {
+    size_t i;
     lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_snapshot_t *snapshot;
     if (quadtree != NULL) {
-        if (quadtree->root != NULL) {
-            lq_quadtree_node_free(quadtree->root);
+        /* snapshots that were not released would hold back the memory
+         * of all other quadtrees for good, so they are unpinned and
+         * detached; quadtree_snapshot_release() frees them later */
+        while ((snapshot = quadtree->snapshots) != NULL) {
+            quadtree->snapshots = snapshot->next;
+            if (snapshot->ref_count > 0) {
+                lq_epoch_unpin(snapshot->pin);
+                snapshot->pin = NULL;
+                snapshot->quadtree = NULL;
+                snapshot->next = NULL;
+            } else {
+                free(snapshot);
+            }
+        }
+        lq_epoch_limbo_destroy(&quadtree->limbo, quadtree);
+        /* only the coordinate arrays and the arrays of the nodes live
+         * outside of the pools */
+        for (i = 0; i < quadtree->polygons_by_id.capacity; ++i) {
+            lq_polygon_t *polygon = (lq_polygon_t*) quadtree->polygons_by_id.entries[i].value;
+            for (; polygon != NULL; polygon = polygon->next_with_same_id) {
+                lq_polygon_free_coordinates(polygon);
+            }
         }
+        lq_quadtree_node_free_arrays(quadtree->root);
+        lq_idmap_destroy(&quadtree->polygons_by_id);
+        free(quadtree->edge_stack.edges);
+        lq_pool_destroy(&quadtree->node_pool);
+        lq_pool_destroy(&quadtree->polygon_node_pool);
+        lq_pool_destroy(&quadtree->polygon_pool);
+        pthread_mutex_destroy(&quadtree->write_lock);
         free(quadtree);
     }
 }
 
 int quadtree_add(quadtree_t qt, long id, int number_of_polygon_points, int *xs, int *ys) {
     int i;
-    int error_code = QUADTREE_SUCCESS;
+    int error_code;
     lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
     lq_quadtree_node_t *root = quadtree->root;
-    LOG_DEBUG("adding polygon id: %ld\n", id);
     for (i = 0; i < number_of_polygon_points; ++i) {
-        if (!lq_rect_point_is_in_bounds(root->bounding_box, xs[i], ys[i])) {
+        if (!lq_rect_point_is_in_bounds(&root->bounding_box, xs[i], ys[i])) {
             return QUADTREE_ERROR_OUT_OF_BOUNDS;
         }
     }
-    lq_polygon_node_t *polygon = lq_polygon_node_allocate();
+    COUNTERS_BEGIN();
+    lq_quadtree_write_begin(quadtree);
+    error_code = lq_quadtree_add(quadtree, id, number_of_polygon_points, xs, ys, NULL);
+    lq_quadtree_write_end(quadtree);
+    COUNTERS_END(quadtree);
+    return error_code;
+}
+
+int quadtree_add_batch(quadtree_t qt, int number_of_polygons, long ids[], int counts[], int xs[], int ys[]) {
+    int i, j, first_point;
+    int error_code = QUADTREE_SUCCESS;
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_quadtree_node_t *root = quadtree->root;
+    lq_quadtree_write_begin(quadtree);
+    /* queries must not run while a tree is built */
+    if (!lq_quadtree_is_shared(quadtree) &&
+        root->children[FIRST_QUADRANT] == NULL && root->number_of_polygons == 0) {
+        error_code = lq_quadtree_build(quadtree, number_of_polygons, ids, counts, xs, ys, NULL);
+        lq_quadtree_write_end(quadtree);
+        return error_code;
+    }
+    first_point = 0;
+    for (i = 0; i < number_of_polygons; ++i) {
+        for (j = first_point; j < first_point + counts[i]; ++j) {
+            if (!lq_rect_point_is_in_bounds(&root->bounding_box, xs[j], ys[j])) {
+                lq_quadtree_write_end(quadtree);
+                return QUADTREE_ERROR_OUT_OF_BOUNDS;
+            }
+        }
+        first_point += counts[i];
+    }
+    COUNTERS_BEGIN();
+    first_point = 0;
+    for (i = 0; i < number_of_polygons && error_code == QUADTREE_SUCCESS; ++i) {
+        if (i > 0) {
+            /* snapshots may be taken between the polygons */
+            lq_quadtree_write_end(quadtree);
+            lq_quadtree_write_begin(quadtree);
+        }
+        error_code = lq_quadtree_add(quadtree, ids[i], counts[i], xs + first_point, ys + first_point, NULL);
+        first_point += counts[i];
+    }
+    lq_quadtree_write_end(quadtree);
+    COUNTERS_END(quadtree);
+    return error_code;
+}
+
+/* Adds a polygon whose corners are known to lie within the quadtree.
+ * If added is not NULL it is set to the new polygon, or to NULL if the
+ * polygon did not end up in any node. */
+static int lq_quadtree_add(lq_quadtree_t *quadtree, long id, int number_of_polygon_points, int *xs, int *ys, lq_polygon_t **added) {
+    int error_code = QUADTREE_SUCCESS;
+    LOG_DEBUG("adding polygon id: %ld\n", id);
+    /* the polygon starts out with one reference which keeps it alive
+     * while it is distributed over the tree */
+    lq_polygon_t *polygon = lq_polygon_create(quadtree, id, number_of_polygon_points, xs, ys);
     if (polygon == NULL) {
         return QUADTREE_ERROR_OUT_OF_MEMORY;
     }
-    error_code = lq_polygon_node_initialize(polygon, id, number_of_polygon_points, xs, ys);
-    if (error_code == QUADTREE_SUCCESS) {
-        error_code = lq_quadtree_node_put_polygon(root, polygon);
+    error_code = lq_quadtree_put_polygon(quadtree, polygon);
+    if (error_code == QUADTREE_SUCCESS && polygon->entries != NULL) {
+        polygon->next_with_same_id = (lq_polygon_t*) lq_idmap_get(&quadtree->polygons_by_id, id);
+        if (lq_idmap_put(&quadtree->polygons_by_id, id, polygon) != 0) {
+            error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
     }
-    lq_polygon_node_free(polygon);
+    if (error_code != QUADTREE_SUCCESS) {
+        lq_polygon_remove_entries(quadtree, polygon);
+    }
+    if (added != NULL) {
+        *added = polygon->entries != NULL ? polygon : NULL;
+    }
+    lq_polygon_release(quadtree, polygon);
     return error_code;
 }
 
 int quadtree_remove(quadtree_t qt, long id) {
     lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
-    lq_quadtree_node_t *root = quadtree->root;
-    lq_quadtree_node_remove(root, id);
+    lq_polygon_t *polygon;
+    COUNTERS_BEGIN();
+    lq_quadtree_write_begin(quadtree);
+    polygon = (lq_polygon_t*) lq_idmap_remove(&quadtree->polygons_by_id, id);
+    while (polygon != NULL) {
+        lq_polygon_t *next = polygon->next_with_same_id;
+        /* the polygon is freed together with its last entry */
+        lq_polygon_remove_entries(quadtree, polygon);
+        polygon = next;
+    }
+    lq_quadtree_write_end(quadtree);
+    COUNTERS_END(quadtree);
     return QUADTREE_SUCCESS;
 }
 
-int quadtree_query(quadtree_t qt, int x, int y, quadtree_query_result_t *query_result) {
+int quadtree_compact(quadtree_t qt) {
     lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
-    lq_quadtree_node_t *root = quadtree->root;
-    if (!lq_rect_point_is_in_bounds(root->bounding_box, x, y)) {
-        return QUADTREE_ERROR_OUT_OF_BOUNDS;
+    lq_quadtree_write_begin(quadtree);
+    lq_quadtree_node_compact(quadtree, quadtree->root);
+    /* snapshots may still read polygons the tree no longer holds */
+    if (quadtree->snapshots == NULL) {
+        lq_quadtree_node_reset_envelope(quadtree->root);
     }
-    return lq_quadtree_node_query(root, x, y, query_result);
+    lq_quadtree_write_end(quadtree);
+    return QUADTREE_SUCCESS;
 }
 
-quadtree_query_result_t* quadtree_query_result_allocate() {
-    quadtree_query_result_t *query_result = (quadtree_query_result_t*) calloc(1, sizeof(quadtree_query_result_t));
-    return query_result;
+int quadtree_get_stats(quadtree_t qt, quadtree_stats_t *stats) {
+    size_t i;
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_polygon_t *polygon;
+    memset(stats, 0, sizeof(quadtree_stats_t));
+    stats->max_polygon_entries_id = -1;
+    lq_quadtree_node_get_stats(quadtree->root, stats);
+    for (i = 0; i < quadtree->polygons_by_id.capacity; ++i) {
+        polygon = (lq_polygon_t*) quadtree->polygons_by_id.entries[i].value;
+        for (; polygon != NULL; polygon = polygon->next_with_same_id) {
+            stats->number_of_polygons++;
+            stats->number_of_points += polygon->number_of_points;
+            stats->point_bytes += 2 * polygon->number_of_points *
+                                  (polygon->points != NULL ? sizeof(unsigned short) : sizeof(int));
+            if (polygon->edge_index != NULL) {
+                stats->edge_index_bytes += lq_edge_index_size(polygon->edge_index);
+            }
+            if (polygon->ref_count > stats->max_polygon_entries) {
+                stats->max_polygon_entries = polygon->ref_count;
+                stats->max_polygon_entries_id = polygon->id;
+            }
+        }
+    }
+    stats->node_bytes = quadtree->node_pool.number_of_reserved_bytes;
+    stats->entry_bytes = quadtree->polygon_node_pool.number_of_reserved_bytes;
+    stats->polygon_bytes = quadtree->polygon_pool.number_of_reserved_bytes;
+    stats->id_map_bytes = quadtree->polygons_by_id.capacity * sizeof(lq_idmap_entry_t);
+    stats->total_bytes = sizeof(lq_quadtree_t) + quadtree->edge_stack.capacity * sizeof(int) +
+                         stats->node_bytes + stats->entry_bytes + stats->leaf_array_bytes +
+                         stats->polygon_bytes + stats->point_bytes + stats->edge_index_bytes +
+                         stats->id_map_bytes;
+    return QUADTREE_SUCCESS;
 }
 
-void quadtree_query_result_free(quadtree_query_result_t *query_result) {
-    lq_quadtree_query_result_reset(query_result);
-    free(query_result);
+int quadtree_get_counters(quadtree_t qt, quadtree_counters_t *counters) {
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+#ifdef QUADTREE_COUNTERS
+    counters->nodes_visited = __atomic_load_n(&quadtree->counters.nodes_visited, __ATOMIC_RELAXED);
+    counters->entries_scanned = __atomic_load_n(&quadtree->counters.entries_scanned, __ATOMIC_RELAXED);
+    counters->point_in_polygon_calls = __atomic_load_n(&quadtree->counters.point_in_polygon_calls, __ATOMIC_RELAXED);
+    counters->edges_tested = __atomic_load_n(&quadtree->counters.edges_tested, __ATOMIC_RELAXED);
+    counters->allocations = __atomic_load_n(&quadtree->counters.allocations, __ATOMIC_RELAXED);
+    return QUADTREE_SUCCESS;
+#else
+    (void) quadtree;
+    memset(counters, 0, sizeof(quadtree_counters_t));
+    return QUADTREE_ERROR;
+#endif
 }
 
+int quadtree_get_call_counters(quadtree_counters_t *counters) {
+#ifdef QUADTREE_COUNTERS
+    *counters = lq_call_counters;
+    return QUADTREE_SUCCESS;
+#else
+    memset(counters, 0, sizeof(quadtree_counters_t));
+    return QUADTREE_ERROR;
+#endif
+}
 
-/*********************
- * private functions *
- *********************/
+int quadtree_reset_counters(quadtree_t qt) {
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    memset(&quadtree->counters, 0, sizeof(quadtree_counters_t));
+#ifdef QUADTREE_COUNTERS
+    return QUADTREE_SUCCESS;
+#else
+    return QUADTREE_ERROR;
+#endif
+}
 
-static lq_quadtree_node_t* lq_quadtree_node_allocate() {
-    lq_quadtree_node_t *node = (lq_quadtree_node_t*) calloc(1, sizeof(lq_quadtree_node_t));
-    if (node != NULL) {
-        lq_rect_t *rect = lq_rect_allocate();
-        if (rect != NULL) {
-            node->bounding_box = rect;
-        } else {
-            lq_quadtree_node_free(node);
-            node = NULL;
+int quadtree_update(quadtree_t qt, long id, int number_of_polygon_points, int *xs, int *ys) {
+    int i;
+    int error_code;
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_polygon_t *polygon, *other, *added;
+    lq_polygon_node_t *entry, *next_entry;
+    lq_quadtree_node_t *owner;
+    for (i = 0; i < number_of_polygon_points; ++i) {
+        if (!lq_rect_point_is_in_bounds(&quadtree->root->bounding_box, xs[i], ys[i])) {
+            return QUADTREE_ERROR_OUT_OF_BOUNDS;
         }
     }
-    return node;
-}
-
-static void lq_quadtree_node_free(lq_quadtree_node_t *node) {
-    int quadrant;
-    if (node == NULL) {
-        return;
+    polygon = (lq_polygon_t*) lq_idmap_get(&quadtree->polygons_by_id, id);
+    if (polygon == NULL) {
+        return quadtree_add(qt, id, number_of_polygon_points, xs, ys);
     }
-    lq_rect_free(node->bounding_box);
-    node->bounding_box = NULL;
-    lq_quadtree_node_clear_polygons(node);
-    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
-        if (node->children[quadrant] != NULL) {
-            lq_quadtree_node_free(node->children[quadrant]);
+    COUNTERS_BEGIN();
+    lq_quadtree_write_begin(quadtree);
+    if (lq_quadtree_is_shared(quadtree)) {
+        /* queries must never see the corners of a polygon change, so
+         * the new shape is added as a polygon of its own before the old
+         * ones are removed */
+        error_code = lq_quadtree_add(quadtree, id, number_of_polygon_points, xs, ys, &added);
+        if (error_code == QUADTREE_SUCCESS) {
+            if (added != NULL) {
+                other = added->next_with_same_id;
+                added->next_with_same_id = NULL;
+            } else {
+                other = (lq_polygon_t*) lq_idmap_remove(&quadtree->polygons_by_id, id);
+            }
+            while (other != NULL) {
+                lq_polygon_t *next = other->next_with_same_id;
+                lq_polygon_remove_entries(quadtree, other);
+                other = next;
+            }
         }
-        node->children[quadrant] = NULL;
+        lq_quadtree_write_end(quadtree);
+        COUNTERS_END(quadtree);
+        return error_code;
     }
-    free(node);
-}
-
-static void lq_quadtree_node_clear_polygons(lq_quadtree_node_t *node) {
-    int i = 0;
-    lq_polygon_node_t *polygon = node->polygons;
-    while (polygon != NULL) {
-        lq_polygon_node_t *next = polygon->next;
-        lq_polygon_node_free(polygon);
-        polygon = next;
-        ++i;
+    /* our own reference keeps the polygon alive should it lose all
+     * of its entries */
+    polygon->ref_count++;
+    error_code = lq_polygon_set_coordinates(quadtree, polygon, number_of_polygon_points, xs, ys);
+    if (error_code != QUADTREE_SUCCESS) {
+        lq_polygon_release(quadtree, polygon);
+        lq_quadtree_write_end(quadtree);
+        COUNTERS_END(quadtree);
+        return error_code;
     }
-    assertEqualsInt("unexpected number of polygons", node->number_of_polygons, i);
-    node->number_of_polygons = 0;
-    node->polygons = NULL;
+    /* further polygons with the same id are replaced as well */
+    other = polygon->next_with_same_id;
+    polygon->next_with_same_id = NULL;
+    while (other != NULL) {
+        lq_polygon_t *next = other->next_with_same_id;
+        lq_polygon_remove_entries(quadtree, other);
+        other = next;
+    }
+    /* Placing the new shape turns every entry it still needs back from
+     * stale and only adds entries to nodes the old shape was not in.
+     * The remaining stale entries are the nodes it left. */
+    for (entry = polygon->entries; entry != NULL; entry = entry->next_sibling) {
+        entry->stale = true;
+    }
+    polygon->updating = true;
+    error_code = lq_quadtree_put_polygon(quadtree, polygon);
+    polygon->updating = false;
+    for (entry = polygon->entries; entry != NULL; entry = next_entry) {
+        next_entry = entry->next_sibling;
+        if (entry->stale || error_code != QUADTREE_SUCCESS) {
+            owner = entry->owner;
+            lq_polygon_node_free(quadtree, entry);
+            lq_quadtree_node_collapse_upwards(quadtree, owner->parent);
+        } else {
+            lq_polygon_node_refresh_box(entry);
+        }
+    }
+    if (polygon->entries == NULL) {
+        lq_idmap_remove(&quadtree->polygons_by_id, id);
+    }
+    lq_polygon_release(quadtree, polygon);
+    lq_quadtree_write_end(quadtree);
+    COUNTERS_END(quadtree);
+    return error_code;
 }
 
-static void lq_quadtree_node_initialize(lq_quadtree_node_t *node, int rx, int ry, int rw, int rh, int depth) {
-    lq_rect_initialize(node->bounding_box, rx, ry, rw, rh);
-    node->depth = depth;
+int quadtree_build(quadtree_t qt, int number_of_polygons, long ids[], int counts[], int xs[], int ys[], quadtree_worker_pool_t wp) {
+    int error_code = QUADTREE_ERROR;
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_quadtree_write_begin(quadtree);
+    /* snapshots must not see the tree being built */
+    if (quadtree->snapshots == NULL) {
+        error_code = lq_quadtree_build(quadtree, number_of_polygons, ids, counts, xs, ys, (lq_worker_pool_t*) wp);
+    }
+    lq_quadtree_write_end(quadtree);
+    return error_code;
 }
 
-static int lq_quadtree_node_query(lq_quadtree_node_t *node, int x, int y, quadtree_query_result_t *query_result) {
-    int i;
-    int number_of_ids = 0;
-    lq_quadtree_query_result_reset(query_result);
-    /* find all polygons... */
-    lq_quadtree_node_t *leaf = lq_quadtree_node_find_leaf(node, x, y);
-    lq_polygon_node_t *polygon = leaf->polygons;
-    /* ...in the beginning we don't know how many polygons we are going to end up with.
-     *    We only know it will be no more than leaf->number_of_polygons */
-    long *tmp_ids = (long*) calloc(leaf->number_of_polygons, sizeof(long));
-    if (tmp_ids == NULL) {
+static int lq_quadtree_build(lq_quadtree_t *quadtree, int number_of_polygons, long ids[], int counts[], int xs[], int ys[], lq_worker_pool_t *worker_pool) {
+    int i, j, first_point;
+    int max_points = 0;
+    int number_of_probes;
+    int number_of_workers = 1;
+    int number_of_root_polygons = 0;
+    int number_of_root_covering = 0;
+    int error_code = QUADTREE_SUCCESS;
+    lq_quadtree_node_t *root = quadtree->root;
+    lq_polygon_t **polygons;
+    lq_build_probe_t probe;
+    lq_build_t build;
+    if (root->children[FIRST_QUADRANT] != NULL || root->number_of_polygons > 0) {
+        return QUADTREE_ERROR;
+    }
+    first_point = 0;
+    for (i = 0; i < number_of_polygons; ++i) {
+        for (j = first_point; j < first_point + counts[i]; ++j) {
+            if (!lq_rect_point_is_in_bounds(&root->bounding_box, xs[j], ys[j])) {
+                return QUADTREE_ERROR_OUT_OF_BOUNDS;
+            }
+        }
+        first_point += counts[i];
+    }
+    if (worker_pool != NULL) {
+        number_of_workers = lq_workers_count(worker_pool->workers);
+    }
+    COUNTERS_BEGIN();
+    polygons = (lq_polygon_t**) calloc(number_of_polygons > 0 ? number_of_polygons : 1, sizeof(lq_polygon_t*));
+    memset(&build, 0, sizeof(build));
+    build.workers = (lq_build_worker_t*) calloc(number_of_workers, sizeof(lq_build_worker_t));
+    COUNT(allocations, 2);
+    if (polygons == NULL || build.workers == NULL) {
+        free(polygons);
+        free(build.workers);
+        COUNTERS_END(quadtree);
         return QUADTREE_ERROR_OUT_OF_MEMORY;
     }
-    while (polygon != NULL) {
-        if (point_in_polygon(x, y, polygon->p->number_of_points, polygon->p->xs, polygon->p->ys)) {
-            tmp_ids[number_of_ids] = polygon->p->id;
-            ++number_of_ids;
+    for (i = 0; i < number_of_workers; ++i) {
+        lq_pool_initialize(&build.workers[i].node_pool, sizeof(lq_quadtree_node_t));
+        lq_pool_initialize(&build.workers[i].polygon_node_pool, sizeof(lq_polygon_node_t));
+    }
+    /* with several workers the tree is built on the calling thread down
+     * to task_depth and the subtrees below are handed to the workers */
+    build.quadtree = quadtree;
+    build.config = &quadtree->config;
+    build.task_depth = -1;
+    if (number_of_workers > 1) {
+        int number_of_nodes = 1;
+        build.task_depth = 0;
+        while (number_of_nodes < number_of_workers * TASKS_PER_WORKER && build.task_depth < quadtree->config.max_depth) {
+            number_of_nodes *= NUMBER_OF_QUADRANTS;
+            build.task_depth++;
         }
-        polygon = polygon->next;
     }
 
-    /* now that we know all polygons copy them into the result */
-    long *ids = (long*) malloc(number_of_ids * sizeof(long));
-    if (ids == NULL) {
-        free(tmp_ids);
-        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    first_point = 0;
+    for (i = 0; i < number_of_polygons; ++i) {
+        /* like quadtree_add() every polygon holds one reference while
+         * the tree is built */
+        polygons[i] = lq_polygon_create(quadtree, ids[i], counts[i], xs + first_point, ys + first_point);
+        if (polygons[i] == NULL) {
+            error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
+            goto error;
+        }
+        first_point += counts[i];
+        if (counts[i] > max_points) {
+            max_points = counts[i];
+        }
+    }
+    /* every polygon starts with all of its edges, which are the first
+     * max_points edges on the stack.  The ones entering the root are
+     * pushed on top of them. */
+    if (lq_reserve((void**) &build.workers[0].stack, &build.workers[0].stack_capacity,
+                   number_of_polygons, sizeof(lq_build_item_t)) != QUADTREE_SUCCESS ||
+        lq_edge_stack_reserve(&build.workers[0].edges, max_points + first_point) != 0) {
+        error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
+        goto error;
+    }
+    for (i = 0; i < max_points; ++i) {
+        build.workers[0].edges.edges[i] = i;
+    }
+    build.workers[0].edges.size = max_points;
+    for (i = 0; i < number_of_polygons; ++i) {
+        build.workers[0].stack[i].polygon = polygons[i];
+        build.workers[0].stack[i].first_edge = 0;
+        build.workers[0].stack[i].number_of_edges = counts[i];
+    }
+    for (i = 0; i < number_of_polygons; ++i) {
+        number_of_probes = 0;
+        lq_build_filter(&build.workers[0], &build.workers[0].stack[i], &root->bounding_box, &probe, &number_of_probes,
+                        build.workers[0].stack, &number_of_root_polygons, &number_of_root_covering);
+    }
+    error_code = lq_build_node(&build, &build.workers[0], root, 0, number_of_root_polygons, number_of_root_covering);
+    if (error_code != QUADTREE_SUCCESS) {
+        goto error;
     }
-    for (i = 0; i < number_of_ids; ++i) {
-        ids[i] = tmp_ids[i];
+    if (build.number_of_tasks > 0) {
+        /* start with the biggest subtrees so that no worker is left
+         * with a big one at the end */
+        qsort(build.tasks, build.number_of_tasks, sizeof(lq_build_task_t), lq_build_task_compare);
+        build.task_depth = -1;
+        COUNTERS_COLLECT(&build.counters);
+        lq_workers_run(worker_pool->workers, lq_build_task, &build);
+        COUNTERS_RESTORE(&build.counters);
+        error_code = build.error_code;
+        if (error_code != QUADTREE_SUCCESS) {
+            goto error;
+        }
     }
-    free(tmp_ids);
 
-    query_result->number_of_ids = number_of_ids;
-    query_result->ids = ids;
-    return QUADTREE_SUCCESS;
-}
+    for (i = 0; i < number_of_polygons; ++i) {
+        if (polygons[i]->entries != NULL) {
+            polygons[i]->next_with_same_id = (lq_polygon_t*) lq_idmap_get(&quadtree->polygons_by_id, ids[i]);
+            if (lq_idmap_put(&quadtree->polygons_by_id, ids[i], polygons[i]) != 0) {
+                error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
+                goto error;
+            }
+        }
+    }
+    for (i = 0; i < number_of_workers; ++i) {
+        lq_pool_merge(&quadtree->node_pool, &build.workers[i].node_pool);
+        lq_pool_merge(&quadtree->polygon_node_pool, &build.workers[i].polygon_node_pool);
+    }
+    for (i = 0; i < number_of_polygons; ++i) {
+        lq_polygon_release(quadtree, polygons[i]);
+    }
+    goto cleanup;
 
-static lq_quadtree_node_t* lq_quadtree_node_find_leaf(lq_quadtree_node_t *node, int x, int y) {
-    assert (node != NULL);
-    int quadrant = lq_rect_get_quadrant(node->bounding_box, x, y);
-    if (node->children[quadrant] != NULL) {
-        return lq_quadtree_node_find_leaf(node->children[quadrant], x, y);
-    } else {
-        return node;
+error:
+    /* nothing outside of the worker pools refers to the new nodes and
+     * entries so dropping the pools undoes the build.  Only the arrays
+     * of the nodes have to be freed one by one. */
+    lq_quadtree_node_free_arrays(root);
+    for (i = 0; i < NUMBER_OF_QUADRANTS; ++i) {
+        root->children[i] = NULL;
+    }
+    root->number_of_polygons = 0;
+    lq_idmap_destroy(&quadtree->polygons_by_id);
+    for (i = 0; i < number_of_polygons && polygons[i] != NULL; ++i) {
+        lq_polygon_free_coordinates(polygons[i]);
+        lq_pool_free(&quadtree->polygon_pool, polygons[i]);
+    }
+cleanup:
+    for (i = 0; i < number_of_workers; ++i) {
+        lq_pool_destroy(&build.workers[i].node_pool);
+        lq_pool_destroy(&build.workers[i].polygon_node_pool);
+        free(build.workers[i].stack);
+        free(build.workers[i].edges.edges);
     }
+    free(build.workers);
+    free(build.tasks);
+    free(build.task_polygons);
+    free(build.task_edges.edges);
+    free(polygons);
+    COUNTERS_END(quadtree);
+    return error_code;
 }
 
-static int lq_quadtree_node_put_polygon(lq_quadtree_node_t *node, lq_polygon_node_t *polygon) {
-    int rx = node->bounding_box->left;
-    int ry = node->bounding_box->bottom;
-    int rw = node->bounding_box->width;
-    int rh = node->bounding_box->height;
-    int quadrant;
+int quadtree_set_edge_index(quadtree_t qt, int enabled) {
+    size_t i;
+    int *coordinates;
     int error_code = QUADTREE_SUCCESS;
-    if (!collide_polygon_rectangle(polygon->p->number_of_points, polygon->p->xs, polygon->p->ys,
-                                  rx, ry, rw, rh)) {
-        LOG_DEBUG("bail %d %d %d %d %d\n", rx, ry, rw, rh, node->depth);
-    } else if (node->depth == MAX_DEPTH || rw <= MIN_SIZE || rh <= MIN_SIZE ||
-               (node->children[FIRST_QUADRANT] == NULL &&
-                rectangle_inside_polygon(rx, ry, rw, rh,
-                                         polygon->p->number_of_points,
-                                         polygon->p->xs, polygon->p->ys))) {
-        LOG_DEBUG("put %d %d %d %d %d %d\n", rx, ry, rw, rh, node->depth, node->number_of_polygons);
-        lq_polygon_node_t *clone = lq_polygon_node_clone(polygon);
-        if (clone != NULL) {
-            lq_quadtree_node_add_polygon(node, clone);
-        } else {
-            error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
-        }
-    } else {
-        LOG_DEBUG("desend %d %d %d %d %d\n", rx, ry, rw, rh, node->depth);
-        error_code = lq_quadtree_node_populate_children(node);
-        if (error_code == QUADTREE_SUCCESS) {
-            for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
-                error_code = lq_quadtree_node_put_polygon(node->children[quadrant], polygon);
-                if (error_code != QUADTREE_SUCCESS) {
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_polygon_t *polygon;
+    lq_edge_index_t *edge_index;
+    lq_quadtree_write_begin(quadtree);
+    for (i = 0; i < quadtree->polygons_by_id.capacity && error_code == QUADTREE_SUCCESS; ++i) {
+        polygon = (lq_polygon_t*) quadtree->polygons_by_id.entries[i].value;
+        for (; polygon != NULL && error_code == QUADTREE_SUCCESS; polygon = polygon->next_with_same_id) {
+            if (enabled && polygon->edge_index == NULL &&
+                polygon->number_of_points >= EDGE_INDEX_MIN_POINTS) {
+                coordinates = polygon->xs;
+                if (polygon->points != NULL) {
+                    coordinates = (int*) malloc(2 * polygon->number_of_points * sizeof(int));
+                    if (coordinates == NULL) {
+                        error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
+                        break;
+                    }
+                    lq_polygon_get_coordinates(polygon, coordinates, coordinates + polygon->number_of_points);
+                }
+                edge_index = lq_edge_index_create(polygon->number_of_points, coordinates,
+                                                  coordinates + polygon->number_of_points);
+                if (coordinates != polygon->xs) {
+                    free(coordinates);
+                }
+                if (edge_index == NULL) {
+                    /* the polygons that already got one keep it */
+                    error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
                     break;
                 }
+                /* queries use the index as soon as they see it */
+                __atomic_store_n(&polygon->edge_index, edge_index, __ATOMIC_RELEASE);
+            } else if (!enabled && polygon->edge_index != NULL) {
+                edge_index = polygon->edge_index;
+                __atomic_store_n(&polygon->edge_index, NULL, __ATOMIC_RELEASE);
+                lq_quadtree_retire(quadtree, edge_index, lq_retired_edge_index_free);
             }
         }
     }
+    if (error_code == QUADTREE_SUCCESS) {
+        quadtree->use_edge_index = enabled ? true : false;
+    }
+    lq_quadtree_write_end(quadtree);
     return error_code;
 }
 
-static void lq_quadtree_node_remove(lq_quadtree_node_t *node, long id) {
-    int quadrant;
-    lq_polygon_node_t *previous, *tmp, *polygon;
-    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
-        if (node->children[quadrant] != NULL) {
-            lq_quadtree_node_remove(node->children[quadrant], id);
-        }
+int quadtree_query(quadtree_t qt, int x, int y, quadtree_query_result_t *query_result) {
+    int error_code;
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_quadtree_node_t *root = quadtree->root;
+    if (!lq_rect_point_is_in_bounds(&root->bounding_box, x, y)) {
+        return QUADTREE_ERROR_OUT_OF_BOUNDS;
     }
-    previous = NULL;
-    polygon = node->polygons;
-    while (polygon != NULL) {
-        if (polygon->p->id == id) {
-            LOG_DEBUG("removing polygon %ld from (%d %d %d %d)\n", id,
-                      node->bounding_box->left, node->bounding_box->bottom,
-                      node->bounding_box->width, node->bounding_box->height);
-            if (previous != NULL) {
-                previous->next = polygon->next;
-            } else {
-                node->polygons = polygon->next;
-            }
-            tmp = polygon;
-            polygon = polygon->next;
-            lq_polygon_node_free(tmp);
-            node->number_of_polygons--;
-        } else {
-            previous = polygon;
-            polygon = polygon->next;
-        }
+    if (lq_quadtree_read_begin(quadtree) != QUADTREE_SUCCESS) {
+        query_result->number_of_ids = -1;
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
     }
+    COUNTERS_BEGIN();
+    error_code = lq_quadtree_node_query(root, 0, x, y, query_result);
+    COUNTERS_END(quadtree);
+    lq_quadtree_read_end(quadtree);
+    return error_code;
 }
 
-static int lq_quadtree_node_populate_children(lq_quadtree_node_t *node) {
-    /* TODO: make sure we divide the space up correctly in case the size is not a power of 2. */
+int quadtree_query_visit(quadtree_t qt, int x, int y, quadtree_query_visitor_t visitor, void *context) {
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_quadtree_node_t *root = quadtree->root;
+    if (!lq_rect_point_is_in_bounds(&root->bounding_box, x, y)) {
+        return QUADTREE_ERROR_OUT_OF_BOUNDS;
+    }
+    if (lq_quadtree_read_begin(quadtree) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    COUNTERS_BEGIN();
+    lq_quadtree_node_visit(root, x, y, visitor, context);
+    COUNTERS_END(quadtree);
+    lq_quadtree_read_end(quadtree);
+    return QUADTREE_SUCCESS;
+}
+
+int quadtree_query_rect(quadtree_t qt, int left, int bottom, int width, int height, quadtree_query_result_t *query_result) {
+    int error_code;
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_quadtree_query_result_reset(query_result);
+    if (lq_quadtree_read_begin(quadtree) != QUADTREE_SUCCESS) {
+        query_result->number_of_ids = -1;
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    error_code = lq_quadtree_query_rect(quadtree, 0, left, bottom, width, height, query_result);
+    lq_quadtree_read_end(quadtree);
+    return error_code;
+}
+
+/* the rectangle query of quadtree_query_rect() of the tree as the
+ * snapshots of generation see it, or of the live tree for 0 */
+static int lq_quadtree_query_rect(lq_quadtree_t *quadtree, unsigned long generation, int left, int bottom, int width, int height, quadtree_query_result_t *query_result) {
+    lq_rect_t *bounds = &quadtree->root->bounding_box;
+    lq_rect_t window;
+    long long right, top;
+    int error_code;
+    lq_quadtree_query_result_reset(query_result);
+    if (width <= 0 || height <= 0) {
+        return QUADTREE_ERROR;
+    }
+    /* only the part of the window inside of the tree can be answered */
+    right = MIN((long long) left + width, (long long) bounds->left + bounds->width);
+    top = MIN((long long) bottom + height, (long long) bounds->bottom + bounds->height);
+    left = MAX(left, bounds->left);
+    bottom = MAX(bottom, bounds->bottom);
+    if (right <= left || top <= bottom) {
+        return QUADTREE_ERROR_OUT_OF_BOUNDS;
+    }
+    lq_rect_initialize(&window, left, bottom, (int) (right - left), (int) (top - bottom));
+    COUNTERS_BEGIN();
+    error_code = lq_quadtree_node_query_rect(quadtree->root, generation, &window, false, query_result);
+    COUNTERS_END(quadtree);
+    if (error_code != QUADTREE_SUCCESS) {
+        query_result->number_of_ids = -1;
+        return error_code;
+    }
+    lq_quadtree_query_result_make_unique(query_result);
+    return QUADTREE_SUCCESS;
+}
+
+int quadtree_query_nearest(quadtree_t qt, int x, int y, int k, double max_distance, quadtree_nearest_result_t *nearest_result) {
+    int error_code;
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    nearest_result->number_of_ids = -1;
+    if (lq_quadtree_read_begin(quadtree) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    error_code = lq_quadtree_query_nearest(quadtree, 0, x, y, k, max_distance, nearest_result);
+    lq_quadtree_read_end(quadtree);
+    return error_code;
+}
+
+/* the nearest query of quadtree_query_nearest() of the tree as the
+ * snapshots of generation see it, or of the live tree for 0 */
+static int lq_quadtree_query_nearest(lq_quadtree_t *quadtree, unsigned long generation, int x, int y, int k, double max_distance, quadtree_nearest_result_t *nearest_result) {
+    lq_nearest_scratch_t *scratch;
+    lq_nearest_node_t next;
+    lq_quadtree_node_t *children[NUMBER_OF_QUADRANTS], *grandchildren[NUMBER_OF_QUADRANTS];
+    lq_node_arrays_t arrays;
+    double limit, bound;
+    int i, quadrant, number_of_polygons;
+    int error_code;
+    nearest_result->number_of_ids = -1;
+    if (k <= 0) {
+        return QUADTREE_ERROR;
+    }
+    COUNTERS_BEGIN();
+    if (lq_nearest_result_prepare(nearest_result, k) != QUADTREE_SUCCESS) {
+        COUNTERS_END(quadtree);
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    max_distance = max_distance < 0 ? DBL_MAX : max_distance * max_distance;
+    nearest_result->number_of_ids = 0;
+    scratch = (lq_nearest_scratch_t*) nearest_result->scratch;
+    scratch->number_of_nodes = 0;
+    bound = lq_quadtree_node_squared_distance_bound(quadtree->root, x, y);
+    error_code = QUADTREE_SUCCESS;
+    if (bound <= max_distance) {
+        error_code = lq_nearest_heap_push(scratch, quadtree->root, bound);
+    }
+    while (error_code == QUADTREE_SUCCESS && scratch->number_of_nodes > 0) {
+        next = lq_nearest_heap_pop(scratch);
+        COUNT(nodes_visited, 1);
+        limit = lq_nearest_result_limit(nearest_result, k, max_distance);
+        if (next.distance > limit) {
+            /* every other node in the heap is at least as far away */
+            break;
+        }
+        number_of_polygons = lq_quadtree_node_load_at(next.node, generation, children, &arrays);
+        if (number_of_polygons >= 0) {
+            lq_node_arrays_query_nearest(&arrays, number_of_polygons, x, y, k, max_distance, nearest_result);
+            continue;
+        }
+        for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS && error_code == QUADTREE_SUCCESS; ++quadrant) {
+            /* empty leaves are not worth a place in the heap */
+            if (lq_quadtree_node_load_at(children[quadrant], generation, grandchildren, &arrays) == 0) {
+                continue;
+            }
+            bound = lq_quadtree_node_squared_distance_bound(children[quadrant], x, y);
+            if (bound <= limit) {
+                error_code = lq_nearest_heap_push(scratch, children[quadrant], bound);
+            }
+        }
+    }
+    if (error_code != QUADTREE_SUCCESS) {
+        nearest_result->number_of_ids = -1;
+    }
+    for (i = 0; i < nearest_result->number_of_ids; ++i) {
+        nearest_result->ids[i] = scratch->polygons[i]->id;
+        nearest_result->distances[i] = sqrt(nearest_result->distances[i]);
+    }
+    COUNTERS_END(quadtree);
+    return error_code;
+}
+
+quadtree_nearest_result_t* quadtree_nearest_result_allocate() {
+    quadtree_nearest_result_t *nearest_result = (quadtree_nearest_result_t*) calloc(1, sizeof(quadtree_nearest_result_t));
+    return nearest_result;
+}
+
+void quadtree_nearest_result_free(quadtree_nearest_result_t *nearest_result) {
+    if (nearest_result != NULL) {
+        free(nearest_result->ids);
+        free(nearest_result->distances);
+        if (nearest_result->scratch != NULL) {
+            free(((lq_nearest_scratch_t*) nearest_result->scratch)->heap);
+            free(((lq_nearest_scratch_t*) nearest_result->scratch)->polygons);
+        }
+        free(nearest_result->scratch);
+    }
+    free(nearest_result);
+}
+
+quadtree_query_result_t* quadtree_query_result_allocate() {
+    quadtree_query_result_t *query_result = (quadtree_query_result_t*) calloc(1, sizeof(quadtree_query_result_t));
+    return query_result;
+}
+
+void quadtree_query_result_free(quadtree_query_result_t *query_result) {
+    if (query_result != NULL) {
+        free(query_result->ids);
+    }
+    free(query_result);
+}
+
+int quadtree_query_batch(quadtree_t qt, int number_of_points, int *xs, int *ys, quadtree_batch_result_t *batch_result) {
+    return lq_quadtree_query_batch((lq_quadtree_t*) qt, number_of_points, xs, ys, 1, batch_result);
+}
+
+int quadtree_query_batch_xy(quadtree_t qt, int number_of_points, int *xy, quadtree_batch_result_t *batch_result) {
+    return lq_quadtree_query_batch((lq_quadtree_t*) qt, number_of_points, xy, xy + 1, 2, batch_result);
+}
+
+/* the batch query of quadtree_query_batch() for the points
+ * (xs[i * stride], ys[i * stride]) */
+static int lq_quadtree_query_batch(lq_quadtree_t *quadtree, int number_of_points, int *xs, int *ys, int stride, quadtree_batch_result_t *batch_result) {
+    int i;
+    int error_code;
+    lq_batch_scratch_t *scratch;
+    COUNTERS_BEGIN();
+    error_code = lq_batch_result_prepare(batch_result, number_of_points);
+    if (error_code != QUADTREE_SUCCESS) {
+        COUNTERS_END(quadtree);
+        return error_code;
+    }
+    scratch = (lq_batch_scratch_t*) batch_result->scratch;
+    /* the counts are written to offsets[1..n] and then summed up in place */
+    scratch->number_of_hits = 0;
+    error_code = lq_quadtree_read_begin(quadtree);
+    if (error_code == QUADTREE_SUCCESS) {
+        error_code = lq_quadtree_query_points(quadtree, number_of_points, xs, ys, stride,
+                                              batch_result->offsets + 1, scratch->starts, scratch);
+        lq_quadtree_read_end(quadtree);
+    }
+    if (error_code == QUADTREE_ERROR_OUT_OF_MEMORY ||
+        lq_batch_result_sum_offsets(batch_result, number_of_points) != QUADTREE_SUCCESS) {
+        COUNTERS_END(quadtree);
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    /* the hits were produced in spatial order, put them back in input order */
+    for (i = 0; i < number_of_points; ++i) {
+        int offset = batch_result->offsets[i];
+        /* scratch->hits is NULL when the batch has no hits */
+        if (batch_result->offsets[i + 1] > offset) {
+            memcpy(batch_result->ids + offset, scratch->hits + scratch->starts[i],
+                   (batch_result->offsets[i + 1] - offset) * sizeof(long));
+        }
+    }
+    batch_result->number_of_points = number_of_points;
+    COUNTERS_END(quadtree);
+    return error_code;
+}
+
+int quadtree_query_batch_parallel(quadtree_t qt, quadtree_worker_pool_t wp, int number_of_points, int *xs, int *ys, quadtree_batch_result_t *batch_result) {
+    lq_parallel_batch_t batch;
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_worker_pool_t *worker_pool = (lq_worker_pool_t*) wp;
+    lq_batch_scratch_t *scratch;
+    lq_batch_key_t *keys;
+    int number_of_workers = lq_workers_count(worker_pool->workers);
+    int error_code;
+    COUNTERS_BEGIN();
+    error_code = lq_batch_result_prepare(batch_result, number_of_points);
+    if (error_code != QUADTREE_SUCCESS) {
+        COUNTERS_END(quadtree);
+        return error_code;
+    }
+    scratch = (lq_batch_scratch_t*) batch_result->scratch;
+    if (lq_reserve((void**) &scratch->keys, &scratch->keys_capacity,
+                   number_of_points, sizeof(lq_batch_key_t)) != QUADTREE_SUCCESS ||
+        lq_reserve((void**) &scratch->sorted_keys, &scratch->sorted_keys_capacity,
+                   number_of_points, sizeof(lq_batch_key_t)) != QUADTREE_SUCCESS) {
+        COUNTERS_END(quadtree);
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    batch.quadtree = quadtree;
+    batch.worker_pool = worker_pool;
+    batch.number_of_points = number_of_points;
+    batch.xs = xs;
+    batch.ys = ys;
+    batch.batch_result = batch_result;
+    batch.keys = scratch->keys;
+    batch.sorted_keys = scratch->sorted_keys;
+    batch.key_bits = lq_rect_key_bits(&quadtree->root->bounding_box);
+    batch.error_code = QUADTREE_SUCCESS;
+    /* All points are sorted at once so that the query order only jumps
+     * between leaves at the boundaries of the chunks.  Every pass of
+     * the radix sort counts the digits of a part of the keys per
+     * worker, turns the counts into positions and then lets every
+     * worker move its keys.  The first pass sorts the keys as they
+     * were computed, which leaves out the points outside of the tree. */
+    batch.shift = 0;
+    lq_workers_run(worker_pool->workers, lq_parallel_batch_keys_task, &batch);
+    for (;;) {
+        lq_parallel_batch_positions(&batch);
+        lq_workers_run(worker_pool->workers, lq_parallel_batch_scatter_task, &batch);
+        keys = batch.keys;
+        batch.keys = batch.sorted_keys;
+        batch.sorted_keys = keys;
+        batch.shift += 8;
+        if (batch.shift >= batch.key_bits) {
+            break;
+        }
+        lq_workers_run(worker_pool->workers, lq_parallel_batch_count_task, &batch);
+    }
+    /* both were reserved for the same number of keys */
+    scratch->keys = batch.keys;
+    scratch->sorted_keys = batch.sorted_keys;
+    /* many more chunks than workers so that fast workers can pick up
+     * the slack of workers that got chunks with expensive polygons */
+    batch.chunk_size = batch.number_of_keys / (number_of_workers * CHUNKS_PER_WORKER);
+    if (batch.chunk_size < MIN_CHUNK_SIZE) {
+        batch.chunk_size = MIN_CHUNK_SIZE;
+    } else if (batch.chunk_size > MAX_CHUNK_SIZE) {
+        batch.chunk_size = MAX_CHUNK_SIZE;
+    }
+    batch.number_of_chunks = (batch.number_of_keys + batch.chunk_size - 1) / batch.chunk_size;
+    if (lq_reserve((void**) &scratch->owners, &scratch->owners_capacity,
+                   batch.number_of_chunks, sizeof(int)) != QUADTREE_SUCCESS) {
+        COUNTERS_END(quadtree);
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    batch.next_chunk = 0;
+    /* the calling thread runs a task, too, which starts its counters
+     * anew.  What was counted so far is kept with those of the tasks. */
+    memset(&batch.counters, 0, sizeof(quadtree_counters_t));
+    if (lq_quadtree_read_begin(quadtree) != QUADTREE_SUCCESS) {
+        COUNTERS_END(quadtree);
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    COUNTERS_COLLECT(&batch.counters);
+    /* the epoch of the calling thread covers the tasks, which run
+     * while it waits for them */
+    lq_workers_run(worker_pool->workers, lq_parallel_batch_query_task, &batch);
+    lq_quadtree_read_end(quadtree);
+    COUNTERS_RESTORE(&batch.counters);
+    if (batch.error_code == QUADTREE_ERROR_OUT_OF_MEMORY) {
+        COUNTERS_END(quadtree);
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    if (lq_batch_result_sum_offsets(batch_result, number_of_points) != QUADTREE_SUCCESS) {
+        COUNTERS_END(quadtree);
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    batch.next_chunk = 0;
+    lq_workers_run(worker_pool->workers, lq_parallel_batch_copy_task, &batch);
+    batch_result->number_of_points = number_of_points;
+    COUNTERS_END(quadtree);
+    return batch.number_of_keys < number_of_points ? QUADTREE_ERROR_OUT_OF_BOUNDS : QUADTREE_SUCCESS;
+}
+
+quadtree_batch_result_t* quadtree_batch_result_allocate() {
+    quadtree_batch_result_t *batch_result = (quadtree_batch_result_t*) calloc(1, sizeof(quadtree_batch_result_t));
+    return batch_result;
+}
+
+void quadtree_batch_result_free(quadtree_batch_result_t *batch_result) {
+    if (batch_result != NULL) {
+        free(batch_result->offsets);
+        free(batch_result->ids);
+        lq_batch_scratch_release((lq_batch_scratch_t*) batch_result->scratch);
+        free(batch_result->scratch);
+    }
+    free(batch_result);
+}
+
+quadtree_worker_pool_t quadtree_worker_pool_create(int number_of_threads) {
+    lq_worker_pool_t *worker_pool = (lq_worker_pool_t*) calloc(1, sizeof(lq_worker_pool_t));
+    if (worker_pool == NULL) {
+        return NULL;
+    }
+    worker_pool->workers = lq_workers_create(number_of_threads);
+    if (worker_pool->workers == NULL) {
+        free(worker_pool);
+        return NULL;
+    }
+    worker_pool->scratches = (lq_batch_scratch_t*) calloc(lq_workers_count(worker_pool->workers),
+                                                         sizeof(lq_batch_scratch_t));
+    if (worker_pool->scratches == NULL) {
+        lq_workers_destroy(worker_pool->workers);
+        free(worker_pool);
+        return NULL;
+    }
+    return (quadtree_worker_pool_t) worker_pool;
+}
+
+void quadtree_worker_pool_destroy(quadtree_worker_pool_t wp) {
+    int i;
+    lq_worker_pool_t *worker_pool = (lq_worker_pool_t*) wp;
+    if (worker_pool == NULL) {
+        return;
+    }
+    for (i = 0; i < lq_workers_count(worker_pool->workers); ++i) {
+        lq_batch_scratch_release(&worker_pool->scratches[i]);
+    }
+    free(worker_pool->scratches);
+    lq_workers_destroy(worker_pool->workers);
+    free(worker_pool);
+}
+
+int quadtree_worker_pool_size(quadtree_worker_pool_t wp) {
+    lq_worker_pool_t *worker_pool = (lq_worker_pool_t*) wp;
+    return lq_workers_count(worker_pool->workers);
+}
+
+quadtree_snapshot_t quadtree_snapshot(quadtree_t qt) {
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_snapshot_t *snapshot, *newest = NULL;
+    int ref_count;
+    pthread_mutex_lock(&quadtree->write_lock);
+    lq_quadtree_sweep_snapshots(quadtree);
+    for (snapshot = quadtree->snapshots; snapshot != NULL; snapshot = snapshot->next) {
+        newest = snapshot;
+    }
+    /* without a change since the newest snapshot it sees the same */
+    if (newest != NULL && newest->number_of_changes == quadtree->number_of_changes &&
+        !lq_snapshot_is_broken(newest)) {
+        ref_count = __atomic_load_n(&newest->ref_count, __ATOMIC_RELAXED);
+        while (ref_count > 0 && !__atomic_compare_exchange_n(&newest->ref_count, &ref_count, ref_count + 1, 0,
+                                                             __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        }
+        if (ref_count > 0) {
+            pthread_mutex_unlock(&quadtree->write_lock);
+            return (quadtree_snapshot_t) newest;
+        }
+    }
+    snapshot = (lq_snapshot_t*) calloc(1, sizeof(lq_snapshot_t));
+    if (snapshot == NULL || (snapshot->pin = lq_epoch_pin()) == NULL) {
+        pthread_mutex_unlock(&quadtree->write_lock);
+        free(snapshot);
+        return NULL;
+    }
+    snapshot->quadtree = quadtree;
+    snapshot->generation = ++quadtree->last_generation;
+    snapshot->number_of_changes = quadtree->number_of_changes;
+    snapshot->ref_count = 1;
+    if (newest != NULL) {
+        newest->next = snapshot;
+    } else {
+        quadtree->snapshots = snapshot;
+    }
+    pthread_mutex_unlock(&quadtree->write_lock);
+    return (quadtree_snapshot_t) snapshot;
+}
+
+void quadtree_snapshot_release(quadtree_snapshot_t s) {
+    lq_snapshot_t *snapshot = (lq_snapshot_t*) s;
+    lq_epoch_reader_t *pin;
+    lq_quadtree_t *quadtree;
+    if (snapshot == NULL) {
+        return;
+    }
+    /* the writer may free the snapshot as soon as the count is 0, and
+     * one detached by quadtree_destroy() is freed here */
+    pin = snapshot->pin;
+    quadtree = snapshot->quadtree;
+    if (__atomic_sub_fetch(&snapshot->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (quadtree == NULL) {
+            free(snapshot);
+        } else {
+            lq_epoch_unpin(pin);
+        }
+    }
+}
+
+int quadtree_snapshot_query(quadtree_snapshot_t s, int x, int y, quadtree_query_result_t *query_result) {
+    int error_code;
+    lq_snapshot_t *snapshot = (lq_snapshot_t*) s;
+    lq_quadtree_t *quadtree = snapshot->quadtree;
+    lq_quadtree_node_t *root = quadtree->root;
+    if (!lq_rect_point_is_in_bounds(&root->bounding_box, x, y)) {
+        return QUADTREE_ERROR_OUT_OF_BOUNDS;
+    }
+    COUNTERS_BEGIN();
+    error_code = lq_quadtree_node_query(root, snapshot->generation, x, y, query_result);
+    COUNTERS_END(quadtree);
+    if (error_code == QUADTREE_SUCCESS && lq_snapshot_is_broken(snapshot)) {
+        query_result->number_of_ids = -1;
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    return error_code;
+}
+
+int quadtree_snapshot_query_rect(quadtree_snapshot_t s, int left, int bottom, int width, int height, quadtree_query_result_t *query_result) {
+    lq_snapshot_t *snapshot = (lq_snapshot_t*) s;
+    int error_code = lq_quadtree_query_rect(snapshot->quadtree, snapshot->generation, left, bottom, width, height, query_result);
+    if (error_code == QUADTREE_SUCCESS && lq_snapshot_is_broken(snapshot)) {
+        query_result->number_of_ids = -1;
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    return error_code;
+}
+
+int quadtree_snapshot_query_nearest(quadtree_snapshot_t s, int x, int y, int k, double max_distance, quadtree_nearest_result_t *nearest_result) {
+    lq_snapshot_t *snapshot = (lq_snapshot_t*) s;
+    int error_code = lq_quadtree_query_nearest(snapshot->quadtree, snapshot->generation, x, y, k, max_distance, nearest_result);
+    if (error_code == QUADTREE_SUCCESS && lq_snapshot_is_broken(snapshot)) {
+        nearest_result->number_of_ids = -1;
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    return error_code;
+}
+
+quadtree_frozen_t quadtree_freeze(quadtree_t qt) {
+    size_t i;
+    int number_of_nodes = 0;
+    int number_of_entries = 0;
+    int number_of_points = 0;
+    int number_of_polygons = 0;
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_rect_t *bounding_box = &quadtree->root->bounding_box;
+    lq_polygon_t *polygon;
+    lq_frozen_header_t header;
+    lq_freeze_t freeze;
+    lq_frozen_quadtree_t *frozen = (lq_frozen_quadtree_t*) calloc(1, sizeof(lq_frozen_quadtree_t));
+    if (frozen == NULL) {
+        return NULL;
+    }
+    lq_freeze_count(quadtree->root, &number_of_nodes, &number_of_entries);
+    for (i = 0; i < quadtree->polygons_by_id.capacity; ++i) {
+        polygon = (lq_polygon_t*) quadtree->polygons_by_id.entries[i].value;
+        for (; polygon != NULL; polygon = polygon->next_with_same_id) {
+            number_of_points += polygon->number_of_points;
+            number_of_polygons++;
+        }
+    }
+    memset(&header, 0, sizeof(header));
+    header.left = bounding_box->left;
+    header.bottom = bounding_box->bottom;
+    header.width = bounding_box->width;
+    header.height = bounding_box->height;
+    header.number_of_nodes = number_of_nodes;
+    header.number_of_entries = number_of_entries;
+    header.number_of_points = number_of_points;
+    frozen->size = lq_frozen_size(&header);
+    /* zeroed since snapshots write out the padding, too */
+    frozen->memory = calloc(1, frozen->size);
+    memset(&freeze, 0, sizeof(freeze));
+    lq_idmap_initialize(&freeze.first_points);
+    freeze.polygon_first_points = (int*) malloc((number_of_polygons > 0 ? number_of_polygons : 1) * sizeof(int));
+    if (frozen->memory == NULL || freeze.polygon_first_points == NULL) {
+        goto error;
+    }
+    memcpy(frozen->memory, &header, sizeof(lq_frozen_header_t));
+    lq_frozen_layout(frozen);
+
+    /* every polygon is stored once no matter how many leaves it is in.
+     * The map takes a polygon to the index of its first corner. */
+    number_of_points = 0;
+    number_of_polygons = 0;
+    for (i = 0; i < quadtree->polygons_by_id.capacity; ++i) {
+        polygon = (lq_polygon_t*) quadtree->polygons_by_id.entries[i].value;
+        for (; polygon != NULL; polygon = polygon->next_with_same_id) {
+            freeze.polygon_first_points[number_of_polygons] = number_of_points;
+            if (lq_idmap_put(&freeze.first_points, (long) polygon,
+                             &freeze.polygon_first_points[number_of_polygons]) != 0) {
+                goto error;
+            }
+            lq_polygon_get_coordinates(polygon, frozen->xs + number_of_points, frozen->ys + number_of_points);
+            number_of_points += polygon->number_of_points;
+            number_of_polygons++;
+        }
+    }
+    freeze.frozen = frozen;
+    freeze.next_node = 1;
+    lq_freeze_node(&freeze, quadtree->root, 0);
+    lq_idmap_destroy(&freeze.first_points);
+    free(freeze.polygon_first_points);
+    return (quadtree_frozen_t) frozen;
+
+error:
+    lq_idmap_destroy(&freeze.first_points);
+    free(freeze.polygon_first_points);
+    free(frozen->memory);
+    free(frozen);
+    return NULL;
+}
+
+void quadtree_frozen_destroy(quadtree_frozen_t fq) {
+    lq_frozen_quadtree_t *frozen = (lq_frozen_quadtree_t*) fq;
+    if (frozen != NULL) {
+        if (frozen->mapping != NULL) {
+            munmap(frozen->mapping, frozen->mapping_size);
+        } else {
+            free(frozen->memory);
+        }
+        free(frozen);
+    }
+}
+
+int quadtree_save(quadtree_t qt, const char *path) {
+    int error_code = QUADTREE_SUCCESS;
+    lq_snapshot_header_t header;
+    lq_frozen_quadtree_t *frozen;
+    FILE *file = NULL;
+    char *temporary_path;
+    int fd;
+    frozen = (lq_frozen_quadtree_t*) quadtree_freeze(qt);
+    temporary_path = (char*) malloc(strlen(path) + 8);
+    if (frozen == NULL || temporary_path == NULL) {
+        quadtree_frozen_destroy((quadtree_frozen_t) frozen);
+        free(temporary_path);
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    lq_snapshot_header_initialize(&header, frozen);
+    /* processes that mapped an older snapshot at path keep their copy
+     * since the new one replaces the file instead of overwriting it.
+     * The temporary file gets a unique name next to path so that
+     * processes saving to the same path do not write to the same
+     * file, and rename() does not have to cross file systems. */
+    strcpy(temporary_path, path);
+    strcat(temporary_path, ".XXXXXX");
+    fd = mkstemp(temporary_path);
+    if (fd >= 0) {
+        /* mkstemp() only lets the owner read the file */
+        fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        file = fdopen(fd, "wb");
+        if (file == NULL) {
+            close(fd);
+        }
+    }
+    if (file == NULL) {
+        error_code = QUADTREE_ERROR;
+    } else {
+        if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+            fwrite(frozen->memory, frozen->size, 1, file) != 1) {
+            error_code = QUADTREE_ERROR;
+        }
+        /* the data has to be on disk before the file replaces the old
+         * snapshot, or a crash could leave a truncated file at path */
+        if (error_code == QUADTREE_SUCCESS && (fflush(file) != 0 || fsync(fileno(file)) != 0)) {
+            error_code = QUADTREE_ERROR;
+        }
+        if (fclose(file) != 0) {
+            error_code = QUADTREE_ERROR;
+        }
+        if (error_code == QUADTREE_SUCCESS && rename(temporary_path, path) != 0) {
+            error_code = QUADTREE_ERROR;
+        }
+    }
+    if (fd >= 0 && error_code != QUADTREE_SUCCESS) {
+        remove(temporary_path);
+    }
+    free(temporary_path);
+    quadtree_frozen_destroy((quadtree_frozen_t) frozen);
+    return error_code;
+}
+
+quadtree_frozen_t quadtree_load(const char *path) {
+    int fd;
+    struct stat file_status;
+    lq_snapshot_header_t *header;
+    lq_frozen_header_t *frozen_header;
+    lq_frozen_quadtree_t *frozen = (lq_frozen_quadtree_t*) calloc(1, sizeof(lq_frozen_quadtree_t));
+    if (frozen == NULL) {
+        return NULL;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        free(frozen);
+        return NULL;
+    }
+    if (fstat(fd, &file_status) != 0 ||
+        (size_t) file_status.st_size < sizeof(lq_snapshot_header_t) + sizeof(lq_frozen_header_t)) {
+        close(fd);
+        free(frozen);
+        return NULL;
+    }
+    frozen->mapping_size = (size_t) file_status.st_size;
+    frozen->mapping = mmap(NULL, frozen->mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (frozen->mapping == MAP_FAILED) {
+        free(frozen);
+        return NULL;
+    }
+    header = (lq_snapshot_header_t*) frozen->mapping;
+    frozen->memory = (char*) frozen->mapping + sizeof(lq_snapshot_header_t);
+    frozen->size = frozen->mapping_size - sizeof(lq_snapshot_header_t);
+    frozen_header = (lq_frozen_header_t*) frozen->memory;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION || header->byte_order != SNAPSHOT_BYTE_ORDER ||
+        header->long_size != (int) sizeof(long) || header->size != frozen->size ||
+        frozen_header->number_of_nodes < 1 || frozen_header->number_of_entries < 0 ||
+        frozen_header->number_of_points < 0 || lq_frozen_size(frozen_header) != frozen->size ||
+        header->checksum != lq_checksum(frozen->memory, frozen->size)) {
+        quadtree_frozen_destroy((quadtree_frozen_t) frozen);
+        return NULL;
+    }
+    lq_frozen_layout(frozen);
+    if (!lq_frozen_is_valid(frozen)) {
+        quadtree_frozen_destroy((quadtree_frozen_t) frozen);
+        return NULL;
+    }
+    return (quadtree_frozen_t) frozen;
+}
+
+void quadtree_ingest_options_initialize(quadtree_ingest_options_t *options) {
+    options->format = QUADTREE_FORMAT_WKT;
+    options->origin_x = 0.;
+    options->origin_y = 0.;
+    options->scale_x = 1.;
+    options->scale_y = 1.;
+    options->skip_lines = 0;
+    options->max_record_length = DEFAULT_MAX_RECORD_LENGTH;
+    options->error_handler = NULL;
+    options->context = NULL;
+}
+
+static void lq_ingest_report(const quadtree_ingest_options_t *options, quadtree_ingest_stats_t *stats,
+                             long line_number, int error_code, const char *message) {
+    stats->number_of_errors++;
+    if (options->error_handler != NULL) {
+        options->error_handler(line_number, error_code, message, options->context);
+    }
+}
+
+int quadtree_ingest(quadtree_t qt, int fd, const quadtree_ingest_options_t *options, quadtree_ingest_stats_t *stats) {
+    int i, status, first_point;
+    int error_code = QUADTREE_SUCCESS;
+    lq_quadtree_t *quadtree = (lq_quadtree_t*) qt;
+    lq_rect_t *bounds = &quadtree->root->bounding_box;
+    quadtree_ingest_options_t default_options;
+    quadtree_ingest_stats_t ingest_stats;
+    lq_ingest_reader_t reader;
+    lq_ingest_record_t record;
+    if (options == NULL) {
+        quadtree_ingest_options_initialize(&default_options);
+        options = &default_options;
+    }
+    memset(&ingest_stats, 0, sizeof(quadtree_ingest_stats_t));
+    if (lq_ingest_reader_initialize(&reader, fd, (size_t) MAX(options->max_record_length, 0)) != 0) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    lq_ingest_record_initialize(&record);
+    while (error_code == QUADTREE_SUCCESS) {
+        status = lq_ingest_reader_next(&reader);
+        if (status == LQ_INGEST_END) {
+            break;
+        } else if (status == LQ_INGEST_READ_ERROR) {
+            error_code = QUADTREE_ERROR;
+            break;
+        } else if (status == LQ_INGEST_NO_MEMORY) {
+            error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
+            break;
+        }
+        if (reader.line_number <= options->skip_lines) {
+            continue;
+        }
+        if (status == LQ_INGEST_LINE_TOO_LONG) {
+            ingest_stats.number_of_records++;
+            lq_ingest_report(options, &ingest_stats, reader.line_number, QUADTREE_ERROR, "record too long");
+            continue;
+        }
+        switch (options->format) {
+        case QUADTREE_FORMAT_GEOJSON:
+            status = lq_ingest_parse_geojson(&record, reader.line);
+            break;
+        case QUADTREE_FORMAT_CSV:
+            status = lq_ingest_parse_csv(&record, reader.line);
+            break;
+        default:
+            status = lq_ingest_parse_wkt(&record, reader.line);
+            break;
+        }
+        if (status == LQ_INGEST_SKIP) {
+            continue;
+        }
+        ingest_stats.number_of_records++;
+        if (status == LQ_INGEST_NO_MEMORY) {
+            error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
+            break;
+        }
+        if (status == LQ_INGEST_SYNTAX_ERROR) {
+            lq_ingest_report(options, &ingest_stats, reader.line_number, QUADTREE_ERROR, record.error);
+            continue;
+        }
+        /* check all parts first so a record is either added completely
+         * or not at all */
+        status = lq_ingest_record_quantize(&record, options->origin_x, options->origin_y,
+                                           options->scale_x, options->scale_y);
+        for (i = 0; status == 0 && i < record.number_of_points; ++i) {
+            if (!lq_rect_point_is_in_bounds(bounds, record.grid_xs[i], record.grid_ys[i])) {
+                status = -1;
+            }
+        }
+        if (status != 0) {
+            lq_ingest_report(options, &ingest_stats, reader.line_number, QUADTREE_ERROR_OUT_OF_BOUNDS,
+                             "polygon outside of the quadtree");
+            continue;
+        }
+        first_point = 0;
+        for (i = 0; i < record.number_of_parts && error_code == QUADTREE_SUCCESS; ++i) {
+            error_code = quadtree_add(qt, record.id, record.part_sizes[i],
+                                      record.grid_xs + first_point, record.grid_ys + first_point);
+            first_point += record.part_sizes[i];
+            if (error_code == QUADTREE_SUCCESS) {
+                ingest_stats.number_of_polygons++;
+            }
+        }
+    }
+    lq_ingest_record_destroy(&record);
+    lq_ingest_reader_destroy(&reader);
+    if (stats != NULL) {
+        *stats = ingest_stats;
+    }
+    return error_code;
+}
+
+int quadtree_frozen_query(quadtree_frozen_t fq, int x, int y, quadtree_query_result_t *query_result) {
+    int i, number_of_ids = 0;
+    lq_frozen_quadtree_t *frozen = (lq_frozen_quadtree_t*) fq;
+    lq_frozen_header_t *header = frozen->header;
+    const lq_frozen_node_t *leaf;
+    const lq_frozen_entry_t *entry;
+    if (x < header->left || header->left + header->width <= x ||
+        y < header->bottom || header->bottom + header->height <= y) {
+        return QUADTREE_ERROR_OUT_OF_BOUNDS;
+    }
+    lq_quadtree_query_result_reset(query_result);
+    leaf = lq_frozen_find_leaf(frozen, x, y);
+    if (lq_quadtree_query_result_reserve(query_result, leaf->number_of_entries) != QUADTREE_SUCCESS) {
+        query_result->number_of_ids = -1;
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    for (i = leaf->first; i < leaf->first + leaf->number_of_entries; ++i) {
+        if (x < frozen->min_xs[i] || frozen->max_xs[i] <= x ||
+            y < frozen->min_ys[i] || frozen->max_ys[i] <= y) {
+            continue;
+        }
+        entry = frozen->entries + i;
+        if (point_in_polygon(x, y, entry->number_of_points,
+                             frozen->xs + entry->first_point, frozen->ys + entry->first_point)) {
+            query_result->ids[number_of_ids] = entry->id;
+            ++number_of_ids;
+        }
+    }
+    query_result->number_of_ids = number_of_ids;
+    return QUADTREE_SUCCESS;
+}
+
+
+/*********************
+ * private functions *
+ *********************/
+
+/* snapshots taken so far cannot see the new node */
+static lq_quadtree_node_t* lq_quadtree_node_allocate(lq_quadtree_t *quadtree) {
+    lq_quadtree_node_t *node;
+    COUNT(allocations, 1);
+    node = (lq_quadtree_node_t*) lq_pool_allocate(&quadtree->node_pool);
+    if (node != NULL) {
+        node->preserved_generation = quadtree->snapshot_generation;
+    }
+    return node;
+}
+
+/* frees node and the nodes below it, which must no longer be part of
+ * the tree.  Their children and arrays are left as they are for the
+ * queries that may still be reading them. */
+static void lq_quadtree_node_free(lq_quadtree_t *quadtree, lq_quadtree_node_t *node) {
+    int quadrant;
+    if (node == NULL) {
+        return;
+    }
+    lq_quadtree_node_release_entries(quadtree, node);
+    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+        lq_quadtree_node_free(quadtree, node->children[quadrant]);
+    }
+    lq_quadtree_retire(quadtree, node, lq_retired_node_free);
+}
+
+static void lq_quadtree_node_clear_polygons(lq_quadtree_t *quadtree, lq_quadtree_node_t *node) {
+    lq_quadtree_node_preserve(quadtree, node);
+    lq_quadtree_node_release_entries(quadtree, node);
+    node->entries_capacity = 0;
+    __atomic_store_n(&node->entries, NULL, __ATOMIC_RELEASE);
+}
+
+/* frees the entries of node and retires its arrays without changing
+ * them, which spares removing the entries one by one */
+static void lq_quadtree_node_release_entries(lq_quadtree_t *quadtree, lq_quadtree_node_t *node) {
+    int i;
+    for (i = 0; i < node->number_of_polygons; ++i) {
+        node->entries[i]->owner = NULL;
+        lq_polygon_node_free(quadtree, node->entries[i]);
+    }
+    node->number_of_polygons = 0;
+    if (node->entries != NULL) {
+        lq_quadtree_retire(quadtree, NODE_HEADER(node->entries), lq_retired_arrays_free);
+    }
+}
+
+/* frees the arrays and history of node and of all nodes below it
+ * without touching their entries, which are released in bulk with the
+ * pools */
+static void lq_quadtree_node_free_arrays(lq_quadtree_node_t *node) {
+    int quadrant;
+    if (node->entries != NULL) {
+        free(NODE_HEADER(node->entries));
+    }
+    lq_node_history_free(node);
+    node->entries = NULL;
+    node->entries_capacity = 0;
+    if (node->children[FIRST_QUADRANT] != NULL) {
+        for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+            lq_quadtree_node_free_arrays(node->children[quadrant]);
+        }
+    }
+}
+
+static void lq_quadtree_node_initialize(lq_quadtree_node_t *node, int rx, int ry, int rw, int rh, int depth) {
+    lq_rect_initialize(&node->bounding_box, rx, ry, rw, rh);
+    node->depth = depth;
+    /* the envelope starts out empty */
+    node->envelope_min_x = INT_MAX;
+    node->envelope_min_y = INT_MAX;
+    node->envelope_max_x = INT_MIN;
+    node->envelope_max_y = INT_MIN;
+}
+
+static int lq_quadtree_node_query(lq_quadtree_node_t *node, unsigned long generation, int x, int y, quadtree_query_result_t *query_result) {
+    int i, number_of_polygons, number_of_ids = 0;
+    lq_node_arrays_t arrays;
+    lq_quadtree_query_result_reset(query_result);
+    lq_quadtree_node_find_leaf_at(node, generation, x, y, &arrays, &number_of_polygons);
+    /* we don't know how many polygons we are going to end up with but
+     * it will be no more than the number of polygons of the leaf */
+    if (lq_quadtree_query_result_reserve(query_result, number_of_polygons) != QUADTREE_SUCCESS) {
+        query_result->number_of_ids = -1;
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    COUNT(entries_scanned, number_of_polygons);
+    for (i = 0; i < number_of_polygons; ++i) {
+        if (lq_node_arrays_box_contains(&arrays, i, x, y) &&
+            lq_polygon_contains(arrays.polygons[i], x, y)) {
+            query_result->ids[number_of_ids] = arrays.polygons[i]->id;
+            ++number_of_ids;
+        }
+    }
+    query_result->number_of_ids = number_of_ids;
+    return QUADTREE_SUCCESS;
+}
+
+static void lq_quadtree_node_visit(lq_quadtree_node_t *node, int x, int y, quadtree_query_visitor_t visitor, void *context) {
+    int i, number_of_polygons;
+    lq_node_arrays_t arrays;
+    lq_quadtree_node_find_leaf(node, x, y, &arrays, &number_of_polygons);
+    COUNT(entries_scanned, number_of_polygons);
+    for (i = 0; i < number_of_polygons; ++i) {
+        if (lq_node_arrays_box_contains(&arrays, i, x, y) &&
+            lq_polygon_contains(arrays.polygons[i], x, y)) {
+            visitor(arrays.polygons[i]->id, context);
+        }
+    }
+}
+
+/* Appends the ids of the polygons of node and its descendants that
+ * collide with window.  A polygon is only ever stored in nodes it
+ * collides with and then also collides with every rectangle containing
+ * such a node, so once a node lies completely inside of the window
+ * (covered) all polygons below it are reported without looking at
+ * their geometry. */
+static int lq_quadtree_node_query_rect(lq_quadtree_node_t *node, unsigned long generation, lq_rect_t *window, bool covered, quadtree_query_result_t *query_result) {
+    int i, quadrant, error_code, number_of_polygons;
+    lq_rect_t *box = &node->bounding_box;
+    lq_quadtree_node_t *children[NUMBER_OF_QUADRANTS];
+    lq_node_arrays_t arrays;
+    COUNT(nodes_visited, 1);
+    if (!covered) {
+        if (window->left + window->width <= box->left || box->left + box->width <= window->left ||
+            window->bottom + window->height <= box->bottom || box->bottom + box->height <= window->bottom) {
+            return QUADTREE_SUCCESS;
+        }
+        covered = (window->left <= box->left && box->left + box->width <= window->left + window->width &&
+                   window->bottom <= box->bottom && box->bottom + box->height <= window->bottom + window->height);
+    }
+    number_of_polygons = lq_quadtree_node_load_at(node, generation, children, &arrays);
+    if (number_of_polygons < 0) {
+        for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+            error_code = lq_quadtree_node_query_rect(children[quadrant], generation, window, covered, query_result);
+            if (error_code != QUADTREE_SUCCESS) {
+                return error_code;
+            }
+        }
+        return QUADTREE_SUCCESS;
+    }
+    COUNT(entries_scanned, number_of_polygons);
+    for (i = 0; i < number_of_polygons; ++i) {
+        if (covered || lq_polygon_intersects_window(&arrays, i, window)) {
+            error_code = lq_quadtree_query_result_append_unique(query_result, arrays.polygons[i]->id);
+            if (error_code != QUADTREE_SUCCESS) {
+                return error_code;
+            }
+        }
+    }
+    return QUADTREE_SUCCESS;
+}
+
+/* offers the polygons of a leaf to the k nearest ids found so far */
+static void lq_node_arrays_query_nearest(lq_node_arrays_t *arrays, int number_of_polygons, int x, int y, int k, double max_distance, quadtree_nearest_result_t *nearest_result) {
+    int i;
+    double limit, distance;
+    COUNT(entries_scanned, number_of_polygons);
+    for (i = 0; i < number_of_polygons; ++i) {
+        limit = lq_nearest_result_limit(nearest_result, k, max_distance);
+        /* polygons that span several leaves are found several times.
+         * Far ones are turned away by their bounding box and near ones
+         * are already part of the result. */
+        if (lq_node_arrays_box_squared_distance(arrays, i, x, y) > limit ||
+            lq_nearest_result_contains(nearest_result, arrays->polygons[i])) {
+            continue;
+        }
+        distance = lq_polygon_squared_distance(arrays->polygons[i], x, y);
+        if (distance <= limit) {
+            lq_nearest_result_insert(nearest_result, k, arrays->polygons[i], distance);
+        }
+    }
+}
+
+/* A lower bound of the squared distance of (x, y) to any polygon stored in
+ * node or below it.  A polygon is only stored in the nodes whose integer
+ * points it collides with, so a thin polygon may reach far beyond all of
+ * them and the node's rectangle is no bound.  The envelope of the node
+ * contains the bounding boxes of its polygons and is one.  DBL_MAX for a
+ * node that never held a polygon. */
+static double lq_quadtree_node_squared_distance_bound(lq_quadtree_node_t *node, int x, int y) {
+    int min_x = __atomic_load_n(&node->envelope_min_x, __ATOMIC_RELAXED);
+    int min_y = __atomic_load_n(&node->envelope_min_y, __ATOMIC_RELAXED);
+    int max_x = __atomic_load_n(&node->envelope_max_x, __ATOMIC_RELAXED);
+    int max_y = __atomic_load_n(&node->envelope_max_y, __ATOMIC_RELAXED);
+    double dx = 0, dy = 0;
+    if (min_x > max_x || min_y > max_y) {
+        return DBL_MAX;
+    }
+    if (x < min_x) {
+        dx = (double) min_x - x;
+    } else if (x > max_x) {
+        dx = (double) x - max_x;
+    }
+    if (y < min_y) {
+        dy = (double) min_y - y;
+    } else if (y > max_y) {
+        dy = (double) y - max_y;
+    }
+    return dx * dx + dy * dy;
+}
+
+/* Answers point queries for a whole batch of points.  The points are
+ * processed in Morton order of their position in the tree so that
+ * consecutive points mostly fall into the same leaf, which then does
+ * not have to be searched for again and whose polygons are still in
+ * cache.  Point i is (xs[i * stride], ys[i * stride]), which lets the
+ * coordinates come from separate arrays or from one interleaved array.
+ * The ids of point i are appended to scratch->hits starting at
+ * starts[i] and there are counts[i] of them.  Points outside of the
+ * tree get no ids and make the function return
+ * QUADTREE_ERROR_OUT_OF_BOUNDS after all other points were answered. */
+static int lq_quadtree_query_points(lq_quadtree_t *quadtree, int number_of_points, int *xs, int *ys, int stride, int *counts, int *starts, lq_batch_scratch_t *scratch) {
+    int number_of_keys;
+    int key_bits = lq_rect_key_bits(&quadtree->root->bounding_box);
+    if (lq_reserve((void**) &scratch->keys, &scratch->keys_capacity,
+                   number_of_points, sizeof(lq_batch_key_t)) != QUADTREE_SUCCESS ||
+        lq_reserve((void**) &scratch->sorted_keys, &scratch->sorted_keys_capacity,
+                   number_of_points, sizeof(lq_batch_key_t)) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    number_of_keys = lq_quadtree_batch_keys(quadtree, key_bits, 0, number_of_points, xs, ys, stride, counts, starts, scratch->keys);
+    lq_batch_keys_sort(&scratch->keys, &scratch->sorted_keys, number_of_keys, key_bits);
+    if (lq_quadtree_query_sorted(quadtree, scratch->keys, number_of_keys, xs, ys, stride, counts, starts, scratch) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    return number_of_keys < number_of_points ? QUADTREE_ERROR_OUT_OF_BOUNDS : QUADTREE_SUCCESS;
+}
+
+/* Stores the Morton keys of the points begin up to end that lie in the
+ * tree in keys and returns how many there are.  The other points get
+ * no ids. */
+static int lq_quadtree_batch_keys(lq_quadtree_t *quadtree, int key_bits, int begin, int end, int *xs, int *ys, int stride, int *counts, int *starts, lq_batch_key_t *keys) {
+    int i;
+    int number_of_keys = 0;
+    lq_rect_t *bounding_box = &quadtree->root->bounding_box;
+    for (i = begin; i < end; ++i) {
+        if (lq_rect_point_is_in_bounds(bounding_box, xs[i * stride], ys[i * stride])) {
+            keys[number_of_keys].key = lq_rect_key(bounding_box, key_bits, xs[i * stride], ys[i * stride]);
+            keys[number_of_keys].index = i;
+            ++number_of_keys;
+        } else {
+            counts[i] = 0;
+            starts[i] = 0;
+        }
+    }
+    return number_of_keys;
+}
+
+/* Answers the queries of the points in the order of the sorted keys
+ * like lq_quadtree_query_points(). */
+static int lq_quadtree_query_sorted(lq_quadtree_t *quadtree, lq_batch_key_t *keys, int number_of_keys, int *xs, int *ys, int stride, int *counts, int *starts, lq_batch_scratch_t *scratch) {
+    int i, j, k, run_end;
+    int number_of_polygons = 0;
+    lq_quadtree_node_t *root = quadtree->root;
+    lq_quadtree_node_t *leaf = NULL;
+    lq_node_arrays_t arrays;
+    for (k = 0; k < number_of_keys; k = run_end) {
+        int x, y;
+        int number_of_hits = scratch->number_of_hits;
+        i = keys[k].index;
+        x = xs[i * stride];
+        y = ys[i * stride];
+        if (leaf == NULL || !lq_rect_point_is_in_bounds(&leaf->bounding_box, x, y)) {
+            leaf = lq_quadtree_node_find_leaf(root, x, y, &arrays, &number_of_polygons);
+        }
+        run_end = k + 1;
+        while (run_end < number_of_keys && run_end - k < MAX_RUN_SIZE &&
+               lq_rect_point_is_in_bounds(&leaf->bounding_box,
+                                          xs[keys[run_end].index * stride],
+                                          ys[keys[run_end].index * stride])) {
+            ++run_end;
+        }
+        if (run_end - k >= MIN_RUN_SIZE && number_of_polygons > 0) {
+            if (lq_quadtree_query_run(&arrays, number_of_polygons, keys + k, run_end - k, xs, ys, stride, counts, starts, scratch) != QUADTREE_SUCCESS) {
+                return QUADTREE_ERROR_OUT_OF_MEMORY;
+            }
+            continue;
+        }
+        run_end = k + 1;
+        if (lq_reserve((void**) &scratch->hits, &scratch->hits_capacity,
+                       number_of_hits + number_of_polygons, sizeof(long)) != QUADTREE_SUCCESS) {
+            return QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+        starts[i] = number_of_hits;
+        COUNT(entries_scanned, number_of_polygons);
+        for (j = 0; j < number_of_polygons; ++j) {
+            if (lq_node_arrays_box_contains(&arrays, j, x, y) &&
+                lq_polygon_contains(arrays.polygons[j], x, y)) {
+                scratch->hits[number_of_hits] = arrays.polygons[j]->id;
+                ++number_of_hits;
+            }
+        }
+        counts[i] = number_of_hits - scratch->number_of_hits;
+        scratch->number_of_hits = number_of_hits;
+    }
+    return QUADTREE_SUCCESS;
+}
+
+/* Queries the number_of_points points of the sorted keys which all lie
+ * in the leaf with the given arrays.
+ * Instead of testing every point against every polygon of the leaf in
+ * turn, every polygon is tested against all points at once which lets
+ * points_in_polygon() work on several points in parallel.  Polygons
+ * whose bounding box misses the bounding box of the points are not
+ * tested at all. */
+static int lq_quadtree_query_run(lq_node_arrays_t *arrays, int number_of_polygons, lq_batch_key_t *keys, int number_of_points, int *xs, int *ys, int stride, int *counts, int *starts, lq_batch_scratch_t *scratch) {
+    int i, k, entry;
+    int number_of_hits = scratch->number_of_hits;
+    int min_x, min_y, max_x, max_y;
+    lq_polygon_t *polygon;
+    lq_edge_index_t *edge_index;
+    unsigned char *inside;
+    if (lq_reserve((void**) &scratch->run_xs, &scratch->run_xs_capacity,
+                   number_of_points, sizeof(int)) != QUADTREE_SUCCESS ||
+        lq_reserve((void**) &scratch->run_ys, &scratch->run_ys_capacity,
+                   number_of_points, sizeof(int)) != QUADTREE_SUCCESS ||
+        lq_reserve((void**) &scratch->inside, &scratch->inside_capacity,
+                   number_of_points * number_of_polygons, sizeof(unsigned char)) != QUADTREE_SUCCESS ||
+        lq_reserve((void**) &scratch->hits, &scratch->hits_capacity,
+                   number_of_hits + number_of_points * number_of_polygons, sizeof(long)) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    min_x = max_x = xs[keys[0].index * stride];
+    min_y = max_y = ys[keys[0].index * stride];
+    for (k = 0; k < number_of_points; ++k) {
+        i = keys[k].index;
+        scratch->run_xs[k] = xs[i * stride];
+        scratch->run_ys[k] = ys[i * stride];
+        min_x = MIN(min_x, xs[i * stride]);
+        min_y = MIN(min_y, ys[i * stride]);
+        max_x = MAX(max_x, xs[i * stride]);
+        max_y = MAX(max_y, ys[i * stride]);
+    }
+    inside = scratch->inside;
+    COUNT(entries_scanned, number_of_polygons);
+    for (entry = 0; entry < number_of_polygons; ++entry) {
+        polygon = arrays->polygons[entry];
+        edge_index = __atomic_load_n(&polygon->edge_index, __ATOMIC_ACQUIRE);
+        if (max_x < arrays->min_xs[entry] || arrays->max_xs[entry] <= min_x ||
+            max_y < arrays->min_ys[entry] || arrays->max_ys[entry] <= min_y) {
+            memset(inside, 0, number_of_points);
+        } else if (edge_index != NULL) {
+            COUNT(point_in_polygon_calls, number_of_points);
+            for (k = 0; k < number_of_points; ++k) {
+                COUNT(edges_tested, lq_edge_index_bucket_size(edge_index, scratch->run_ys[k]));
+                inside[k] = lq_edge_index_contains(edge_index, scratch->run_xs[k], scratch->run_ys[k]);
+            }
+        } else if (polygon->points != NULL) {
+            /* compact corners are decoded edge by edge for every point */
+            for (k = 0; k < number_of_points; ++k) {
+                inside[k] = lq_polygon_contains(polygon, scratch->run_xs[k], scratch->run_ys[k]);
+            }
+        } else {
+            COUNT(point_in_polygon_calls, number_of_points);
+            COUNT(edges_tested, (unsigned long) number_of_points * polygon->number_of_points);
+            points_in_polygon(number_of_points, scratch->run_xs, scratch->run_ys,
+                              polygon->number_of_points, polygon->xs, polygon->ys, inside);
+        }
+        inside += number_of_points;
+    }
+    /* collect the hits point by point in the order of the polygons */
+    for (k = 0; k < number_of_points; ++k) {
+        i = keys[k].index;
+        starts[i] = number_of_hits;
+        inside = scratch->inside + k;
+        for (entry = 0; entry < number_of_polygons; ++entry) {
+            if (inside[entry * number_of_points]) {
+                scratch->hits[number_of_hits] = arrays->polygons[entry]->id;
+                ++number_of_hits;
+            }
+        }
+        counts[i] = number_of_hits - starts[i];
+    }
+    scratch->number_of_hits = number_of_hits;
+    return QUADTREE_SUCCESS;
+}
+
+/* Descends from node to the leaf containing (x, y) and takes its
+ * arrays and number of entries.  The writer may change the tree
+ * meanwhile: a leaf that is split hands its entries down to its new
+ * children, and a node may even be split and collapsed again.  The
+ * arrays are only taken if the leaf still has no child for (x, y) and
+ * its version did not change, otherwise the search goes on from
+ * there.  Retired nodes are never changed and stay valid, so a query
+ * that already descended into one simply finishes in it. */
+static lq_quadtree_node_t* lq_quadtree_node_find_leaf(lq_quadtree_node_t *node, int x, int y, lq_node_arrays_t *arrays, int *number_of_polygons) {
+    int quadrant;
+    unsigned int version;
+    lq_quadtree_node_t *child;
+    assert (node != NULL);
+    for (;;) {
+        COUNT(nodes_visited, 1);
+        quadrant = lq_rect_get_quadrant(&node->bounding_box, x, y);
+        version = __atomic_load_n(&node->version, __ATOMIC_ACQUIRE);
+        child = __atomic_load_n(&node->children[quadrant], __ATOMIC_ACQUIRE);
+        if (child == NULL) {
+            *number_of_polygons = lq_quadtree_node_load_arrays(node, arrays);
+            child = __atomic_load_n(&node->children[quadrant], __ATOMIC_ACQUIRE);
+            if (child == NULL && __atomic_load_n(&node->version, __ATOMIC_ACQUIRE) == version) {
+                return node;
+            }
+        }
+        if (child != NULL) {
+            node = child;
+        }
+    }
+}
+
+/* Takes the children of node and returns -1 if it has any.  Otherwise
+ * takes its arrays and returns the number of its entries, checked like
+ * lq_quadtree_node_find_leaf() does.  A split publishes the first
+ * child last and a collapse withdraws it first, so a node with a first
+ * child has all four unless it is being collapsed right now. */
+static int lq_quadtree_node_load(lq_quadtree_node_t *node, lq_quadtree_node_t **children, lq_node_arrays_t *arrays) {
+    int quadrant, number_of_polygons;
+    unsigned int version;
+    for (;;) {
+        version = __atomic_load_n(&node->version, __ATOMIC_ACQUIRE);
+        children[FIRST_QUADRANT] = __atomic_load_n(&node->children[FIRST_QUADRANT], __ATOMIC_ACQUIRE);
+        if (children[FIRST_QUADRANT] != NULL) {
+            for (quadrant = FIRST_QUADRANT + 1; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+                children[quadrant] = __atomic_load_n(&node->children[quadrant], __ATOMIC_ACQUIRE);
+                if (children[quadrant] == NULL) {
+                    break;
+                }
+            }
+            if (quadrant == NUMBER_OF_QUADRANTS) {
+                return -1;
+            }
+        } else {
+            number_of_polygons = lq_quadtree_node_load_arrays(node, arrays);
+            if (__atomic_load_n(&node->children[FIRST_QUADRANT], __ATOMIC_ACQUIRE) == NULL &&
+                __atomic_load_n(&node->version, __ATOMIC_ACQUIRE) == version) {
+                return number_of_polygons;
+            }
+        }
+    }
+}
+
+/* Like lq_quadtree_node_load() but for the node as the snapshots of
+ * generation see it, which is the oldest record of its history that
+ * is not older than them.  Without one the snapshots see the node as
+ * it is now, unless the writer changes it meanwhile, which it always
+ * records first.  A generation of 0 stands for the live tree. */
+static int lq_quadtree_node_load_at(lq_quadtree_node_t *node, unsigned long generation, lq_quadtree_node_t **children, lq_node_arrays_t *arrays) {
+    int quadrant, number_of_polygons;
+    lq_node_history_t *head, *record, *found;
+    if (generation == 0) {
+        return lq_quadtree_node_load(node, children, arrays);
+    }
+    for (;;) {
+        head = __atomic_load_n(&node->history, __ATOMIC_ACQUIRE);
+        found = NULL;
+        for (record = head; record != NULL && record->generation >= generation;
+             record = __atomic_load_n(&record->next, __ATOMIC_ACQUIRE)) {
+            found = record;
+        }
+        if (found != NULL) {
+            if (found->children[FIRST_QUADRANT] != NULL) {
+                for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+                    children[quadrant] = found->children[quadrant];
+                }
+                return -1;
+            }
+            if (found->entries == NULL) {
+                memset(arrays, 0, sizeof(lq_node_arrays_t));
+                return 0;
+            }
+            *arrays = lq_node_arrays_at(found->entries, NODE_HEADER(found->entries)->capacity);
+            return found->number_of_polygons;
+        }
+        number_of_polygons = lq_quadtree_node_load(node, children, arrays);
+        if (__atomic_load_n(&node->history, __ATOMIC_ACQUIRE) == head) {
+            return number_of_polygons;
+        }
+    }
+}
+
+/* lq_quadtree_node_find_leaf() for the snapshots of generation */
+static lq_quadtree_node_t* lq_quadtree_node_find_leaf_at(lq_quadtree_node_t *node, unsigned long generation, int x, int y, lq_node_arrays_t *arrays, int *number_of_polygons) {
+    lq_quadtree_node_t *children[NUMBER_OF_QUADRANTS];
+    if (generation == 0) {
+        return lq_quadtree_node_find_leaf(node, x, y, arrays, number_of_polygons);
+    }
+    for (;;) {
+        COUNT(nodes_visited, 1);
+        *number_of_polygons = lq_quadtree_node_load_at(node, generation, children, arrays);
+        if (*number_of_polygons >= 0) {
+            return node;
+        }
+        node = children[lq_rect_get_quadrant(&node->bounding_box, x, y)];
+    }
+}
+
+/* places the polygon into the tree starting at the root whose
+ * entering edges are found among all edges of the polygon */
+static int lq_quadtree_put_polygon(lq_quadtree_t *quadtree, lq_polygon_t *polygon) {
+    int i, classification;
+    int number_of_entering = 0;
+    int error_code;
+    int n = polygon->number_of_points;
+    lq_edge_stack_t *stack = &quadtree->edge_stack;
+    lq_rect_t *rect = &quadtree->root->bounding_box;
+    if (lq_edge_stack_reserve(stack, 2 * n) != 0) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < n; ++i) {
+        stack->edges[i] = i;
+    }
+    if (polygon->max_x <= rect->left || rect->left + rect->width <= polygon->min_x ||
+        polygon->max_y <= rect->bottom || rect->bottom + rect->height <= polygon->min_y) {
+        classification = RECTANGLE_OUTSIDE;
+    } else {
+        classification = lq_polygon_classify_edges(polygon, n, stack->edges, stack->edges + n,
+                                                   &number_of_entering, rect);
+    }
+    stack->size = n + number_of_entering;
+    error_code = lq_quadtree_node_put_polygon(quadtree, quadtree->root, polygon, classification, n, number_of_entering);
+    stack->size = 0;
+    return error_code;
+}
+
+/* classification is how the polygon covers the node.  The
+ * number_of_edges edges at first_edge of the edge stack are the ones
+ * that enter the node; the children are classified against them only. */
+static int lq_quadtree_node_put_polygon(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, lq_polygon_t *polygon,
+                                        int classification, int first_edge, int number_of_edges) {
+    int quadrant;
+    int child_classification;
+    int number_of_entering;
+    int error_code = QUADTREE_SUCCESS;
+    lq_edge_stack_t *stack = &quadtree->edge_stack;
+    lq_polygon_node_t *entry;
+    COUNT(nodes_visited, 1);
+    if (classification == RECTANGLE_OUTSIDE) {
+        LOG_DEBUG("bail %d %d %d %d %d\n", node->bounding_box.left, node->bounding_box.bottom, node->bounding_box.width, node->bounding_box.height, node->depth);
+    } else if (lq_quadtree_node_is_at_limit(&quadtree->config, node) ||
+               (node->children[FIRST_QUADRANT] == NULL &&
+                (classification == RECTANGLE_COVERED ||
+                 lq_quadtree_node_has_room(&quadtree->config, node, polygon)))) {
+        LOG_DEBUG("put %d %d %d %d %d %d\n", node->bounding_box.left, node->bounding_box.bottom, node->bounding_box.width, node->bounding_box.height, node->depth, node->number_of_polygons);
+        /* an updated polygon keeps the entry of its old shape */
+        entry = polygon->updating ? lq_quadtree_node_find_entry(node, polygon) : NULL;
+        if (entry != NULL) {
+            entry->stale = false;
+        } else {
+            entry = lq_polygon_node_create(quadtree, node, polygon);
+        }
+        if (entry != NULL) {
+            entry->covered = classification == RECTANGLE_COVERED;
+        } else {
+            error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+    } else {
+        LOG_DEBUG("desend %d %d %d %d %d\n", node->bounding_box.left, node->bounding_box.bottom, node->bounding_box.width, node->bounding_box.height, node->depth);
+        error_code = lq_quadtree_node_populate_children(quadtree, node);
+        if (error_code == QUADTREE_SUCCESS && lq_edge_stack_reserve(stack, stack->size + number_of_edges) != 0) {
+            error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+        if (error_code == QUADTREE_SUCCESS) {
+            for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+                lq_rect_t *rect = &node->children[quadrant]->bounding_box;
+                number_of_entering = 0;
+                if (classification == RECTANGLE_COVERED) {
+                    child_classification = RECTANGLE_COVERED;
+                } else if (polygon->max_x <= rect->left || rect->left + rect->width <= polygon->min_x ||
+                           polygon->max_y <= rect->bottom || rect->bottom + rect->height <= polygon->min_y) {
+                    child_classification = RECTANGLE_OUTSIDE;
+                } else {
+                    /* the edges entering the child are pushed on top of
+                     * those of the node */
+                    child_classification = lq_polygon_classify_edges(polygon, number_of_edges, stack->edges + first_edge,
+                                                                     stack->edges + stack->size, &number_of_entering,
+                                                                     rect);
+                }
+                stack->size += number_of_entering;
+                error_code = lq_quadtree_node_put_polygon(quadtree, node->children[quadrant], polygon, child_classification,
+                                                          stack->size - number_of_entering, number_of_entering);
+                stack->size -= number_of_entering;
+                if (error_code != QUADTREE_SUCCESS) {
+                    break;
+                }
+            }
+        }
+    }
+    return error_code;
+}
+
+/* collapses the subtrees of node bottom-up, see
+ * lq_quadtree_node_collapse() */
+static void lq_quadtree_node_compact(lq_quadtree_t *quadtree, lq_quadtree_node_t *node) {
+    int quadrant;
+    if (node->children[FIRST_QUADRANT] == NULL) {
+        return;
+    }
+    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+        lq_quadtree_node_compact(quadtree, node->children[quadrant]);
+    }
+    lq_quadtree_node_collapse(quadtree, node);
+}
+
+/* Shrinks the envelopes of node and of the nodes below it to the
+ * bounding boxes of the polygons they hold now.  Every side only moves
+ * inwards and stays outside of the polygons still held, so queries
+ * running meanwhile see envelopes that contain those. */
+static void lq_quadtree_node_reset_envelope(lq_quadtree_node_t *node) {
+    int i, quadrant;
+    int min_x = INT_MAX, min_y = INT_MAX, max_x = INT_MIN, max_y = INT_MIN;
+    lq_quadtree_node_t *child;
+    lq_node_arrays_t arrays;
+    if (node->children[FIRST_QUADRANT] != NULL) {
+        for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+            child = node->children[quadrant];
+            lq_quadtree_node_reset_envelope(child);
+            min_x = MIN(min_x, child->envelope_min_x);
+            min_y = MIN(min_y, child->envelope_min_y);
+            max_x = MAX(max_x, child->envelope_max_x);
+            max_y = MAX(max_y, child->envelope_max_y);
+        }
+    } else if (node->number_of_polygons > 0) {
+        arrays = lq_quadtree_node_arrays(node);
+        for (i = 0; i < node->number_of_polygons; ++i) {
+            min_x = MIN(min_x, arrays.min_xs[i]);
+            min_y = MIN(min_y, arrays.min_ys[i]);
+            max_x = MAX(max_x, arrays.max_xs[i]);
+            max_y = MAX(max_y, arrays.max_ys[i]);
+        }
+    }
+    __atomic_store_n(&node->envelope_min_x, min_x, __ATOMIC_RELAXED);
+    __atomic_store_n(&node->envelope_min_y, min_y, __ATOMIC_RELAXED);
+    __atomic_store_n(&node->envelope_max_x, max_x, __ATOMIC_RELAXED);
+    __atomic_store_n(&node->envelope_max_y, max_y, __ATOMIC_RELAXED);
+}
+
+/* adds the nodes, leaves and entries of the subtree of node to stats */
+static void lq_quadtree_node_get_stats(lq_quadtree_node_t *node, quadtree_stats_t *stats) {
+    int quadrant, bucket = 0;
+    stats->number_of_nodes++;
+    stats->nodes_per_depth[MIN(node->depth, QUADTREE_STATS_BUCKETS - 1)]++;
+    if (node->entries != NULL) {
+        stats->leaf_array_bytes += sizeof(lq_node_header_t) + (long) node->entries_capacity *
+            (sizeof(lq_polygon_node_t*) + sizeof(lq_polygon_t*) + 4 * sizeof(int));
+    }
+    stats->number_of_entries += node->number_of_polygons;
+    if (node->children[FIRST_QUADRANT] != NULL) {
+        for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+            lq_quadtree_node_get_stats(node->children[quadrant], stats);
+        }
+        return;
+    }
+    stats->number_of_leaves++;
+    stats->max_depth = MAX(stats->max_depth, node->depth);
+    stats->max_leaf_polygons = MAX(stats->max_leaf_polygons, node->number_of_polygons);
+    while (bucket < QUADTREE_STATS_BUCKETS - 1 && (node->number_of_polygons >> bucket) > 0) {
+        bucket++;
+    }
+    stats->leaves_per_size[bucket]++;
+}
+
+/* Collapses node and then its ancestors for as long as all their
+ * children are empty leaves.  Called with the parent of a node that
+ * just lost an entry since only its children can have become empty.
+ * Children that still hold the same polygons are left to
+ * quadtree_compact(): a polygon removed and added back nearby would
+ * split them again right away. */
+static void lq_quadtree_node_collapse_upwards(lq_quadtree_t *quadtree, lq_quadtree_node_t *node) {
+    while (node != NULL && lq_quadtree_node_has_empty_children(node) && lq_quadtree_node_collapse(quadtree, node)) {
+        node = node->parent;
+    }
+}
+
+/* whether node has children and all of them are leaves without
+ * polygons */
+static bool lq_quadtree_node_has_empty_children(lq_quadtree_node_t *node) {
     int quadrant;
-    int rx = node->bounding_box->left;
-    int ry = node->bounding_box->bottom;
-    int half_width = node->bounding_box->width / 2;
-    int half_height = node->bounding_box->height / 2;
-    int new_rx, new_ry;
-    int new_width = half_width;
-    int new_height = half_height;
+    lq_quadtree_node_t *child;
+    if (node->children[FIRST_QUADRANT] == NULL) {
+        return false;
+    }
+    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+        child = node->children[quadrant];
+        if (child->children[FIRST_QUADRANT] != NULL || child->number_of_polygons > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Merges the four children of node back into it if all of them are
+ * leaves holding the same polygons, which includes holding none at
+ * all.  Such a polygon is not outside of any child so the merged node
+ * does not hold it needlessly, and splitting the node again
+ * reproduces the children.  The node takes over the arrays of its
+ * first child so that merging does not allocate, unless queries may
+ * still be reading them; then it gets a copy.  Returns whether node is
+ * a leaf afterwards. */
+static bool lq_quadtree_node_collapse(lq_quadtree_t *quadtree, lq_quadtree_node_t *node) {
+    int i, quadrant;
+    int number_of_partial = 0;
+    long number_of_points = 0;
+    bool covered;
+    lq_quadtree_node_t *first = node->children[FIRST_QUADRANT];
+    lq_quadtree_node_t *children[NUMBER_OF_QUADRANTS];
+    lq_polygon_node_t *entry;
+    lq_polygon_node_t **entries;
+    lq_node_arrays_t arrays;
+    if (first == NULL) {
+        return true;
+    }
+    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+        lq_quadtree_node_t *child = node->children[quadrant];
+        if (child->children[FIRST_QUADRANT] != NULL || child->number_of_polygons != first->number_of_polygons) {
+            return false;
+        }
+    }
+    /* a node holds at most one entry per polygon.  A polygon only
+     * covers node if it covers all children. */
+    arrays = lq_quadtree_node_arrays(first);
+    for (i = 0; i < first->number_of_polygons; ++i) {
+        covered = first->entries[i]->covered;
+        for (quadrant = FIRST_QUADRANT + 1; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+            entry = lq_quadtree_node_find_entry(node->children[quadrant], arrays.polygons[i]);
+            if (entry == NULL) {
+                return false;
+            }
+            covered = covered && entry->covered;
+        }
+        if (!covered) {
+            number_of_partial++;
+            number_of_points += arrays.polygons[i]->number_of_points;
+        }
+    }
+    /* children that cannot be split any further may pass their
+     * partially covering polygons on regardless of the limits */
+    if (!lq_quadtree_node_is_at_limit(&quadtree->config, first) &&
+        !lq_config_leaf_fits(&quadtree->config, number_of_partial, number_of_points)) {
+        return false;
+    }
+    entries = first->entries;
+    if (lq_quadtree_is_shared(quadtree) && first->number_of_polygons > 0) {
+        entries = lq_node_arrays_copy(first->entries, first->number_of_polygons, first->entries_capacity);
+        if (entries == NULL) {
+            return false;
+        }
+    } else if (lq_quadtree_is_shared(quadtree)) {
+        entries = NULL;
+    }
+    lq_quadtree_node_preserve(quadtree, node);
+    if (number_of_partial > 0) {
+        for (i = 0; i < first->number_of_polygons; ++i) {
+            for (quadrant = FIRST_QUADRANT + 1; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+                entry = lq_quadtree_node_find_entry(node->children[quadrant], arrays.polygons[i]);
+                first->entries[i]->covered = first->entries[i]->covered && entry->covered;
+            }
+        }
+    }
+    LOG_DEBUG("collapse %d %d %d %d %d\n", node->bounding_box.left, node->bounding_box.bottom, node->bounding_box.width, node->bounding_box.height, node->depth);
+    node->entries_capacity = entries != NULL ? first->entries_capacity : 0;
+    node->number_of_polygons = first->number_of_polygons;
+    for (i = 0; i < node->number_of_polygons; ++i) {
+        entries[i]->owner = node;
+    }
+    if (entries == first->entries) {
+        __atomic_store_n(&first->entries, NULL, __ATOMIC_RELAXED);
+        first->entries_capacity = 0;
+    }
+    first->number_of_polygons = 0;
+    /* the arrays are in place before queries find node to be a leaf.
+     * The first child goes first, see lq_quadtree_node_load(). */
+    __atomic_store_n(&node->entries, entries, __ATOMIC_RELEASE);
+    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+        children[quadrant] = node->children[quadrant];
+        __atomic_store_n(&node->children[quadrant], NULL, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&node->version, node->version + 1, __ATOMIC_RELEASE);
+    /* the entries of the other children only drop their references */
+    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+        lq_quadtree_node_free(quadtree, children[quadrant]);
+    }
+    return true;
+}
+
+/* makes room for size edges on the stack */
+static int lq_edge_stack_reserve(lq_edge_stack_t *stack, int size) {
+    int capacity = stack->capacity < 64 ? 64 : stack->capacity;
+    int *edges;
+    if (size <= stack->capacity) {
+        return 0;
+    }
+    while (capacity < size) {
+        capacity *= 2;
+    }
+    COUNT(allocations, 1);
+    edges = (int*) realloc(stack->edges, capacity * sizeof(int));
+    if (edges == NULL) {
+        return -1;
+    }
+    stack->edges = edges;
+    stack->capacity = capacity;
+    return 0;
+}
+
+static int lq_quadtree_node_populate_children(lq_quadtree_t *quadtree, lq_quadtree_node_t *node) {
+    int i, quadrant;
     int error_code;
+    lq_quadtree_node_t *children[NUMBER_OF_QUADRANTS] = { NULL, NULL, NULL, NULL };
+    lq_polygon_node_t *entry;
     if (node->children[FIRST_QUADRANT] != NULL) {
         return QUADTREE_SUCCESS;
     }
     for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
-        lq_quadtree_node_t *new_node = lq_quadtree_node_allocate();
-        if (new_node == NULL) {
+        children[quadrant] = lq_quadtree_node_allocate(quadtree);
+        if (children[quadrant] == NULL) {
             error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
             goto error;
         }
-        switch (quadrant) {
-        case FIRST_QUADRANT:
-            new_rx = rx + half_width;
-            new_ry = ry + half_height;
-            break;
-        case SECOND_QUADRANT:
-            new_rx = rx;
-            new_ry = ry + half_height;
-            break;
-        case THIRD_QUADRANT:
-            new_rx = rx;
-            new_ry = ry;
-            break;
-        case FOURTH_QUADRANT:
-            new_rx = rx + half_width;
-            new_ry = ry;
-            break;
-        default:
-            error_code = QUADTREE_ERROR;
-            goto error;
+        error_code = lq_quadtree_node_initialize_child(node, quadrant, children[quadrant]);
+        if (error_code == QUADTREE_SUCCESS) {
+            error_code = lq_quadtree_node_add_polygons(quadtree, children[quadrant], node);
         }
-
-        lq_quadtree_node_initialize(new_node, new_rx, new_ry, new_width, new_height, node->depth + 1);
-        error_code = lq_quadtree_node_add_polygons(new_node, node->polygons);
-        node->children[quadrant] = new_node;
         if (error_code != QUADTREE_SUCCESS) {
             goto error;
         }
     }
-    lq_quadtree_node_clear_polygons(node);
+    /* queries only find the children once they are complete.  The
+     * first child goes last, see lq_quadtree_node_load(). */
+    lq_quadtree_node_preserve(quadtree, node);
+    for (quadrant = FOURTH_QUADRANT; quadrant >= FIRST_QUADRANT; --quadrant) {
+        __atomic_store_n(&node->children[quadrant], children[quadrant], __ATOMIC_RELEASE);
+    }
+    /* A polygon that only touches node is outside of all children.
+     * If node holds its last entry it must not be found by its id once
+     * the entry is gone. */
+    for (i = 0; i < node->number_of_polygons; ++i) {
+        entry = node->entries[i];
+        if (entry->next_sibling == NULL && entry->previous_sibling == NULL) {
+            lq_quadtree_forget_polygon(quadtree, entry->p);
+        }
+    }
+    lq_quadtree_node_clear_polygons(quadtree, node);
+    __atomic_store_n(&node->version, node->version + 1, __ATOMIC_RELEASE);
     return QUADTREE_SUCCESS;
 
 error:
     for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
-        lq_quadtree_node_free(node->children[quadrant]);
-        node->children[quadrant] = NULL;
+        lq_quadtree_node_free(quadtree, children[quadrant]);
+    }
+    return error_code;
+}
+
+static int lq_quadtree_node_initialize_child(lq_quadtree_node_t *node, int quadrant, lq_quadtree_node_t *child) {
+    /* TODO: make sure we divide the space up correctly in case the size is not a power of 2. */
+    int rx = node->bounding_box.left;
+    int ry = node->bounding_box.bottom;
+    int half_width = node->bounding_box.width / 2;
+    int half_height = node->bounding_box.height / 2;
+    int new_rx, new_ry;
+    switch (quadrant) {
+    case FIRST_QUADRANT:
+        new_rx = rx + half_width;
+        new_ry = ry + half_height;
+        break;
+    case SECOND_QUADRANT:
+        new_rx = rx;
+        new_ry = ry + half_height;
+        break;
+    case THIRD_QUADRANT:
+        new_rx = rx;
+        new_ry = ry;
+        break;
+    case FOURTH_QUADRANT:
+        new_rx = rx + half_width;
+        new_ry = ry;
+        break;
+    default:
+        return QUADTREE_ERROR;
+    }
+    lq_quadtree_node_initialize(child, new_rx, new_ry, half_width, half_height, node->depth + 1);
+    child->parent = node;
+    return QUADTREE_SUCCESS;
+}
+
+/* Adds an entry to node for every polygon of its parent source that
+ * is not outside of it.  Polygons covering source cover node, too.
+ * Stale entries are copied as they are since quadtree_update() decides
+ * about them. */
+static int lq_quadtree_node_add_polygons(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, lq_quadtree_node_t *source) {
+    int i;
+    int classification;
+    lq_polygon_node_t *entry, *source_entry;
+    lq_node_arrays_t arrays = lq_quadtree_node_arrays(source);
+    if (lq_quadtree_node_reserve(quadtree, node, source->number_of_polygons) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < source->number_of_polygons; ++i) {
+        source_entry = source->entries[i];
+        classification = RECTANGLE_COVERED;
+        if (!source_entry->covered && !source_entry->stale) {
+            classification = lq_polygon_classify(arrays.polygons[i], &node->bounding_box);
+            if (classification == RECTANGLE_OUTSIDE) {
+                continue;
+            }
+        }
+        entry = lq_polygon_node_create(quadtree, node, arrays.polygons[i]);
+        if (entry == NULL) {
+            lq_quadtree_node_clear_polygons(quadtree, node);
+            return QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+        entry->covered = classification == RECTANGLE_COVERED;
+        entry->stale = source_entry->stale;
+    }
+    return QUADTREE_SUCCESS;
+}
+
+static lq_polygon_node_t* lq_quadtree_node_find_entry(lq_quadtree_node_t *node, lq_polygon_t *polygon) {
+    int i;
+    lq_node_arrays_t arrays = lq_quadtree_node_arrays(node);
+    for (i = 0; i < node->number_of_polygons; ++i) {
+        if (arrays.polygons[i] == polygon) {
+            return node->entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Makes room for number_of_polygons entries in the arrays of node.
+ * Growing them publishes a complete copy, see lq_node_arrays_copy(). */
+static int lq_quadtree_node_reserve(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, int number_of_polygons) {
+    int capacity = node->entries_capacity;
+    lq_polygon_node_t **entries, **old_entries;
+    if (number_of_polygons <= capacity) {
+        return QUADTREE_SUCCESS;
+    }
+    if (capacity < 4) {
+        capacity = 4;
+    }
+    while (capacity < number_of_polygons) {
+        capacity *= 2;
+    }
+    entries = lq_node_arrays_copy(node->entries, node->number_of_polygons, capacity);
+    if (entries == NULL) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    lq_quadtree_node_preserve(quadtree, node);
+    old_entries = node->entries;
+    node->entries_capacity = capacity;
+    __atomic_store_n(&node->entries, entries, __ATOMIC_RELEASE);
+    if (old_entries != NULL) {
+        lq_quadtree_retire(quadtree, NODE_HEADER(old_entries), lq_retired_arrays_free);
+    }
+    return QUADTREE_SUCCESS;
+}
+
+static int lq_quadtree_node_add_polygon(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, lq_polygon_node_t *polygon) {
+    int index = node->number_of_polygons;
+    lq_node_arrays_t arrays;
+    assertTrue("poly already has an owner\n", polygon->owner == NULL);
+    if (lq_quadtree_node_reserve(quadtree, node, index + 1) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    lq_quadtree_node_extend_envelope(node, polygon->p);
+    arrays = lq_quadtree_node_arrays(node);
+    node->entries[index] = polygon;
+    arrays.polygons[index] = polygon->p;
+    arrays.min_xs[index] = polygon->p->min_x;
+    arrays.min_ys[index] = polygon->p->min_y;
+    arrays.max_xs[index] = polygon->p->max_x;
+    arrays.max_ys[index] = polygon->p->max_y;
+    polygon->index = index;
+    polygon->owner = node;
+    lq_quadtree_node_preserve(quadtree, node);
+    node->number_of_polygons++;
+    /* queries take the entry once they see it counted */
+    __atomic_store_n(&NODE_HEADER(node->entries)->number_of_polygons, node->number_of_polygons, __ATOMIC_RELEASE);
+    LOG_DEBUG("added polygon to node (%d %d %d %d). now has %d polygons\n", node->bounding_box.left, node->bounding_box.bottom, node->bounding_box.width, node->bounding_box.height, node->number_of_polygons);
+    return QUADTREE_SUCCESS;
+}
+
+/* Grows the envelopes of node and of its ancestors until they contain
+ * the bounding box of polygon.  The envelope of a node contains those
+ * of its children, so the walk ends at the first node that already
+ * contains the box.  Envelopes never shrink here, which costs nearest
+ * queries some pruning after removals and updates but lets queries and
+ * snapshots read them at any time: whatever mix of old and new sides a
+ * query sees contains everything the node held when the query started.
+ * quadtree_compact() shrinks them again, see
+ * lq_quadtree_node_reset_envelope(). */
+static void lq_quadtree_node_extend_envelope(lq_quadtree_node_t *node, lq_polygon_t *polygon) {
+    for (; node != NULL; node = node->parent) {
+        if (node->envelope_min_x <= polygon->min_x && node->envelope_min_y <= polygon->min_y &&
+            polygon->max_x <= node->envelope_max_x && polygon->max_y <= node->envelope_max_y) {
+            break;
+        }
+        __atomic_store_n(&node->envelope_min_x, MIN(node->envelope_min_x, polygon->min_x), __ATOMIC_RELAXED);
+        __atomic_store_n(&node->envelope_min_y, MIN(node->envelope_min_y, polygon->min_y), __ATOMIC_RELAXED);
+        __atomic_store_n(&node->envelope_max_x, MAX(node->envelope_max_x, polygon->max_x), __ATOMIC_RELAXED);
+        __atomic_store_n(&node->envelope_max_y, MAX(node->envelope_max_y, polygon->max_y), __ATOMIC_RELAXED);
+    }
+}
+
+/* The last entry of node takes the place of polygon.  Queries may be
+ * reading the arrays, so with concurrent readers or snapshots the
+ * change is made to a copy that then replaces them.  Without memory
+ * for the copy the writer waits until no query can be reading them,
+ * see lq_epoch_synchronize(), and changes them in place.  Queries of
+ * snapshots are not waited for, so the snapshots are marked broken. */
+static void lq_quadtree_node_unlink_polygon(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, lq_polygon_node_t *polygon) {
+    int index = polygon->index;
+    int last = node->number_of_polygons - 1;
+    lq_polygon_node_t **entries = node->entries;
+    lq_polygon_node_t **old_entries = node->entries;
+    lq_node_arrays_t arrays;
+    if (lq_quadtree_is_shared(quadtree)) {
+        entries = lq_node_arrays_copy(old_entries, node->number_of_polygons, node->entries_capacity);
+        if (entries == NULL) {
+            entries = old_entries;
+            lq_quadtree_snapshots_break(quadtree);
+            lq_epoch_synchronize();
+        }
+    }
+    lq_quadtree_node_preserve(quadtree, node);
+    arrays = lq_node_arrays_at(entries, node->entries_capacity);
+    if (index != last) {
+        entries[index] = entries[last];
+        arrays.polygons[index] = arrays.polygons[last];
+        arrays.min_xs[index] = arrays.min_xs[last];
+        arrays.min_ys[index] = arrays.min_ys[last];
+        arrays.max_xs[index] = arrays.max_xs[last];
+        arrays.max_ys[index] = arrays.max_ys[last];
+        entries[index]->index = index;
+    }
+    polygon->owner = NULL;
+    node->number_of_polygons--;
+    __atomic_store_n(&NODE_HEADER(entries)->number_of_polygons, node->number_of_polygons, __ATOMIC_RELEASE);
+    if (entries != old_entries) {
+        __atomic_store_n(&node->entries, entries, __ATOMIC_RELEASE);
+        lq_quadtree_retire(quadtree, NODE_HEADER(old_entries), lq_retired_arrays_free);
+    }
+}
+
+static lq_node_arrays_t lq_quadtree_node_arrays(lq_quadtree_node_t *node) {
+    return lq_node_arrays_at(node->entries, node->entries_capacity);
+}
+
+/* the arrays following entries, which has room for capacity entries */
+static lq_node_arrays_t lq_node_arrays_at(lq_polygon_node_t **entries, int capacity) {
+    lq_node_arrays_t arrays;
+    arrays.polygons = (lq_polygon_t**) (entries + capacity);
+    arrays.min_xs = (int*) (arrays.polygons + capacity);
+    arrays.min_ys = arrays.min_xs + capacity;
+    arrays.max_xs = arrays.min_ys + capacity;
+    arrays.max_ys = arrays.max_xs + capacity;
+    return arrays;
+}
+
+/* Takes the arrays of node for a query and returns the number of its
+ * entries.  Both come from the header of the arrays so that they
+ * always belong together, even if the writer replaces the arrays. */
+static int lq_quadtree_node_load_arrays(lq_quadtree_node_t *node, lq_node_arrays_t *arrays) {
+    lq_polygon_node_t **entries = __atomic_load_n(&node->entries, __ATOMIC_ACQUIRE);
+    if (entries == NULL) {
+        memset(arrays, 0, sizeof(lq_node_arrays_t));
+        return 0;
+    }
+    *arrays = lq_node_arrays_at(entries, NODE_HEADER(entries)->capacity);
+    return __atomic_load_n(&NODE_HEADER(entries)->number_of_polygons, __ATOMIC_ACQUIRE);
+}
+
+/* Allocates the arrays for capacity entries together with their
+ * header and copies the first number_of_polygons entries of source
+ * into them.  The arrays are only published once they are complete,
+ * so queries never see them change except for entries being added
+ * behind the ones they counted. */
+static lq_polygon_node_t** lq_node_arrays_copy(lq_polygon_node_t **source, int number_of_polygons, int capacity) {
+    lq_node_header_t *header;
+    lq_polygon_node_t **entries;
+    lq_node_arrays_t arrays, source_arrays;
+    COUNT(allocations, 1);
+    header = (lq_node_header_t*) malloc(sizeof(lq_node_header_t) + capacity * (sizeof(lq_polygon_node_t*) +
+                                                                            sizeof(lq_polygon_t*) + 4 * sizeof(int)));
+    if (header == NULL) {
+        return NULL;
+    }
+    header->number_of_polygons = number_of_polygons;
+    header->capacity = capacity;
+    entries = (lq_polygon_node_t**) (header + 1);
+    if (number_of_polygons > 0) {
+        arrays = lq_node_arrays_at(entries, capacity);
+        source_arrays = lq_node_arrays_at(source, NODE_HEADER(source)->capacity);
+        memcpy(entries, source, number_of_polygons * sizeof(lq_polygon_node_t*));
+        memcpy(arrays.polygons, source_arrays.polygons, number_of_polygons * sizeof(lq_polygon_t*));
+        memcpy(arrays.min_xs, source_arrays.min_xs, number_of_polygons * sizeof(int));
+        memcpy(arrays.min_ys, source_arrays.min_ys, number_of_polygons * sizeof(int));
+        memcpy(arrays.max_xs, source_arrays.max_xs, number_of_polygons * sizeof(int));
+        memcpy(arrays.max_ys, source_arrays.max_ys, number_of_polygons * sizeof(int));
+    }
+    return entries;
+}
+
+/* whether node is too deep or too small to be split */
+static bool lq_quadtree_node_is_at_limit(const quadtree_config_t *config, lq_quadtree_node_t *node) {
+    return node->depth >= config->max_depth || node->bounding_box.width <= config->min_size ||
+           node->bounding_box.height <= config->min_size;
+}
+
+/* whether the leaf node may hold polygon, which only partially covers
+ * it, without being split.  An entry polygon already has in node is
+ * not counted twice. */
+static bool lq_quadtree_node_has_room(const quadtree_config_t *config, lq_quadtree_node_t *node, lq_polygon_t *polygon) {
+    int i;
+    int number_of_partial = 1;
+    long number_of_points = polygon->number_of_points;
+    lq_node_arrays_t arrays;
+    if (config->max_leaf_entries == 0) {
+        return false;
+    }
+    arrays = lq_quadtree_node_arrays(node);
+    for (i = 0; i < node->number_of_polygons; ++i) {
+        if (!node->entries[i]->covered && arrays.polygons[i] != polygon) {
+            number_of_partial++;
+            number_of_points += arrays.polygons[i]->number_of_points;
+        }
+    }
+    return lq_config_leaf_fits(config, number_of_partial, number_of_points);
+}
+
+/* whether a leaf may hold number_of_partial partially covering
+ * polygons with number_of_points corners in total */
+static bool lq_config_leaf_fits(const quadtree_config_t *config, int number_of_partial, long number_of_points) {
+    return number_of_partial <= config->max_leaf_entries &&
+           (config->max_leaf_points == 0 || number_of_points <= config->max_leaf_points);
+}
+
+static bool lq_node_arrays_box_contains(lq_node_arrays_t *arrays, int index, int x, int y) {
+    return arrays->min_xs[index] <= x && x < arrays->max_xs[index] &&
+           arrays->min_ys[index] <= y && y < arrays->max_ys[index];
+}
+
+
+/* creates a new entry for polygon and adds it to node */
+static lq_polygon_node_t* lq_polygon_node_create(lq_quadtree_t *quadtree, lq_quadtree_node_t *node, lq_polygon_t *polygon) {
+    lq_polygon_node_t *entry = (lq_polygon_node_t*) lq_pool_allocate(&quadtree->polygon_node_pool);
+    COUNT(allocations, 1);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->p = polygon;
+    if (lq_quadtree_node_add_polygon(quadtree, node, entry) != QUADTREE_SUCCESS) {
+        lq_pool_free(&quadtree->polygon_node_pool, entry);
+        return NULL;
+    }
+    polygon->ref_count++;
+    entry->next_sibling = polygon->entries;
+    if (polygon->entries != NULL) {
+        polygon->entries->previous_sibling = entry;
+    }
+    polygon->entries = entry;
+    return entry;
+}
+
+/* removes the entry from its node, unless the node drops all of its
+ * entries at once, and drops its reference on the polygon */
+static void lq_polygon_node_free(lq_quadtree_t *quadtree, lq_polygon_node_t *polygon) {
+    lq_polygon_t *p;
+    if (polygon == NULL) {
+        return;
+    }
+    p = polygon->p;
+    if (polygon->owner != NULL) {
+        LOG_DEBUG("removing polygon %ld from (%d %d %d %d)\n", polygon->p->id,
+                  polygon->owner->bounding_box.left, polygon->owner->bounding_box.bottom,
+                  polygon->owner->bounding_box.width, polygon->owner->bounding_box.height);
+        lq_quadtree_node_unlink_polygon(quadtree, polygon->owner, polygon);
+    }
+    if (polygon->previous_sibling != NULL) {
+        polygon->previous_sibling->next_sibling = polygon->next_sibling;
+    } else {
+        p->entries = polygon->next_sibling;
+    }
+    if (polygon->next_sibling != NULL) {
+        polygon->next_sibling->previous_sibling = polygon->previous_sibling;
+    }
+    lq_pool_free(&quadtree->polygon_node_pool, polygon);
+    lq_polygon_release(quadtree, p);
+}
+
+/* copies the polygon's current bounding box into the arrays of the
+ * entry's node */
+static void lq_polygon_node_refresh_box(lq_polygon_node_t *polygon) {
+    lq_node_arrays_t arrays = lq_quadtree_node_arrays(polygon->owner);
+    lq_quadtree_node_extend_envelope(polygon->owner, polygon->p);
+    arrays.min_xs[polygon->index] = polygon->p->min_x;
+    arrays.min_ys[polygon->index] = polygon->p->min_y;
+    arrays.max_xs[polygon->index] = polygon->p->max_x;
+    arrays.max_ys[polygon->index] = polygon->p->max_y;
+}
+
+static lq_polygon_t* lq_polygon_create(lq_quadtree_t *quadtree, long id, int number_of_points, int *xs, int *ys) {
+    lq_polygon_t *p = (lq_polygon_t*) lq_pool_allocate(&quadtree->polygon_pool);
+    COUNT(allocations, 1);
+    if (p == NULL) {
+        return NULL;
+    }
+    if (lq_polygon_set_coordinates(quadtree, p, number_of_points, xs, ys) != QUADTREE_SUCCESS) {
+        lq_pool_free(&quadtree->polygon_pool, p);
+        return NULL;
+    }
+    p->id = id;
+    p->ref_count = 1;
+    return p;
+}
+
+/* Replaces the corners of the polygon and everything derived from
+ * them.  The coordinate array is reused if the number of corners and
+ * the way they are kept stay the same.  If memory runs out the polygon
+ * is left unchanged. */
+static int lq_polygon_set_coordinates(lq_quadtree_t *quadtree, lq_polygon_t *polygon, int number_of_points, int *xs, int *ys) {
+    int i;
+    int min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+    bool compact;
+    void *coordinates;
+    lq_edge_index_t *edge_index = NULL;
+    if (number_of_points > 0) {
+        min_x = max_x = xs[0];
+        min_y = max_y = ys[0];
+    }
+    for (i = 1; i < number_of_points; ++i) {
+        min_x = MIN(min_x, xs[i]);
+        min_y = MIN(min_y, ys[i]);
+        max_x = MAX(max_x, xs[i]);
+        max_y = MAX(max_y, ys[i]);
+    }
+    compact = (long long) max_x - min_x <= COMPACT_MAX_EXTENT &&
+              (long long) max_y - min_y <= COMPACT_MAX_EXTENT;
+    if (quadtree->use_edge_index && number_of_points >= EDGE_INDEX_MIN_POINTS) {
+        COUNT(allocations, 1);
+        edge_index = lq_edge_index_create(number_of_points, xs, ys);
+        if (edge_index == NULL) {
+            return QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    coordinates = compact ? (void*) polygon->points : (void*) polygon->xs;
+    if (coordinates == NULL || number_of_points != polygon->number_of_points) {
+        COUNT(allocations, 1);
+        coordinates = malloc(2 * number_of_points * (compact ? sizeof(unsigned short) : sizeof(int)));
+        if (coordinates == NULL) {
+            lq_edge_index_destroy(edge_index);
+            return QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+        free(polygon->xs);
+        free(polygon->points);
+    }
+    lq_edge_index_destroy(polygon->edge_index);
+    polygon->edge_index = edge_index;
+    polygon->number_of_points = number_of_points;
+    polygon->min_x = min_x;
+    polygon->min_y = min_y;
+    polygon->max_x = max_x;
+    polygon->max_y = max_y;
+    if (compact) {
+        polygon->points = (unsigned short*) coordinates;
+        polygon->xs = polygon->ys = NULL;
+        for (i = 0; i < number_of_points; ++i) {
+            polygon->points[2 * i] = (unsigned short) (xs[i] - min_x);
+            polygon->points[2 * i + 1] = (unsigned short) (ys[i] - min_y);
+        }
+    } else {
+        polygon->points = NULL;
+        polygon->xs = (int*) coordinates;
+        polygon->ys = polygon->xs + number_of_points;
+        memcpy(polygon->xs, xs, number_of_points * sizeof(int));
+        memcpy(polygon->ys, ys, number_of_points * sizeof(int));
+    }
+    return QUADTREE_SUCCESS;
+}
+
+/* copies the corners of the polygon to xs and ys */
+static void lq_polygon_get_coordinates(lq_polygon_t *polygon, int *xs, int *ys) {
+    int i;
+    if (polygon->points == NULL) {
+        memcpy(xs, polygon->xs, polygon->number_of_points * sizeof(int));
+        memcpy(ys, polygon->ys, polygon->number_of_points * sizeof(int));
+        return;
+    }
+    for (i = 0; i < polygon->number_of_points; ++i) {
+        xs[i] = COMPACT_X(polygon->points, i, polygon->min_x);
+        ys[i] = COMPACT_Y(polygon->points, i, polygon->min_y);
+    }
+}
+
+static void lq_polygon_release(lq_quadtree_t *quadtree, lq_polygon_t *polygon) {
+    polygon->ref_count--;
+    if (polygon->ref_count == 0) {
+        lq_quadtree_retire(quadtree, polygon, lq_retired_polygon_free);
+    }
+}
+
+/* frees everything of the polygon that does not live in a pool */
+static void lq_polygon_free_coordinates(lq_polygon_t *polygon) {
+    free(polygon->xs);
+    free(polygon->points);
+    lq_edge_index_destroy(polygon->edge_index);
+}
+
+static int lq_polygon_contains(lq_polygon_t *polygon, int x, int y) {
+    lq_edge_index_t *edge_index = __atomic_load_n(&polygon->edge_index, __ATOMIC_ACQUIRE);
+    COUNT(point_in_polygon_calls, 1);
+    if (edge_index != NULL) {
+        COUNT(edges_tested, lq_edge_index_bucket_size(edge_index, y));
+        return lq_edge_index_contains(edge_index, x, y);
+    }
+    COUNT(edges_tested, polygon->number_of_points);
+    if (polygon->points != NULL) {
+        return point_in_polygon_compact(x, y, polygon->number_of_points, polygon->points,
+                                        polygon->min_x, polygon->min_y);
+    }
+    return point_in_polygon(x, y, polygon->number_of_points, polygon->xs, polygon->ys);
+}
+
+/* how polygon covers rect, see classify_polygon_rectangle().  Polygons
+ * whose bounding box misses rect are rejected without looking at their
+ * edges. */
+static int lq_polygon_classify(lq_polygon_t *polygon, lq_rect_t *rect) {
+    if (polygon->max_x <= rect->left || rect->left + rect->width <= polygon->min_x ||
+        polygon->max_y <= rect->bottom || rect->bottom + rect->height <= polygon->min_y) {
+        return RECTANGLE_OUTSIDE;
+    }
+    COUNT(edges_tested, polygon->number_of_points);
+    if (polygon->points != NULL) {
+        return classify_polygon_rectangle_compact(polygon->number_of_points, polygon->points,
+                                                  polygon->min_x, polygon->min_y,
+                                                  rect->left, rect->bottom, rect->width, rect->height);
+    }
+    return classify_polygon_rectangle(polygon->number_of_points, polygon->xs, polygon->ys,
+                                      rect->left, rect->bottom, rect->width, rect->height);
+}
+
+/* how polygon covers rect if only the given edges may enter it, see
+ * classify_polygon_edges_rectangle() */
+static int lq_polygon_classify_edges(lq_polygon_t *polygon, int number_of_edges, const int *edges,
+                                     int *entering, int *number_of_entering, lq_rect_t *rect) {
+    COUNT(edges_tested, number_of_edges);
+    if (polygon->points != NULL) {
+        return classify_polygon_edges_rectangle_compact(polygon->number_of_points, polygon->points,
+                                                        polygon->min_x, polygon->min_y,
+                                                        number_of_edges, edges, entering, number_of_entering,
+                                                        rect->left, rect->bottom, rect->width, rect->height);
+    }
+    return classify_polygon_edges_rectangle(polygon->number_of_points, polygon->xs, polygon->ys,
+                                            number_of_edges, edges, entering, number_of_entering,
+                                            rect->left, rect->bottom, rect->width, rect->height);
+}
+
+/* stores the given edges of polygon that enter rect in entering and
+ * returns their number, see find_edges_entering_rectangle() */
+static int lq_polygon_find_entering_edges(lq_polygon_t *polygon, int number_of_edges, const int *edges,
+                                          int *entering, lq_rect_t *rect) {
+    COUNT(edges_tested, number_of_edges);
+    if (polygon->points != NULL) {
+        return find_edges_entering_rectangle_compact(polygon->number_of_points, polygon->points,
+                                                     polygon->min_x, polygon->min_y, number_of_edges, edges,
+                                                     entering, rect->left, rect->bottom, rect->width, rect->height);
+    }
+    return find_edges_entering_rectangle(polygon->number_of_points, polygon->xs, polygon->ys, number_of_edges,
+                                         edges, entering, rect->left, rect->bottom, rect->width, rect->height);
+}
+
+/* whether (x, y) is inside polygon given whether (reference_x, y) is,
+ * where only the given edges enter a rectangle holding both points, see
+ * point_in_polygon_edges() */
+static int lq_polygon_contains_in_row(lq_polygon_t *polygon, int x, int y, int reference_x, int reference_inside,
+                                      int number_of_edges, const int *edges) {
+    COUNT(edges_tested, number_of_edges);
+    if (polygon->points != NULL) {
+        return point_in_polygon_edges_compact(x, y, reference_x, reference_inside, polygon->number_of_points,
+                                              polygon->points, polygon->min_x, polygon->min_y,
+                                              number_of_edges, edges);
+    }
+    return point_in_polygon_edges(x, y, reference_x, reference_inside, polygon->number_of_points,
+                                  polygon->xs, polygon->ys, number_of_edges, edges);
+}
+
+/* whether the polygon at index of a node collides with the window, see
+ * lq_polygon_classify().  The bounding box is checked first so that
+ * most polygons are rejected without touching them. */
+static bool lq_polygon_intersects_window(lq_node_arrays_t *arrays, int index, lq_rect_t *window) {
+    if (arrays->max_xs[index] <= window->left || window->left + window->width <= arrays->min_xs[index] ||
+        arrays->max_ys[index] <= window->bottom || window->bottom + window->height <= arrays->min_ys[index]) {
+        return false;
+    }
+    return lq_polygon_classify(arrays->polygons[index], window) != RECTANGLE_OUTSIDE;
+}
+
+/* the squared distance of (x, y) to the polygon, 0 if the polygon
+ * contains it */
+static double lq_polygon_squared_distance(lq_polygon_t *polygon, int x, int y) {
+    if (lq_polygon_contains(polygon, x, y)) {
+        return 0;
+    }
+    COUNT(edges_tested, polygon->number_of_points);
+    if (polygon->points != NULL) {
+        return polygon_edges_distance_squared_compact(x, y, polygon->number_of_points, polygon->points,
+                                                      polygon->min_x, polygon->min_y);
+    }
+    return polygon_edges_distance_squared(x, y, polygon->number_of_points, polygon->xs, polygon->ys);
+}
+
+/* the squared distance of (x, y) to the closed bounding box of the
+ * polygon at index which contains all its edges */
+static double lq_node_arrays_box_squared_distance(lq_node_arrays_t *arrays, int index, int x, int y) {
+    double dx = 0, dy = 0;
+    if (x < arrays->min_xs[index]) {
+        dx = (double) arrays->min_xs[index] - x;
+    } else if (x > arrays->max_xs[index]) {
+        dx = (double) x - arrays->max_xs[index];
+    }
+    if (y < arrays->min_ys[index]) {
+        dy = (double) arrays->min_ys[index] - y;
+    } else if (y > arrays->max_ys[index]) {
+        dy = (double) y - arrays->max_ys[index];
+    }
+    return dx * dx + dy * dy;
+}
+
+/* Frees all entries of the polygon, touching only the nodes that hold
+ * it, and collapses the nodes that are no longer needed.  Collapsing
+ * never frees a node holding the polygon: its siblings would have to
+ * hold the same polygons as the node that just lost it.  If nothing
+ * else holds a reference the polygon is freed as well, so the caller
+ * must not use it afterwards unless it holds one. */
+static void lq_polygon_remove_entries(lq_quadtree_t *quadtree, lq_polygon_t *polygon) {
+    lq_polygon_node_t *entry = polygon->entries;
+    while (entry != NULL) {
+        lq_polygon_node_t *next = entry->next_sibling;
+        lq_quadtree_node_t *owner = entry->owner;
+        lq_polygon_node_free(quadtree, entry);
+        lq_quadtree_node_collapse_upwards(quadtree, owner->parent);
+        entry = next;
+    }
+}
+
+/* takes the polygon out of the list of polygons with its id if it is
+ * in there */
+static void lq_quadtree_forget_polygon(lq_quadtree_t *quadtree, lq_polygon_t *polygon) {
+    lq_polygon_t *head = (lq_polygon_t*) lq_idmap_get(&quadtree->polygons_by_id, polygon->id);
+    lq_polygon_t *previous;
+    if (head == polygon) {
+        if (polygon->next_with_same_id != NULL) {
+            /* replacing a value never fails */
+            lq_idmap_put(&quadtree->polygons_by_id, polygon->id, polygon->next_with_same_id);
+        } else {
+            lq_idmap_remove(&quadtree->polygons_by_id, polygon->id);
+        }
+    } else {
+        for (previous = head; previous != NULL; previous = previous->next_with_same_id) {
+            if (previous->next_with_same_id == polygon) {
+                previous->next_with_same_id = polygon->next_with_same_id;
+                break;
+            }
+        }
+    }
+    polygon->next_with_same_id = NULL;
+}
+
+/* Queries of a quadtree with concurrent readers run within an epoch so
+ * that the writer keeps everything they may still see, see epoch.h. */
+static int lq_quadtree_read_begin(lq_quadtree_t *quadtree) {
+    if (quadtree->config.concurrent_readers && lq_epoch_enter() != 0) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    return QUADTREE_SUCCESS;
+}
+
+static void lq_quadtree_read_end(lq_quadtree_t *quadtree) {
+    if (quadtree->config.concurrent_readers) {
+        lq_epoch_leave();
+    }
+}
+
+/* Every change runs between lq_quadtree_write_begin() and
+ * lq_quadtree_write_end(), so snapshots are only taken between
+ * changes.  The snapshots known at the start of a change decide how it
+ * is made, see lq_quadtree_is_shared(). */
+static void lq_quadtree_write_begin(lq_quadtree_t *quadtree) {
+    pthread_mutex_lock(&quadtree->write_lock);
+    lq_quadtree_sweep_snapshots(quadtree);
+    quadtree->number_of_changes++;
+}
+
+/* frees what the finished change and earlier ones retired as far as
+ * no query can see it anymore */
+static void lq_quadtree_write_end(lq_quadtree_t *quadtree) {
+    lq_epoch_reclaim(&quadtree->limbo, quadtree);
+    pthread_mutex_unlock(&quadtree->write_lock);
+}
+
+/* Whether queries may read the tree while it changes, either because
+ * of concurrent readers or of snapshots.  The writer then never
+ * changes what they may be reading but replaces it, see
+ * lq_quadtree_retire(). */
+static bool lq_quadtree_is_shared(lq_quadtree_t *quadtree) {
+    return quadtree->config.concurrent_readers || quadtree->snapshots != NULL;
+}
+
+/* frees the snapshots whose last handle was released and finds the
+ * generation of the newest one left.  Called with write_lock held. */
+static void lq_quadtree_sweep_snapshots(lq_quadtree_t *quadtree) {
+    lq_snapshot_t *snapshot, **link = &quadtree->snapshots;
+    quadtree->snapshot_generation = 0;
+    while ((snapshot = *link) != NULL) {
+        if (__atomic_load_n(&snapshot->ref_count, __ATOMIC_ACQUIRE) == 0) {
+            *link = snapshot->next;
+            free(snapshot);
+        } else {
+            quadtree->snapshot_generation = snapshot->generation;
+            link = &snapshot->next;
+        }
+    }
+}
+
+/* whether a snapshot with a generation in (older, newer] is alive */
+static bool lq_quadtree_has_snapshot_between(lq_quadtree_t *quadtree, unsigned long older, unsigned long newer) {
+    lq_snapshot_t *snapshot;
+    for (snapshot = quadtree->snapshots; snapshot != NULL; snapshot = snapshot->next) {
+        if (older < snapshot->generation && snapshot->generation <= newer &&
+            __atomic_load_n(&snapshot->ref_count, __ATOMIC_ACQUIRE) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Keeps what the snapshots see of node before the writer changes its
+ * children, its arrays or its number of entries, which must come
+ * right after.  The first change after a new snapshot was taken adds
+ * a record to the history of node; records no snapshot reads from
+ * anymore are retired on the way.  Without memory for the record the
+ * snapshots lose node and are marked broken instead, see
+ * lq_snapshot_is_broken(). */
+static void lq_quadtree_node_preserve(lq_quadtree_t *quadtree, lq_quadtree_node_t *node) {
+    int quadrant;
+    unsigned long older;
+    lq_node_history_t *record, **link;
+    if (quadtree->snapshot_generation <= node->preserved_generation &&
+        (quadtree->snapshot_generation != 0 || node->history == NULL)) {
+        return;
+    }
+    /* a record serves the snapshots since the next older one */
+    link = &node->history;
+    while ((record = *link) != NULL) {
+        older = record->next != NULL ? record->next->generation : 0;
+        if (lq_quadtree_has_snapshot_between(quadtree, older, record->generation)) {
+            link = &record->next;
+        } else {
+            __atomic_store_n(link, record->next, __ATOMIC_RELEASE);
+            lq_quadtree_retire(quadtree, record, lq_retired_history_free);
+        }
+    }
+    if (quadtree->snapshot_generation <= node->preserved_generation) {
+        return;
+    }
+    node->preserved_generation = quadtree->snapshot_generation;
+    COUNT(allocations, 1);
+    record = (lq_node_history_t*) malloc(sizeof(lq_node_history_t));
+    if (record == NULL) {
+        lq_quadtree_snapshots_break(quadtree);
+        return;
+    }
+    record->generation = quadtree->snapshot_generation;
+    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+        record->children[quadrant] = node->children[quadrant];
     }
-    return error_code;
+    record->entries = node->entries;
+    record->number_of_polygons = node->number_of_polygons;
+    record->next = node->history;
+    __atomic_store_n(&node->history, record, __ATOMIC_RELEASE);
 }
 
-static int lq_quadtree_node_add_polygons(lq_quadtree_node_t *node, lq_polygon_node_t *polygons) {
-    lq_polygon_node_t *current = polygons;
-    while (current != NULL) {
-        lq_polygon_node_t *clone = lq_polygon_node_clone(current);
-        if (clone == NULL) {
-            goto out_of_memory;
-        }
-        lq_quadtree_node_add_polygon(node, clone);
-        current = current->next;
+/* marks the snapshots taken so far as no longer seeing the tree as it
+ * was when they were taken */
+static void lq_quadtree_snapshots_break(lq_quadtree_t *quadtree) {
+    if (quadtree->snapshot_generation > quadtree->broken_generation) {
+        __atomic_store_n(&quadtree->broken_generation, quadtree->snapshot_generation, __ATOMIC_RELEASE);
     }
-    return QUADTREE_SUCCESS;
-
-out_of_memory:
-    lq_quadtree_node_clear_polygons(node);
-    return QUADTREE_ERROR_OUT_OF_MEMORY;
 }
 
-static void lq_quadtree_node_add_polygon(lq_quadtree_node_t *node, lq_polygon_node_t *polygon) {
-    assertTrue("poly has unexpected next\n", polygon->next == NULL);
-    polygon->next = node->polygons;
-    node->polygons = polygon;
-    node->number_of_polygons++;
-    LOG_DEBUG("added polygon to node (%d %d %d %d). now has %d polygons\n", node->bounding_box->left, node->bounding_box->bottom, node->bounding_box->width, node->bounding_box->height, node->number_of_polygons);
+/* Whether the writer could not keep everything snapshot sees.  Queries
+ * check this after they are done, so that a snapshot that broke while
+ * they ran fails them, too. */
+static int lq_snapshot_is_broken(lq_snapshot_t *snapshot) {
+    return snapshot->generation <= __atomic_load_n(&snapshot->quadtree->broken_generation, __ATOMIC_ACQUIRE);
 }
 
-
-
-static lq_polygon_node_t* lq_polygon_node_allocate() {
-    lq_polygon_node_t *polygon = (lq_polygon_node_t*) calloc(1, sizeof(lq_polygon_node_t));
-    return polygon;
+/* Frees a node, arrays, polygon, edge index or history record that was
+ * just taken out of the tree.  With concurrent readers or snapshots it
+ * waits in the limbo until no query can see it anymore. */
+static void lq_quadtree_retire(lq_quadtree_t *quadtree, void *object, lq_epoch_free_t free_object) {
+    if (lq_quadtree_is_shared(quadtree)) {
+        lq_epoch_retire(&quadtree->limbo, object, free_object, quadtree);
+    } else {
+        free_object(quadtree, object);
+    }
 }
 
-static lq_polygon_node_t* lq_polygon_node_clone(lq_polygon_node_t *polygon) {
-    lq_polygon_node_t *clone = lq_polygon_node_allocate();
-    if (clone != NULL) {
-        clone->p = polygon->p;
-        clone->ref_count = polygon->ref_count;
-        *(polygon->ref_count) += 1;
-        clone->next = NULL;
-    }
-    return clone;
+static void lq_retired_node_free(void *context, void *object) {
+    lq_node_history_free((lq_quadtree_node_t*) object);
+    lq_pool_free(&((lq_quadtree_t*) context)->node_pool, object);
 }
 
-static void lq_polygon_node_free(lq_polygon_node_t *polygon) {
-    if (polygon == NULL) {
-        return;
-    }
-    (*(polygon->ref_count))--;
-    if (*(polygon->ref_count) == 0) {
-        if (polygon->p != NULL) {
-            free(polygon->p->xs);
-            free(polygon->p->ys);
-            free(polygon->p);
-        }
-        free(polygon->ref_count);
-    }
-    free(polygon);
+static void lq_retired_history_free(void *context, void *object) {
+    (void) context;
+    free(object);
 }
 
-static int lq_polygon_node_initialize(lq_polygon_node_t *polygon, long id, int number_of_points, int *xs, int *ys) {
-    int i;
-    lq_polygon_t *p = (lq_polygon_t*) calloc(1, sizeof(lq_polygon_t));
-    if (p == NULL) {
-        goto out_of_memory;
-    }
-    p->id = id;
-    p->number_of_points = number_of_points;
-    p->xs = (int*) malloc(number_of_points * sizeof(int));
-    p->ys = (int*) malloc(number_of_points * sizeof(int));
-    if (p->xs == NULL || p->ys == NULL) {
-        goto out_of_memory;
-    }
-    for (i = 0; i < number_of_points; ++i) {
-        p->xs[i] = xs[i];
-        p->ys[i] = ys[i];
-    }
-    polygon->p = p;
-    polygon->ref_count = (int*) malloc(sizeof(int));
-    if (polygon->ref_count == NULL) {
-        goto out_of_memory;
+/* frees the records still in the history of node */
+static void lq_node_history_free(lq_quadtree_node_t *node) {
+    lq_node_history_t *record, *next;
+    for (record = node->history; record != NULL; record = next) {
+        next = record->next;
+        free(record);
     }
-    *(polygon->ref_count) = 1;
-    polygon->next = NULL;
-    return QUADTREE_SUCCESS;
+    node->history = NULL;
+}
 
-out_of_memory:
-    if (p != NULL) {
-        free(p->ys);
-        p->xs = NULL;
-        free(p->xs);
-        p->ys = NULL;
-        free(polygon->ref_count);
-        polygon->ref_count = NULL;
-        free(p);
-        polygon->p = NULL;
-    }
-    return QUADTREE_ERROR_OUT_OF_MEMORY;
+static void lq_retired_arrays_free(void *context, void *object) {
+    (void) context;
+    free(object);
 }
 
-static lq_rect_t* lq_rect_allocate() {
-    lq_rect_t *rect = (lq_rect_t*) calloc(1, sizeof(lq_rect_t));
-    return rect;
+static void lq_retired_polygon_free(void *context, void *object) {
+    lq_polygon_free_coordinates((lq_polygon_t*) object);
+    lq_pool_free(&((lq_quadtree_t*) context)->polygon_pool, object);
 }
 
-static void lq_rect_free(lq_rect_t *rect) {
-    free(rect);
+static void lq_retired_edge_index_free(void *context, void *object) {
+    (void) context;
+    lq_edge_index_destroy((lq_edge_index_t*) object);
 }
 
 static void lq_rect_initialize(lq_rect_t *rect, int rx, int ry, int rw, int rh) {
@@ -554,10 +3714,835 @@ static bool lq_rect_point_is_in_bounds(lq_rect_t *rect, int x, int y) {
     return true;
 }
 
+/* number of bits lq_rect_key() produces for points inside of rect */
+static int lq_rect_key_bits(lq_rect_t *rect) {
+    int bits = 0;
+    while ((1l << bits) < rect->width || (1l << bits) < rect->height) {
+        ++bits;
+    }
+    return 2 * bits;
+}
+
+/* Morton key of a point inside of rect.  The coordinates are aligned so
+ * that both axes have the same number of bits, which makes every node
+ * of the tree correspond to a contiguous range of keys even if the
+ * tree is not square. */
+static unsigned long long lq_rect_key(lq_rect_t *rect, int key_bits, int x, int y) {
+    unsigned long dx = (unsigned long) ((long) x - rect->left);
+    unsigned long dy = (unsigned long) ((long) y - rect->bottom);
+    int bits = key_bits / 2;
+    while ((1l << bits) > rect->width) {
+        dx <<= 1;
+        --bits;
+    }
+    bits = key_bits / 2;
+    while ((1l << bits) > rect->height) {
+        dy <<= 1;
+        --bits;
+    }
+    return interleave_bits(dx, dy);
+}
+
+/* stable LSD radix sort on the lowest key_bits bits of the keys.  On
+ * return *keys points to the sorted keys and *tmp to the scratch
+ * space. */
+static void lq_batch_keys_sort(lq_batch_key_t **keys, lq_batch_key_t **tmp, int number_of_keys, int key_bits) {
+    int shift, i;
+    int positions[256];
+    for (shift = 0; shift < key_bits; shift += 8) {
+        lq_batch_key_t *from = *keys;
+        lq_batch_key_t *to = *tmp;
+        int position = 0;
+        memset(positions, 0, sizeof(positions));
+        for (i = 0; i < number_of_keys; ++i) {
+            positions[(from[i].key >> shift) & 0xff]++;
+        }
+        for (i = 0; i < 256; ++i) {
+            int count = positions[i];
+            positions[i] = position;
+            position += count;
+        }
+        for (i = 0; i < number_of_keys; ++i) {
+            to[positions[(from[i].key >> shift) & 0xff]++] = from[i];
+        }
+        *keys = to;
+        *tmp = from;
+    }
+}
+
+static void lq_batch_scratch_release(lq_batch_scratch_t *scratch) {
+    if (scratch != NULL) {
+        free(scratch->keys);
+        free(scratch->sorted_keys);
+        free(scratch->starts);
+        free(scratch->owners);
+        free(scratch->hits);
+        free(scratch->run_xs);
+        free(scratch->run_ys);
+        free(scratch->inside);
+    }
+}
+
+/* makes sure batch_result can take the counts of number_of_points
+ * points and that it has scratch memory */
+static int lq_batch_result_prepare(quadtree_batch_result_t *batch_result, int number_of_points) {
+    lq_batch_scratch_t *scratch = (lq_batch_scratch_t*) batch_result->scratch;
+    batch_result->number_of_points = -1;
+    batch_result->number_of_ids = -1;
+    if (number_of_points < 0) {
+        return QUADTREE_ERROR;
+    }
+    if (scratch == NULL) {
+        COUNT(allocations, 1);
+        scratch = (lq_batch_scratch_t*) calloc(1, sizeof(lq_batch_scratch_t));
+        if (scratch == NULL) {
+            return QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+        batch_result->scratch = scratch;
+    }
+    if (lq_reserve((void**) &batch_result->offsets, &batch_result->offsets_capacity,
+                   number_of_points + 1, sizeof(int)) != QUADTREE_SUCCESS ||
+        lq_reserve((void**) &scratch->starts, &scratch->starts_capacity,
+                   number_of_points, sizeof(int)) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    return QUADTREE_SUCCESS;
+}
+
+/* makes room for k ids, distances and polygons in nearest_result */
+static int lq_nearest_result_prepare(quadtree_nearest_result_t *nearest_result, int k) {
+    int capacity = nearest_result->capacity;
+    lq_nearest_scratch_t *scratch;
+    if (nearest_result->scratch == NULL) {
+        COUNT(allocations, 1);
+        nearest_result->scratch = calloc(1, sizeof(lq_nearest_scratch_t));
+        if (nearest_result->scratch == NULL) {
+            return QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    if (lq_reserve((void**) &nearest_result->ids, &capacity, k, sizeof(long)) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    capacity = nearest_result->capacity;
+    if (lq_reserve((void**) &nearest_result->distances, &capacity, k, sizeof(double)) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    nearest_result->capacity = capacity;
+    scratch = (lq_nearest_scratch_t*) nearest_result->scratch;
+    return lq_reserve((void**) &scratch->polygons, &scratch->polygons_capacity, k, sizeof(lq_polygon_t*));
+}
+
+/* the distance a polygon or node must not exceed to still be of
+ * interest: the distance of the k-th polygon once k were found */
+static double lq_nearest_result_limit(quadtree_nearest_result_t *nearest_result, int k, double max_distance) {
+    if (nearest_result->number_of_ids == k) {
+        return MIN(max_distance, nearest_result->distances[k - 1]);
+    }
+    return max_distance;
+}
+
+static bool lq_nearest_result_contains(quadtree_nearest_result_t *nearest_result, lq_polygon_t *polygon) {
+    int i;
+    lq_polygon_t **polygons = ((lq_nearest_scratch_t*) nearest_result->scratch)->polygons;
+    for (i = 0; i < nearest_result->number_of_ids; ++i) {
+        if (polygons[i] == polygon) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Adds polygon to the polygons found so far, which are kept sorted by
+ * distance.  Of several polygons with the same id only the nearest is
+ * kept and once there are k polygons the farthest one is dropped. */
+static void lq_nearest_result_insert(quadtree_nearest_result_t *nearest_result, int k, lq_polygon_t *polygon, double distance) {
+    int i, number_of_ids = nearest_result->number_of_ids;
+    lq_polygon_t **polygons = ((lq_nearest_scratch_t*) nearest_result->scratch)->polygons;
+    double *distances = nearest_result->distances;
+    for (i = 0; i < number_of_ids && polygons[i]->id != polygon->id; ++i);
+    if (i < number_of_ids) {
+        if (distances[i] <= distance) {
+            return;
+        }
+        number_of_ids--;
+        memmove(polygons + i, polygons + i + 1, (number_of_ids - i) * sizeof(lq_polygon_t*));
+        memmove(distances + i, distances + i + 1, (number_of_ids - i) * sizeof(double));
+    } else if (number_of_ids == k) {
+        if (distances[k - 1] <= distance) {
+            return;
+        }
+        number_of_ids--;
+    }
+    for (i = number_of_ids; i > 0 && distances[i - 1] > distance; --i) {
+        polygons[i] = polygons[i - 1];
+        distances[i] = distances[i - 1];
+    }
+    polygons[i] = polygon;
+    distances[i] = distance;
+    nearest_result->number_of_ids = number_of_ids + 1;
+}
+
+static int lq_nearest_heap_push(lq_nearest_scratch_t *scratch, lq_quadtree_node_t *node, double distance) {
+    int i, parent;
+    lq_nearest_node_t *heap;
+    if (lq_reserve((void**) &scratch->heap, &scratch->heap_capacity,
+                   scratch->number_of_nodes + 1, sizeof(lq_nearest_node_t)) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    heap = scratch->heap;
+    for (i = scratch->number_of_nodes; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (heap[parent].distance <= distance) {
+            break;
+        }
+        heap[i] = heap[parent];
+    }
+    heap[i].distance = distance;
+    heap[i].node = node;
+    scratch->number_of_nodes++;
+    return QUADTREE_SUCCESS;
+}
+
+static lq_nearest_node_t lq_nearest_heap_pop(lq_nearest_scratch_t *scratch) {
+    int i, child;
+    lq_nearest_node_t *heap = scratch->heap;
+    lq_nearest_node_t top = heap[0];
+    lq_nearest_node_t last = heap[--scratch->number_of_nodes];
+    for (i = 0; (child = 2 * i + 1) < scratch->number_of_nodes; i = child) {
+        if (child + 1 < scratch->number_of_nodes && heap[child + 1].distance < heap[child].distance) {
+            child++;
+        }
+        if (last.distance <= heap[child].distance) {
+            break;
+        }
+        heap[i] = heap[child];
+    }
+    heap[i] = last;
+    return top;
+}
+
+/* turns the counts in offsets[1..n] into offsets and makes room for
+ * all ids */
+static int lq_batch_result_sum_offsets(quadtree_batch_result_t *batch_result, int number_of_points) {
+    int i;
+    batch_result->offsets[0] = 0;
+    for (i = 0; i < number_of_points; ++i) {
+        batch_result->offsets[i + 1] += batch_result->offsets[i];
+    }
+    if (lq_reserve((void**) &batch_result->ids, &batch_result->ids_capacity,
+                   batch_result->offsets[number_of_points], sizeof(long)) != QUADTREE_SUCCESS) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    batch_result->number_of_ids = batch_result->offsets[number_of_points];
+    return QUADTREE_SUCCESS;
+}
+
+/* the part of n items worker_index works on, each worker taking an
+ * equal share */
+static int lq_parallel_batch_share(lq_parallel_batch_t *batch, int worker_index, int n) {
+    return (int) ((long long) n * worker_index / lq_workers_count(batch->worker_pool->workers));
+}
+
+/* counts how many of the worker's keys have each digit */
+static void lq_parallel_batch_count(lq_parallel_batch_t *batch, lq_batch_scratch_t *scratch) {
+    int i;
+    memset(scratch->positions, 0, sizeof(scratch->positions));
+    for (i = scratch->keys_begin; i < scratch->keys_end; ++i) {
+        scratch->positions[(batch->keys[i].key >> batch->shift) & 0xff]++;
+    }
+}
+
+/* Every worker computes the keys of its share of the points and counts
+ * their lowest digits.  The keys of the points in the tree are kept at
+ * the start of the share. */
+static void lq_parallel_batch_keys_task(int worker_index, void *context) {
+    lq_parallel_batch_t *batch = (lq_parallel_batch_t*) context;
+    lq_batch_scratch_t *scratch = &batch->worker_pool->scratches[worker_index];
+    lq_batch_scratch_t *result_scratch = (lq_batch_scratch_t*) batch->batch_result->scratch;
+    int begin = lq_parallel_batch_share(batch, worker_index, batch->number_of_points);
+    int end = lq_parallel_batch_share(batch, worker_index + 1, batch->number_of_points);
+    scratch->keys_begin = begin;
+    scratch->keys_end = begin + lq_quadtree_batch_keys(batch->quadtree, batch->key_bits, begin, end,
+                                                       batch->xs, batch->ys, 1, batch->batch_result->offsets + 1,
+                                                       result_scratch->starts, batch->keys + begin);
+    lq_parallel_batch_count(batch, scratch);
+}
+
+/* every worker counts the digits of its share of the keys */
+static void lq_parallel_batch_count_task(int worker_index, void *context) {
+    lq_parallel_batch_t *batch = (lq_parallel_batch_t*) context;
+    lq_batch_scratch_t *scratch = &batch->worker_pool->scratches[worker_index];
+    scratch->keys_begin = lq_parallel_batch_share(batch, worker_index, batch->number_of_keys);
+    scratch->keys_end = lq_parallel_batch_share(batch, worker_index + 1, batch->number_of_keys);
+    lq_parallel_batch_count(batch, scratch);
+}
+
+/* Turns the digit counts of the workers into the positions their keys
+ * go to.  The keys with the same digit keep the order of the workers,
+ * which keeps the sort stable. */
+static void lq_parallel_batch_positions(lq_parallel_batch_t *batch) {
+    int digit, i;
+    int position = 0;
+    int number_of_workers = lq_workers_count(batch->worker_pool->workers);
+    for (digit = 0; digit < 256; ++digit) {
+        for (i = 0; i < number_of_workers; ++i) {
+            int count = batch->worker_pool->scratches[i].positions[digit];
+            batch->worker_pool->scratches[i].positions[digit] = position;
+            position += count;
+        }
+    }
+    batch->number_of_keys = position;
+}
+
+/* every worker moves its keys to their positions in sorted_keys */
+static void lq_parallel_batch_scatter_task(int worker_index, void *context) {
+    lq_parallel_batch_t *batch = (lq_parallel_batch_t*) context;
+    lq_batch_scratch_t *scratch = &batch->worker_pool->scratches[worker_index];
+    int i;
+    for (i = scratch->keys_begin; i < scratch->keys_end; ++i) {
+        batch->sorted_keys[scratch->positions[(batch->keys[i].key >> batch->shift) & 0xff]++] = batch->keys[i];
+    }
+}
+
+/* Workers repeatedly claim the next unprocessed chunk of the sorted
+ * keys until none are left.  Hits go to the worker's own scratch
+ * memory and the worker is remembered as the owner of the chunk. */
+static void lq_parallel_batch_query_task(int worker_index, void *context) {
+    lq_parallel_batch_t *batch = (lq_parallel_batch_t*) context;
+    lq_batch_scratch_t *scratch = &batch->worker_pool->scratches[worker_index];
+    lq_batch_scratch_t *result_scratch = (lq_batch_scratch_t*) batch->batch_result->scratch;
+    int *counts = batch->batch_result->offsets + 1;
+    int chunk, begin;
+    scratch->number_of_hits = 0;
+    COUNTERS_BEGIN();
+    for (;;) {
+        chunk = __atomic_fetch_add(&batch->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= batch->number_of_chunks) {
+            break;
+        }
+        begin = chunk * batch->chunk_size;
+        result_scratch->owners[chunk] = worker_index;
+        if (lq_quadtree_query_sorted(batch->quadtree, batch->keys + begin,
+                                     MIN(batch->chunk_size, batch->number_of_keys - begin),
+                                     batch->xs, batch->ys, 1, counts, result_scratch->starts,
+                                     scratch) != QUADTREE_SUCCESS) {
+            __atomic_store_n(&batch->error_code, QUADTREE_ERROR_OUT_OF_MEMORY, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    COUNTERS_COLLECT(&batch->counters);
+}
+
+/* copies the hits of every chunk from its owner's scratch memory to
+ * their final place in the result */
+static void lq_parallel_batch_copy_task(int worker_index, void *context) {
+    lq_parallel_batch_t *batch = (lq_parallel_batch_t*) context;
+    quadtree_batch_result_t *batch_result = batch->batch_result;
+    lq_batch_scratch_t *result_scratch = (lq_batch_scratch_t*) batch_result->scratch;
+    lq_batch_scratch_t *scratch;
+    int chunk, i, k, end;
+    (void) worker_index;
+    for (;;) {
+        chunk = __atomic_fetch_add(&batch->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= batch->number_of_chunks) {
+            break;
+        }
+        scratch = &batch->worker_pool->scratches[result_scratch->owners[chunk]];
+        end = MIN((chunk + 1) * batch->chunk_size, batch->number_of_keys);
+        for (k = chunk * batch->chunk_size; k < end; ++k) {
+            int offset;
+            i = batch->keys[k].index;
+            offset = batch_result->offsets[i];
+            /* the scratch memory of a worker without hits is NULL */
+            if (batch_result->offsets[i + 1] > offset) {
+                memcpy(batch_result->ids + offset, scratch->hits + result_scratch->starts[i],
+                       (batch_result->offsets[i + 1] - offset) * sizeof(long));
+            }
+        }
+    }
+}
+
+/* Builds the subtree below node from the polygons
+ * worker->stack[first] up to worker->stack[first + number_of_polygons]
+ * which all collide with node.  The first number_of_covering of them
+ * cover node and the others only partially cover it; their edges
+ * entering node are on the edge stack of worker.  The resulting
+ * tree is the same that adding the polygons one by one would produce:
+ * a node is split as long as one of its polygons only partially covers
+ * it. */
+static int lq_build_node(lq_build_t *build, lq_build_worker_t *worker, lq_quadtree_node_t *node, int first, int number_of_polygons, int number_of_covering) {
+    int i, quadrant, error_code;
+    int child_first[NUMBER_OF_QUADRANTS];
+    int number_of_child_polygons[NUMBER_OF_QUADRANTS];
+    int number_of_child_covering[NUMBER_OF_QUADRANTS];
+    int number_of_probes;
+    lq_build_probe_t probes[NUMBER_OF_QUADRANTS];
+    long number_of_points = 0;
+    int number_of_edges = 0;
+    int edges_size = worker->edges.size;
+    lq_build_item_t *polygons = worker->stack + first;
+    lq_quadtree_node_t *children[NUMBER_OF_QUADRANTS];
+    COUNT(nodes_visited, 1);
+    if (node->depth == build->task_depth) {
+        return lq_build_add_task(build, worker, node, polygons, number_of_polygons, number_of_covering);
+    }
+    if (build->config->max_leaf_points > 0) {
+        for (i = number_of_covering; i < number_of_polygons; ++i) {
+            number_of_points += polygons[i].polygon->number_of_points;
+        }
+    }
+    /* node stays a leaf if the polygons that do not cover it fit */
+    if (lq_quadtree_node_is_at_limit(build->config, node) ||
+        lq_config_leaf_fits(build->config, number_of_polygons - number_of_covering, number_of_points)) {
+        if (lq_quadtree_node_reserve(build->quadtree, node, number_of_polygons) != QUADTREE_SUCCESS) {
+            return QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+        for (i = 0; i < number_of_polygons; ++i) {
+            lq_polygon_node_t *entry = (lq_polygon_node_t*) lq_pool_allocate(&worker->polygon_node_pool);
+            lq_polygon_node_t *next;
+            COUNT(allocations, 1);
+            if (entry == NULL) {
+                return QUADTREE_ERROR_OUT_OF_MEMORY;
+            }
+            entry->p = polygons[i].polygon;
+            entry->covered = i < number_of_covering;
+            lq_quadtree_node_add_polygon(build->quadtree, node, entry);
+            /* other workers may add entries to the same polygon.  Whoever
+             * swaps an entry out of the head of the list is the only one
+             * to touch it afterwards. */
+            next = __atomic_exchange_n(&entry->p->entries, entry, __ATOMIC_ACQ_REL);
+            entry->next_sibling = next;
+            if (next != NULL) {
+                next->previous_sibling = entry;
+            }
+            __atomic_add_fetch(&entry->p->ref_count, 1, __ATOMIC_RELAXED);
+        }
+        return QUADTREE_SUCCESS;
+    }
+    /* a node has all four children or none, also if the build fails
+     * and is undone, see lq_quadtree_node_free_arrays() */
+    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+        children[quadrant] = (lq_quadtree_node_t*) lq_pool_allocate(&worker->node_pool);
+        COUNT(allocations, 1);
+        if (children[quadrant] == NULL) {
+            return QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+        lq_quadtree_node_initialize_child(node, quadrant, children[quadrant]);
+        node->children[quadrant] = children[quadrant];
+    }
+    /* The polygons of the children go on top of the ones of node and
+     * their edges entering the children on top of the edges of node.
+     * Every polygon is tested against all children in a row so that
+     * its corners are only loaded once.  The lists of later quadrants
+     * lie lower on the stack, so building a child only overwrites the
+     * lists of the children built before it. */
+    for (i = number_of_covering; i < number_of_polygons; ++i) {
+        number_of_edges += polygons[i].number_of_edges;
+    }
+    if (lq_reserve((void**) &worker->stack, &worker->stack_capacity,
+                   first + (NUMBER_OF_QUADRANTS + 1) * number_of_polygons, sizeof(lq_build_item_t)) != QUADTREE_SUCCESS ||
+        lq_edge_stack_reserve(&worker->edges, edges_size + NUMBER_OF_QUADRANTS * number_of_edges) != 0) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    polygons = worker->stack + first;
+    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+        child_first[quadrant] = first + (NUMBER_OF_QUADRANTS - quadrant) * number_of_polygons;
+        memcpy(worker->stack + child_first[quadrant], polygons, number_of_covering * sizeof(lq_build_item_t));
+        number_of_child_polygons[quadrant] = number_of_covering;
+        number_of_child_covering[quadrant] = number_of_covering;
+    }
+    for (i = number_of_covering; i < number_of_polygons; ++i) {
+        number_of_probes = 0;
+        for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+            lq_build_filter(worker, &polygons[i], &node->children[quadrant]->bounding_box, probes, &number_of_probes,
+                            worker->stack + child_first[quadrant],
+                            &number_of_child_polygons[quadrant], &number_of_child_covering[quadrant]);
+        }
+    }
+    for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+        error_code = lq_build_node(build, worker, node->children[quadrant], child_first[quadrant],
+                                   number_of_child_polygons[quadrant], number_of_child_covering[quadrant]);
+        if (error_code != QUADTREE_SUCCESS) {
+            return error_code;
+        }
+    }
+    worker->edges.size = edges_size;
+    return QUADTREE_SUCCESS;
+}
+
+/* Appends polygon to destination if it collides with rect.
+ * destination already holds *number_of_polygons polygons of which the
+ * first *number_of_covering cover rect; a polygon covering rect as
+ * well joins those at the front.  Like lq_quadtree_node_put_polygon()
+ * only the edges of the polygon entering its node are tested, and the
+ * ones entering rect are pushed on the edge stack of worker, which
+ * must have room for them.  polygon may lie in destination at or after
+ * *number_of_polygons.
+ *
+ * If no edge enters rect its corner decides.  The corners decided so
+ * far for the polygon in the same node are kept in probes, and a
+ * corner in the same row as one of them only needs the edges entering
+ * the node instead of a point in polygon test over all edges. */
+static void lq_build_filter(lq_build_worker_t *worker, lq_build_item_t *polygon, lq_rect_t *rect, lq_build_probe_t *probes, int *number_of_probes, lq_build_item_t *destination, int *number_of_polygons, int *number_of_covering) {
+    int i, classification;
+    int number_of_entering = 0;
+    lq_edge_stack_t *edges = &worker->edges;
+    lq_build_item_t item = *polygon;
+    lq_polygon_t *p = item.polygon;
+    if (p->max_x <= rect->left || rect->left + rect->width <= p->min_x ||
+        p->max_y <= rect->bottom || rect->bottom + rect->height <= p->min_y) {
+        return;
+    }
+    for (i = 0; i < *number_of_probes && probes[i].y != rect->bottom; ++i) {
+    }
+    if (i == *number_of_probes) {
+        classification = lq_polygon_classify_edges(p, item.number_of_edges, edges->edges + item.first_edge,
+                                                   edges->edges + edges->size, &number_of_entering, rect);
+        if (number_of_entering == 0) {
+            probes[i].x = rect->left;
+            probes[i].y = rect->bottom;
+            probes[i].inside = classification == RECTANGLE_COVERED;
+            (*number_of_probes)++;
+        }
+    } else {
+        number_of_entering = lq_polygon_find_entering_edges(p, item.number_of_edges, edges->edges + item.first_edge,
+                                                            edges->edges + edges->size, rect);
+        if (number_of_entering > 0) {
+            classification = RECTANGLE_PARTIALLY_COVERED;
+        } else if (lq_polygon_contains_in_row(p, rect->left, rect->bottom, probes[i].x, probes[i].inside,
+                                              item.number_of_edges, edges->edges + item.first_edge)) {
+            classification = RECTANGLE_COVERED;
+        } else {
+            classification = RECTANGLE_OUTSIDE;
+        }
+    }
+    if (classification == RECTANGLE_OUTSIDE) {
+        return;
+    }
+    item.first_edge = edges->size;
+    item.number_of_edges = number_of_entering;
+    edges->size += number_of_entering;
+    destination[*number_of_polygons] = item;
+    if (classification == RECTANGLE_COVERED) {
+        destination[*number_of_polygons] = destination[*number_of_covering];
+        destination[*number_of_covering] = item;
+        (*number_of_covering)++;
+    }
+    (*number_of_polygons)++;
+}
+
+static int lq_build_add_task(lq_build_t *build, lq_build_worker_t *worker, lq_quadtree_node_t *node, lq_build_item_t *polygons, int number_of_polygons, int number_of_covering) {
+    lq_build_task_t *task;
+    lq_build_item_t *item;
+    int i;
+    int number_of_edges = 0;
+    for (i = 0; i < number_of_polygons; ++i) {
+        number_of_edges += polygons[i].number_of_edges;
+    }
+    if (lq_reserve((void**) &build->tasks, &build->tasks_capacity,
+                   build->number_of_tasks + 1, sizeof(lq_build_task_t)) != QUADTREE_SUCCESS ||
+        lq_reserve((void**) &build->task_polygons, &build->task_polygons_capacity,
+                   build->number_of_task_polygons + number_of_polygons, sizeof(lq_build_item_t)) != QUADTREE_SUCCESS ||
+        lq_edge_stack_reserve(&build->task_edges, build->task_edges.size + number_of_edges) != 0) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    /* with the envelopes of node and its ancestors grown now, the
+     * workers never get past node when they grow envelopes */
+    for (i = 0; i < number_of_polygons; ++i) {
+        lq_quadtree_node_extend_envelope(node, polygons[i].polygon);
+    }
+    task = &build->tasks[build->number_of_tasks++];
+    task->node = node;
+    task->first_polygon = build->number_of_task_polygons;
+    task->number_of_polygons = number_of_polygons;
+    task->number_of_covering = number_of_covering;
+    task->first_edge = build->task_edges.size;
+    task->number_of_edges = number_of_edges;
+    /* the edges of the task are copied one after the other and the
+     * polygons refer to them from the start of the task */
+    for (i = 0; i < number_of_polygons; ++i) {
+        item = &build->task_polygons[build->number_of_task_polygons++];
+        item->polygon = polygons[i].polygon;
+        item->first_edge = build->task_edges.size - task->first_edge;
+        item->number_of_edges = polygons[i].number_of_edges;
+        if (item->number_of_edges > 0) {
+            memcpy(build->task_edges.edges + build->task_edges.size, worker->edges.edges + polygons[i].first_edge,
+                   item->number_of_edges * sizeof(int));
+            build->task_edges.size += item->number_of_edges;
+        }
+    }
+    return QUADTREE_SUCCESS;
+}
+
+/* orders tasks by decreasing number of polygons */
+static int lq_build_task_compare(const void *a, const void *b) {
+    const lq_build_task_t *task_a = (const lq_build_task_t*) a;
+    const lq_build_task_t *task_b = (const lq_build_task_t*) b;
+    return task_b->number_of_polygons - task_a->number_of_polygons;
+}
+
+static void lq_build_task(int worker_index, void *context) {
+    lq_build_t *build = (lq_build_t*) context;
+    lq_build_worker_t *worker = &build->workers[worker_index];
+    lq_build_task_t *task;
+    int task_index, error_code;
+    COUNTERS_BEGIN();
+    for (;;) {
+        task_index = __atomic_fetch_add(&build->next_task, 1, __ATOMIC_RELAXED);
+        if (task_index >= build->number_of_tasks ||
+            __atomic_load_n(&build->error_code, __ATOMIC_RELAXED) != QUADTREE_SUCCESS) {
+            break;
+        }
+        task = &build->tasks[task_index];
+        error_code = lq_reserve((void**) &worker->stack, &worker->stack_capacity,
+                                task->number_of_polygons, sizeof(lq_build_item_t));
+        if (error_code == QUADTREE_SUCCESS && lq_edge_stack_reserve(&worker->edges, task->number_of_edges) != 0) {
+            error_code = QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+        if (error_code == QUADTREE_SUCCESS && task->number_of_polygons > 0) {
+            memcpy(worker->stack, build->task_polygons + task->first_polygon,
+                   task->number_of_polygons * sizeof(lq_build_item_t));
+        }
+        if (error_code == QUADTREE_SUCCESS && task->number_of_edges > 0) {
+            memcpy(worker->edges.edges, build->task_edges.edges + task->first_edge,
+                   task->number_of_edges * sizeof(int));
+        }
+        worker->edges.size = task->number_of_edges;
+        if (error_code == QUADTREE_SUCCESS) {
+            error_code = lq_build_node(build, worker, task->node, 0,
+                                       task->number_of_polygons, task->number_of_covering);
+        }
+        if (error_code != QUADTREE_SUCCESS) {
+            __atomic_store_n(&build->error_code, error_code, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    COUNTERS_COLLECT(&build->counters);
+}
+
+static void lq_freeze_count(lq_quadtree_node_t *node, int *number_of_nodes, int *number_of_entries) {
+    int quadrant;
+    (*number_of_nodes)++;
+    *number_of_entries += node->number_of_polygons;
+    if (node->children[FIRST_QUADRANT] != NULL) {
+        for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+            lq_freeze_count(node->children[quadrant], number_of_nodes, number_of_entries);
+        }
+    }
+}
+
+/* stores node at index and its children depth first */
+static void lq_freeze_node(lq_freeze_t *freeze, lq_quadtree_node_t *node, int index) {
+    int i, quadrant;
+    lq_frozen_quadtree_t *frozen = freeze->frozen;
+    lq_frozen_node_t *frozen_node = &frozen->nodes[index];
+    lq_node_arrays_t arrays = lq_quadtree_node_arrays(node);
+    if (node->children[FIRST_QUADRANT] != NULL) {
+        frozen_node->first = freeze->next_node;
+        frozen_node->number_of_entries = -1;
+        freeze->next_node += NUMBER_OF_QUADRANTS;
+        for (quadrant = FIRST_QUADRANT; quadrant < NUMBER_OF_QUADRANTS; ++quadrant) {
+            lq_freeze_node(freeze, node->children[quadrant], frozen_node->first + quadrant);
+        }
+    } else {
+        frozen_node->first = freeze->next_entry;
+        frozen_node->number_of_entries = node->number_of_polygons;
+        for (i = 0; i < node->number_of_polygons; ++i) {
+            lq_polygon_t *polygon = arrays.polygons[i];
+            lq_frozen_entry_t *entry = &frozen->entries[freeze->next_entry];
+            memset(entry, 0, sizeof(lq_frozen_entry_t));
+            entry->id = polygon->id;
+            entry->first_point = *((int*) lq_idmap_get(&freeze->first_points, (long) polygon));
+            entry->number_of_points = polygon->number_of_points;
+            frozen->min_xs[freeze->next_entry] = arrays.min_xs[i];
+            frozen->min_ys[freeze->next_entry] = arrays.min_ys[i];
+            frozen->max_xs[freeze->next_entry] = arrays.max_xs[i];
+            frozen->max_ys[freeze->next_entry] = arrays.max_ys[i];
+            freeze->next_entry++;
+        }
+    }
+}
+
+/* points the arrays of frozen to their place in frozen->memory */
+static void lq_frozen_layout(lq_frozen_quadtree_t *frozen) {
+    char *memory = (char*) frozen->memory;
+    frozen->header = (lq_frozen_header_t*) memory;
+    memory += sizeof(lq_frozen_header_t);
+    frozen->nodes = (lq_frozen_node_t*) memory;
+    memory += frozen->header->number_of_nodes * sizeof(lq_frozen_node_t);
+    frozen->entries = (lq_frozen_entry_t*) memory;
+    memory += frozen->header->number_of_entries * sizeof(lq_frozen_entry_t);
+    frozen->min_xs = (int*) memory;
+    frozen->min_ys = frozen->min_xs + frozen->header->number_of_entries;
+    frozen->max_xs = frozen->min_ys + frozen->header->number_of_entries;
+    frozen->max_ys = frozen->max_xs + frozen->header->number_of_entries;
+    memory += 4 * frozen->header->number_of_entries * sizeof(int);
+    frozen->xs = (int*) memory;
+    frozen->ys = frozen->xs + frozen->header->number_of_points;
+}
+
+/* Whether every index of frozen stays within its arrays, so that
+ * queries of a loaded snapshot whose checksum matches but that was not
+ * written by quadtree_save() cannot read outside of the mapping.  The
+ * children of a node have to come after it, which also keeps
+ * lq_frozen_find_leaf() from running in circles. */
+static bool lq_frozen_is_valid(lq_frozen_quadtree_t *frozen) {
+    int i;
+    lq_frozen_header_t *header = frozen->header;
+    lq_frozen_node_t *node;
+    lq_frozen_entry_t *entry;
+    for (i = 0; i < header->number_of_nodes; ++i) {
+        node = &frozen->nodes[i];
+        if (node->number_of_entries < 0) {
+            if (node->number_of_entries != -1 || node->first <= i ||
+                node->first > header->number_of_nodes - NUMBER_OF_QUADRANTS) {
+                return false;
+            }
+        } else if (node->first < 0 || node->first > header->number_of_entries - node->number_of_entries) {
+            return false;
+        }
+    }
+    for (i = 0; i < header->number_of_entries; ++i) {
+        entry = &frozen->entries[i];
+        if (entry->first_point < 0 || entry->number_of_points < 0 ||
+            entry->first_point > header->number_of_points - entry->number_of_points) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The size of the memory of a frozen quadtree with header.  The
+ * arrays are padded to a multiple of the size of long which keeps the
+ * entries of a mapped snapshot aligned. */
+static size_t lq_frozen_size(const lq_frozen_header_t *header) {
+    size_t size = sizeof(lq_frozen_header_t) +
+                  (size_t) header->number_of_nodes * sizeof(lq_frozen_node_t) +
+                  (size_t) header->number_of_entries * (sizeof(lq_frozen_entry_t) + 4 * sizeof(int)) +
+                  2 * (size_t) header->number_of_points * sizeof(int);
+    return (size + sizeof(long) - 1) / sizeof(long) * sizeof(long);
+}
+
+/* FNV-1a over the 4 byte words of memory whose size is a multiple of 4 */
+static unsigned long long lq_checksum(const void *memory, size_t size) {
+    size_t i;
+    const unsigned int *words = (const unsigned int*) memory;
+    unsigned long long checksum = 0xcbf29ce484222325ull;
+    for (i = 0; i < size / sizeof(unsigned int); ++i) {
+        checksum ^= words[i];
+        checksum *= 0x100000001b3ull;
+    }
+    return checksum;
+}
+
+static void lq_snapshot_header_initialize(lq_snapshot_header_t *header, lq_frozen_quadtree_t *frozen) {
+    memset(header, 0, sizeof(lq_snapshot_header_t));
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = SNAPSHOT_VERSION;
+    header->byte_order = SNAPSHOT_BYTE_ORDER;
+    header->long_size = (int) sizeof(long);
+    header->size = frozen->size;
+    header->checksum = lq_checksum(frozen->memory, frozen->size);
+}
+
+static const lq_frozen_node_t* lq_frozen_find_leaf(lq_frozen_quadtree_t *frozen, int x, int y) {
+    /* children in the order of the quadrants indexed by [top][right] */
+    static const int quadrants[2][2] = {
+        { THIRD_QUADRANT, FOURTH_QUADRANT },
+        { SECOND_QUADRANT, FIRST_QUADRANT }
+    };
+    int left = frozen->header->left;
+    int bottom = frozen->header->bottom;
+    int width = frozen->header->width;
+    int height = frozen->header->height;
+    const lq_frozen_node_t *node = frozen->nodes;
+    while (node->number_of_entries < 0) {
+        int right, top;
+        width /= 2;
+        height /= 2;
+        right = x >= left + width;
+        top = y >= bottom + height;
+        left += right * width;
+        bottom += top * height;
+        node = frozen->nodes + node->first + quadrants[top][right];
+    }
+    return node;
+}
+
+/* makes room for at least size elements in *buffer.  The buffer grows
+ * geometrically and is never shrunk so that buffers which are reused
+ * stop allocating once they are warmed up. */
+static int lq_reserve(void **buffer, int *capacity, int size, size_t element_size) {
+    int new_capacity = *capacity;
+    void *new_buffer;
+    if (size <= new_capacity) {
+        return QUADTREE_SUCCESS;
+    }
+    if (new_capacity < 8) {
+        new_capacity = 8;
+    }
+    while (new_capacity < size) {
+        new_capacity *= 2;
+    }
+    COUNT(allocations, 1);
+    new_buffer = realloc(*buffer, new_capacity * element_size);
+    if (new_buffer == NULL) {
+        return QUADTREE_ERROR_OUT_OF_MEMORY;
+    }
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return QUADTREE_SUCCESS;
+}
+
 static void lq_quadtree_query_result_reset(quadtree_query_result_t *query_result) {
     if (query_result != NULL) {
-        free(query_result->ids);
-        query_result->ids = NULL;
-        query_result->number_of_ids = -1;
+        query_result->number_of_ids = 0;
     }
 }
+
+static int lq_quadtree_query_result_reserve(quadtree_query_result_t *query_result, int number_of_ids) {
+    return lq_reserve((void**) &query_result->ids, &query_result->capacity, number_of_ids, sizeof(long));
+}
+
+/* Appends id unless it is already part of the result.  A window query
+ * finds a polygon once for every leaf it overlaps, so when the buffer
+ * is full the ids are first sorted and deduplicated in place and the
+ * buffer only grows if that did not free at least half of it.  The
+ * result is only free of duplicates after a final call to
+ * lq_quadtree_query_result_make_unique(). */
+static int lq_quadtree_query_result_append_unique(quadtree_query_result_t *query_result, long id) {
+    if (query_result->number_of_ids == query_result->capacity) {
+        lq_quadtree_query_result_make_unique(query_result);
+        if (2 * query_result->number_of_ids >= query_result->capacity &&
+            lq_quadtree_query_result_reserve(query_result, query_result->capacity + 1) != QUADTREE_SUCCESS) {
+            return QUADTREE_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    query_result->ids[query_result->number_of_ids] = id;
+    query_result->number_of_ids++;
+    return QUADTREE_SUCCESS;
+}
+
+/* sorts the ids of the result and drops duplicates */
+static void lq_quadtree_query_result_make_unique(quadtree_query_result_t *query_result) {
+    int i, number_of_ids = 0;
+    if (query_result->number_of_ids < 2) {
+        return;
+    }
+    qsort(query_result->ids, query_result->number_of_ids, sizeof(long), lq_compare_ids);
+    for (i = 0; i < query_result->number_of_ids; ++i) {
+        if (number_of_ids == 0 || query_result->ids[number_of_ids - 1] != query_result->ids[i]) {
+            query_result->ids[number_of_ids] = query_result->ids[i];
+            number_of_ids++;
+        }
+    }
+    query_result->number_of_ids = number_of_ids;
+}
+
+static int lq_compare_ids(const void *a, const void *b) {
+    long id_a = *(const long*) a;
+    long id_b = *(const long*) b;
+    return (id_a > id_b) - (id_a < id_b);
+}
@@ -53,7 +53,8 @@
  * cover with this quadtree.
  *
  * Next, you should populate the quadtree with polygons by calling
- * quadtree_add().
+ * quadtree_add().  If all polygons are known up front it is much
+ * faster to pass them to quadtree_build() in one go instead.
  *
  * Once the quadtree is filled you can query it by calling
  * quadtree_query().  It expects a pointer to a quadtree_query_result_t
@@ -61,17 +62,111 @@
  * of the query.  To obtain a quadtree_query_result_t you should call
  * quadtree_query_result_allocate().  After processing the results you
  * can reuse a quadtree_query_result_t object for further queries.
+ * Reusing it is encouraged since its buffer is kept between queries
+ * and only ever grows, so that steady-state queries do not allocate.
  * Once you are done with a quadtree_query_result_t object you should
  * dispose of it by calling quadtree_query_result_free().
  *
- * Should a polygon change it has to be removed by calling
- * quadtree_remove() and readded by calling quadtree_add().
+ * If you only need to look at each matching id once you can call
+ * quadtree_query_visit() instead which hands every id to a callback
+ * and does not need a result object at all.
+ *
+ * Many points can be looked up at once with quadtree_query_batch()
+ * which fills a quadtree_batch_result_t obtained from
+ * quadtree_batch_result_allocate().  This is considerably faster than
+ * calling quadtree_query() for every point.
+ *
+ * Should a polygon change it can be given its new shape by calling
+ * quadtree_update().  Polygons are removed by calling
+ * quadtree_remove() which also merges nodes that are no longer needed
+ * back into their parents.  quadtree_compact() does the same for the
+ * whole quadtree.
+ *
+ * Very large batches can be spread over several threads by creating a
+ * worker pool with quadtree_worker_pool_create() and passing it to
+ * quadtree_query_batch_parallel().
+ *
+ * A series of queries that must all see the same polygons while the
+ * quadtree keeps changing can be run on a quadtree_snapshot_t taken
+ * with quadtree_snapshot().  Taking one copies nothing; the quadtree
+ * instead keeps what the snapshot sees of the parts it changes until
+ * the snapshot is released with quadtree_snapshot_release().  These
+ * snapshots live in memory and have nothing to do with the snapshot
+ * files written by quadtree_save().
+ *
+ * A quadtree that is done changing can be compiled into a compact,
+ * read-only quadtree_frozen_t by calling quadtree_freeze().  Querying
+ * it with quadtree_frozen_query() gives the same results as
+ * quadtree_query() but is faster since the frozen form is laid out in
+ * a few contiguous arrays instead of many small nodes.
+ *
+ * quadtree_save() writes the frozen form of a quadtree to a file.
+ * quadtree_load() maps such a file into memory and returns a
+ * quadtree_frozen_t that is queried right from the mapping, so loading
+ * takes no longer than checking the file and all processes loading
+ * the same file share one copy of it.
+ *
+ * Polygons stored in files can be streamed into a quadtree with
+ * quadtree_ingest() which reads well-known text, GeoJSON or CSV from a
+ * file descriptor and adds every record as soon as it is parsed.
  *
  * When the quadtree is no longer needed it can be disposed of by
  * calling quadtree_destroy(). This will clean up all internal data
  * structures. It is \em not necessary to remove the polygons before
  * destroying a quadtree.
  *
+ * @section Threads Thread safety
+ *
+ * Functions that only read a quadtree may be called concurrently from
+ * any number of threads as long as no thread modifies the same
+ * quadtree at the same time.  The read-only functions are
+ * quadtree_query(), quadtree_query_visit(), quadtree_query_rect(),
+ * quadtree_query_nearest(), quadtree_query_batch(),
+ * quadtree_query_batch_xy(), quadtree_query_batch_parallel() and
+ * quadtree_freeze().  A
+ * quadtree_frozen_t never changes, so quadtree_frozen_query() may be
+ * called from any number of threads at any time.  Each thread has to
+ * pass its own quadtree_query_result_t, quadtree_nearest_result_t or
+ * quadtree_batch_result_t since the result objects are written to,
+ * and a quadtree_worker_pool_t can only run one
+ * quadtree_query_batch_parallel() at a time.
+ *
+ * quadtree_add(), quadtree_add_batch(), quadtree_build(),
+ * quadtree_ingest(), quadtree_update(), quadtree_remove(),
+ * quadtree_compact(), quadtree_set_edge_index() and quadtree_destroy()
+ * modify the quadtree and must not run concurrently with any other
+ * call on the same quadtree.  quadtree_get_stats() walks the quadtree
+ * without any protection and needs the same exclusive access.
+ * Distinct quadtrees are completely independent of each other.
+ *
+ * A quadtree created with quadtree_config_t::concurrent_readers set
+ * also lets one thread at a time call quadtree_add(),
+ * quadtree_add_batch(), quadtree_ingest(), quadtree_remove(),
+ * quadtree_update(), quadtree_compact() and quadtree_set_edge_index()
+ * while other threads call quadtree_query(), quadtree_query_visit(),
+ * quadtree_query_rect(), quadtree_query_nearest(),
+ * quadtree_query_batch(), quadtree_query_batch_xy() and
+ * quadtree_query_batch_parallel().  Queries
+ * take no locks and never wait for the writer.  A query sees every
+ * polygon that was not changed while it ran; a polygon that was added,
+ * removed or updated meanwhile may or may not be reported, and a query
+ * running during quadtree_update() may report the old and the new
+ * shape.  quadtree_build(), quadtree_freeze(), quadtree_save(),
+ * quadtree_get_stats() and quadtree_destroy() still require that no
+ * other call runs at the same time.
+ *
+ * quadtree_snapshot() and quadtree_snapshot_release() may be called
+ * from any thread at any time, also while another thread changes the
+ * quadtree; taking a snapshot waits for a change in progress to
+ * finish.  quadtree_snapshot_query(), quadtree_snapshot_query_rect()
+ * and quadtree_snapshot_query_nearest() may run on any number of
+ * threads while one thread changes the quadtree, whether or not it
+ * was created with concurrent readers, and see none of the changes.
+ * quadtree_build() fails while snapshots of the quadtree exist.
+ * Snapshots still held when the quadtree is destroyed can only be
+ * released afterwards, and quadtree_destroy() must not run at the same
+ * time as any call on them.
+ *
  * @section Example
  *
  * \code{.c}
@@ -136,6 +231,31 @@ int QUADTREE_ERROR_OUT_OF_BOUNDS =       3;
  */
 typedef struct lq_quadtree_t *quadtree_t;
 
+/**
+ * @brief Opaque object representing a set of worker threads.
+ * @anchor quadtree_worker_pool_t
+ *
+ * @see quadtree_worker_pool_create()
+ * @see quadtree_query_batch_parallel()
+ */
+typedef struct lq_worker_pool_t *quadtree_worker_pool_t;
+
+/**
+ * @brief Opaque object representing a frozen quadtree.
+ * @anchor quadtree_frozen_t
+ *
+ * @see quadtree_freeze()
+ */
+typedef struct lq_frozen_quadtree_t *quadtree_frozen_t;
+
+/**
+ * @brief Opaque object representing a quadtree as it was at one moment.
+ * @anchor quadtree_snapshot_t
+ *
+ * @see quadtree_snapshot()
+ */
+typedef struct lq_snapshot_t *quadtree_snapshot_t;
+
 /**
  * @brief Structure to hold the result of a quadtree query
  *
@@ -155,8 +275,316 @@ typedef struct {
     int number_of_ids;
     /** an array of ids that resulted from the query */
     long *ids;
+    /** the number of ids that fit into \a ids before it has to be
+     * reallocated.  Managed by the library.
+     */
+    int capacity;
 } quadtree_query_result_t;
 
+/**
+ * @brief Structure to hold the result of a batch query
+ *
+ * The ids found for the i-th point of a batch are
+ * <tt>ids[offsets[i]]</tt> up to but excluding
+ * <tt>ids[offsets[i + 1]]</tt>.  Like quadtree_query_result_t it
+ * should be reused for multiple batches because its buffers are kept.
+ *
+ * @see quadtree_batch_result_allocate()
+ * @see quadtree_batch_result_free()
+ * @see quadtree_query_batch()
+ */
+typedef struct {
+    /** the number of points of the last batch or -1 if it failed */
+    int number_of_points;
+    /** number_of_points + 1 offsets into \a ids */
+    int *offsets;
+    /** the total number of ids in \a ids or -1 if the batch failed */
+    int number_of_ids;
+    /** the ids of all points, grouped by point */
+    long *ids;
+    /** size of the \a offsets buffer.  Managed by the library. */
+    int offsets_capacity;
+    /** size of the \a ids buffer.  Managed by the library. */
+    int ids_capacity;
+    /** working memory.  Managed by the library. */
+    void *scratch;
+} quadtree_batch_result_t;
+
+/**
+ * @brief Structure to hold the result of a nearest polygon query
+ *
+ * Like quadtree_query_result_t but every id comes with the distance
+ * of its polygon to the query point.  It should be reused for
+ * multiple queries because its buffers are kept.
+ *
+ * @see quadtree_nearest_result_allocate()
+ * @see quadtree_nearest_result_free()
+ * @see quadtree_query_nearest()
+ */
+typedef struct {
+    /** the number of ids this result contains or -1 if the query
+     * failed
+     */
+    int number_of_ids;
+    /** the ids of the polygons, nearest first */
+    long *ids;
+    /** distances[i] is the distance of the polygon ids[i] */
+    double *distances;
+    /** the number of ids that fit into \a ids and \a distances
+     * before they have to be reallocated.  Managed by the library.
+     */
+    int capacity;
+    /** working memory.  Managed by the library. */
+    void *scratch;
+} quadtree_nearest_result_t;
+
+/**
+ * @brief How a quadtree subdivides its area
+ *
+ * A leaf is split into four children when a polygon that only
+ * partially covers it is added, unless the leaf is already
+ * \a max_depth levels deep or no wider or higher than \a min_size.
+ * Leaves may be allowed to hold some partially covering polygons
+ * before they are split.  The cost of a point query in a leaf is
+ * roughly the total number of corners of those polygons, so a leaf is
+ * split once it would hold more than \a max_leaf_entries of them or
+ * once they would have more than \a max_leaf_points corners
+ * together.
+ *
+ * Shallow trees with big leaves need less memory while deep trees
+ * answer queries faster.  Always fill the structure with
+ * quadtree_config_initialize() before changing individual fields.
+ *
+ * @see quadtree_config_initialize()
+ * @see quadtree_create_ex()
+ */
+typedef struct {
+    /** the depth below which leaves are never split.  Defaults to
+     * 15.
+     */
+    int max_depth;
+    /** leaves whose width or height is no more than this are never
+     * split.  Must be at least 1 and defaults to 4.
+     */
+    int min_size;
+    /** the number of partially covering polygons a leaf may hold
+     * without being split.  Defaults to 0 which splits a leaf as
+     * soon as a polygon only partially covers it.
+     */
+    int max_leaf_entries;
+    /** the total number of corners the partially covering polygons
+     * of a leaf may have without the leaf being split.  0, the
+     * default, places no limit on the corners.
+     */
+    int max_leaf_points;
+    /** non-zero lets queries run while one thread changes the
+     * quadtree, see @ref Threads.  Changes cost a little more since
+     * the memory they free is only reclaimed once no query can see it
+     * anymore.  Defaults to 0.
+     */
+    int concurrent_readers;
+} quadtree_config_t;
+
+/**
+ * @brief The number of buckets of the histograms in quadtree_stats_t
+ */
+#define QUADTREE_STATS_BUCKETS (32)
+
+/**
+ * @brief Structure describing the shape and size of a quadtree
+ *
+ * Byte counts are what the quadtree allocated, without the overhead of
+ * the memory allocator.  Nodes, entries and polygons are carved from
+ * pools which do not hand memory back before the quadtree is
+ * destroyed, so their byte counts include freed objects that await
+ * reuse.
+ *
+ * @see quadtree_get_stats()
+ */
+typedef struct {
+    /** the number of nodes including the root */
+    long number_of_nodes;
+    /** the number of nodes without children */
+    long number_of_leaves;
+    /** the depth of the deepest leaf.  The root has depth 0. */
+    int max_depth;
+    /** nodes_per_depth[d] is the number of nodes at depth d */
+    long nodes_per_depth[QUADTREE_STATS_BUCKETS];
+    /** leaves_per_size[0] is the number of leaves without polygons
+     * and leaves_per_size[b] for b > 0 the number of leaves holding
+     * at least 2^(b-1) and less than 2^b polygons
+     */
+    long leaves_per_size[QUADTREE_STATS_BUCKETS];
+    /** the number of polygons of the fullest leaf */
+    long max_leaf_polygons;
+    /** the number of polygons held by the leaves together, counting a
+     * polygon once for every leaf holding it
+     */
+    long number_of_entries;
+    /** the number of distinct polygons */
+    long number_of_polygons;
+    /** the number of leaves holding the polygon that is held by the
+     * most leaves
+     */
+    long max_polygon_entries;
+    /** the id of that polygon */
+    long max_polygon_entries_id;
+    /** the number of corners of all polygons */
+    long number_of_points;
+    /** bytes taken by the nodes */
+    long node_bytes;
+    /** bytes taken by the entries linking polygons and leaves */
+    long entry_bytes;
+    /** bytes taken by the arrays in which leaves keep their entries
+     * and the bounding boxes of their polygons
+     */
+    long leaf_array_bytes;
+    /** bytes taken by the polygons, not counting their corners */
+    long polygon_bytes;
+    /** bytes taken by the corners of the polygons */
+    long point_bytes;
+    /** bytes taken by the edge indexes of large polygons, see
+     * quadtree_set_edge_index()
+     */
+    long edge_index_bytes;
+    /** bytes taken by the lookup of polygons by id */
+    long id_map_bytes;
+    /** all of the above and the bookkeeping of the quadtree itself */
+    long total_bytes;
+} quadtree_stats_t;
+
+/**
+ * @brief Structure counting the work done by quadtree calls
+ *
+ * The counters are only maintained if the library was compiled with
+ * QUADTREE_COUNTERS defined, e.g. with
+ * <tt>make DEFINES=-DQUADTREE_COUNTERS</tt>.
+ *
+ * @see quadtree_get_counters()
+ * @see quadtree_get_call_counters()
+ */
+typedef struct {
+    /** the number of nodes visited on the way to a leaf or while
+     * placing or finding polygons
+     */
+    unsigned long nodes_visited;
+    /** the number of entries of leaves looked at by queries */
+    unsigned long entries_scanned;
+    /** the number of exact point in polygon tests */
+    unsigned long point_in_polygon_calls;
+    /** the number of polygon edges tested against points or nodes */
+    unsigned long edges_tested;
+    /** the number of objects and buffers allocated from the heap or
+     * from the pools of the quadtree
+     */
+    unsigned long allocations;
+} quadtree_counters_t;
+
+/**
+ * @brief The text formats quadtree_ingest() understands
+ *
+ * Every format has one record per line.  Blank lines are skipped and
+ * so are lines starting with '#' in all formats but
+ * QUADTREE_FORMAT_GEOJSON.  A record gives the id of a polygon and the
+ * outer ring of the polygon or, for multipolygons, of each of its
+ * parts.  Rings may repeat their first corner at the end.  Polygons
+ * with holes are not supported.
+ */
+typedef enum {
+    /** an integer id and a POLYGON or MULTIPOLYGON in well-known
+     * text, separated by white space, ',' or ';'.  The geometry may be
+     * enclosed in double quotes, e.g.
+     * <tt>7,"POLYGON ((0 0, 10 0, 10 10, 0 0))"</tt>
+     */
+    QUADTREE_FORMAT_WKT,
+    /** a GeoJSON Feature with an integer id, or a string holding one,
+     * and a Polygon or MultiPolygon geometry on every line as in
+     * newline delimited GeoJSON
+     */
+    QUADTREE_FORMAT_GEOJSON,
+    /** an integer id followed by the x and y coordinates of all
+     * corners, all separated by ',', e.g. <tt>7,0,0,10,0,10,10</tt>
+     */
+    QUADTREE_FORMAT_CSV
+} quadtree_format_t;
+
+/**
+ * @brief Callback invoked by quadtree_ingest() for every bad record
+ *
+ * @param line_number the number of the line holding the record,
+ *                    starting at 1
+ * @param error_code QUADTREE_ERROR if the record could not be parsed
+ *                   or QUADTREE_ERROR_OUT_OF_BOUNDS if part of the
+ *                   polygon lies outside the area covered by the
+ *                   quadtree
+ * @param message a description of the problem
+ * @param context the \a context of the quadtree_ingest_options_t
+ */
+typedef void (*quadtree_ingest_error_handler_t)(long line_number, int error_code, const char *message, void *context);
+
+/**
+ * @brief How quadtree_ingest() reads its input
+ *
+ * A coordinate x of the input is placed at the integer
+ * <tt>(x - origin_x) * scale_x</tt> rounded to the nearest integer and
+ * likewise for y.  Always fill the structure with
+ * quadtree_ingest_options_initialize() before changing individual
+ * fields.
+ *
+ * @see quadtree_ingest_options_initialize()
+ * @see quadtree_ingest()
+ */
+typedef struct {
+    /** the format of the input.  Defaults to QUADTREE_FORMAT_WKT. */
+    quadtree_format_t format;
+    /** the x coordinate placed at 0.  Defaults to 0. */
+    double origin_x;
+    /** the y coordinate placed at 0.  Defaults to 0. */
+    double origin_y;
+    /** the grid units per unit of x.  Defaults to 1. */
+    double scale_x;
+    /** the grid units per unit of y.  Defaults to 1. */
+    double scale_y;
+    /** the number of lines at the start of the input to ignore, e.g.
+     * a header.  Defaults to 0.
+     */
+    long skip_lines;
+    /** lines longer than this many bytes are reported as errors
+     * instead of being read into memory.  Defaults to 16 MiB.
+     */
+    long max_record_length;
+    /** called for every record that could not be added or NULL.
+     * Defaults to NULL.
+     */
+    quadtree_ingest_error_handler_t error_handler;
+    /** passed on to \a error_handler */
+    void *context;
+} quadtree_ingest_options_t;
+
+/**
+ * @brief What quadtree_ingest() did
+ *
+ * @see quadtree_ingest()
+ */
+typedef struct {
+    /** the number of records read, including bad ones */
+    long number_of_records;
+    /** the number of polygons added.  Every part of a multipolygon
+     * is counted.
+     */
+    long number_of_polygons;
+    /** the number of records that were not added */
+    long number_of_errors;
+} quadtree_ingest_stats_t;
+
+/**
+ * @brief Callback invoked by quadtree_query_visit()
+ *
+ * @param id the id of a polygon that contains the query point
+ * @param context the pointer that was passed to quadtree_query_visit()
+ */
+typedef void (*quadtree_query_visitor_t)(long id, void *context);
+
 
 /**
  * @brief Creates a new quadtree object
@@ -179,10 +607,47 @@ typedef struct {
  */
 quadtree_t quadtree_create(int left, int bottom, int width, int height);
 
+/**
+ * @brief Fill a quadtree_config_t with the defaults
+ *
+ * The defaults are what quadtree_create() uses.
+ *
+ * @param config the structure to fill
+ * @see quadtree_create_ex
+ */
+void quadtree_config_initialize(quadtree_config_t *config);
+
+/**
+ * @brief Creates a new quadtree object subdividing as configured
+ *
+ * Like quadtree_create() but the quadtree subdivides its area as set
+ * out in \a config which is copied.  Leaves that hold partially
+ * covering polygons are split when a further one is added, so a
+ * quadtree filled by quadtree_add() may end up with a few leaves above
+ * the limits while quadtree_build() splits every leaf that exceeds
+ * them.  Both answer queries the same.
+ *
+ * @param left the x coordinate of the left side of the area covered
+ *             by the quadtree
+ * @param bottom the y coordinate of the bottom side of the area
+ *               covered by the quadtree
+ * @param width the width of the area covered by the quadtree
+ * @param height the height of the area covered by the quadtree
+ * @param config how the quadtree subdivides its area
+ * @returns the new quadtree object or NULL on failure or if a field of
+ *          \a config is negative or \a min_size is 0
+ * @see quadtree_config_initialize
+ * @see quadtree_create
+ */
+quadtree_t quadtree_create_ex(int left, int bottom, int width, int height, const quadtree_config_t *config);
+
 /**
  * @brief Deletes a quadtree object
  *
- * Cleans up all resources of the quadtree.
+ * Cleans up all resources of the quadtree.  Snapshots of the
+ * quadtree that were not released yet stay valid until they are
+ * passed to quadtree_snapshot_release(), but cannot be queried
+ * anymore.
  *
  * @param quadtree the quadtree to be deleted
  * @see quadtree_create
@@ -213,20 +678,137 @@ void quadtree_destroy(quadtree_t quadtree);
  */
 int quadtree_add(quadtree_t quadtree, long id, int number_of_polygon_points, int xs[], int ys[]);
 
+/**
+ * @brief Change the corners of a polygon in place
+ *
+ * Gives the polygon with the given \a id a new shape.  This has the
+ * same effect as quadtree_remove() followed by quadtree_add() but
+ * leaves the nodes that hold the polygon before and after the change
+ * alone: entries are only added to the nodes the polygon moved into and
+ * removed from the nodes it left.  The coordinate array of the polygon
+ * is reused if the number of corners stays the same.  This makes it
+ * cheap to move or reshape polygons by small amounts.
+ *
+ * If there is no polygon with the \a id yet it is added like
+ * quadtree_add() does.  If there are several all of them are replaced
+ * by the new shape.
+ *
+ * @param quadtree the quadtree to operate on
+ * @param id the id of the polygon to change
+ * @param number_of_polygon_points size of the following arrays
+ * @param xs[] array of the new x coordinates
+ * @param ys[] array of the new y coordinates
+ * @returns QUADTREE_SUCCESS if successful.
+ * @returns QUADTREE_OUT_OF_BOUNDS if part of the polygon lies outside
+ *                                 the area covered by the quadtree.
+ *                                 The polygon is left unchanged.
+ * @returns QUADTREE_ERROR_OUT_OF_MEMORY if the function could not
+ *                                       allocate memory.  The polygon
+ *                                       is either unchanged or was
+ *                                       removed from the quadtree.
+ * @see quadtree_add
+ * @see quadtree_remove
+ */
+int quadtree_update(quadtree_t quadtree, long id, int number_of_polygon_points, int xs[], int ys[]);
+
+/**
+ * @brief Place many polygons into an empty quadtree at once
+ *
+ * Produces the same quadtree as calling quadtree_add() for every
+ * polygon but builds it top-down: every node is visited once with all
+ * polygons that collide with it instead of being split again and again
+ * as polygons trickle in.  The quadtrees only differ if leaves may hold
+ * partially covering polygons, see quadtree_create_ex().  If
+ * \a worker_pool is not NULL the upper levels are built on the calling
+ * thread and the subtrees below are built by the threads of the pool.
+ *
+ * The corners of all polygons are concatenated in \a xs and \a ys.
+ * The i-th polygon has \a counts[i] corners which follow the corners
+ * of polygon i - 1.
+ *
+ * @param quadtree the quadtree to operate on.  It must be empty.
+ * @param number_of_polygons size of \a ids and \a counts
+ * @param ids[] the id of every polygon
+ * @param counts[] the number of corners of every polygon
+ * @param xs[] x coordinates of the corners of all polygons
+ * @param ys[] y coordinates of the corners of all polygons
+ * @param worker_pool the threads to use or NULL to build the quadtree
+ *                    on the calling thread only
+ * @returns QUADTREE_SUCCESS if successful.
+ * @returns QUADTREE_ERROR if \a quadtree is not empty or snapshots
+ *                         of it exist.
+ * @returns QUADTREE_OUT_OF_BOUNDS if part of a polygon lies outside
+ *                                 the area covered by the quadtree.
+ * @returns QUADTREE_ERROR_OUT_OF_MEMORY if the function could not
+ *                                       allocate memory
+ * In case of an error the quadtree is left empty.
+ * @see quadtree_add
+ * @see quadtree_worker_pool_create
+ */
+int quadtree_build(quadtree_t quadtree, int number_of_polygons, long ids[], int counts[], int xs[], int ys[], quadtree_worker_pool_t worker_pool);
+
+/**
+ * @brief Add many polygons to a quadtree with one call
+ *
+ * Takes the same arrays as quadtree_build() but also works on a
+ * quadtree that already holds polygons, in which case the polygons are
+ * added one after the other as if by quadtree_add().  An empty
+ * quadtree is filled by quadtree_build() instead.  Bindings use this to
+ * hand over whole arrays instead of calling quadtree_add() once per
+ * polygon.
+ *
+ * @param quadtree the quadtree to operate on
+ * @param number_of_polygons size of \a ids and \a counts
+ * @param ids[] the id of every polygon
+ * @param counts[] the number of corners of every polygon
+ * @param xs[] x coordinates of the corners of all polygons
+ * @param ys[] y coordinates of the corners of all polygons
+ * @returns QUADTREE_SUCCESS if successful.
+ * @returns QUADTREE_OUT_OF_BOUNDS if part of a polygon lies outside
+ *                                 the area covered by the quadtree.
+ *                                 No polygon is added.
+ * @returns QUADTREE_ERROR_OUT_OF_MEMORY if the function could not
+ *                                       allocate memory.  Some of the
+ *                                       polygons may have been added.
+ * @see quadtree_add
+ * @see quadtree_build
+ */
+int quadtree_add_batch(quadtree_t quadtree, int number_of_polygons, long ids[], int counts[], int xs[], int ys[]);
+
+/**
+ * @brief Trade memory for faster queries of polygons with many corners
+ *
+ * With the edge index enabled every polygon with at least 16 corners
+ * keeps its edges sorted into buckets by their y range along with
+ * their slope.  Queries then only look at the edges near the query
+ * point and test them with multiplications instead of divisions.  The
+ * results do not change.  The index needs between four and about
+ * seventeen times the memory of the polygon's corners.
+ *
+ * Enabling the index builds it for the polygons already in the
+ * quadtree and all polygons added later; disabling it frees it.
+ *
+ * @param quadtree the quadtree to operate on
+ * @param enabled nonzero to enable the edge index, 0 to disable it
+ * @returns QUADTREE_SUCCESS if successful.
+ * @returns QUADTREE_ERROR_OUT_OF_MEMORY if the function could not
+ *                                       allocate memory.  The index is
+ *                                       not enabled for later polygons
+ *                                       in this case.
+ */
+int quadtree_set_edge_index(quadtree_t quadtree, int enabled);
+
 /**
  * @brief Get a list of polygon ids that contain the given point.
  *
- * Finds all polygons that contain the point (\a x, \a y) and returns
- * them in a newly allocated array.  The Caller is responsible for
- * freeing the allocated memory in the ids parameter.
+ * Finds all polygons that contain the point (\a x, \a y) and stores
+ * them in \a query_result.  The buffer of \a query_result is reused
+ * and only reallocated when it is too small to hold the result.
  *
  * @param[in] quadtree the quadtree to operate on
  * @param[in] x the x coordinate of the point
  * @param[in] y the y coordinate of the point
- * @param[out] number_of_ids the number of ids that were put into the
- *                           ids array
- * @param[out] ids the function will put the list of ids at the
- *                 pointer this argument points to
+ * @param[out] query_result receives the ids of the polygons
  * @returns QUADTREE_SUCCESS if successful.
  * @returns QUADTREE_ERROR_OUT_OF_BOUNDS if (\a x, \a y) does not lie
  *                                       within the quadtree's
@@ -238,6 +820,164 @@ int quadtree_add(quadtree_t quadtree, long id, int number_of_polygon_points, int
  */
 int quadtree_query(quadtree_t quadtree, int x, int y, quadtree_query_result_t *query_result);
 
+/**
+ * @brief Call a function for every polygon that contains the given point.
+ *
+ * Like quadtree_query() but instead of collecting the ids in a result
+ * object \a visitor is called once for every matching polygon.  This
+ * function never allocates memory, except for the first query of a
+ * thread on a quadtree with concurrent readers.
+ *
+ * @param[in] quadtree the quadtree to operate on
+ * @param[in] x the x coordinate of the point
+ * @param[in] y the y coordinate of the point
+ * @param[in] visitor the function to call for every matching polygon
+ * @param[in] context passed through to \a visitor unchanged
+ * @returns QUADTREE_SUCCESS if successful.
+ * @returns QUADTREE_ERROR_OUT_OF_BOUNDS if (\a x, \a y) does not lie
+ *                                       within the quadtree's
+ *                                       bounding box
+ * @returns QUADTREE_ERROR_OUT_OF_MEMORY if the thread could not be
+ *                                       registered as a concurrent
+ *                                       reader
+ * @see quadtree_query
+ */
+int quadtree_query_visit(quadtree_t quadtree, int x, int y, quadtree_query_visitor_t visitor, void *context);
+
+/**
+ * @brief Get a list of polygon ids that intersect the given rectangle.
+ *
+ * Finds all polygons that overlap the rectangle with the lower left
+ * corner (\a left, \a bottom) and the given \a width and \a height.
+ * The rectangle excludes its right and top edge.  A polygon whose
+ * corner or edge just touches the rectangle may be reported although
+ * quadtree_query() would not find it at any point of the rectangle,
+ * but every polygon found at some point of it is reported.  Only the
+ * part of the rectangle that lies within the quadtree's bounding box
+ * is considered.  Every id is reported once even if several polygons
+ * with that id match, and the ids are sorted in ascending order.
+ *
+ * Parts of the quadtree that lie completely inside of the rectangle
+ * are reported without testing their polygons, so large windows are
+ * cheap.  No memory besides the buffer of \a query_result is
+ * allocated.
+ *
+ * @param[in] quadtree the quadtree to operate on
+ * @param[in] left the smallest x coordinate of the rectangle
+ * @param[in] bottom the smallest y coordinate of the rectangle
+ * @param[in] width the width of the rectangle
+ * @param[in] height the height of the rectangle
+ * @param[out] query_result receives the ids of the polygons
+ * @returns QUADTREE_SUCCESS if successful.
+ * @returns QUADTREE_ERROR if \a width or \a height is not positive
+ * @returns QUADTREE_ERROR_OUT_OF_BOUNDS if the rectangle does not
+ *                                       overlap the quadtree's
+ *                                       bounding box
+ * @returns QUADTREE_ERROR_OUT_OF_MEMORY if the function could not
+ *                                       allocate memory
+ * @see quadtree_query
+ */
+int quadtree_query_rect(quadtree_t quadtree, int left, int bottom, int width, int height, quadtree_query_result_t *query_result);
+
+/**
+ * @brief Get the polygons closest to the given point.
+ *
+ * Finds the \a k polygons with the smallest distance to the point
+ * (\a x, \a y) and stores their ids and distances in
+ * \a nearest_result, nearest first.  The distance of a polygon is 0 if
+ * it contains the point and the euclidean distance to the closest point
+ * on its edges otherwise.  Several polygons with the same id count as
+ * one.  Fewer than \a k ids are returned if the quadtree does not hold
+ * that many polygons within \a max_distance.
+ *
+ * The quadtree is searched nearest node first and the search stops as
+ * soon as no remaining node can be closer than the k-th polygon found
+ * so far, so the cost depends on the number of polygons near the point
+ * rather than on the size of the quadtree.  The point may lie outside
+ * of the quadtree's bounding box.
+ *
+ * @param[in] quadtree the quadtree to operate on
+ * @param[in] x the x coordinate of the point
+ * @param[in] y the y coordinate of the point
+ * @param[in] k the maximal number of polygons to return
+ * @param[in] max_distance polygons farther away than this are ignored.
+ *                         Pass a negative value to not limit the
+ *                         distance.
+ * @param[out] nearest_result receives the ids and distances
+ * @returns QUADTREE_SUCCESS if successful.
+ * @returns QUADTREE_ERROR if \a k is not positive
+ * @returns QUADTREE_ERROR_OUT_OF_MEMORY if the function could not
+ *                                       allocate memory
+ * @see quadtree_query
+ */
+int quadtree_query_nearest(quadtree_t quadtree, int x, int y, int k, double max_distance, quadtree_nearest_result_t *nearest_result);
+
+/**
+ * @brief Get the polygons containing each of a list of points.
+ *
+ * Does the same as calling quadtree_query() for every point
+ * (\a xs[i], \a ys[i]) but stores all results in one
+ * quadtree_batch_result_t.  Internally the points are sorted along a
+ * space filling curve so that points falling into the same part of
+ * the quadtree are handled together.  Points outside of the
+ * quadtree's bounding box get no ids.
+ *
+ * @param[in] quadtree the quadtree to operate on
+ * @param[in] number_of_points size of the following arrays
+ * @param[in] xs[] array of x coordinates
+ * @param[in] ys[] array of y coordinates
+ * @param[out] batch_result receives the ids for every point
+ * @returns QUADTREE_SUCCESS if successful.
+ * @returns QUADTREE_ERROR_OUT_OF_BOUNDS if at least one point does
+ *                                       not lie within the quadtree's
+ *                                       bounding box.  The result is
+ *                                       still valid for all points.
+ * @returns QUADTREE_ERROR_OUT_OF_MEMORY if the function could not
+ *                                       allocate memory
+ * @see quadtree_query
+ */
+int quadtree_query_batch(quadtree_t quadtree, int number_of_points, int xs[], int ys[], quadtree_batch_result_t *batch_result);
+
+/**
+ * @brief Like quadtree_query_batch() for interleaved coordinates.
+ *
+ * Point i is (\a xy[2 * i], \a xy[2 * i + 1]), which is the layout of
+ * an array of (x, y) pairs or of a row-major N x 2 matrix, so such
+ * points can be passed without splitting them into two arrays first.
+ *
+ * @param[in] quadtree the quadtree to operate on
+ * @param[in] number_of_points the number of points in \a xy
+ * @param[in] xy[] array of 2 * \a number_of_points coordinates
+ * @param[out] batch_result receives the ids for every point
+ * @returns the same values as quadtree_query_batch()
+ * @see quadtree_query_batch
+ */
+int quadtree_query_batch_xy(quadtree_t quadtree, int number_of_points, int xy[], quadtree_batch_result_t *batch_result);
+
+/**
+ * @brief Like quadtree_query_batch() but spread over several threads.
+ *
+ * The threads of \a worker_pool sort all points into the order
+ * quadtree_query_batch() answers them in.  The sorted points are then
+ * cut into chunks which the threads claim one after the other until
+ * all chunks are done, so threads that happen to get cheap chunks
+ * take over more of the work.  Every thread
+ * collects its ids in its own memory; they are merged into
+ * \a batch_result at the end.  The result is identical to the result
+ * of quadtree_query_batch().
+ *
+ * @param[in] quadtree the quadtree to operate on
+ * @param[in] worker_pool the threads to use
+ * @param[in] number_of_points size of the following arrays
+ * @param[in] xs[] array of x coordinates
+ * @param[in] ys[] array of y coordinates
+ * @param[out] batch_result receives the ids for every point
+ * @returns the same values as quadtree_query_batch()
+ * @see quadtree_query_batch
+ * @see quadtree_worker_pool_create
+ */
+int quadtree_query_batch_parallel(quadtree_t quadtree, quadtree_worker_pool_t worker_pool, int number_of_points, int xs[], int ys[], quadtree_batch_result_t *batch_result);
+
 /**
  * @brief Removes a polygon from a quadtree
  *
@@ -252,6 +992,94 @@ int quadtree_query(quadtree_t quadtree, int x, int y, quadtree_query_result_t *q
  */
 int quadtree_remove(quadtree_t quadtree, long id);
 
+/**
+ * @brief Merge nodes that are no longer needed
+ *
+ * Removing polygons leaves behind nodes whose four children are empty
+ * or all hold the very same polygons.  quadtree_remove() and
+ * quadtree_update() merge empty children back into their parent
+ * within the area they touched.  Children that still hold the same
+ * polygons are kept since a polygon added back nearby would split
+ * them again.  This function merges both kinds for the whole
+ * quadtree, so that its size and depth follow the polygons it holds
+ * now rather than the most it ever held.  Queries give the same
+ * results before and after.
+ *
+ * quadtree_query_nearest() skips the parts of the quadtree that are
+ * too far from every polygon they ever held.  Polygons that were
+ * removed or moved away keep a part from being skipped, so pruning
+ * gets worse the more the polygons change.  Compacting the quadtree
+ * while no snapshots of it exist restores pruning to what the current
+ * polygons allow.
+ *
+ * @param quadtree the quadtree to operate on
+ * @returns QUADTREE_SUCCESS always. This function cannot fail.
+ * @see quadtree_remove
+ */
+int quadtree_compact(quadtree_t quadtree);
+
+/**
+ * @brief Describes the shape of a quadtree and the memory it takes
+ *
+ * Walks the whole quadtree, so it takes about as long as
+ * quadtree_freeze() and should not be called for every query.  It
+ * must not run at the same time as any other call on the quadtree.
+ *
+ * The byte counts leave out the memory kept for snapshots, i.e. the
+ * old versions of nodes that quadtree_snapshot() callers may still
+ * read, and the memory a quadtree with concurrent readers has already
+ * taken out of the tree but cannot free before running queries end.
+ *
+ * @param[in] quadtree the quadtree to look at
+ * @param[out] stats receives the description
+ * @returns QUADTREE_SUCCESS always. This function cannot fail.
+ */
+int quadtree_get_stats(quadtree_t quadtree, quadtree_stats_t *stats);
+
+/**
+ * @brief The work done by all calls on a quadtree so far
+ *
+ * Every call on the quadtree adds to the counters, whichever thread
+ * makes it.  They start out at zero when the quadtree is created and
+ * are set back to zero by quadtree_reset_counters().
+ *
+ * @param[in] quadtree the quadtree to look at
+ * @param[out] counters receives the counters, all zero if the library
+ *                      was compiled without QUADTREE_COUNTERS
+ * @returns QUADTREE_SUCCESS or QUADTREE_ERROR if the library was
+ *          compiled without QUADTREE_COUNTERS
+ */
+int quadtree_get_counters(quadtree_t quadtree, quadtree_counters_t *counters);
+
+/**
+ * @brief The work done by the last call the calling thread made
+ *
+ * Covers the last call of quadtree_add(), quadtree_add_batch(),
+ * quadtree_build(), quadtree_update(), quadtree_remove(),
+ * quadtree_query(), quadtree_query_visit(), quadtree_query_rect(),
+ * quadtree_query_nearest(), quadtree_query_batch() or
+ * quadtree_query_batch_parallel() on any quadtree, including the work
+ * the worker threads did for it.
+ *
+ * @param[out] counters receives the counters, all zero if the library
+ *                      was compiled without QUADTREE_COUNTERS
+ * @returns QUADTREE_SUCCESS or QUADTREE_ERROR if the library was
+ *          compiled without QUADTREE_COUNTERS
+ */
+int quadtree_get_call_counters(quadtree_counters_t *counters);
+
+/**
+ * @brief Sets the counters of a quadtree back to zero
+ *
+ * Must not run concurrently with any other call on the same quadtree.
+ *
+ * @param quadtree the quadtree to operate on
+ * @returns QUADTREE_SUCCESS or QUADTREE_ERROR if the library was
+ *          compiled without QUADTREE_COUNTERS
+ * @see quadtree_get_counters()
+ */
+int quadtree_reset_counters(quadtree_t quadtree);
+
 /**
  * @brief Allocate a new quadtree_query_result_t
  *
@@ -274,5 +1102,271 @@ quadtree_query_result_t *quadtree_query_result_allocate();
  */
 void quadtree_query_result_free(quadtree_query_result_t *query_result);
 
+/**
+ * @brief Allocate a new quadtree_nearest_result_t
+ *
+ * @return a pointer to a new quadtree_nearest_result_t object to be
+ *         used with quadtree_query_nearest() or NULL on failure
+ * @see quadtree_nearest_result_free()
+ * @see quadtree_query_nearest()
+ */
+quadtree_nearest_result_t *quadtree_nearest_result_allocate();
+
+/**
+ * @brief Frees the memory pointed to by \a nearest_result
+ * @param nearest_result the quadtree_nearest_result_t object to dispose of
+ * @see quadtree_nearest_result_allocate()
+ */
+void quadtree_nearest_result_free(quadtree_nearest_result_t *nearest_result);
+
+/**
+ * @brief Allocate a new quadtree_batch_result_t
+ *
+ * @return a pointer to a new quadtree_batch_result_t object to be used
+ *         with quadtree_query_batch() or NULL on failure
+ * @see quadtree_batch_result_free()
+ * @see quadtree_query_batch()
+ */
+quadtree_batch_result_t *quadtree_batch_result_allocate();
+
+/**
+ * @brief Frees the memory pointed to by \a batch_result
+ * @param batch_result the quadtree_batch_result_t object to dispose of
+ * @see quadtree_batch_result_allocate()
+ */
+void quadtree_batch_result_free(quadtree_batch_result_t *batch_result);
+
+/**
+ * @brief Creates a pool of worker threads
+ *
+ * The calling thread of a function using the pool counts as one of
+ * the workers, so a pool of \a number_of_threads workers starts
+ * \a number_of_threads - 1 threads.  The threads sleep while they are
+ * not needed.
+ *
+ * @param number_of_threads the number of workers or 0 to use one
+ *                          worker per online processor
+ * @returns the new worker pool or NULL on failure
+ * @see quadtree_worker_pool_destroy
+ */
+quadtree_worker_pool_t quadtree_worker_pool_create(int number_of_threads);
+
+/**
+ * @brief Stops the threads of a worker pool and frees it
+ * @param worker_pool the worker pool to be deleted
+ */
+void quadtree_worker_pool_destroy(quadtree_worker_pool_t worker_pool);
+
+/**
+ * @brief Returns the number of workers in a worker pool
+ * @param worker_pool the worker pool to inspect
+ */
+int quadtree_worker_pool_size(quadtree_worker_pool_t worker_pool);
+
+/**
+ * @brief Takes a snapshot of a quadtree
+ *
+ * Queries of the snapshot report the polygons of \a quadtree as they
+ * are now, whatever changes are made to it later.  Nothing is copied:
+ * from now on every node the quadtree changes keeps its old state
+ * next to the new one, and the arrays, nodes and polygons the
+ * quadtree no longer needs are kept, too.  This costs memory in
+ * proportion to the changes made while the snapshot lives, and no
+ * memory any quadtree retires is freed in the meantime, so snapshots
+ * should be released soon.  If nothing was changed since the last
+ * snapshot that one is returned again and has to be released one more
+ * time.
+ *
+ * While a snapshot exists the quadtree changes its nodes like a
+ * quadtree with concurrent readers does.
+ *
+ * @param quadtree the quadtree to take a snapshot of
+ * @returns the snapshot or NULL if the function could not allocate
+ *          memory
+ * @see quadtree_snapshot_release
+ * @see quadtree_snapshot_query
+ */
+quadtree_snapshot_t quadtree_snapshot(quadtree_t quadtree);
+
+/**
+ * @brief Releases a snapshot taken with quadtree_snapshot()
+ *
+ * The quadtree frees what only the snapshot still needed the next
+ * time it is changed.  Snapshots of a quadtree that was destroyed
+ * are freed right away.
+ *
+ * @param snapshot the snapshot to release or NULL
+ * @see quadtree_snapshot
+ */
+void quadtree_snapshot_release(quadtree_snapshot_t snapshot);
+
+/**
+ * @brief Get a list of polygon ids that contained the given point.
+ *
+ * Does the same as quadtree_query() on the quadtree as it was when
+ * \a snapshot was taken.
+ *
+ * @param[in] snapshot the snapshot to operate on
+ * @param[in] x the x coordinate of the point
+ * @param[in] y the y coordinate of the point
+ * @param[out] query_result receives the ids of the polygons
+ * @returns the same values as quadtree_query().
+ * @returns QUADTREE_ERROR_OUT_OF_MEMORY also if the quadtree could
+ *                                       not allocate the memory to
+ *                                       keep what \a snapshot sees.
+ *                                       All further queries of the
+ *                                       snapshot fail, too.
+ * @see quadtree_snapshot
+ * @see quadtree_query
+ */
+int quadtree_snapshot_query(quadtree_snapshot_t snapshot, int x, int y, quadtree_query_result_t *query_result);
+
+/**
+ * @brief Get a list of polygon ids that intersected the given rectangle.
+ *
+ * Does the same as quadtree_query_rect() on the quadtree as it was
+ * when \a snapshot was taken.
+ *
+ * @returns the same values as quadtree_snapshot_query() and
+ *          quadtree_query_rect()
+ * @see quadtree_snapshot
+ * @see quadtree_query_rect
+ */
+int quadtree_snapshot_query_rect(quadtree_snapshot_t snapshot, int left, int bottom, int width, int height, quadtree_query_result_t *query_result);
+
+/**
+ * @brief Get the polygons that were closest to the given point.
+ *
+ * Does the same as quadtree_query_nearest() on the quadtree as it was
+ * when \a snapshot was taken.
+ *
+ * @returns the same values as quadtree_snapshot_query() and
+ *          quadtree_query_nearest()
+ * @see quadtree_snapshot
+ * @see quadtree_query_nearest
+ */
+int quadtree_snapshot_query_nearest(quadtree_snapshot_t snapshot, int x, int y, int k, double max_distance, quadtree_nearest_result_t *nearest_result);
+
+/**
+ * @brief Compiles a quadtree into a compact read-only form
+ *
+ * The frozen quadtree is a copy of \a quadtree stored in one block of
+ * memory.  Its nodes are kept in a single array in depth first order
+ * with the four children of a node next to each other, and the
+ * polygons of every leaf follow each other in a second array.  Later
+ * changes of \a quadtree do not affect the frozen quadtree and
+ * \a quadtree may be destroyed while the frozen quadtree is still in
+ * use.
+ *
+ * @param quadtree the quadtree to compile
+ * @returns the frozen quadtree or NULL if the function could not
+ *          allocate memory
+ * @see quadtree_frozen_query
+ * @see quadtree_frozen_destroy
+ */
+quadtree_frozen_t quadtree_freeze(quadtree_t quadtree);
+
+/**
+ * @brief Frees a frozen quadtree
+ * @param frozen the frozen quadtree to be deleted
+ * @see quadtree_freeze
+ */
+void quadtree_frozen_destroy(quadtree_frozen_t frozen);
+
+/**
+ * @brief Get a list of polygon ids that contain the given point.
+ *
+ * Does the same as quadtree_query() on the quadtree \a frozen was
+ * created from, including the order of the ids.
+ *
+ * @param[in] frozen the frozen quadtree to operate on
+ * @param[in] x the x coordinate of the point
+ * @param[in] y the y coordinate of the point
+ * @param[out] query_result receives the ids of the polygons
+ * @returns the same values as quadtree_query()
+ * @see quadtree_freeze
+ * @see quadtree_query
+ */
+int quadtree_frozen_query(quadtree_frozen_t frozen, int x, int y, quadtree_query_result_t *query_result);
+
+/**
+ * @brief Writes a quadtree to a snapshot file
+ *
+ * The file holds the frozen form of \a quadtree, see
+ * quadtree_freeze(), behind a header with a format version and a
+ * checksum.  The coordinates of every polygon are stored once.  The
+ * file is first written to a temporary file with a unique name next
+ * to \a path, flushed to disk and then renamed, so processes that
+ * loaded an earlier snapshot at \a path are not affected, processes
+ * saving to the same path at once do not mix their files, and a
+ * crash leaves either the old or the new snapshot at \a path.
+ *
+ * Snapshots can only be loaded on machines with the same byte order
+ * and size of \c long.
+ *
+ * @param quadtree the quadtree to save
+ * @param path the name of the file to write
+ * @returns QUADTREE_SUCCESS if successful.
+ * @returns QUADTREE_ERROR if the file could not be written.
+ * @returns QUADTREE_ERROR_OUT_OF_MEMORY if the function could not
+ *                                       allocate memory
+ * @see quadtree_load
+ */
+int quadtree_save(quadtree_t quadtree, const char *path);
+
+/**
+ * @brief Loads a snapshot file written by quadtree_save()
+ *
+ * The file is mapped into memory read-only and queried in place with
+ * quadtree_frozen_query(); nothing is parsed or allocated per node.
+ * Only the checksum is computed over the whole file once and the
+ * indices of the nodes and entries are checked to stay within the
+ * file.  The snapshot stays mapped until it is passed to
+ * quadtree_frozen_destroy().
+ *
+ * @param path the name of the file to load
+ * @returns the frozen quadtree or NULL if the file could not be read,
+ *          was written by another version of the library or another
+ *          kind of machine, or is damaged
+ * @see quadtree_save
+ * @see quadtree_frozen_query
+ * @see quadtree_frozen_destroy
+ */
+quadtree_frozen_t quadtree_load(const char *path);
+
+/**
+ * @brief Fill a quadtree_ingest_options_t with the defaults
+ * @param options the structure to fill
+ * @see quadtree_ingest
+ */
+void quadtree_ingest_options_initialize(quadtree_ingest_options_t *options);
+
+/**
+ * @brief Adds the polygons read from a file descriptor
+ *
+ * Reads \a fd up to its end in chunks of a fixed size and adds the
+ * polygon of every record with quadtree_add() as soon as the record
+ * has been parsed, so only one record is held in memory at a time.
+ * The parts of a multipolygon are added as separate polygons sharing
+ * the id of the record.  A record that cannot be parsed or lies partly
+ * outside the area covered by the quadtree is passed to the \a
+ * error_handler of \a options and skipped; none of its parts are
+ * added.  The polygons added before an error is returned stay in the
+ * quadtree.
+ *
+ * @param quadtree the quadtree to operate on
+ * @param fd the file descriptor to read from.  It is not closed.
+ * @param options how to read the input or NULL for the defaults
+ * @param stats receives the number of records and polygons or NULL
+ * @returns QUADTREE_SUCCESS if the whole input was read, even if some
+ *                           records were skipped.
+ * @returns QUADTREE_ERROR if reading from \a fd failed.
+ * @returns QUADTREE_ERROR_OUT_OF_MEMORY if the function could not
+ *                                       allocate memory
+ * @see quadtree_ingest_options_initialize
+ * @see quadtree_add
+ */
+int quadtree_ingest(quadtree_t quadtree, int fd, const quadtree_ingest_options_t *options, quadtree_ingest_stats_t *stats);
+
 
 #endif /* DE_LORENZQUACK_CODE_QUADTREE_H */
@@ -5,8 +5,12 @@
 #include <stdio.h>
 #include "bool.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
 long cross_product(long x1, long y1, long x2, long y2);
-bool point_in_rectangle(int px, int py, int rx, int ry, int w, int h);
 bool lines_intersect(int line1[2][2], int line2[2][2]);
 
 unsigned long next_power_of_2(unsigned long n) {
@@ -22,41 +26,210 @@ unsigned long next_power_of_2(unsigned long n) {
     return 1l << shifts;
 }
 
-int collide_polygon_rectangle(int n, int *xs, int *ys, int rx, int ry, int w, int h) {
+static unsigned long long spread_bits(unsigned long n) {
+    unsigned long long v = n & 0xffffffffull;
+    v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+    v = (v | (v << 8))  & 0x00ff00ff00ff00ffull;
+    v = (v | (v << 4))  & 0x0f0f0f0f0f0f0f0full;
+    v = (v | (v << 2))  & 0x3333333333333333ull;
+    v = (v | (v << 1))  & 0x5555555555555555ull;
+    return v;
+}
+
+/* Morton code: bit i of x ends up in bit 2i and bit i of y in bit 2i+1 */
+unsigned long long interleave_bits(unsigned long x, unsigned long y) {
+    return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+/* outcodes of a corner relative to the region tested by
+ * edge_enters_rectangle() */
+#define OUTCODE_LEFT  (1)
+#define OUTCODE_RIGHT (2)
+#define OUTCODE_BELOW (4)
+#define OUTCODE_ABOVE (8)
+
+static int rectangle_outcode(int x, int y, int rx, int ry, int w, int h) {
+    int code = 0;
+    if (x <= rx) {
+        code |= OUTCODE_LEFT;
+    } else if (x >= rx + w) {
+        code |= OUTCODE_RIGHT;
+    }
+    if (y < ry) {
+        code |= OUTCODE_BELOW;
+    } else if (y > ry + h - 1) {
+        code |= OUTCODE_ABOVE;
+    }
+    return code;
+}
+
+/* Whether the edge from (xi, yi) to (xj, yj) with the given outcodes
+ * has a point with rx < x < rx + w and ry <= y <= ry + h - 1.  Only
+ * such edges can make point_in_polygon() differ between the points of
+ * the rectangle: a crossing at x <= rx is left of all of them and one
+ * at x >= rx + w right of all of them, even after truncation.  A
+ * horizontal edge at y == ry only separates the row below from the
+ * rectangle and is ignored.  The products are exact as long as all
+ * coordinates are less than 2^31 apart. */
+static __inline__ int edge_enters_rectangle(int xi, int yi, int xj, int yj, int code_i, int code_j, int rx, int ry, int w, int h) {
+    long long dx, dy, low, high;
+    if ((code_i & code_j) != 0 || (yi == yj && yi == ry)) {
+        return 0;
+    }
+    if (code_i == 0 || code_j == 0 || yi == yj) {
+        /* a horizontal edge without a common outcode spans the
+         * rectangle from left to right */
+        return 1;
+    }
+    if (yi > yj) {
+        int tmp;
+        tmp = xi; xi = xj; xj = tmp;
+        tmp = yi; yi = yj; yj = tmp;
+    }
+    /* clip the edge to the rows of the rectangle.  The sign of
+     * (xi - X) * dy + dx * (y - yi) is the sign of x(y) - X. */
+    low = yi > ry ? yi : ry;
+    high = yj < ry + h - 1 ? yj : ry + h - 1;
+    dx = (long long) xj - xi;
+    dy = (long long) yj - yi;
+    return (((long long) xi - rx) * dy + dx * (low - yi) > 0 ||
+            ((long long) xi - rx) * dy + dx * (high - yi) > 0) &&
+           (((long long) xi - rx - w) * dy + dx * (low - yi) < 0 ||
+            ((long long) xi - rx - w) * dy + dx * (high - yi) < 0);
+}
+
+/* Classifies how the polygon covers the points of the rectangle
+ * rx <= x < rx + w, ry <= y < ry + h as seen by point_in_polygon().
+ * RECTANGLE_OUTSIDE and RECTANGLE_COVERED are exact: none or all of the
+ * points are inside.  RECTANGLE_PARTIALLY_COVERED may also be returned
+ * if an edge only passes close by.  Edges are clipped against the
+ * rectangle with outcodes and exact integer arithmetic; only if none
+ * of them enters the rectangle a single corner decides. */
+int classify_polygon_rectangle(int n, int *xs, int *ys, int rx, int ry, int w, int h) {
+    int i, j, code_j, common_code;
     assert(n > 0);
-    int polygon_line[2][2];
-    int rectangle_lines[4][2][2] = { { {rx,   ry},   {rx+w, ry} },
-                                     { {rx+w, ry},   {rx+w, ry+h} },
-                                     { {rx+w, ry+h}, {rx,   ry+h} },
-                                     { {rx,   ry+h}, {rx,   ry} } };
-    int polygon_index, rectangle_index;
-    int old_polygon_index = n - 1;
-    for (polygon_index = 0; polygon_index < n; ++polygon_index) {
-        polygon_line[0][0] = xs[old_polygon_index];
-        polygon_line[0][1] = ys[old_polygon_index];
-        polygon_line[1][0] = xs[polygon_index];
-        polygon_line[1][1] = ys[polygon_index];
-        for (rectangle_index = 0; rectangle_index < 4; ++rectangle_index) {
-            if (lines_intersect(polygon_line, rectangle_lines[rectangle_index])) {
-                return COLLISION;
-            }
+    j = n - 1;
+    code_j = rectangle_outcode(xs[j], ys[j], rx, ry, w, h);
+    common_code = code_j;
+    for (i = 0; i < n; ++i) {
+        int code_i = rectangle_outcode(xs[i], ys[i], rx, ry, w, h);
+        if (edge_enters_rectangle(xs[i], ys[i], xs[j], ys[j], code_i, code_j, rx, ry, w, h)) {
+            return RECTANGLE_PARTIALLY_COVERED;
         }
-        old_polygon_index = polygon_index;
+        common_code &= code_i;
+        code_j = code_i;
+        j = i;
     }
-    if (point_in_rectangle(xs[0], ys[0], rx, ry, w, h)) {
-        return COLLISION;
+    /* all corners on the same side: the bounding box misses the rectangle */
+    if (common_code != 0) {
+        return RECTANGLE_OUTSIDE;
     }
-    if (point_in_polygon(rx, ry, n, xs, ys)) {
-        return COLLISION;
+    return point_in_polygon(rx, ry, n, xs, ys) ? RECTANGLE_COVERED : RECTANGLE_OUTSIDE;
+}
+
+/* Like classify_polygon_rectangle() but only tests the number_of_edges
+ * edges listed in edges, where edge i runs from corner i - 1 (n - 1
+ * for i = 0) to corner i.  The caller makes sure that no other edge
+ * enters the rectangle, e.g. by passing the edges that enter an
+ * enclosing rectangle: an edge that enters a rectangle also enters
+ * every rectangle containing it.  The edges that enter this rectangle
+ * are stored in entering and their number in *number_of_entering. */
+int classify_polygon_edges_rectangle(int n, int *xs, int *ys, int number_of_edges, const int *edges,
+                                     int *entering, int *number_of_entering, int rx, int ry, int w, int h) {
+    *number_of_entering = find_edges_entering_rectangle(n, xs, ys, number_of_edges, edges, entering, rx, ry, w, h);
+    if (*number_of_entering > 0) {
+        return RECTANGLE_PARTIALLY_COVERED;
+    }
+    return point_in_polygon(rx, ry, n, xs, ys) ? RECTANGLE_COVERED : RECTANGLE_OUTSIDE;
+}
+
+/* Stores those of the number_of_edges edges listed in edges that enter
+ * the rectangle in entering and returns their number, see
+ * classify_polygon_edges_rectangle(). */
+int find_edges_entering_rectangle(int n, int *xs, int *ys, int number_of_edges, const int *edges,
+                                  int *entering, int rx, int ry, int w, int h) {
+    int i, j, k, count = 0;
+    for (k = 0; k < number_of_edges; ++k) {
+        i = edges[k];
+        j = i == 0 ? n - 1 : i - 1;
+        if (edge_enters_rectangle(xs[i], ys[i], xs[j], ys[j],
+                                  rectangle_outcode(xs[i], ys[i], rx, ry, w, h),
+                                  rectangle_outcode(xs[j], ys[j], rx, ry, w, h), rx, ry, w, h)) {
+            entering[count] = i;
+            count++;
+        }
+    }
+    return count;
+}
+
+int classify_polygon_rectangle_compact(int n, const unsigned short *points, int origin_x, int origin_y,
+                                       int rx, int ry, int w, int h) {
+    int i, code_i, code_j, common_code;
+    int xi, yi, xj, yj;
+    assert(n > 0);
+    xj = COMPACT_X(points, n - 1, origin_x);
+    yj = COMPACT_Y(points, n - 1, origin_y);
+    code_j = rectangle_outcode(xj, yj, rx, ry, w, h);
+    common_code = code_j;
+    for (i = 0; i < n; ++i) {
+        xi = COMPACT_X(points, i, origin_x);
+        yi = COMPACT_Y(points, i, origin_y);
+        code_i = rectangle_outcode(xi, yi, rx, ry, w, h);
+        if (edge_enters_rectangle(xi, yi, xj, yj, code_i, code_j, rx, ry, w, h)) {
+            return RECTANGLE_PARTIALLY_COVERED;
+        }
+        common_code &= code_i;
+        code_j = code_i;
+        xj = xi;
+        yj = yi;
+    }
+    if (common_code != 0) {
+        return RECTANGLE_OUTSIDE;
+    }
+    return point_in_polygon_compact(rx, ry, n, points, origin_x, origin_y) ? RECTANGLE_COVERED : RECTANGLE_OUTSIDE;
+}
+
+int classify_polygon_edges_rectangle_compact(int n, const unsigned short *points, int origin_x, int origin_y,
+                                             int number_of_edges, const int *edges, int *entering,
+                                             int *number_of_entering, int rx, int ry, int w, int h) {
+    *number_of_entering = find_edges_entering_rectangle_compact(n, points, origin_x, origin_y, number_of_edges,
+                                                                edges, entering, rx, ry, w, h);
+    if (*number_of_entering > 0) {
+        return RECTANGLE_PARTIALLY_COVERED;
     }
-    return NO_COLLISION;
+    return point_in_polygon_compact(rx, ry, n, points, origin_x, origin_y) ? RECTANGLE_COVERED : RECTANGLE_OUTSIDE;
+}
+
+int find_edges_entering_rectangle_compact(int n, const unsigned short *points, int origin_x, int origin_y,
+                                          int number_of_edges, const int *edges, int *entering,
+                                          int rx, int ry, int w, int h) {
+    int i, j, k, xi, yi, xj, yj, count = 0;
+    for (k = 0; k < number_of_edges; ++k) {
+        i = edges[k];
+        j = i == 0 ? n - 1 : i - 1;
+        xi = COMPACT_X(points, i, origin_x);
+        yi = COMPACT_Y(points, i, origin_y);
+        xj = COMPACT_X(points, j, origin_x);
+        yj = COMPACT_Y(points, j, origin_y);
+        if (edge_enters_rectangle(xi, yi, xj, yj,
+                                  rectangle_outcode(xi, yi, rx, ry, w, h),
+                                  rectangle_outcode(xj, yj, rx, ry, w, h), rx, ry, w, h)) {
+            entering[count] = i;
+            count++;
+        }
+    }
+    return count;
+}
+
+int collide_polygon_rectangle(int n, int *xs, int *ys, int rx, int ry, int w, int h) {
+    if (classify_polygon_rectangle(n, xs, ys, rx, ry, w, h) == RECTANGLE_OUTSIDE) {
+        return NO_COLLISION;
+    }
+    return COLLISION;
 }
 
 int rectangle_inside_polygon(int rx, int ry, int w, int h, int number_of_points, int *xs, int *ys) {
-    return (point_in_polygon(rx,   ry,   number_of_points, xs, ys) &&
-            point_in_polygon(rx+w-1, ry,   number_of_points, xs, ys) &&
-            point_in_polygon(rx,   ry+h-1, number_of_points, xs, ys) &&
-            point_in_polygon(rx+w-1, ry+h-1, number_of_points, xs, ys));
+    return classify_polygon_rectangle(number_of_points, xs, ys, rx, ry, w, h) == RECTANGLE_COVERED;
 }
 
 
@@ -68,20 +241,27 @@ long dot_product(long x1, long y1, long x2, long y2) {
     return ((x1 * x2) + (y1 * y2));
 }
 
-bool point_in_rectangle(int px, int py, int rx, int ry, int w, int h) {
-    int rectangle_xs[4] = { rx, rx+w, rx+w, rx };
-    int rectangle_ys[4] = { ry, ry  , ry+h, ry+h };
-    return point_in_polygon(px, py, 4, rectangle_xs, rectangle_ys);
+/* Polygons with fewer corners than this are not worth the set up of
+ * the vectorized point in polygon tests. */
+#define SIMD_MIN_POINTS (16)
+
+/* Whether the edge from (xi, yi) to (xj, yj) crosses the ray going
+ * from (px, py) to the right.  The vectorized kernels compute exactly
+ * the same: the integer product wraps like a 32 bit multiplication and
+ * the truncated quotient of two 32 bit integers is exact in double
+ * precision, so the results are bit-identical. */
+static int edge_crosses_ray(int px, int py, int xi, int yi, int xj, int yj) {
+    return ((yi > py) != (yj > py) &&
+            (px < (xj - xi) * (py - yi) / (yj - yi) + xi));
 }
 
 /* left and bottom lines are "inside" while right and top lines are "outside" */
-int point_in_polygon(int px, int py, int n, int *xs, int *ys) {
+static int point_in_polygon_scalar(int px, int py, int n, int *xs, int *ys) {
     bool inside = false;
     int i;
     int j = n - 1;
     for (i = 0; i < n; ++i) {
-        if ((ys[i] > py) != (ys[j] > py) &&
-            (px < (xs[j] - xs[i]) * (py - ys[i]) / (ys[j] - ys[i]) + xs[i])) {
+        if (edge_crosses_ray(px, py, xs[i], ys[i], xs[j], ys[j])) {
             inside = !inside;
         }
         j = i;
@@ -89,6 +269,378 @@ int point_in_polygon(int px, int py, int n, int *xs, int *ys) {
     return inside;
 }
 
+static int point_in_polygon_compact_scalar(int px, int py, int n, const unsigned short *points, int origin_x, int origin_y) {
+    bool inside = false;
+    int i;
+    int xj = COMPACT_X(points, n - 1, origin_x);
+    int yj = COMPACT_Y(points, n - 1, origin_y);
+    for (i = 0; i < n; ++i) {
+        int xi = COMPACT_X(points, i, origin_x);
+        int yi = COMPACT_Y(points, i, origin_y);
+        if (edge_crosses_ray(px, py, xi, yi, xj, yj)) {
+            inside = !inside;
+        }
+        xj = xi;
+        yj = yi;
+    }
+    return inside;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* The number of the 8 edges (xi, yi) - (xj, yj) that cross the ray
+ * from (point_x, point_y) to the right.  Most edges of a large polygon
+ * do not straddle the horizontal line through the point, so the
+ * division is skipped if none of them does. */
+__attribute__((target("avx2"), always_inline))
+static __inline__ int edges_cross_ray_avx2(__m256i point_x, __m256i point_y, __m256i xi, __m256i yi, __m256i xj, __m256i yj) {
+    __m256i straddles = _mm256_xor_si256(_mm256_cmpgt_epi32(yi, point_y),
+                                         _mm256_cmpgt_epi32(yj, point_y));
+    __m256i product, divisor, quotient;
+    __m128i quotient_low, quotient_high;
+    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(straddles));
+    if (mask == 0) {
+        return 0;
+    }
+    product = _mm256_mullo_epi32(_mm256_sub_epi32(xj, xi), _mm256_sub_epi32(point_y, yi));
+    /* edges that do not straddle may be horizontal */
+    divisor = _mm256_blendv_epi8(_mm256_set1_epi32(1), _mm256_sub_epi32(yj, yi), straddles);
+    quotient_low = _mm256_cvttpd_epi32(_mm256_div_pd(
+        _mm256_cvtepi32_pd(_mm256_castsi256_si128(product)),
+        _mm256_cvtepi32_pd(_mm256_castsi256_si128(divisor))));
+    quotient_high = _mm256_cvttpd_epi32(_mm256_div_pd(
+        _mm256_cvtepi32_pd(_mm256_extracti128_si256(product, 1)),
+        _mm256_cvtepi32_pd(_mm256_extracti128_si256(divisor, 1))));
+    quotient = _mm256_inserti128_si256(_mm256_castsi128_si256(quotient_low), quotient_high, 1);
+    mask &= _mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_cmpgt_epi32(_mm256_add_epi32(quotient, xi), point_x)));
+    return __builtin_popcount(mask);
+}
+
+/* Tests 8 edges (xs[i], ys[i]) - (xs[i - 1], ys[i - 1]) per step. */
+__attribute__((target("avx2")))
+static int point_in_polygon_avx2(int px, int py, int n, int *xs, int *ys) {
+    int i;
+    int crossings = edge_crosses_ray(px, py, xs[0], ys[0], xs[n - 1], ys[n - 1]);
+    __m256i point_x = _mm256_set1_epi32(px);
+    __m256i point_y = _mm256_set1_epi32(py);
+    for (i = 1; i + 8 <= n; i += 8) {
+        crossings += edges_cross_ray_avx2(point_x, point_y,
+                                          _mm256_loadu_si256((__m256i*) (xs + i)),
+                                          _mm256_loadu_si256((__m256i*) (ys + i)),
+                                          _mm256_loadu_si256((__m256i*) (xs + i - 1)),
+                                          _mm256_loadu_si256((__m256i*) (ys + i - 1)));
+    }
+    for (; i < n; ++i) {
+        crossings += edge_crosses_ray(px, py, xs[i], ys[i], xs[i - 1], ys[i - 1]);
+    }
+    return crossings & 1;
+}
+
+/* Like point_in_polygon_avx2() for compact corners.  The 32 bits of a
+ * corner hold its x offset in the low and its y offset in the high
+ * half, so 8 corners are split into xs and ys with a mask and a shift. */
+__attribute__((target("avx2")))
+static int point_in_polygon_compact_avx2(int px, int py, int n, const unsigned short *points, int origin_x, int origin_y) {
+    int i;
+    int crossings = edge_crosses_ray(px, py, COMPACT_X(points, 0, origin_x), COMPACT_Y(points, 0, origin_y),
+                                     COMPACT_X(points, n - 1, origin_x), COMPACT_Y(points, n - 1, origin_y));
+    __m256i point_x = _mm256_set1_epi32(px);
+    __m256i point_y = _mm256_set1_epi32(py);
+    __m256i offset_x = _mm256_set1_epi32(origin_x);
+    __m256i offset_y = _mm256_set1_epi32(origin_y);
+    __m256i low_half = _mm256_set1_epi32(0xffff);
+    for (i = 1; i + 8 <= n; i += 8) {
+        __m256i corners_i = _mm256_loadu_si256((__m256i*) (points + 2 * i));
+        __m256i corners_j = _mm256_loadu_si256((__m256i*) (points + 2 * (i - 1)));
+        crossings += edges_cross_ray_avx2(point_x, point_y,
+                                          _mm256_add_epi32(_mm256_and_si256(corners_i, low_half), offset_x),
+                                          _mm256_add_epi32(_mm256_srli_epi32(corners_i, 16), offset_y),
+                                          _mm256_add_epi32(_mm256_and_si256(corners_j, low_half), offset_x),
+                                          _mm256_add_epi32(_mm256_srli_epi32(corners_j, 16), offset_y));
+    }
+    for (; i < n; ++i) {
+        crossings += edge_crosses_ray(px, py, COMPACT_X(points, i, origin_x), COMPACT_Y(points, i, origin_y),
+                                      COMPACT_X(points, i - 1, origin_x), COMPACT_Y(points, i - 1, origin_y));
+    }
+    return crossings & 1;
+}
+
+/* like edges_cross_ray_avx2() for 4 edges */
+__attribute__((target("sse4.1"), always_inline))
+static __inline__ int edges_cross_ray_sse41(__m128i point_x, __m128i point_y, __m128i xi, __m128i yi, __m128i xj, __m128i yj) {
+    __m128i straddles = _mm_xor_si128(_mm_cmpgt_epi32(yi, point_y),
+                                      _mm_cmpgt_epi32(yj, point_y));
+    __m128i product, divisor, quotient;
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(straddles));
+    if (mask == 0) {
+        return 0;
+    }
+    product = _mm_mullo_epi32(_mm_sub_epi32(xj, xi), _mm_sub_epi32(point_y, yi));
+    divisor = _mm_blendv_epi8(_mm_set1_epi32(1), _mm_sub_epi32(yj, yi), straddles);
+    quotient = _mm_unpacklo_epi64(
+        _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(product), _mm_cvtepi32_pd(divisor))),
+        _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(product, 0x0e)),
+                                    _mm_cvtepi32_pd(_mm_shuffle_epi32(divisor, 0x0e)))));
+    mask &= _mm_movemask_ps(_mm_castsi128_ps(
+        _mm_cmpgt_epi32(_mm_add_epi32(quotient, xi), point_x)));
+    return __builtin_popcount(mask);
+}
+
+/* like point_in_polygon_avx2() with 4 edges per step */
+__attribute__((target("sse4.1")))
+static int point_in_polygon_sse41(int px, int py, int n, int *xs, int *ys) {
+    int i;
+    int crossings = edge_crosses_ray(px, py, xs[0], ys[0], xs[n - 1], ys[n - 1]);
+    __m128i point_x = _mm_set1_epi32(px);
+    __m128i point_y = _mm_set1_epi32(py);
+    for (i = 1; i + 4 <= n; i += 4) {
+        crossings += edges_cross_ray_sse41(point_x, point_y,
+                                           _mm_loadu_si128((__m128i*) (xs + i)),
+                                           _mm_loadu_si128((__m128i*) (ys + i)),
+                                           _mm_loadu_si128((__m128i*) (xs + i - 1)),
+                                           _mm_loadu_si128((__m128i*) (ys + i - 1)));
+    }
+    for (; i < n; ++i) {
+        crossings += edge_crosses_ray(px, py, xs[i], ys[i], xs[i - 1], ys[i - 1]);
+    }
+    return crossings & 1;
+}
+
+/* like point_in_polygon_compact_avx2() with 4 edges per step */
+__attribute__((target("sse4.1")))
+static int point_in_polygon_compact_sse41(int px, int py, int n, const unsigned short *points, int origin_x, int origin_y) {
+    int i;
+    int crossings = edge_crosses_ray(px, py, COMPACT_X(points, 0, origin_x), COMPACT_Y(points, 0, origin_y),
+                                     COMPACT_X(points, n - 1, origin_x), COMPACT_Y(points, n - 1, origin_y));
+    __m128i point_x = _mm_set1_epi32(px);
+    __m128i point_y = _mm_set1_epi32(py);
+    __m128i offset_x = _mm_set1_epi32(origin_x);
+    __m128i offset_y = _mm_set1_epi32(origin_y);
+    __m128i low_half = _mm_set1_epi32(0xffff);
+    for (i = 1; i + 4 <= n; i += 4) {
+        __m128i corners_i = _mm_loadu_si128((__m128i*) (points + 2 * i));
+        __m128i corners_j = _mm_loadu_si128((__m128i*) (points + 2 * (i - 1)));
+        crossings += edges_cross_ray_sse41(point_x, point_y,
+                                           _mm_add_epi32(_mm_and_si128(corners_i, low_half), offset_x),
+                                           _mm_add_epi32(_mm_srli_epi32(corners_i, 16), offset_y),
+                                           _mm_add_epi32(_mm_and_si128(corners_j, low_half), offset_x),
+                                           _mm_add_epi32(_mm_srli_epi32(corners_j, 16), offset_y));
+    }
+    for (; i < n; ++i) {
+        crossings += edge_crosses_ray(px, py, COMPACT_X(points, i, origin_x), COMPACT_Y(points, i, origin_y),
+                                      COMPACT_X(points, i - 1, origin_x), COMPACT_Y(points, i - 1, origin_y));
+    }
+    return crossings & 1;
+}
+
+/* Tests the 8 points (pxs[k], pys[k]) against one edge per step and
+ * stores 1 in inside[k] if point k is inside the polygon. */
+__attribute__((target("avx2")))
+static void points_in_polygon_avx2(int *pxs, int *pys, int n, int *xs, int *ys, unsigned char *inside) {
+    int i, k, mask;
+    int j = n - 1;
+    __m256i point_x = _mm256_loadu_si256((__m256i*) pxs);
+    __m256i point_y = _mm256_loadu_si256((__m256i*) pys);
+    __m256i crossings = _mm256_setzero_si256();
+    for (i = 0; i < n; ++i) {
+        __m256i xi = _mm256_set1_epi32(xs[i]);
+        __m256i yi = _mm256_set1_epi32(ys[i]);
+        __m256i yj = _mm256_set1_epi32(ys[j]);
+        __m256i straddles = _mm256_xor_si256(_mm256_cmpgt_epi32(yi, point_y),
+                                             _mm256_cmpgt_epi32(yj, point_y));
+        if (!_mm256_testz_si256(straddles, straddles)) {
+            /* some point straddles so ys[i] != ys[j] */
+            __m256d divisor = _mm256_set1_pd((double) (ys[j] - ys[i]));
+            __m256i product = _mm256_mullo_epi32(_mm256_sub_epi32(_mm256_set1_epi32(xs[j]), xi),
+                                                 _mm256_sub_epi32(point_y, yi));
+            __m128i quotient_low = _mm256_cvttpd_epi32(_mm256_div_pd(
+                _mm256_cvtepi32_pd(_mm256_castsi256_si128(product)), divisor));
+            __m128i quotient_high = _mm256_cvttpd_epi32(_mm256_div_pd(
+                _mm256_cvtepi32_pd(_mm256_extracti128_si256(product, 1)), divisor));
+            __m256i quotient = _mm256_inserti128_si256(_mm256_castsi128_si256(quotient_low), quotient_high, 1);
+            crossings = _mm256_xor_si256(crossings, _mm256_and_si256(straddles,
+                _mm256_cmpgt_epi32(_mm256_add_epi32(quotient, xi), point_x)));
+        }
+        j = i;
+    }
+    mask = _mm256_movemask_ps(_mm256_castsi256_ps(crossings));
+    for (k = 0; k < 8; ++k) {
+        inside[k] = (mask >> k) & 1;
+    }
+}
+
+/* like points_in_polygon_avx2() for 4 points */
+__attribute__((target("sse4.1")))
+static void points_in_polygon_sse41(int *pxs, int *pys, int n, int *xs, int *ys, unsigned char *inside) {
+    int i, k, mask;
+    int j = n - 1;
+    __m128i point_x = _mm_loadu_si128((__m128i*) pxs);
+    __m128i point_y = _mm_loadu_si128((__m128i*) pys);
+    __m128i crossings = _mm_setzero_si128();
+    for (i = 0; i < n; ++i) {
+        __m128i xi = _mm_set1_epi32(xs[i]);
+        __m128i yi = _mm_set1_epi32(ys[i]);
+        __m128i yj = _mm_set1_epi32(ys[j]);
+        __m128i straddles = _mm_xor_si128(_mm_cmpgt_epi32(yi, point_y),
+                                          _mm_cmpgt_epi32(yj, point_y));
+        if (!_mm_testz_si128(straddles, straddles)) {
+            __m128d divisor = _mm_set1_pd((double) (ys[j] - ys[i]));
+            __m128i product = _mm_mullo_epi32(_mm_sub_epi32(_mm_set1_epi32(xs[j]), xi),
+                                              _mm_sub_epi32(point_y, yi));
+            __m128i quotient = _mm_unpacklo_epi64(
+                _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(product), divisor)),
+                _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(product, 0x0e)), divisor)));
+            crossings = _mm_xor_si128(crossings, _mm_and_si128(straddles,
+                _mm_cmpgt_epi32(_mm_add_epi32(quotient, xi), point_x)));
+        }
+        j = i;
+    }
+    mask = _mm_movemask_ps(_mm_castsi128_ps(crossings));
+    for (k = 0; k < 4; ++k) {
+        inside[k] = (mask >> k) & 1;
+    }
+}
+
+#endif /* HAVE_X86_SIMD */
+
+int point_in_polygon(int px, int py, int n, int *xs, int *ys) {
+#ifdef HAVE_X86_SIMD
+    if (n >= SIMD_MIN_POINTS) {
+        if (__builtin_cpu_supports("avx2")) {
+            return point_in_polygon_avx2(px, py, n, xs, ys);
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return point_in_polygon_sse41(px, py, n, xs, ys);
+        }
+    }
+#endif
+    return point_in_polygon_scalar(px, py, n, xs, ys);
+}
+
+int point_in_polygon_compact(int px, int py, int n, const unsigned short *points, int origin_x, int origin_y) {
+#ifdef HAVE_X86_SIMD
+    if (n >= SIMD_MIN_POINTS) {
+        if (__builtin_cpu_supports("avx2")) {
+            return point_in_polygon_compact_avx2(px, py, n, points, origin_x, origin_y);
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return point_in_polygon_compact_sse41(px, py, n, points, origin_x, origin_y);
+        }
+    }
+#endif
+    return point_in_polygon_compact_scalar(px, py, n, points, origin_x, origin_y);
+}
+
+/* Whether (px, py) is inside the polygon given whether (qx, py) in the
+ * same row is.  Both points lie in a rectangle that only the
+ * number_of_edges edges listed in edges enter, see
+ * classify_polygon_edges_rectangle().  Every other edge crosses the
+ * row left or right of both points, see edge_enters_rectangle(), so
+ * only the listed edges can tell point_in_polygon() apart for them. */
+int point_in_polygon_edges(int px, int py, int qx, int q_inside, int n, int *xs, int *ys,
+                           int number_of_edges, const int *edges) {
+    int i, j, k;
+    bool inside = q_inside ? true : false;
+    for (k = 0; k < number_of_edges; ++k) {
+        i = edges[k];
+        j = i == 0 ? n - 1 : i - 1;
+        if (edge_crosses_ray(px, py, xs[i], ys[i], xs[j], ys[j]) !=
+            edge_crosses_ray(qx, py, xs[i], ys[i], xs[j], ys[j])) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+int point_in_polygon_edges_compact(int px, int py, int qx, int q_inside, int n, const unsigned short *points,
+                                   int origin_x, int origin_y, int number_of_edges, const int *edges) {
+    int i, j, k, xi, yi, xj, yj;
+    bool inside = q_inside ? true : false;
+    for (k = 0; k < number_of_edges; ++k) {
+        i = edges[k];
+        j = i == 0 ? n - 1 : i - 1;
+        xi = COMPACT_X(points, i, origin_x);
+        yi = COMPACT_Y(points, i, origin_y);
+        xj = COMPACT_X(points, j, origin_x);
+        yj = COMPACT_Y(points, j, origin_y);
+        if (edge_crosses_ray(px, py, xi, yi, xj, yj) != edge_crosses_ray(qx, py, xi, yi, xj, yj)) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+/* Sets inside[k] to point_in_polygon(pxs[k], pys[k], n, xs, ys) for
+ * every point.  Vectorized over the points rather than the edges
+ * which pays off when many points are tested against the same large
+ * polygon. */
+void points_in_polygon(int number_of_points, int *pxs, int *pys, int n, int *xs, int *ys, unsigned char *inside) {
+    int k = 0;
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        for (; k + 8 <= number_of_points; k += 8) {
+            points_in_polygon_avx2(pxs + k, pys + k, n, xs, ys, inside + k);
+        }
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        for (; k + 4 <= number_of_points; k += 4) {
+            points_in_polygon_sse41(pxs + k, pys + k, n, xs, ys, inside + k);
+        }
+    }
+#endif
+    for (; k < number_of_points; ++k) {
+        inside[k] = point_in_polygon(pxs[k], pys[k], n, xs, ys);
+    }
+}
+
+/* Returns the squared distance of (px, py) to the closest point on the
+ * edges of the polygon.  The projection onto every edge is done with
+ * exact 64-bit products, which holds as long as all coordinates are
+ * less than 2^31 apart; only the final perpendicular distance is a
+ * division. */
+static double edge_distance_squared(int px, int py, int xi, int yi, int xj, int yj) {
+    long long dx = (long long) xi - xj;
+    long long dy = (long long) yi - yj;
+    long long qx = (long long) px - xj;
+    long long qy = (long long) py - yj;
+    long long dot = qx * dx + qy * dy;
+    long long length = dx * dx + dy * dy;
+    double cross;
+    if (dot <= 0) {
+        return (double) (qx * qx + qy * qy);
+    } else if (dot >= length) {
+        qx -= dx;
+        qy -= dy;
+        return (double) (qx * qx + qy * qy);
+    }
+    cross = (double) (qx * dy - qy * dx);
+    return cross * cross / (double) length;
+}
+
+double polygon_edges_distance_squared(int px, int py, int n, int *xs, int *ys) {
+    int i, j;
+    double distance, best = -1;
+    for (i = 0, j = n - 1; i < n; j = i++) {
+        distance = edge_distance_squared(px, py, xs[i], ys[i], xs[j], ys[j]);
+        if (best < 0 || distance < best) {
+            best = distance;
+        }
+    }
+    return best;
+}
+
+double polygon_edges_distance_squared_compact(int px, int py, int n, const unsigned short *points, int origin_x, int origin_y) {
+    int i, j;
+    double distance, best = -1;
+    for (i = 0, j = n - 1; i < n; j = i++) {
+        distance = edge_distance_squared(px, py, COMPACT_X(points, i, origin_x), COMPACT_Y(points, i, origin_y),
+                                         COMPACT_X(points, j, origin_x), COMPACT_Y(points, j, origin_y));
+        if (best < 0 || distance < best) {
+            best = distance;
+        }
+    }
+    return best;
+}
 
 bool lines_intersect(int line1[2][2], int line2[2][2]) {
     int line1Vector_x = line1[1][0] - line1[0][0];
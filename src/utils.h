@@ -4,9 +4,42 @@
 #define NO_COLLISION (0)
 #define COLLISION    (1)
 
+/* results of classify_polygon_rectangle() */
+#define RECTANGLE_OUTSIDE           (0)
+#define RECTANGLE_PARTIALLY_COVERED (1)
+#define RECTANGLE_COVERED           (2)
+
+int classify_polygon_rectangle(int n, int *xs, int *ys, int rx, int ry, int w, int h);
+int classify_polygon_edges_rectangle(int n, int *xs, int *ys, int number_of_edges, const int *edges,
+                                     int *entering, int *number_of_entering, int rx, int ry, int w, int h);
+int find_edges_entering_rectangle(int n, int *xs, int *ys, int number_of_edges, const int *edges,
+                                  int *entering, int rx, int ry, int w, int h);
 int collide_polygon_rectangle(int n, int *xs, int *ys, int rx, int ry, int w, int h);
 int rectangle_inside_polygon(int rx, int ry, int w, int h, int n, int *xs, int *ys);
 int point_in_polygon(int px, int py, int n, int *xs, int *ys);
+int point_in_polygon_edges(int px, int py, int qx, int q_inside, int n, int *xs, int *ys,
+                           int number_of_edges, const int *edges);
+double polygon_edges_distance_squared(int px, int py, int n, int *xs, int *ys);
+void points_in_polygon(int number_of_points, int *pxs, int *pys, int n, int *xs, int *ys, unsigned char *inside);
+/* Compact corners are pairs of 16 bit offsets from an origin, x
+ * first.  The _compact functions give the same results as the others
+ * for the corners the offsets decode to. */
+#define COMPACT_X(points, i, origin_x) ((origin_x) + (int) (points)[2 * (i)])
+#define COMPACT_Y(points, i, origin_y) ((origin_y) + (int) (points)[2 * (i) + 1])
+
+int classify_polygon_rectangle_compact(int n, const unsigned short *points, int origin_x, int origin_y,
+                                       int rx, int ry, int w, int h);
+int classify_polygon_edges_rectangle_compact(int n, const unsigned short *points, int origin_x, int origin_y,
+                                             int number_of_edges, const int *edges, int *entering,
+                                             int *number_of_entering, int rx, int ry, int w, int h);
+int find_edges_entering_rectangle_compact(int n, const unsigned short *points, int origin_x, int origin_y,
+                                          int number_of_edges, const int *edges, int *entering,
+                                          int rx, int ry, int w, int h);
+int point_in_polygon_compact(int px, int py, int n, const unsigned short *points, int origin_x, int origin_y);
+int point_in_polygon_edges_compact(int px, int py, int qx, int q_inside, int n, const unsigned short *points,
+                                   int origin_x, int origin_y, int number_of_edges, const int *edges);
+double polygon_edges_distance_squared_compact(int px, int py, int n, const unsigned short *points, int origin_x, int origin_y);
 unsigned long next_power_of_2(unsigned long n);
+unsigned long long interleave_bits(unsigned long x, unsigned long y);
 
 #endif /* __UTILS_H__ */
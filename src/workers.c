@@ -0,0 +1,146 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "workers.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* The calling thread of lq_workers_run() acts as worker 0 so a pool of
+ * n workers only starts n - 1 threads. */
+struct lq_workers_type {
+    int number_of_workers;
+    int number_of_threads;
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t task_available;
+    pthread_cond_t task_done;
+    lq_workers_task_t task;
+    void *context;
+    unsigned long generation;
+    int number_of_busy_threads;
+    int shutdown;
+};
+
+typedef struct {
+    lq_workers_t *workers;
+    int worker_index;
+} lq_workers_thread_argument_t;
+
+static void* lq_workers_thread_main(void *argument) {
+    lq_workers_thread_argument_t *thread_argument = (lq_workers_thread_argument_t*) argument;
+    lq_workers_t *workers = thread_argument->workers;
+    int worker_index = thread_argument->worker_index;
+    unsigned long generation = 0;
+    free(thread_argument);
+    pthread_mutex_lock(&workers->mutex);
+    for (;;) {
+        while (!workers->shutdown && workers->generation == generation) {
+            pthread_cond_wait(&workers->task_available, &workers->mutex);
+        }
+        if (workers->shutdown) {
+            break;
+        }
+        generation = workers->generation;
+        pthread_mutex_unlock(&workers->mutex);
+        workers->task(worker_index, workers->context);
+        pthread_mutex_lock(&workers->mutex);
+        workers->number_of_busy_threads--;
+        if (workers->number_of_busy_threads == 0) {
+            pthread_cond_signal(&workers->task_done);
+        }
+    }
+    pthread_mutex_unlock(&workers->mutex);
+    return NULL;
+}
+
+lq_workers_t* lq_workers_create(int number_of_workers) {
+    int i;
+    lq_workers_t *workers;
+    if (number_of_workers <= 0) {
+        number_of_workers = lq_workers_default_count();
+    }
+    workers = (lq_workers_t*) calloc(1, sizeof(lq_workers_t));
+    if (workers == NULL) {
+        return NULL;
+    }
+    workers->number_of_workers = number_of_workers;
+    workers->threads = (pthread_t*) calloc(number_of_workers, sizeof(pthread_t));
+    if (workers->threads == NULL) {
+        free(workers);
+        return NULL;
+    }
+    pthread_mutex_init(&workers->mutex, NULL);
+    pthread_cond_init(&workers->task_available, NULL);
+    pthread_cond_init(&workers->task_done, NULL);
+    for (i = 1; i < number_of_workers; ++i) {
+        lq_workers_thread_argument_t *argument = (lq_workers_thread_argument_t*) malloc(sizeof(lq_workers_thread_argument_t));
+        if (argument == NULL) {
+            goto error;
+        }
+        argument->workers = workers;
+        argument->worker_index = i;
+        if (pthread_create(&workers->threads[i - 1], NULL, lq_workers_thread_main, argument) != 0) {
+            free(argument);
+            goto error;
+        }
+        workers->number_of_threads++;
+    }
+    return workers;
+
+error:
+    lq_workers_destroy(workers);
+    return NULL;
+}
+
+void lq_workers_destroy(lq_workers_t *workers) {
+    int i;
+    if (workers == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&workers->mutex);
+    workers->shutdown = 1;
+    pthread_cond_broadcast(&workers->task_available);
+    pthread_mutex_unlock(&workers->mutex);
+    for (i = 0; i < workers->number_of_threads; ++i) {
+        pthread_join(workers->threads[i], NULL);
+    }
+    pthread_cond_destroy(&workers->task_done);
+    pthread_cond_destroy(&workers->task_available);
+    pthread_mutex_destroy(&workers->mutex);
+    free(workers->threads);
+    free(workers);
+}
+
+int lq_workers_count(lq_workers_t *workers) {
+    return workers->number_of_workers;
+}
+
+/* runs task on all workers and returns once every one of them is done */
+void lq_workers_run(lq_workers_t *workers, lq_workers_task_t task, void *context) {
+    if (workers->number_of_threads > 0) {
+        pthread_mutex_lock(&workers->mutex);
+        workers->task = task;
+        workers->context = context;
+        workers->number_of_busy_threads = workers->number_of_threads;
+        workers->generation++;
+        pthread_cond_broadcast(&workers->task_available);
+        pthread_mutex_unlock(&workers->mutex);
+    }
+    task(0, context);
+    if (workers->number_of_threads > 0) {
+        pthread_mutex_lock(&workers->mutex);
+        while (workers->number_of_busy_threads > 0) {
+            pthread_cond_wait(&workers->task_done, &workers->mutex);
+        }
+        pthread_mutex_unlock(&workers->mutex);
+    }
+}
+
+int lq_workers_default_count(void) {
+    long number_of_processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (number_of_processors < 1) {
+        return 1;
+    }
+    return (int) number_of_processors;
+}
@@ -0,0 +1,17 @@
+#ifndef __WORKERS_H__
+#define __WORKERS_H__
+
+typedef struct lq_workers_type lq_workers_t;
+
+/* a task is run once on every worker.  worker_index is in the range
+ * [0, number_of_workers) and identifies the worker for the duration
+ * of the task. */
+typedef void (*lq_workers_task_t)(int worker_index, void *context);
+
+lq_workers_t* lq_workers_create(int number_of_workers);
+void lq_workers_destroy(lq_workers_t *workers);
+int lq_workers_count(lq_workers_t *workers);
+void lq_workers_run(lq_workers_t *workers, lq_workers_task_t task, void *context);
+int lq_workers_default_count(void);
+
+#endif /* __WORKERS_H__ */
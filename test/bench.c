@@ -0,0 +1,403 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <limits.h>
+#include <malloc.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "quadtree.h"
+
+/* Synthetic workloads for measuring the quadtree.  Every workload runs
+ * in a child process of its own so that its peak RSS is not inflated
+ * by the workloads before it.  The polygons and query points only
+ * depend on the seed, so runs of different commits see the same
+ * input. */
+
+#define AREA_SIZE (1 << 12)
+#define NUMBER_OF_QUERIES (100000)
+#define DEFAULT_SEED (42)
+#define TWO_PI (6.283185307179586)
+
+typedef struct {
+    const char *name;
+    int number_of_polygons;
+    int number_of_points;
+    long *ids;
+    int *counts;
+    int *offsets;
+    int *xs;
+    int *ys;
+} workload_t;
+
+typedef struct {
+    double build_ms;
+    double add_ms;
+    long long add_p50, add_p99;
+    long long query_p50, query_p99;
+    long long remove_p50, remove_p99;
+    long peak_rss_kib;
+    long bytes_per_polygon;
+} measurement_t;
+
+typedef void (*generator_t)(workload_t *workload, double scale);
+/* the number of polygons a generator makes at a scale */
+typedef int (*sizer_t)(double scale);
+
+static unsigned long long random_state;
+
+/* xorshift64* so the input does not depend on the C library */
+static int random_below(int n) {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return (int) (((random_state * 2685821657736338717ull) >> 33) % (unsigned long long) n);
+}
+
+static long long now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void* checked_malloc(size_t size) {
+    void *memory = malloc(size);
+    if (memory == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return memory;
+}
+
+static void workload_allocate(workload_t *workload, int number_of_polygons, int number_of_points) {
+    workload->number_of_polygons = 0;
+    workload->number_of_points = 0;
+    workload->ids = (long*) checked_malloc(number_of_polygons * sizeof(long));
+    workload->counts = (int*) checked_malloc(number_of_polygons * sizeof(int));
+    workload->offsets = (int*) checked_malloc(number_of_polygons * sizeof(int));
+    workload->xs = (int*) checked_malloc(number_of_points * sizeof(int));
+    workload->ys = (int*) checked_malloc(number_of_points * sizeof(int));
+}
+
+static void workload_free(workload_t *workload) {
+    free(workload->ids);
+    free(workload->counts);
+    free(workload->offsets);
+    free(workload->xs);
+    free(workload->ys);
+}
+
+static void workload_start_polygon(workload_t *workload) {
+    int i = workload->number_of_polygons++;
+    workload->ids[i] = i;
+    workload->counts[i] = 0;
+    workload->offsets[i] = workload->number_of_points;
+}
+
+static void workload_add_point(workload_t *workload, int x, int y) {
+    workload->xs[workload->number_of_points] = x < 0 ? 0 : x >= AREA_SIZE ? AREA_SIZE - 1 : x;
+    workload->ys[workload->number_of_points] = y < 0 ? 0 : y >= AREA_SIZE ? AREA_SIZE - 1 : y;
+    workload->number_of_points++;
+    workload->counts[workload->number_of_polygons - 1]++;
+}
+
+/* polygon with number_of_corners corners around (x, y) whose distance
+ * to the center varies between min_radius and max_radius */
+static void workload_add_star(workload_t *workload, int x, int y, int number_of_corners, int min_radius, int max_radius) {
+    int i;
+    workload_start_polygon(workload);
+    for (i = 0; i < number_of_corners; ++i) {
+        double angle = TWO_PI * i / number_of_corners;
+        double radius = min_radius + random_below(max_radius - min_radius + 1);
+        workload_add_point(workload, x + (int) (radius * cos(angle)), y + (int) (radius * sin(angle)));
+    }
+}
+
+static int random_triangles_size(double scale) {
+    return (int) (50 * scale);
+}
+
+/* triangles with corners anywhere in the area like test/pytest.py */
+static void generate_random_triangles(workload_t *workload, double scale) {
+    int i, j, n = random_triangles_size(scale);
+    workload_allocate(workload, n, 3 * n);
+    for (i = 0; i < n; ++i) {
+        workload_start_polygon(workload);
+        for (j = 0; j < 3; ++j) {
+            workload_add_point(workload, random_below(AREA_SIZE), random_below(AREA_SIZE));
+        }
+    }
+}
+
+static int large_polygons_size(double scale) {
+    return (int) (16 * scale);
+}
+
+/* a few polygons with thousands of corners each */
+static void generate_large_polygons(workload_t *workload, double scale) {
+    int i, n = large_polygons_size(scale), grid = (int) ceil(sqrt(n)), cell = AREA_SIZE / grid;
+    workload_allocate(workload, n, 2000 * n);
+    for (i = 0; i < n; ++i) {
+        workload_add_star(workload, (i % grid) * cell + cell / 2, (i / grid) * cell + cell / 2,
+                          2000, cell / 4, cell / 2);
+    }
+}
+
+static int tiles_grid(double scale) {
+    return (int) (64 * sqrt(scale));
+}
+
+static int tiles_size(double scale) {
+    return tiles_grid(scale) * tiles_grid(scale);
+}
+
+/* quadrilaterals sharing their jittered corners with their neighbours
+ * like the parcels of a map */
+static void generate_tiles(workload_t *workload, double scale) {
+    int i, j, k, grid = tiles_grid(scale), cell = AREA_SIZE / grid;
+    int *corner_xs = (int*) checked_malloc((grid + 1) * (grid + 1) * sizeof(int));
+    int *corner_ys = (int*) checked_malloc((grid + 1) * (grid + 1) * sizeof(int));
+    static const int di[] = { 0, 1, 1, 0 };
+    static const int dj[] = { 0, 0, 1, 1 };
+    for (i = 0; i <= grid; ++i) {
+        for (j = 0; j <= grid; ++j) {
+            int inner = i > 0 && i < grid && j > 0 && j < grid;
+            corner_xs[i * (grid + 1) + j] = j * cell + (inner ? random_below(cell / 2) - cell / 4 : 0);
+            corner_ys[i * (grid + 1) + j] = i * cell + (inner ? random_below(cell / 2) - cell / 4 : 0);
+        }
+    }
+    workload_allocate(workload, grid * grid, 4 * grid * grid);
+    for (i = 0; i < grid; ++i) {
+        for (j = 0; j < grid; ++j) {
+            workload_start_polygon(workload);
+            for (k = 0; k < 4; ++k) {
+                int corner = (i + di[k]) * (grid + 1) + j + dj[k];
+                workload_add_point(workload, corner_xs[corner], corner_ys[corner]);
+            }
+        }
+    }
+    free(corner_xs);
+    free(corner_ys);
+}
+
+static int heavy_overlap_size(double scale) {
+    return (int) (200 * scale);
+}
+
+/* big polygons piled up around the center of the area */
+static void generate_heavy_overlap(workload_t *workload, double scale) {
+    int i, n = heavy_overlap_size(scale);
+    workload_allocate(workload, n, 16 * n);
+    for (i = 0; i < n; ++i) {
+        workload_add_star(workload, AREA_SIZE / 2 + random_below(AREA_SIZE / 8) - AREA_SIZE / 16,
+                          AREA_SIZE / 2 + random_below(AREA_SIZE / 8) - AREA_SIZE / 16,
+                          16, AREA_SIZE / 16, AREA_SIZE / 8);
+    }
+}
+
+static int compare_durations(const void *a, const void *b) {
+    long long duration_a = *(const long long*) a;
+    long long duration_b = *(const long long*) b;
+    return (duration_a > duration_b) - (duration_a < duration_b);
+}
+
+/* sorts durations and returns the given percentile of them */
+static long long percentile(long long *durations, int n, int p) {
+    qsort(durations, n, sizeof(long long), compare_durations);
+    return durations[(long long) (n - 1) * p / 100];
+}
+
+static void check(int error_code, const char *what) {
+    if (error_code != QUADTREE_SUCCESS) {
+        fprintf(stderr, "%s failed with error code %d\n", what, error_code);
+        exit(1);
+    }
+}
+
+static void measure(workload_t *workload, measurement_t *measurement) {
+    int i, n = workload->number_of_polygons;
+    int left = AREA_SIZE, bottom = AREA_SIZE, right = 0, top = 0;
+    long long start;
+    long long *durations = (long long*) checked_malloc((n > NUMBER_OF_QUERIES ? n : NUMBER_OF_QUERIES) * sizeof(long long));
+    int *query_xs = (int*) checked_malloc(NUMBER_OF_QUERIES * sizeof(int));
+    int *query_ys = (int*) checked_malloc(NUMBER_OF_QUERIES * sizeof(int));
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    struct rusage usage;
+    quadtree_stats_t stats;
+    quadtree_t qt = quadtree_create(0, 0, AREA_SIZE, AREA_SIZE);
+    if (qt == NULL || result == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    /* query where the polygons are */
+    for (i = 0; i < workload->number_of_points; ++i) {
+        left = workload->xs[i] < left ? workload->xs[i] : left;
+        right = workload->xs[i] > right ? workload->xs[i] : right;
+        bottom = workload->ys[i] < bottom ? workload->ys[i] : bottom;
+        top = workload->ys[i] > top ? workload->ys[i] : top;
+    }
+    for (i = 0; i < NUMBER_OF_QUERIES; ++i) {
+        query_xs[i] = left + random_below(right - left + 1);
+        query_ys[i] = bottom + random_below(top - bottom + 1);
+    }
+
+    /* the first tree of the process pays for faulting in the memory
+     * of the heap, so an untimed build runs first and the timed build
+     * and add loop both start from a warm heap, see main() */
+    check(quadtree_build(qt, n, workload->ids, workload->counts, workload->xs, workload->ys, NULL), "build");
+    quadtree_destroy(qt);
+
+    qt = quadtree_create(0, 0, AREA_SIZE, AREA_SIZE);
+    start = now_ns();
+    check(quadtree_build(qt, n, workload->ids, workload->counts, workload->xs, workload->ys, NULL), "build");
+    measurement->build_ms = (now_ns() - start) / 1e6;
+    quadtree_destroy(qt);
+
+    qt = quadtree_create(0, 0, AREA_SIZE, AREA_SIZE);
+    measurement->add_ms = 0;
+    for (i = 0; i < n; ++i) {
+        int offset = workload->offsets[i];
+        start = now_ns();
+        check(quadtree_add(qt, workload->ids[i], workload->counts[i], workload->xs + offset, workload->ys + offset), "add");
+        durations[i] = now_ns() - start;
+        measurement->add_ms += durations[i] / 1e6;
+    }
+    quadtree_get_stats(qt, &stats);
+    measurement->bytes_per_polygon = stats.total_bytes / n;
+    measurement->add_p50 = percentile(durations, n, 50);
+    measurement->add_p99 = percentile(durations, n, 99);
+
+    for (i = 0; i < NUMBER_OF_QUERIES; ++i) {
+        start = now_ns();
+        check(quadtree_query(qt, query_xs[i], query_ys[i], result), "query");
+        durations[i] = now_ns() - start;
+    }
+    measurement->query_p50 = percentile(durations, NUMBER_OF_QUERIES, 50);
+    measurement->query_p99 = percentile(durations, NUMBER_OF_QUERIES, 99);
+
+    for (i = 0; i < n; ++i) {
+        start = now_ns();
+        check(quadtree_remove(qt, workload->ids[i]), "remove");
+        durations[i] = now_ns() - start;
+    }
+    measurement->remove_p50 = percentile(durations, n, 50);
+    measurement->remove_p99 = percentile(durations, n, 99);
+
+    quadtree_destroy(qt);
+    quadtree_query_result_free(result);
+    free(durations);
+    free(query_xs);
+    free(query_ys);
+    getrusage(RUSAGE_SELF, &usage);
+    measurement->peak_rss_kib = usage.ru_maxrss;
+}
+
+static void print_header(int csv) {
+    if (csv) {
+        printf("workload,polygons,points,build_ms,add_ms,add_p50_ns,add_p99_ns,query_p50_ns,query_p99_ns,"
+               "remove_p50_ns,remove_p99_ns,peak_rss_kib,bytes_per_polygon\n");
+    } else {
+        printf("%-16s %8s %9s %9s %9s %17s %17s %17s %10s %9s\n", "workload", "polygons", "points", "build ms",
+               "add ms", "add p50/p99 ns", "query p50/p99 ns", "remove p50/p99 ns", "peak KiB", "B/polygon");
+    }
+}
+
+static void print_measurement(int csv, const workload_t *workload, const measurement_t *m) {
+    if (csv) {
+        printf("%s,%d,%d,%.3f,%.3f,%lld,%lld,%lld,%lld,%lld,%lld,%ld,%ld\n", workload->name,
+               workload->number_of_polygons, workload->number_of_points, m->build_ms,
+               m->add_ms, m->add_p50, m->add_p99, m->query_p50, m->query_p99, m->remove_p50, m->remove_p99,
+               m->peak_rss_kib, m->bytes_per_polygon);
+    } else {
+        printf("%-16s %8d %9d %9.1f %9.1f %8lld/%-8lld %8lld/%-8lld %8lld/%-8lld %10ld %9ld\n", workload->name,
+               workload->number_of_polygons, workload->number_of_points, m->build_ms,
+               m->add_ms, m->add_p50, m->add_p99, m->query_p50, m->query_p99, m->remove_p50, m->remove_p99,
+               m->peak_rss_kib, m->bytes_per_polygon);
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [--csv] [--seed=N] [--scale=F] [workload...]\n"
+                    "workloads: random_triangles large_polygons tiles heavy_overlap\n", program);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static const char *names[] = { "random_triangles", "large_polygons", "tiles", "heavy_overlap" };
+    static const generator_t generators[] = { generate_random_triangles, generate_large_polygons,
+                                              generate_tiles, generate_heavy_overlap };
+    static const sizer_t sizers[] = { random_triangles_size, large_polygons_size, tiles_size, heavy_overlap_size };
+    int i, w, csv = 0, number_of_selected = 0, failed = 0;
+    int selected[4] = { 0, 0, 0, 0 };
+    unsigned long long seed = DEFAULT_SEED;
+    double scale = 1.;
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            csv = 1;
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = strtoull(argv[i] + 7, NULL, 10);
+        } else if (strncmp(argv[i], "--scale=", 8) == 0) {
+            scale = atof(argv[i] + 8);
+            if (scale <= 0.) {
+                usage(argv[0]);
+            }
+        } else {
+            for (w = 0; w < 4 && strcmp(argv[i], names[w]) != 0; ++w) {
+            }
+            if (w == 4) {
+                usage(argv[0]);
+            }
+            selected[w] = 1;
+            number_of_selected++;
+        }
+    }
+    /* the measurements are per polygon and need at least one */
+    for (w = 0; w < 4; ++w) {
+        if ((number_of_selected == 0 || selected[w]) && sizers[w](scale) == 0) {
+            fprintf(stderr, "--scale=%g leaves no polygons for %s\n", scale, names[w]);
+            usage(argv[0]);
+        }
+    }
+    /* freed memory stays in the process instead of going back to the
+     * system, otherwise glibc unmaps the slabs of a destroyed tree and
+     * the next tree faults them in again */
+    mallopt(M_MMAP_THRESHOLD, 32 * 1024 * 1024);
+    mallopt(M_TRIM_THRESHOLD, INT_MAX);
+    print_header(csv);
+    fflush(stdout);
+    for (w = 0; w < 4; ++w) {
+        pid_t pid;
+        int status;
+        if (number_of_selected > 0 && !selected[w]) {
+            continue;
+        }
+        pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            workload_t workload;
+            measurement_t measurement;
+            /* every workload gets the same input regardless of which
+             * workloads run before it */
+            random_state = seed * 0x9e3779b97f4a7c15ull + w + 1;
+            workload.name = names[w];
+            generators[w](&workload, scale);
+            measure(&workload, &measurement);
+            print_measurement(csv, &workload, &measurement);
+            workload_free(&workload);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "workload %s failed\n", names[w]);
+            failed = 1;
+        }
+    }
+    return failed;
+}
@@ -1,8 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "testutils.h"
 #include "quadtree.h"
 #include "utils.c"
+/* the library takes its pools from here, see lq_pool_allocate() below */
+#define lq_pool_allocate lq_pool_allocate_unfailing
+#include "pool.c"
+#undef lq_pool_allocate
+#include "idmap.c"
+#include "edges.c"
+
+/* the number of pool allocations that succeed before one fails or -1 */
+static long pool_allocations_until_failure = -1;
+
+void* lq_pool_allocate(lq_pool_t *pool) {
+    if (pool_allocations_until_failure >= 0 && pool_allocations_until_failure-- == 0) {
+        return NULL;
+    }
+    return lq_pool_allocate_unfailing(pool);
+}
 
 void test_point_in_polygon() {
     int rect_AA_xs[4] = { 2, 8, 8, 2 };
@@ -35,6 +55,212 @@ void test_point_in_polygon() {
     assertFalse("point in tri", point_in_polygon(4, 4, 3, tri_xs, tri_ys));
 }
 
+void test_point_in_polygon_simd() {
+    int i, n, px, py, k;
+    int xs[100], ys[100];
+    int pxs[25 * 25], pys[25 * 25];
+    unsigned char inside[25 * 25];
+    srand(3);
+    for (n = 3; n < 100; n += 7) {
+        /* small coordinates so that many points lie on edges and
+         * corners and many edges are horizontal or vertical */
+        for (i = 0; i < n; ++i) {
+            xs[i] = rand() % 21;
+            ys[i] = rand() % 21;
+        }
+        k = 0;
+        for (px = -2; px < 23; ++px) {
+            for (py = -2; py < 23; ++py) {
+                int expected = point_in_polygon_scalar(px, py, n, xs, ys);
+                assertEqualsInt("point_in_polygon differs", expected, point_in_polygon(px, py, n, xs, ys));
+#ifdef HAVE_X86_SIMD
+                if (__builtin_cpu_supports("avx2")) {
+                    assertEqualsInt("avx2 differs", expected, point_in_polygon_avx2(px, py, n, xs, ys));
+                }
+                if (__builtin_cpu_supports("sse4.1")) {
+                    assertEqualsInt("sse4.1 differs", expected, point_in_polygon_sse41(px, py, n, xs, ys));
+                }
+#endif
+                pxs[k] = px;
+                pys[k] = py;
+                ++k;
+            }
+        }
+        points_in_polygon(k, pxs, pys, n, xs, ys, inside);
+        for (i = 0; i < k; ++i) {
+            assertEqualsInt("points_in_polygon differs",
+                            point_in_polygon_scalar(pxs[i], pys[i], n, xs, ys), inside[i]);
+        }
+#ifdef HAVE_X86_SIMD
+        if (__builtin_cpu_supports("sse4.1")) {
+            for (i = 0; i + 4 <= k; i += 4) {
+                points_in_polygon_sse41(pxs + i, pys + i, n, xs, ys, inside + i);
+            }
+            for (i = 0; i + 4 <= k; ++i) {
+                assertEqualsInt("sse4.1 points_in_polygon differs",
+                                point_in_polygon_scalar(pxs[i], pys[i], n, xs, ys), inside[i]);
+            }
+        }
+#endif
+    }
+}
+
+/* a comb of 1000 teeth, 4002 corners whose long edges all straddle
+ * most rows */
+#define COMB_TEETH (1000)
+
+void test_edge_index() {
+    int i, n, px, py;
+    int xs[100], ys[100];
+    int comb_xs[4 * COMB_TEETH + 2], comb_ys[4 * COMB_TEETH + 2];
+    int rows[] = { -1, 0, 5, 9, 10, 11, 500, 999, 1000, 1001 };
+    lq_edge_index_t *index;
+    srand(4);
+    for (n = 3; n < 100; n += 5) {
+        for (i = 0; i < n; ++i) {
+            xs[i] = rand() % 41 - 20;
+            ys[i] = rand() % 41 - 20;
+        }
+        index = lq_edge_index_create(n, xs, ys);
+        assertTrue("index creation failed", index != NULL);
+        for (px = -22; px < 23; ++px) {
+            for (py = -22; py < 23; ++py) {
+                assertEqualsInt("edge index differs", point_in_polygon_scalar(px, py, n, xs, ys),
+                                lq_edge_index_contains(index, px, py));
+            }
+        }
+        lq_edge_index_destroy(index);
+    }
+    n = 0;
+    comb_xs[n] = 0;
+    comb_ys[n++] = 0;
+    for (i = 0; i < COMB_TEETH; ++i) {
+        comb_xs[n] = 4 * i;
+        comb_ys[n++] = 1000;
+        comb_xs[n] = 4 * i + 2;
+        comb_ys[n++] = 1000;
+        comb_xs[n] = 4 * i + 2;
+        comb_ys[n++] = 10;
+        comb_xs[n] = 4 * i + 4;
+        comb_ys[n++] = 10;
+    }
+    comb_xs[n] = 4 * COMB_TEETH;
+    comb_ys[n++] = 0;
+    index = lq_edge_index_create(n, comb_xs, comb_ys);
+    assertTrue("index creation failed", index != NULL);
+    assertTrue("index is not linear in the corners", lq_edge_index_size(index) < (MAX_EDGE_COPIES + 1) * n * sizeof(lq_edge_t));
+    for (px = -1; px <= 4 * COMB_TEETH + 1; px += 3) {
+        for (i = 0; i < (int) (sizeof(rows) / sizeof(rows[0])); ++i) {
+            assertEqualsInt("edge index of the comb differs",
+                            point_in_polygon_scalar(px, rows[i], n, comb_xs, comb_ys),
+                            lq_edge_index_contains(index, px, rows[i]));
+        }
+    }
+    lq_edge_index_destroy(index);
+}
+
+void test_compact_points() {
+    int i, n, px, py, w, h, k;
+    int xs[100], ys[100];
+    int edges[100], entering[100], compact_entering[100];
+    int number_of_entering, compact_number_of_entering;
+    unsigned short points[200];
+    int origin_x = -1000, origin_y = 70000;
+    srand(5);
+    for (n = 3; n < 100; n += 7) {
+        for (i = 0; i < n; ++i) {
+            points[2 * i] = (unsigned short) (rand() % 21);
+            points[2 * i + 1] = (unsigned short) (rand() % 21);
+            xs[i] = origin_x + points[2 * i];
+            ys[i] = origin_y + points[2 * i + 1];
+            edges[i] = i;
+        }
+        for (px = origin_x - 2; px < origin_x + 23; ++px) {
+            for (py = origin_y - 2; py < origin_y + 23; ++py) {
+                int expected = point_in_polygon_scalar(px, py, n, xs, ys);
+                assertEqualsInt("compact point_in_polygon differs", expected,
+                                point_in_polygon_compact(px, py, n, points, origin_x, origin_y));
+                assertEqualsInt("compact scalar differs", expected,
+                                point_in_polygon_compact_scalar(px, py, n, points, origin_x, origin_y));
+#ifdef HAVE_X86_SIMD
+                if (__builtin_cpu_supports("avx2")) {
+                    assertEqualsInt("compact avx2 differs", expected,
+                                    point_in_polygon_compact_avx2(px, py, n, points, origin_x, origin_y));
+                }
+                if (__builtin_cpu_supports("sse4.1")) {
+                    assertEqualsInt("compact sse4.1 differs", expected,
+                                    point_in_polygon_compact_sse41(px, py, n, points, origin_x, origin_y));
+                }
+#endif
+                assertTrue("compact distance differs",
+                           polygon_edges_distance_squared(px, py, n, xs, ys) ==
+                           polygon_edges_distance_squared_compact(px, py, n, points, origin_x, origin_y));
+            }
+        }
+        for (k = 0; k < 50; ++k) {
+            px = origin_x + rand() % 25 - 2;
+            py = origin_y + rand() % 25 - 2;
+            w = 1 + rand() % 8;
+            h = 1 + rand() % 8;
+            assertEqualsInt("compact classification differs",
+                            classify_polygon_rectangle(n, xs, ys, px, py, w, h),
+                            classify_polygon_rectangle_compact(n, points, origin_x, origin_y, px, py, w, h));
+            assertEqualsInt("compact edge classification differs",
+                            classify_polygon_edges_rectangle(n, xs, ys, n, edges, entering,
+                                                             &number_of_entering, px, py, w, h),
+                            classify_polygon_edges_rectangle_compact(n, points, origin_x, origin_y, n, edges,
+                                                                     compact_entering, &compact_number_of_entering,
+                                                                     px, py, w, h));
+            assertEqualsInt("wrong number of entering edges", number_of_entering, compact_number_of_entering);
+            for (i = 0; i < number_of_entering; ++i) {
+                assertEqualsInt("wrong entering edge", entering[i], compact_entering[i]);
+            }
+        }
+    }
+}
+
+void test_compact_quadtree() {
+    int i;
+    /* the first fits 16 bit offsets, the second is too wide */
+    int small_xs[] = { 100, 65635, 65635, 100 };
+    int small_ys[] = { 100, 100, 300, 300 };
+    int wide_xs[] = { 50, 70000, 70000, 50 };
+    int wide_ys[] = { 200, 200, 400, 400 };
+    int xs[] = { 99, 100, 150, 65634, 65635, 69999, 70000, 60 };
+    int ys[] = { 150, 150, 250, 299, 299, 350, 350, 100 };
+    int counts[] = { 0, 1, 2, 2, 1, 1, 0, 0 };
+    quadtree_stats_t stats;
+    quadtree_t qt = quadtree_create(0, 0, 1 << 17, 1 << 10);
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    quadtree_frozen_t frozen;
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 1, 4, small_xs, small_ys));
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 2, 4, wide_xs, wide_ys));
+    quadtree_get_stats(qt, &stats);
+    assertEqualsULong("wrong point bytes", 8 * sizeof(unsigned short) + 8 * sizeof(int),
+                      (unsigned long) stats.point_bytes);
+    frozen = quadtree_freeze(qt);
+    for (i = 0; i < 8; ++i) {
+        quadtree_query(qt, xs[i], ys[i], result);
+        assertEqualsInt("wrong number of ids", counts[i], result->number_of_ids);
+        quadtree_frozen_query(frozen, xs[i], ys[i], result);
+        assertEqualsInt("wrong number of frozen ids", counts[i], result->number_of_ids);
+    }
+    quadtree_frozen_destroy(frozen);
+
+    /* updates switch between both kinds of corners */
+    assertEqualsInt("update failed", QUADTREE_SUCCESS, quadtree_update(qt, 1, 4, wide_xs, wide_ys));
+    assertEqualsInt("update failed", QUADTREE_SUCCESS, quadtree_update(qt, 2, 4, small_xs, small_ys));
+    for (i = 0; i < 8; ++i) {
+        quadtree_query(qt, xs[i], ys[i], result);
+        assertEqualsInt("wrong number of ids after update", counts[i], result->number_of_ids);
+    }
+    quadtree_set_edge_index(qt, 1);
+    quadtree_query(qt, 150, 250, result);
+    assertEqualsInt("wrong number of ids with edge index", 2, result->number_of_ids);
+    quadtree_query_result_free(result);
+    quadtree_destroy(qt);
+}
+
 void test_lines_intersect() {
     int line1[2][2] = { {2, 2}, {10, 2} };
     int line1b[2][2] = { {11, 2}, {2, 2} };
@@ -89,6 +315,52 @@ void test_collide_polygon_rectangle() {
 */
 }
 
+void test_classify_polygon_rectangle() {
+    int i, k, x, y, inside, outside, classification;
+    int xs[6], ys[6];
+    int square_xs[] = { 0, 8, 8, 0 };
+    int square_ys[] = { 0, 0, 8, 8 };
+    /* edges on the border of the rectangle do not make it partial */
+    assertEqualsInt("square should cover", RECTANGLE_COVERED,
+                    classify_polygon_rectangle(4, square_xs, square_ys, 0, 0, 8, 8));
+    assertEqualsInt("neighbour should be outside", RECTANGLE_OUTSIDE,
+                    classify_polygon_rectangle(4, square_xs, square_ys, 8, 0, 8, 8));
+    assertEqualsInt("neighbour should be outside", RECTANGLE_OUTSIDE,
+                    classify_polygon_rectangle(4, square_xs, square_ys, 0, 8, 8, 8));
+    assertEqualsInt("square should be partial", RECTANGLE_PARTIALLY_COVERED,
+                    classify_polygon_rectangle(4, square_xs, square_ys, 4, 4, 8, 8));
+    /* outside and covered must agree with point_in_polygon() on every
+     * point of the rectangle */
+    srand(11);
+    for (i = 0; i < 20000; ++i) {
+        int n = 3 + rand() % 4;
+        int rx = rand() % 24, ry = rand() % 24;
+        int w = 1 + rand() % 12, h = 1 + rand() % 12;
+        for (k = 0; k < n; ++k) {
+            xs[k] = rand() % 40;
+            ys[k] = rand() % 40;
+        }
+        inside = outside = 0;
+        for (x = rx; x < rx + w; ++x) {
+            for (y = ry; y < ry + h; ++y) {
+                if (point_in_polygon(x, y, n, xs, ys)) {
+                    inside++;
+                } else {
+                    outside++;
+                }
+            }
+        }
+        classification = classify_polygon_rectangle(n, xs, ys, rx, ry, w, h);
+        if (classification == RECTANGLE_OUTSIDE) {
+            assertEqualsInt("point inside of outside rectangle", 0, inside);
+        } else if (classification == RECTANGLE_COVERED) {
+            assertEqualsInt("point outside of covered rectangle", 0, outside);
+        } else {
+            assertTrue("mixed rectangle not partial", classification == RECTANGLE_PARTIALLY_COVERED);
+        }
+    }
+}
+
 void test_rectangle_inside_polygon() {
     int pxs[] = { 0, 8, 0 };
     int pys[] = { 0, 0, 8 };
@@ -111,12 +383,1786 @@ void test_next_power_of_2() {
     assertEqualsULong("", 1l<<31, next_power_of_2((1l<<31)));
 }
 
+void test_pool() {
+    lq_pool_t pool;
+    int i;
+    long *objects[100];
+    lq_pool_initialize(&pool, sizeof(long));
+    for (i = 0; i < 100; ++i) {
+        objects[i] = (long*) lq_pool_allocate(&pool);
+        assertTrue("pool allocation failed", objects[i] != NULL);
+        assertTrue("pool object not zeroed", *objects[i] == 0);
+        *objects[i] = i;
+    }
+    assertEqualsULong("unexpected number of objects", 100lu, (unsigned long) pool.number_of_objects);
+    lq_pool_free(&pool, objects[42]);
+    assertTrue("freed slot not reused", lq_pool_allocate(&pool) == (void*) objects[42]);
+    for (i = 0; i < 100; ++i) {
+        assertTrue("pool object clobbered", i == 42 || *objects[i] == i);
+    }
+    lq_pool_destroy(&pool);
+    assertEqualsULong("pool not emptied", 0lu, (unsigned long) pool.number_of_objects);
+}
+
+void test_idmap() {
+    lq_idmap_t map;
+    long i;
+    static long values[1000];
+    lq_idmap_initialize(&map);
+    assertTrue("empty map returned a value", lq_idmap_get(&map, 3) == NULL);
+    for (i = 0; i < 1000; ++i) {
+        values[i] = i;
+        /* multiples of the capacity collide in the low bits */
+        assertEqualsInt("put failed", 0, lq_idmap_put(&map, i * 1024, &values[i]));
+    }
+    assertEqualsULong("unexpected size", 1000lu, (unsigned long) map.size);
+    for (i = 0; i < 1000; i += 2) {
+        assertTrue("removed wrong value", lq_idmap_remove(&map, i * 1024) == &values[i]);
+    }
+    assertTrue("removed missing key", lq_idmap_remove(&map, 1) == NULL);
+    for (i = 0; i < 1000; ++i) {
+        assertTrue("unexpected value", lq_idmap_get(&map, i * 1024) == (i % 2 ? &values[i] : NULL));
+    }
+    assertEqualsInt("put failed", 0, lq_idmap_put(&map, 1024, &values[0]));
+    assertTrue("value not replaced", lq_idmap_get(&map, 1024) == &values[0]);
+    assertEqualsULong("unexpected size", 500lu, (unsigned long) map.size);
+    lq_idmap_destroy(&map);
+}
+
+void test_remove() {
+    int xs[] = { 0, 80, 0 };
+    int ys[] = { 0, 0, 60 };
+    int small_xs[] = { 1, 9, 1 };
+    int small_ys[] = { 1, 1, 9 };
+    quadtree_t qt = quadtree_create(0, 0, 80, 60);
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 1, 3, xs, ys));
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 2, 3, small_xs, small_ys));
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 1, 3, small_xs, small_ys));
+    assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, 2, 2, result));
+    assertEqualsInt("unexpected number of ids", 3, result->number_of_ids);
+    /* removes both polygons with id 1 */
+    assertEqualsInt("remove failed", QUADTREE_SUCCESS, quadtree_remove(qt, 1));
+    assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, 2, 2, result));
+    assertEqualsInt("unexpected number of ids", 1, result->number_of_ids);
+    assertEqualsInt("unexpected id", 2, (int) result->ids[0]);
+    assertEqualsInt("remove failed", QUADTREE_SUCCESS, quadtree_remove(qt, 1));
+    assertEqualsInt("remove failed", QUADTREE_SUCCESS, quadtree_remove(qt, 2));
+    assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, 2, 2, result));
+    assertEqualsInt("unexpected number of ids", 0, result->number_of_ids);
+    quadtree_query_result_free(result);
+    quadtree_destroy(qt);
+}
+
+static void count_visited_ids(long id, void *context) {
+    *((long*) context) += id + 1;
+}
+
+void test_query_result_reuse() {
+    int xs[] = { 0, 80, 0 };
+    int ys[] = { 0, 0, 60 };
+    long *ids;
+    long visited = 0;
+    quadtree_t qt = quadtree_create(0, 0, 80, 60);
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 7, 3, xs, ys));
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 8, 3, xs, ys));
+    assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, 1, 1, result));
+    assertEqualsInt("unexpected number of ids", 2, result->number_of_ids);
+    ids = result->ids;
+    assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, 79, 59, result));
+    assertEqualsInt("unexpected number of ids", 0, result->number_of_ids);
+    assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, 2, 2, result));
+    assertEqualsInt("unexpected number of ids", 2, result->number_of_ids);
+    assertTrue("result buffer was reallocated", ids == result->ids);
+    assertEqualsInt("visit failed", QUADTREE_SUCCESS, quadtree_query_visit(qt, 2, 2, count_visited_ids, &visited));
+    assertEqualsInt("unexpected ids visited", 17, (int) visited);
+    assertEqualsInt("visit should fail", QUADTREE_ERROR_OUT_OF_BOUNDS,
+                    quadtree_query_visit(qt, 200, 2, count_visited_ids, &visited));
+    quadtree_query_result_free(result);
+    quadtree_destroy(qt);
+}
+
+void test_interleave_bits() {
+    assertEqualsULong("", 0lu, (unsigned long) interleave_bits(0, 0));
+    assertEqualsULong("", 1lu, (unsigned long) interleave_bits(1, 0));
+    assertEqualsULong("", 2lu, (unsigned long) interleave_bits(0, 1));
+    assertEqualsULong("", 0x3flu, (unsigned long) interleave_bits(7, 7));
+    assertEqualsULong("", 0x88lu, (unsigned long) interleave_bits(0, 10));
+}
+
+void test_query_batch() {
+    int i, j, k;
+    int xs[3], ys[3];
+    int pxs[500], pys[500], pxys[1000];
+    quadtree_t qt = quadtree_create(0, 0, 800, 600);
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    quadtree_batch_result_t *batch_result = quadtree_batch_result_allocate();
+    quadtree_batch_result_t *xy_result = quadtree_batch_result_allocate();
+    srand(42);
+    for (i = 0; i < 50; ++i) {
+        for (k = 0; k < 3; ++k) {
+            xs[k] = rand() % 800;
+            ys[k] = rand() % 600;
+        }
+        assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, i, 3, xs, ys));
+    }
+    for (i = 0; i < 500; ++i) {
+        pxs[i] = rand() % 800;
+        pys[i] = rand() % 600;
+    }
+    assertEqualsInt("batch failed", QUADTREE_SUCCESS, quadtree_query_batch(qt, 500, pxs, pys, batch_result));
+    assertEqualsInt("wrong number of points", 500, batch_result->number_of_points);
+    for (i = 0; i < 500; ++i) {
+        quadtree_query(qt, pxs[i], pys[i], result);
+        assertEqualsInt("wrong number of ids", result->number_of_ids,
+                        batch_result->offsets[i + 1] - batch_result->offsets[i]);
+        for (j = 0; j < result->number_of_ids; ++j) {
+            assertEqualsInt("wrong id", (int) result->ids[j],
+                            (int) batch_result->ids[batch_result->offsets[i] + j]);
+        }
+    }
+    for (i = 0; i < 500; ++i) {
+        pxys[2 * i] = pxs[i];
+        pxys[2 * i + 1] = pys[i];
+    }
+    assertEqualsInt("interleaved batch failed", QUADTREE_SUCCESS, quadtree_query_batch_xy(qt, 500, pxys, xy_result));
+    assertEqualsInt("wrong number of points", 500, xy_result->number_of_points);
+    for (i = 0; i <= 500; ++i) {
+        assertEqualsInt("wrong offset", batch_result->offsets[i], xy_result->offsets[i]);
+    }
+    for (i = 0; i < batch_result->offsets[500]; ++i) {
+        assertEqualsInt("wrong id", (int) batch_result->ids[i], (int) xy_result->ids[i]);
+    }
+    pxs[3] = 5000;
+    assertEqualsInt("batch should report out of bounds", QUADTREE_ERROR_OUT_OF_BOUNDS,
+                    quadtree_query_batch(qt, 10, pxs, pys, batch_result));
+    assertEqualsInt("out of bounds point has ids", batch_result->offsets[3], batch_result->offsets[4]);
+    quadtree_batch_result_free(xy_result);
+    quadtree_batch_result_free(batch_result);
+    quadtree_query_result_free(result);
+    quadtree_destroy(qt);
+}
+
+void test_query_batch_large_polygons() {
+    int i, j, k;
+    int xs[64], ys[64];
+    int pxs[2000], pys[2000];
+    quadtree_t qt = quadtree_create(0, 0, 800, 600);
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    quadtree_batch_result_t *batch_result = quadtree_batch_result_allocate();
+    quadtree_batch_result_t *indexed_result = quadtree_batch_result_allocate();
+    srand(43);
+    /* jagged polygons around the center so that many points share
+     * leaves with several large polygons */
+    for (i = 0; i < 6; ++i) {
+        for (k = 0; k < 64; ++k) {
+            /* walk around a square and pull every corner in or out */
+            int radius = 50 + rand() % 250;
+            int t = 2 * (k % 16);
+            int dx[4], dy[4];
+            dx[0] = t - 16; dy[0] = -16;
+            dx[1] = 16;     dy[1] = t - 16;
+            dx[2] = 16 - t; dy[2] = 16;
+            dx[3] = -16;    dy[3] = 16 - t;
+            xs[k] = 400 + dx[k / 16] * radius / 16;
+            ys[k] = 300 + dy[k / 16] * radius / 16;
+        }
+        assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, i, 64, xs, ys));
+    }
+    for (i = 0; i < 2000; ++i) {
+        pxs[i] = 300 + rand() % 200;
+        pys[i] = 200 + rand() % 200;
+    }
+    assertEqualsInt("batch failed", QUADTREE_SUCCESS, quadtree_query_batch(qt, 2000, pxs, pys, batch_result));
+    for (i = 0; i < 2000; ++i) {
+        quadtree_query(qt, pxs[i], pys[i], result);
+        assertEqualsInt("wrong number of ids", result->number_of_ids,
+                        batch_result->offsets[i + 1] - batch_result->offsets[i]);
+        for (j = 0; j < result->number_of_ids; ++j) {
+            assertEqualsInt("wrong id", (int) result->ids[j],
+                            (int) batch_result->ids[batch_result->offsets[i] + j]);
+        }
+    }
+    /* the edge index must not change any result */
+    assertEqualsInt("enabling edge index failed", QUADTREE_SUCCESS, quadtree_set_edge_index(qt, 1));
+    for (i = 0; i < 2000; ++i) {
+        quadtree_query(qt, pxs[i], pys[i], result);
+        assertEqualsInt("wrong number of ids", result->number_of_ids,
+                        batch_result->offsets[i + 1] - batch_result->offsets[i]);
+        for (j = 0; j < result->number_of_ids; ++j) {
+            assertEqualsInt("wrong id", (int) result->ids[j],
+                            (int) batch_result->ids[batch_result->offsets[i] + j]);
+        }
+    }
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 6, 64, xs, ys));
+    quadtree_remove(qt, 6);
+    assertEqualsInt("batch failed", QUADTREE_SUCCESS, quadtree_query_batch(qt, 2000, pxs, pys, indexed_result));
+    assertEqualsInt("wrong number of ids", batch_result->number_of_ids, indexed_result->number_of_ids);
+    for (i = 0; i < batch_result->number_of_ids; ++i) {
+        assertEqualsInt("wrong id", (int) batch_result->ids[i], (int) indexed_result->ids[i]);
+    }
+    quadtree_set_edge_index(qt, 0);
+    quadtree_batch_result_free(indexed_result);
+    quadtree_batch_result_free(batch_result);
+    quadtree_query_result_free(result);
+    quadtree_destroy(qt);
+}
+
+void test_query_batch_parallel() {
+    int i, k;
+    int xs[3], ys[3];
+    int number_of_points = 20000;
+    int *pxs = (int*) malloc(number_of_points * sizeof(int));
+    int *pys = (int*) malloc(number_of_points * sizeof(int));
+    quadtree_t qt = quadtree_create(0, 0, 800, 600);
+    quadtree_worker_pool_t worker_pool = quadtree_worker_pool_create(4);
+    quadtree_batch_result_t *expected = quadtree_batch_result_allocate();
+    quadtree_batch_result_t *batch_result = quadtree_batch_result_allocate();
+    assertEqualsInt("wrong pool size", 4, quadtree_worker_pool_size(worker_pool));
+    srand(7);
+    for (i = 0; i < 50; ++i) {
+        for (k = 0; k < 3; ++k) {
+            xs[k] = rand() % 800;
+            ys[k] = rand() % 600;
+        }
+        quadtree_add(qt, i, 3, xs, ys);
+    }
+    for (i = 0; i < number_of_points; ++i) {
+        pxs[i] = rand() % 800;
+        pys[i] = rand() % 600;
+    }
+    assertEqualsInt("batch failed", QUADTREE_SUCCESS,
+                    quadtree_query_batch(qt, number_of_points, pxs, pys, expected));
+    assertEqualsInt("parallel batch failed", QUADTREE_SUCCESS,
+                    quadtree_query_batch_parallel(qt, worker_pool, number_of_points, pxs, pys, batch_result));
+    assertEqualsInt("wrong number of ids", expected->number_of_ids, batch_result->number_of_ids);
+    for (i = 0; i <= number_of_points; ++i) {
+        assertEqualsInt("wrong offset", expected->offsets[i], batch_result->offsets[i]);
+    }
+    for (i = 0; i < expected->number_of_ids; ++i) {
+        assertEqualsInt("wrong id", (int) expected->ids[i], (int) batch_result->ids[i]);
+    }
+    pxs[12345] = -1;
+    assertEqualsInt("parallel batch should report out of bounds", QUADTREE_ERROR_OUT_OF_BOUNDS,
+                    quadtree_query_batch_parallel(qt, worker_pool, number_of_points, pxs, pys, batch_result));
+    quadtree_batch_result_free(batch_result);
+    quadtree_batch_result_free(expected);
+    quadtree_worker_pool_destroy(worker_pool);
+    quadtree_destroy(qt);
+    free(pxs);
+    free(pys);
+}
+
+/* sum of the ids found for every point so that results can be compared
+ * regardless of the order of the ids */
+static void sum_batch_ids(quadtree_batch_result_t *batch_result, long *sums) {
+    int i, j;
+    for (i = 0; i < batch_result->number_of_points; ++i) {
+        sums[i] = 0;
+        for (j = batch_result->offsets[i]; j < batch_result->offsets[i + 1]; ++j) {
+            sums[i] += batch_result->ids[j] + 1;
+        }
+    }
+}
+
+void test_build() {
+    int i, k;
+    int number_of_polygons = 300;
+    int number_of_points = 5000;
+    long ids[300];
+    int counts[300];
+    int xs[900], ys[900];
+    int pxs[5000], pys[5000];
+    static long expected_sums[5000], sums[5000];
+    quadtree_t incremental = quadtree_create(0, 0, 800, 600);
+    quadtree_t serial = quadtree_create(0, 0, 800, 600);
+    quadtree_t parallel = quadtree_create(0, 0, 800, 600);
+    quadtree_worker_pool_t worker_pool = quadtree_worker_pool_create(3);
+    quadtree_batch_result_t *batch_result = quadtree_batch_result_allocate();
+    srand(11);
+    for (i = 0; i < number_of_polygons; ++i) {
+        ids[i] = i % 250;
+        counts[i] = 3;
+        for (k = 0; k < 3; ++k) {
+            xs[3 * i + k] = rand() % 800;
+            ys[3 * i + k] = rand() % 600;
+        }
+        quadtree_add(incremental, ids[i], 3, xs + 3 * i, ys + 3 * i);
+    }
+    for (i = 0; i < number_of_points; ++i) {
+        pxs[i] = rand() % 800;
+        pys[i] = rand() % 600;
+    }
+    assertEqualsInt("build failed", QUADTREE_SUCCESS,
+                    quadtree_build(serial, number_of_polygons, ids, counts, xs, ys, NULL));
+    assertEqualsInt("parallel build failed", QUADTREE_SUCCESS,
+                    quadtree_build(parallel, number_of_polygons, ids, counts, xs, ys, worker_pool));
+    assertEqualsInt("build into non-empty quadtree", QUADTREE_ERROR,
+                    quadtree_build(serial, number_of_polygons, ids, counts, xs, ys, NULL));
+    /* removing ids works on built quadtrees, too */
+    quadtree_remove(incremental, 3);
+    quadtree_remove(serial, 3);
+    quadtree_remove(parallel, 3);
+    quadtree_query_batch(incremental, number_of_points, pxs, pys, batch_result);
+    sum_batch_ids(batch_result, expected_sums);
+    quadtree_query_batch(serial, number_of_points, pxs, pys, batch_result);
+    sum_batch_ids(batch_result, sums);
+    for (i = 0; i < number_of_points; ++i) {
+        assertEqualsInt("serial build differs", (int) expected_sums[i], (int) sums[i]);
+    }
+    quadtree_query_batch(parallel, number_of_points, pxs, pys, batch_result);
+    sum_batch_ids(batch_result, sums);
+    for (i = 0; i < number_of_points; ++i) {
+        assertEqualsInt("parallel build differs", (int) expected_sums[i], (int) sums[i]);
+    }
+    xs[5] = -5;
+    quadtree_destroy(serial);
+    serial = quadtree_create(0, 0, 800, 600);
+    assertEqualsInt("build should report out of bounds", QUADTREE_ERROR_OUT_OF_BOUNDS,
+                    quadtree_build(serial, number_of_polygons, ids, counts, xs, ys, NULL));
+    quadtree_batch_result_free(batch_result);
+    quadtree_worker_pool_destroy(worker_pool);
+    quadtree_destroy(incremental);
+    quadtree_destroy(serial);
+    quadtree_destroy(parallel);
+}
+
+/* A build that runs out of memory at any point leaves the quadtree
+ * empty and ready for another build. */
+void test_build_out_of_memory() {
+    int i, k, x, y, error_code;
+    long failure;
+    long ids[30];
+    int counts[30];
+    int xs[90], ys[90];
+    quadtree_t expected = quadtree_create(0, 0, 256, 256);
+    quadtree_t qt;
+    quadtree_query_result_t *expected_result = quadtree_query_result_allocate();
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    srand(13);
+    /* small triangles keep the number of allocations to fail low */
+    for (i = 0; i < 30; ++i) {
+        ids[i] = i;
+        counts[i] = 3;
+        x = rand() % 224;
+        y = rand() % 224;
+        for (k = 0; k < 3; ++k) {
+            xs[3 * i + k] = x + rand() % 32;
+            ys[3 * i + k] = y + rand() % 32;
+        }
+    }
+    assertEqualsInt("build failed", QUADTREE_SUCCESS, quadtree_build(expected, 30, ids, counts, xs, ys, NULL));
+    for (failure = 0;; ++failure) {
+        qt = quadtree_create(0, 0, 256, 256);
+        assertTrue("creating failed", qt != NULL);
+        pool_allocations_until_failure = failure;
+        error_code = quadtree_build(qt, 30, ids, counts, xs, ys, NULL);
+        pool_allocations_until_failure = -1;
+        if (error_code == QUADTREE_SUCCESS) {
+            quadtree_destroy(qt);
+            break;
+        }
+        assertEqualsInt("build did not run out of memory", QUADTREE_ERROR_OUT_OF_MEMORY, error_code);
+        assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query_rect(qt, 0, 0, 256, 256, result));
+        assertEqualsInt("failed build left polygons", 0, result->number_of_ids);
+        assertEqualsInt("build after failed build failed", QUADTREE_SUCCESS,
+                        quadtree_build(qt, 30, ids, counts, xs, ys, NULL));
+        for (x = 0; x < 256; x += 23) {
+            for (y = 0; y < 256; y += 23) {
+                quadtree_query(expected, x, y, expected_result);
+                quadtree_query(qt, x, y, result);
+                assertEqualsInt("build after failed build differs", expected_result->number_of_ids, result->number_of_ids);
+            }
+        }
+        quadtree_destroy(qt);
+    }
+    assertTrue("build never ran out of memory", failure > 0);
+    quadtree_query_result_free(result);
+    quadtree_query_result_free(expected_result);
+    quadtree_destroy(expected);
+}
+
+void test_add_batch() {
+    int i, k;
+    int number_of_polygons = 200;
+    int number_of_points = 2000;
+    long ids[200];
+    int counts[200];
+    int xs[800], ys[800];
+    int pxs[2000], pys[2000];
+    static long expected_sums[2000], sums[2000];
+    int first_point = 0;
+    quadtree_t incremental = quadtree_create(0, 0, 800, 600);
+    quadtree_t empty = quadtree_create(0, 0, 800, 600);
+    quadtree_t filled = quadtree_create(0, 0, 800, 600);
+    quadtree_query_result_t *query_result = quadtree_query_result_allocate();
+    quadtree_batch_result_t *batch_result = quadtree_batch_result_allocate();
+    srand(23);
+    for (i = 0; i < number_of_polygons; ++i) {
+        ids[i] = i % 150;
+        counts[i] = 3 + i % 2;
+        for (k = 0; k < counts[i]; ++k) {
+            xs[first_point + k] = rand() % 800;
+            ys[first_point + k] = rand() % 600;
+        }
+        quadtree_add(incremental, ids[i], counts[i], xs + first_point, ys + first_point);
+        first_point += counts[i];
+    }
+    for (i = 0; i < number_of_points; ++i) {
+        pxs[i] = rand() % 800;
+        pys[i] = rand() % 600;
+    }
+    assertEqualsInt("batch add into empty quadtree failed", QUADTREE_SUCCESS,
+                    quadtree_add_batch(empty, number_of_polygons, ids, counts, xs, ys));
+    /* the first polygon on its own so the rest is added to a non-empty quadtree */
+    quadtree_add(filled, ids[0], counts[0], xs, ys);
+    assertEqualsInt("batch add into filled quadtree failed", QUADTREE_SUCCESS,
+                    quadtree_add_batch(filled, number_of_polygons - 1, ids + 1, counts + 1,
+                                       xs + counts[0], ys + counts[0]));
+    quadtree_query_batch(incremental, number_of_points, pxs, pys, batch_result);
+    sum_batch_ids(batch_result, expected_sums);
+    quadtree_query_batch(empty, number_of_points, pxs, pys, batch_result);
+    sum_batch_ids(batch_result, sums);
+    for (i = 0; i < number_of_points; ++i) {
+        assertEqualsInt("batch add into empty quadtree differs", (int) expected_sums[i], (int) sums[i]);
+    }
+    quadtree_query_batch(filled, number_of_points, pxs, pys, batch_result);
+    sum_batch_ids(batch_result, sums);
+    for (i = 0; i < number_of_points; ++i) {
+        assertEqualsInt("batch add into filled quadtree differs", (int) expected_sums[i], (int) sums[i]);
+    }
+    /* nothing is added if one of the polygons is out of bounds */
+    ids[0] = 1000;
+    ids[1] = 1001;
+    xs[0] = xs[1] = xs[2] = 0;
+    ys[0] = ys[1] = ys[2] = 0;
+    xs[counts[0] + 2] = -5;
+    assertEqualsInt("batch add should report out of bounds", QUADTREE_ERROR_OUT_OF_BOUNDS,
+                    quadtree_add_batch(filled, 2, ids, counts, xs, ys));
+    quadtree_query(filled, 0, 0, query_result);
+    for (i = 0; i < query_result->number_of_ids; ++i) {
+        assertTrue("out of bounds batch added a polygon", query_result->ids[i] < 1000);
+    }
+    quadtree_query_result_free(query_result);
+    quadtree_batch_result_free(batch_result);
+    quadtree_destroy(incremental);
+    quadtree_destroy(empty);
+    quadtree_destroy(filled);
+}
+
+void test_freeze() {
+    int i, j, k;
+    int xs[3], ys[3];
+    quadtree_t qt = quadtree_create(0, 0, 800, 600);
+    quadtree_frozen_t frozen;
+    quadtree_query_result_t *expected = quadtree_query_result_allocate();
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    srand(5);
+    for (i = 0; i < 100; ++i) {
+        for (k = 0; k < 3; ++k) {
+            xs[k] = rand() % 800;
+            ys[k] = rand() % 600;
+        }
+        quadtree_add(qt, i % 80, 3, xs, ys);
+    }
+    quadtree_remove(qt, 17);
+    frozen = quadtree_freeze(qt);
+    assertTrue("freeze failed", frozen != NULL);
+    /* the frozen quadtree does not depend on the original */
+    quadtree_remove(qt, 18);
+    quadtree_add(qt, 18, 3, xs, ys);
+    quadtree_destroy(qt);
+    qt = NULL;
+    for (i = 0; i < 2000; ++i) {
+        int x = rand() % 800;
+        int y = rand() % 600;
+        assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_frozen_query(frozen, x, y, result));
+        for (j = 0; j < result->number_of_ids; ++j) {
+            assertTrue("removed id found", result->ids[j] != 17);
+        }
+    }
+    assertEqualsInt("query should fail", QUADTREE_ERROR_OUT_OF_BOUNDS,
+                    quadtree_frozen_query(frozen, 2000, 2, result));
+    quadtree_frozen_destroy(frozen);
+
+    qt = quadtree_create(0, 0, 800, 600);
+    srand(6);
+    for (i = 0; i < 100; ++i) {
+        for (k = 0; k < 3; ++k) {
+            xs[k] = rand() % 800;
+            ys[k] = rand() % 600;
+        }
+        quadtree_add(qt, i, 3, xs, ys);
+    }
+    frozen = quadtree_freeze(qt);
+    for (i = 0; i < 2000; ++i) {
+        int x = rand() % 800;
+        int y = rand() % 600;
+        quadtree_query(qt, x, y, expected);
+        quadtree_frozen_query(frozen, x, y, result);
+        assertEqualsInt("wrong number of ids", expected->number_of_ids, result->number_of_ids);
+        for (j = 0; j < result->number_of_ids; ++j) {
+            assertEqualsInt("wrong id", (int) expected->ids[j], (int) result->ids[j]);
+        }
+    }
+    quadtree_frozen_destroy(frozen);
+    quadtree_query_result_free(expected);
+    quadtree_query_result_free(result);
+    quadtree_destroy(qt);
+}
+
+void test_bounding_boxes() {
+    int i, k, x, y;
+    int xs[60][3], ys[60][3];
+    long expected_sum, sum;
+    int expected_count;
+    quadtree_t qt = quadtree_create(0, 0, 64, 64);
+    quadtree_frozen_t frozen;
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    /* small overlapping triangles clip the corners of many leaves */
+    srand(7);
+    for (i = 0; i < 60; ++i) {
+        for (k = 0; k < 3; ++k) {
+            xs[i][k] = 20 + rand() % 20;
+            ys[i][k] = 20 + rand() % 20;
+        }
+        assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, i, 3, xs[i], ys[i]));
+    }
+    /* removal moves the last entry of a leaf into the freed slot */
+    for (i = 0; i < 60; i += 3) {
+        assertEqualsInt("remove failed", QUADTREE_SUCCESS, quadtree_remove(qt, i));
+    }
+    frozen = quadtree_freeze(qt);
+    assertTrue("freeze failed", frozen != NULL);
+    for (x = 16; x < 44; ++x) {
+        for (y = 16; y < 44; ++y) {
+            expected_count = 0;
+            expected_sum = 0;
+            for (i = 0; i < 60; ++i) {
+                if (i % 3 != 0 && point_in_polygon(x, y, 3, xs[i], ys[i])) {
+                    expected_count++;
+                    expected_sum += i;
+                }
+            }
+            assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, x, y, result));
+            assertEqualsInt("wrong number of ids", expected_count, result->number_of_ids);
+            for (sum = 0, i = 0; i < result->number_of_ids; ++i) {
+                sum += result->ids[i];
+            }
+            assertEqualsInt("wrong ids", (int) expected_sum, (int) sum);
+            assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_frozen_query(frozen, x, y, result));
+            assertEqualsInt("wrong number of frozen ids", expected_count, result->number_of_ids);
+        }
+    }
+    quadtree_frozen_destroy(frozen);
+    quadtree_query_result_free(result);
+    quadtree_destroy(qt);
+}
+
+void test_query_rect() {
+    int i, k, j, x, y, left, bottom, width, height;
+    int xs[80][4], ys[80][4];
+    int big_xs[] = { 2, 125, 64 };
+    int big_ys[] = { 3, 10, 120 };
+    int found[80];
+    quadtree_t qt = quadtree_create(0, 0, 128, 128);
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    srand(11);
+    for (i = 0; i < 80; ++i) {
+        for (k = 0; k < 4; ++k) {
+            xs[i][k] = rand() % 128;
+            ys[i][k] = rand() % 128;
+        }
+        assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, i, 4, xs[i], ys[i]));
+    }
+    /* a second polygon with id 0 must not show up twice */
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 0, 3, big_xs, big_ys));
+    for (j = 0; j < 200; ++j) {
+        /* the first window covers the whole tree */
+        left = j == 0 ? -10 : rand() % 130 - 6;
+        bottom = j == 0 ? -10 : rand() % 130 - 6;
+        width = j == 0 ? 200 : 7 + rand() % 40;
+        height = j == 0 ? 200 : 7 + rand() % 40;
+        assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query_rect(qt, left, bottom, width, height, result));
+        /* compare with the part of the window inside of the tree */
+        if (left + width > 128) {
+            width = 128 - left;
+        }
+        if (bottom + height > 128) {
+            height = 128 - bottom;
+        }
+        if (left < 0) {
+            width += left;
+            left = 0;
+        }
+        if (bottom < 0) {
+            height += bottom;
+            bottom = 0;
+        }
+        for (i = 0; i < 80; ++i) {
+            found[i] = 0;
+        }
+        for (i = 0; i < result->number_of_ids; ++i) {
+            assertTrue("unknown id", result->ids[i] >= 0 && result->ids[i] < 80);
+            assertTrue("ids not sorted and unique", i == 0 || result->ids[i - 1] < result->ids[i]);
+            found[result->ids[i]] = 1;
+        }
+        for (i = 0; i < 80; ++i) {
+            /* polygons that merely touch the window may be reported */
+            if (found[i]) {
+                assertTrue("polygon does not collide with the window",
+                           collide_polygon_rectangle(4, xs[i], ys[i], left, bottom, width, height) ||
+                           (i == 0 && collide_polygon_rectangle(3, big_xs, big_ys, left, bottom, width, height)));
+                continue;
+            }
+            for (x = left; x < left + width; ++x) {
+                for (y = bottom; y < bottom + height; ++y) {
+                    assertFalse("polygon is missing", point_in_polygon(x, y, 4, xs[i], ys[i]) ||
+                                (i == 0 && point_in_polygon(x, y, 3, big_xs, big_ys)));
+                }
+            }
+        }
+    }
+    assertEqualsInt("window outside", QUADTREE_ERROR_OUT_OF_BOUNDS, quadtree_query_rect(qt, 128, 0, 10, 10, result));
+    assertEqualsInt("empty window", QUADTREE_ERROR, quadtree_query_rect(qt, 0, 0, 0, 10, result));
+    quadtree_query_result_free(result);
+    quadtree_destroy(qt);
+}
+
+void test_query_nearest() {
+    int i, j, k, m, x, y, width, height;
+    int xs[60][4], ys[60][4];
+    double distances[60], distance, max_distance;
+    quadtree_t qt = quadtree_create(0, 0, 256, 256);
+    quadtree_nearest_result_t *result = quadtree_nearest_result_allocate();
+    srand(13);
+    for (i = 0; i < 60; ++i) {
+        /* skewed rectangles */
+        x = rand() % 236;
+        y = rand() % 236;
+        width = 6 + rand() % 14;
+        height = 6 + rand() % 14;
+        xs[i][0] = x;
+        ys[i][0] = y + rand() % 3;
+        xs[i][1] = x + width;
+        ys[i][1] = y;
+        xs[i][2] = x + width - rand() % 3;
+        ys[i][2] = y + height;
+        xs[i][3] = x + rand() % 3;
+        ys[i][3] = y + height - rand() % 3;
+        /* ids 0 and 1 have two polygons each */
+        assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, i < 4 ? i % 2 : i, 4, xs[i], ys[i]));
+    }
+    for (j = 0; j < 300; ++j) {
+        x = rand() % 300 - 20;
+        y = rand() % 300 - 20;
+        k = 1 + rand() % 6;
+        max_distance = j % 3 == 0 ? 30.0 : -1;
+        for (i = 0; i < 60; ++i) {
+            distances[i] = point_in_polygon(x, y, 4, xs[i], ys[i]) ? 0 :
+                           sqrt(polygon_edges_distance_squared(x, y, 4, xs[i], ys[i]));
+        }
+        for (i = 0; i < 2; ++i) {
+            distances[i] = distances[i] < distances[i + 2] ? distances[i] : distances[i + 2];
+            distances[i + 2] = 1e300;
+        }
+        assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query_nearest(qt, x, y, k, max_distance, result));
+        /* the brute force answer is the k smallest distances */
+        for (m = 0; m < k; ++m) {
+            int nearest = 0;
+            for (i = 1; i < 60; ++i) {
+                if (distances[i] < distances[nearest]) {
+                    nearest = i;
+                }
+            }
+            distance = distances[nearest];
+            if (max_distance >= 0 && distance > max_distance) {
+                break;
+            }
+            assertTrue("too few ids", m < result->number_of_ids);
+            assertTrue("wrong distance", fabs(distance - result->distances[m]) < 1e-9);
+            assertTrue("wrong id", distances[result->ids[m]] == distance);
+            distances[result->ids[m]] = 1e300;
+        }
+        assertEqualsInt("wrong number of ids", m, result->number_of_ids);
+    }
+    assertEqualsInt("k must be positive", QUADTREE_ERROR, quadtree_query_nearest(qt, 0, 0, 0, -1, result));
+    quadtree_nearest_result_free(result);
+    quadtree_destroy(qt);
+}
+
+/* compares the three nearest of 400 random points with a brute force
+ * search over the triangles from first on */
+static void assert_nearest_triangles(quadtree_t qt, int first, int number_of_triangles, int *xs, int *ys, quadtree_nearest_result_t *result) {
+    int i, j, m, x, y;
+    double distances[120], distance;
+    for (j = 0; j < 400; ++j) {
+        x = rand() % 256;
+        y = rand() % 256;
+        for (i = 0; i < number_of_triangles; ++i) {
+            distances[i] = i < first ? 1e300 :
+                           point_in_polygon(x, y, 3, xs + 3 * i, ys + 3 * i) ? 0 :
+                           sqrt(polygon_edges_distance_squared(x, y, 3, xs + 3 * i, ys + 3 * i));
+        }
+        assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query_nearest(qt, x, y, 3, -1, result));
+        assertEqualsInt("wrong number of ids", 3, result->number_of_ids);
+        for (m = 0; m < 3; ++m) {
+            int nearest = 0;
+            for (i = 1; i < number_of_triangles; ++i) {
+                if (distances[i] < distances[nearest]) {
+                    nearest = i;
+                }
+            }
+            distance = distances[nearest];
+            assertTrue("wrong distance", fabs(distance - result->distances[m]) < 1e-9);
+            assertTrue("wrong id", distances[result->ids[m]] == distance);
+            distances[result->ids[m]] = 1e300;
+        }
+    }
+}
+
+/* thin triangles are only held by the leaves whose integer points they
+ * contain but reach far beyond them */
+void test_query_nearest_slivers() {
+    int i, x, y;
+    int xs[3][3] = { { 26, 21, 27 }, { 0, 56, 39 }, { 17, 20, 32 } };
+    int ys[3][3] = { { 44, 13, 56 }, { 27, 29, 28 }, { 35, 36, 17 } };
+    long ids[120];
+    int counts[120], sliver_xs[360], sliver_ys[360];
+    quadtree_t qt = quadtree_create(0, 0, 64, 64);
+    quadtree_t built;
+    quadtree_worker_pool_t worker_pool = quadtree_worker_pool_create(3);
+    quadtree_nearest_result_t *result = quadtree_nearest_result_allocate();
+    for (i = 0; i < 3; ++i) {
+        assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 3 + i, 3, xs[i], ys[i]));
+    }
+    assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query_nearest(qt, 12, 35, 2, -1, result));
+    assertEqualsInt("wrong number of ids", 2, result->number_of_ids);
+    assertTrue("wrong nearest id", result->ids[0] == 5);
+    assertTrue("wrong nearest distance", fabs(result->distances[0] - 5.0) < 1e-9);
+    assertTrue("sliver not found", result->ids[1] == 4);
+    assertTrue("wrong sliver distance",
+               fabs(result->distances[1] - sqrt(polygon_edges_distance_squared(12, 35, 3, xs[1], ys[1]))) < 1e-9);
+    assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query_nearest(qt, 12, 35, 2, 8.0, result));
+    assertEqualsInt("sliver not found within the distance", 2, result->number_of_ids);
+    quadtree_destroy(qt);
+
+    srand(17);
+    for (i = 0; i < 120; ++i) {
+        x = rand() % 256;
+        y = rand() % 256;
+        sliver_xs[3 * i] = x;
+        sliver_ys[3 * i] = y;
+        sliver_xs[3 * i + 1] = rand() % 256;
+        sliver_ys[3 * i + 1] = rand() % 256;
+        sliver_xs[3 * i + 2] = (x + sliver_xs[3 * i + 1]) / 2 + rand() % 3 - 1;
+        sliver_ys[3 * i + 2] = (y + sliver_ys[3 * i + 1]) / 2 + rand() % 3 - 1;
+        /* triangles without area are held nowhere, try again */
+        if ((long) (sliver_xs[3 * i + 1] - x) * (sliver_ys[3 * i + 2] - y) ==
+            (long) (sliver_ys[3 * i + 1] - y) * (sliver_xs[3 * i + 2] - x)) {
+            --i;
+            continue;
+        }
+        ids[i] = i;
+        counts[i] = 3;
+    }
+    qt = quadtree_create(0, 0, 256, 256);
+    built = quadtree_create(0, 0, 256, 256);
+    for (i = 0; i < 120; ++i) {
+        assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, i, 3, sliver_xs + 3 * i, sliver_ys + 3 * i));
+    }
+    assertEqualsInt("build failed", QUADTREE_SUCCESS,
+                    quadtree_build(built, 120, ids, counts, sliver_xs, sliver_ys, worker_pool));
+    assert_nearest_triangles(qt, 0, 120, sliver_xs, sliver_ys, result);
+    assert_nearest_triangles(built, 0, 120, sliver_xs, sliver_ys, result);
+    /* compacting shrinks the envelopes to the triangles left */
+    for (i = 0; i < 60; ++i) {
+        assertEqualsInt("remove failed", QUADTREE_SUCCESS, quadtree_remove(qt, i));
+    }
+    quadtree_compact(qt);
+    assert_nearest_triangles(qt, 60, 120, sliver_xs, sliver_ys, result);
+    quadtree_nearest_result_free(result);
+    quadtree_worker_pool_destroy(worker_pool);
+    quadtree_destroy(qt);
+    quadtree_destroy(built);
+}
+
+void test_update() {
+    int i, k, round, x, y, count;
+    int xs[40][24], ys[40][24], counts[40];
+    long expected_sum, sum;
+    int expected_count;
+    quadtree_t qt = quadtree_create(0, 0, 64, 64);
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    assertEqualsInt("enabling the edge index failed", QUADTREE_SUCCESS, quadtree_set_edge_index(qt, 1));
+    srand(17);
+    for (round = 0; round < 12; ++round) {
+        for (i = 0; i < 40; ++i) {
+            if (round > 0 && rand() % 3 == 0) {
+                continue;
+            }
+            /* move and resize a bit, sometimes change the number of
+             * corners which also switches the edge index on and off */
+            x = rand() % 44;
+            y = rand() % 44;
+            count = rand() % 4 == 0 ? 24 : 3 + rand() % 2;
+            for (k = 0; k < count; ++k) {
+                xs[i][k] = x + rand() % 20;
+                ys[i][k] = y + rand() % 20;
+            }
+            counts[i] = count;
+            assertEqualsInt("update failed", QUADTREE_SUCCESS, quadtree_update(qt, i, count, xs[i], ys[i]));
+        }
+        for (x = 0; x < 64; x += 3) {
+            for (y = 0; y < 64; y += 3) {
+                expected_count = 0;
+                expected_sum = 0;
+                for (i = 0; i < 40; ++i) {
+                    if (point_in_polygon(x, y, counts[i], xs[i], ys[i])) {
+                        expected_count++;
+                        expected_sum += i;
+                    }
+                }
+                assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, x, y, result));
+                assertEqualsInt("wrong number of ids", expected_count, result->number_of_ids);
+                for (sum = 0, i = 0; i < result->number_of_ids; ++i) {
+                    sum += result->ids[i];
+                }
+                assertEqualsInt("wrong ids", (int) expected_sum, (int) sum);
+            }
+        }
+    }
+    /* several polygons with one id are replaced by a single one */
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 0, counts[1], xs[1], ys[1]));
+    assertEqualsInt("update failed", QUADTREE_SUCCESS, quadtree_update(qt, 0, counts[2], xs[2], ys[2]));
+    for (x = 0; x < 64; ++x) {
+        for (y = 0; y < 64; ++y) {
+            assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, x, y, result));
+            for (count = 0, i = 0; i < result->number_of_ids; ++i) {
+                count += result->ids[i] == 0;
+            }
+            assertEqualsInt("wrong polygons with id 0", point_in_polygon(x, y, counts[2], xs[2], ys[2]), count);
+        }
+    }
+    xs[0][0] = 64;
+    assertEqualsInt("out of bounds", QUADTREE_ERROR_OUT_OF_BOUNDS, quadtree_update(qt, 0, 3, xs[0], ys[0]));
+    quadtree_query_result_free(result);
+    quadtree_destroy(qt);
+}
+
+/* Removing polygons merges children back into their parents.  The
+ * queries have to stay exact and a merged node must not report a
+ * polygon for a window the polygon does not touch. */
+void test_compact() {
+    int i, k, round, x, y, hits;
+    int xs[30][4], ys[30][4];
+    bool present[30];
+    quadtree_stats_t stats;
+    long number_of_nodes;
+    quadtree_t qt = quadtree_create(0, 0, 64, 64);
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    srand(23);
+    for (i = 0; i < 30; ++i) {
+        present[i] = false;
+    }
+    for (round = 0; round < 10; ++round) {
+        for (i = 0; i < 30; ++i) {
+            if (rand() % 2 == 0) {
+                continue;
+            }
+            if (present[i]) {
+                assertEqualsInt("remove failed", QUADTREE_SUCCESS, quadtree_remove(qt, i));
+                present[i] = false;
+            } else {
+                x = rand() % 48;
+                y = rand() % 48;
+                for (k = 0; k < 4; ++k) {
+                    xs[i][k] = x + (k == 1 || k == 2 ? 1 + rand() % 16 : 0);
+                    ys[i][k] = y + (k >= 2 ? 1 + rand() % 16 : 0);
+                }
+                assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, i, 4, xs[i], ys[i]));
+                present[i] = true;
+            }
+        }
+        if (round % 3 == 2) {
+            assertEqualsInt("compact failed", QUADTREE_SUCCESS, quadtree_compact(qt));
+        }
+        for (x = 0; x < 64; x += 2) {
+            for (y = 0; y < 64; y += 2) {
+                assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, x, y, result));
+                for (hits = 0, i = 0; i < 30; ++i) {
+                    hits += present[i] && point_in_polygon(x, y, 4, xs[i], ys[i]);
+                }
+                assertEqualsInt("wrong number of ids", hits, result->number_of_ids);
+                for (k = 0; k < result->number_of_ids; ++k) {
+                    i = (int) result->ids[k];
+                    assertTrue("wrong id", present[i] && point_in_polygon(x, y, 4, xs[i], ys[i]));
+                }
+                assertEqualsInt("rect query failed", QUADTREE_SUCCESS, quadtree_query_rect(qt, x, y, 2, 2, result));
+                for (k = 0; k < result->number_of_ids; ++k) {
+                    i = (int) result->ids[k];
+                    assertTrue("polygon reported for a window it misses",
+                               present[i] && collide_polygon_rectangle(4, xs[i], ys[i], x, y, 2, 2));
+                }
+            }
+        }
+    }
+    for (i = 0; i < 30; ++i) {
+        assertEqualsInt("remove failed", QUADTREE_SUCCESS, quadtree_remove(qt, i));
+    }
+    assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query_rect(qt, 0, 0, 64, 64, result));
+    assertEqualsInt("removed polygons reported", 0, result->number_of_ids);
+    quadtree_query_result_free(result);
+    quadtree_destroy(qt);
+
+    /* removing the small squares leaves children that all hold the
+     * big one, which only quadtree_compact() merges */
+    qt = quadtree_create(0, 0, 64, 64);
+    for (k = 0; k < 4; ++k) {
+        xs[0][k] = k == 1 || k == 2 ? 63 : 0;
+        ys[0][k] = k >= 2 ? 63 : 0;
+    }
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 0, 4, xs[0], ys[0]));
+    for (i = 1; i < 30; ++i) {
+        for (k = 0; k < 4; ++k) {
+            xs[i][k] = (i % 6) * 5 + (k == 1 || k == 2 ? 3 : 0);
+            ys[i][k] = (i / 6) * 5 + (k >= 2 ? 3 : 0);
+        }
+        assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, i, 4, xs[i], ys[i]));
+    }
+    quadtree_get_stats(qt, &stats);
+    number_of_nodes = stats.number_of_nodes;
+    for (i = 1; i < 30; ++i) {
+        assertEqualsInt("remove failed", QUADTREE_SUCCESS, quadtree_remove(qt, i));
+    }
+    quadtree_get_stats(qt, &stats);
+    assertTrue("children holding the same polygon merged on removal", stats.number_of_nodes == number_of_nodes);
+    assertEqualsInt("compact failed", QUADTREE_SUCCESS, quadtree_compact(qt));
+    quadtree_get_stats(qt, &stats);
+    assertTrue("children holding the same polygon not merged", stats.number_of_nodes < number_of_nodes);
+    quadtree_destroy(qt);
+}
+
+#define CONCURRENT_STATIC (16)
+#define CONCURRENT_CHURN (40)
+
+typedef struct {
+    quadtree_t qt;
+    int stop;
+    int xs[CONCURRENT_CHURN][4];
+    int ys[CONCURRENT_CHURN][4];
+    bool present[CONCURRENT_CHURN];
+} concurrent_test_t;
+
+/* the static polygons are the squares of a 4x4 grid and keep their ids
+ * while the writer adds, moves and removes quadrilaterals with ids from
+ * 100 on everywhere around them */
+static void concurrent_square(int s, int *xs, int *ys) {
+    int x = (s % 4) * 64 + 8, y = (s / 4) * 64 + 8;
+    xs[0] = x;
+    ys[0] = y;
+    xs[1] = x + 24;
+    ys[1] = y;
+    xs[2] = x + 24;
+    ys[2] = y + 24;
+    xs[3] = x;
+    ys[3] = y + 24;
+}
+
+/* rand() is not thread safe and rand_r() not C90 */
+static int concurrent_random(unsigned long *state) {
+    *state = *state * 1103515245ul + 12345ul;
+    return (int) ((*state >> 16) & 0x7fff);
+}
+
+/* the change the writer makes in the given step */
+static void concurrent_change(concurrent_test_t *test, unsigned long *seed, int step) {
+    int i, k, x, y;
+    i = concurrent_random(seed) % CONCURRENT_CHURN;
+    if (test->present[i] && concurrent_random(seed) % 3 == 0) {
+        assertEqualsInt("remove failed", QUADTREE_SUCCESS, quadtree_remove(test->qt, 100 + i));
+        test->present[i] = false;
+        return;
+    }
+    x = concurrent_random(seed) % 200;
+    y = concurrent_random(seed) % 200;
+    for (k = 0; k < 4; ++k) {
+        test->xs[i][k] = x + (k == 1 || k == 2 ? 1 + concurrent_random(seed) % 50 : 0);
+        test->ys[i][k] = y + (k >= 2 ? 1 + concurrent_random(seed) % 50 : 0);
+    }
+    assertEqualsInt("update failed", QUADTREE_SUCCESS, quadtree_update(test->qt, 100 + i, 4, test->xs[i], test->ys[i]));
+    test->present[i] = true;
+    if (step % 1000 == 999) {
+        assertEqualsInt("compact failed", QUADTREE_SUCCESS, quadtree_compact(test->qt));
+    }
+    if (step % 3000 == 1500) {
+        assertEqualsInt("switching the edge index failed", QUADTREE_SUCCESS,
+                        quadtree_set_edge_index(test->qt, step % 6000 == 1500));
+    }
+}
+
+static void* concurrent_writer(void *context) {
+    concurrent_test_t *test = (concurrent_test_t*) context;
+    int step;
+    unsigned long seed = 37;
+    for (step = 0; step < 20000; ++step) {
+        concurrent_change(test, &seed, step);
+    }
+    __atomic_store_n(&test->stop, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void* concurrent_reader(void *context) {
+    concurrent_test_t *test = (concurrent_test_t*) context;
+    int i, s, x, y, found;
+    unsigned long seed = (unsigned long) (size_t) &s;
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    quadtree_nearest_result_t *nearest = quadtree_nearest_result_allocate();
+    assertTrue("allocating the results failed", result != NULL && nearest != NULL);
+    while (!__atomic_load_n(&test->stop, __ATOMIC_ACQUIRE)) {
+        s = concurrent_random(&seed) % CONCURRENT_STATIC;
+        x = (s % 4) * 64 + 9 + concurrent_random(&seed) % 22;
+        y = (s / 4) * 64 + 9 + concurrent_random(&seed) % 22;
+        assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(test->qt, x, y, result));
+        for (found = 0, i = 0; i < result->number_of_ids; ++i) {
+            assertTrue("unknown id", result->ids[i] == s || (result->ids[i] >= 100 && result->ids[i] < 100 + CONCURRENT_CHURN));
+            found += result->ids[i] == s;
+        }
+        assertEqualsInt("static polygon not found exactly once", 1, found);
+        assertEqualsInt("rect query failed", QUADTREE_SUCCESS, quadtree_query_rect(test->qt, x, y, 2, 2, result));
+        for (found = 0, i = 0; i < result->number_of_ids; ++i) {
+            assertTrue("other static polygon reported", result->ids[i] == s || result->ids[i] >= 100);
+            found += result->ids[i] == s;
+        }
+        assertEqualsInt("static polygon not found by the rect query", 1, found);
+        assertEqualsInt("nearest query failed", QUADTREE_SUCCESS, quadtree_query_nearest(test->qt, x, y, 1, -1, nearest));
+        assertEqualsInt("no nearest polygon", 1, nearest->number_of_ids);
+        assertTrue("nearest polygon not containing the point", nearest->distances[0] == 0.);
+    }
+    quadtree_nearest_result_free(nearest);
+    quadtree_query_result_free(result);
+    return NULL;
+}
+
+/* Readers query without locks while one writer keeps changing the tree
+ * around polygons that stay put.  Afterwards the tree has to agree with
+ * what the writer left. */
+void test_concurrent_readers() {
+    int i, s, x, y, hits;
+    int xs[4], ys[4];
+    pthread_t writer, readers[3];
+    quadtree_config_t config;
+    concurrent_test_t test;
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    quadtree_config_initialize(&config);
+    config.concurrent_readers = 1;
+    test.qt = quadtree_create_ex(0, 0, 256, 256, &config);
+    test.stop = 0;
+    assertTrue("creating failed", test.qt != NULL);
+    for (i = 0; i < CONCURRENT_CHURN; ++i) {
+        test.present[i] = false;
+    }
+    for (s = 0; s < CONCURRENT_STATIC; ++s) {
+        concurrent_square(s, xs, ys);
+        assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(test.qt, s, 4, xs, ys));
+    }
+    for (i = 0; i < 3; ++i) {
+        assertEqualsInt("starting a reader failed", 0, pthread_create(&readers[i], NULL, concurrent_reader, &test));
+    }
+    assertEqualsInt("starting the writer failed", 0, pthread_create(&writer, NULL, concurrent_writer, &test));
+    pthread_join(writer, NULL);
+    for (i = 0; i < 3; ++i) {
+        pthread_join(readers[i], NULL);
+    }
+    for (x = 0; x < 256; x += 3) {
+        for (y = 0; y < 256; y += 3) {
+            for (hits = 0, s = 0; s < CONCURRENT_STATIC; ++s) {
+                concurrent_square(s, xs, ys);
+                hits += point_in_polygon(x, y, 4, xs, ys);
+            }
+            for (i = 0; i < CONCURRENT_CHURN; ++i) {
+                hits += test.present[i] && point_in_polygon(x, y, 4, test.xs[i], test.ys[i]);
+            }
+            assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(test.qt, x, y, result));
+            assertEqualsInt("wrong number of ids", hits, result->number_of_ids);
+        }
+    }
+    quadtree_query_result_free(result);
+    quadtree_destroy(test.qt);
+}
+
+/* checks the answers of snapshot against the polygons of expected */
+static void snapshot_check(quadtree_snapshot_t snapshot, concurrent_test_t *expected) {
+    int i, s, x, y, hits;
+    int xs[4], ys[4];
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    quadtree_nearest_result_t *nearest = quadtree_nearest_result_allocate();
+    for (x = 0; x < 256; x += 5) {
+        for (y = 0; y < 256; y += 5) {
+            for (hits = 0, s = 0; s < CONCURRENT_STATIC; ++s) {
+                concurrent_square(s, xs, ys);
+                hits += point_in_polygon(x, y, 4, xs, ys);
+            }
+            for (i = 0; i < CONCURRENT_CHURN; ++i) {
+                hits += expected->present[i] && point_in_polygon(x, y, 4, expected->xs[i], expected->ys[i]);
+            }
+            assertEqualsInt("snapshot query failed", QUADTREE_SUCCESS, quadtree_snapshot_query(snapshot, x, y, result));
+            assertEqualsInt("wrong number of ids in the snapshot", hits, result->number_of_ids);
+            assertEqualsInt("snapshot nearest query failed", QUADTREE_SUCCESS,
+                            quadtree_snapshot_query_nearest(snapshot, x, y, 1, -1, nearest));
+            assertEqualsInt("no nearest polygon in the snapshot", 1, nearest->number_of_ids);
+            assertTrue("nearest polygon of the snapshot not containing the point", hits == 0 || nearest->distances[0] == 0.);
+        }
+    }
+    for (hits = CONCURRENT_STATIC, i = 0; i < CONCURRENT_CHURN; ++i) {
+        hits += expected->present[i];
+    }
+    assertEqualsInt("snapshot rect query failed", QUADTREE_SUCCESS,
+                    quadtree_snapshot_query_rect(snapshot, 0, 0, 256, 256, result));
+    assertEqualsInt("wrong number of polygons in the snapshot", hits, result->number_of_ids);
+    quadtree_nearest_result_free(nearest);
+    quadtree_query_result_free(result);
+}
+
+/* takes snapshots while the writer changes the tree and checks that
+ * each sees the same polygons from start to end */
+static void* snapshot_reader(void *context) {
+    concurrent_test_t *test = (concurrent_test_t*) context;
+    int i, s, x, y, found, number_of_ids;
+    long ids[CONCURRENT_STATIC + CONCURRENT_CHURN];
+    unsigned long seed = (unsigned long) (size_t) &s;
+    quadtree_snapshot_t snapshot;
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    assertTrue("allocating the result failed", result != NULL);
+    while (!__atomic_load_n(&test->stop, __ATOMIC_ACQUIRE)) {
+        snapshot = quadtree_snapshot(test->qt);
+        assertTrue("taking a snapshot failed", snapshot != NULL);
+        assertEqualsInt("snapshot rect query failed", QUADTREE_SUCCESS,
+                        quadtree_snapshot_query_rect(snapshot, 0, 0, 256, 256, result));
+        number_of_ids = result->number_of_ids;
+        memcpy(ids, result->ids, number_of_ids * sizeof(long));
+        for (i = 0; i < 20; ++i) {
+            s = concurrent_random(&seed) % CONCURRENT_STATIC;
+            x = (s % 4) * 64 + 9 + concurrent_random(&seed) % 22;
+            y = (s / 4) * 64 + 9 + concurrent_random(&seed) % 22;
+            assertEqualsInt("snapshot query failed", QUADTREE_SUCCESS, quadtree_snapshot_query(snapshot, x, y, result));
+            for (found = 0, s = 0; s < result->number_of_ids; ++s) {
+                found += result->ids[s] < CONCURRENT_STATIC;
+            }
+            assertEqualsInt("static polygon not found exactly once", 1, found);
+        }
+        assertEqualsInt("snapshot rect query failed", QUADTREE_SUCCESS,
+                        quadtree_snapshot_query_rect(snapshot, 0, 0, 256, 256, result));
+        assertEqualsInt("snapshot changed", number_of_ids, result->number_of_ids);
+        assertTrue("snapshot changed", memcmp(ids, result->ids, number_of_ids * sizeof(long)) == 0);
+        quadtree_snapshot_release(snapshot);
+    }
+    quadtree_query_result_free(result);
+    return NULL;
+}
+
+/* Snapshots keep answering like the tree did when they were taken,
+ * whatever the writer does to it later, also on another thread. */
+void test_snapshot_queries() {
+    int i, s, step;
+    int xs[4], ys[4], counts[1];
+    long ids[1];
+    unsigned long seed = 41;
+    pthread_t writer, readers[2];
+    concurrent_test_t test, first, second;
+    quadtree_snapshot_t snapshot, again, later;
+    test.qt = quadtree_create(0, 0, 256, 256);
+    test.stop = 0;
+    assertTrue("creating failed", test.qt != NULL);
+    for (i = 0; i < CONCURRENT_CHURN; ++i) {
+        test.present[i] = false;
+    }
+    for (s = 0; s < CONCURRENT_STATIC; ++s) {
+        concurrent_square(s, xs, ys);
+        assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(test.qt, s, 4, xs, ys));
+    }
+    for (step = 0; step < 300; ++step) {
+        concurrent_change(&test, &seed, step);
+    }
+    snapshot = quadtree_snapshot(test.qt);
+    assertTrue("taking a snapshot failed", snapshot != NULL);
+    again = quadtree_snapshot(test.qt);
+    assertTrue("unchanged tree got a new snapshot", again == snapshot);
+    quadtree_snapshot_release(again);
+    first = test;
+    concurrent_square(0, xs, ys);
+    counts[0] = 4;
+    ids[0] = 0;
+    assertEqualsInt("build with a snapshot succeeded", QUADTREE_ERROR,
+                    quadtree_build(test.qt, 1, ids, counts, xs, ys, NULL));
+    for (; step < 1300; ++step) {
+        concurrent_change(&test, &seed, step);
+    }
+    later = quadtree_snapshot(test.qt);
+    assertTrue("taking a snapshot failed", later != NULL && later != snapshot);
+    second = test;
+    for (; step < 2300; ++step) {
+        concurrent_change(&test, &seed, step);
+    }
+    snapshot_check(snapshot, &first);
+    snapshot_check(later, &second);
+    quadtree_snapshot_release(snapshot);
+    for (; step < 3300; ++step) {
+        concurrent_change(&test, &seed, step);
+    }
+    snapshot_check(later, &second);
+    quadtree_snapshot_release(later);
+    for (; step < 3400; ++step) {
+        concurrent_change(&test, &seed, step);
+    }
+    snapshot = quadtree_snapshot(test.qt);
+    snapshot_check(snapshot, &test);
+    quadtree_snapshot_release(snapshot);
+    for (i = 0; i < 2; ++i) {
+        assertEqualsInt("starting a reader failed", 0, pthread_create(&readers[i], NULL, snapshot_reader, &test));
+    }
+    assertEqualsInt("starting the writer failed", 0, pthread_create(&writer, NULL, concurrent_writer, &test));
+    pthread_join(writer, NULL);
+    for (i = 0; i < 2; ++i) {
+        pthread_join(readers[i], NULL);
+    }
+    /* snapshots may outlive their quadtree until they are released */
+    snapshot = quadtree_snapshot(test.qt);
+    again = quadtree_snapshot(test.qt);
+    assertTrue("taking a snapshot failed", snapshot != NULL && again == snapshot);
+    quadtree_destroy(test.qt);
+    quadtree_snapshot_release(again);
+    quadtree_snapshot_release(snapshot);
+}
+
+/* Trees with other subdivision settings, filled one by one or built
+ * at once, answer queries like the default one. */
+void test_config() {
+    int c, i, k, x, y, hits, first, n;
+    int counts[40], xs[40 * 12], ys[40 * 12];
+    long ids[40];
+    quadtree_config_t configs[5];
+    quadtree_config_t config;
+    quadtree_t qt, built;
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    quadtree_query_result_t *built_result = quadtree_query_result_allocate();
+    quadtree_config_initialize(&config);
+    config.min_size = 0;
+    assertTrue("min_size 0 accepted", quadtree_create_ex(0, 0, 64, 64, &config) == NULL);
+    quadtree_config_initialize(&config);
+    config.max_leaf_entries = -1;
+    assertTrue("negative max_leaf_entries accepted", quadtree_create_ex(0, 0, 64, 64, &config) == NULL);
+    for (c = 0; c < 5; ++c) {
+        quadtree_config_initialize(&configs[c]);
+    }
+    configs[1].max_depth = 2;
+    configs[2].min_size = 16;
+    configs[3].max_leaf_entries = 4;
+    configs[4].max_leaf_entries = 8;
+    configs[4].max_leaf_points = 30;
+    srand(29);
+    for (first = 0, i = 0; i < 40; ++i) {
+        n = rand() % 3 == 0 ? 12 : 3;
+        x = rand() % 48;
+        y = rand() % 48;
+        for (k = 0; k < n; ++k) {
+            xs[first + k] = x + rand() % 16;
+            ys[first + k] = y + rand() % 16;
+        }
+        ids[i] = i;
+        counts[i] = n;
+        first += n;
+    }
+    for (c = 0; c < 5; ++c) {
+        qt = quadtree_create_ex(0, 0, 64, 64, &configs[c]);
+        built = quadtree_create_ex(0, 0, 64, 64, &configs[c]);
+        assertTrue("creating failed", qt != NULL && built != NULL);
+        for (first = 0, i = 0; i < 40; ++i) {
+            assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, i, counts[i], xs + first, ys + first));
+            first += counts[i];
+        }
+        assertEqualsInt("build failed", QUADTREE_SUCCESS, quadtree_build(built, 40, ids, counts, xs, ys, NULL));
+        /* removing and adding back again exercises merging */
+        for (first = 0, i = 0; i < 40; ++i) {
+            if (i % 3 == 0) {
+                assertEqualsInt("remove failed", QUADTREE_SUCCESS, quadtree_remove(qt, i));
+                assertEqualsInt("update failed", QUADTREE_SUCCESS, quadtree_update(qt, i, counts[i], xs + first, ys + first));
+            }
+            first += counts[i];
+        }
+        for (x = 0; x < 64; x += 2) {
+            for (y = 0; y < 64; y += 2) {
+                for (hits = 0, first = 0, i = 0; i < 40; ++i) {
+                    hits += point_in_polygon(x, y, counts[i], xs + first, ys + first);
+                    first += counts[i];
+                }
+                assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, x, y, result));
+                assertEqualsInt("wrong number of ids", hits, result->number_of_ids);
+                assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(built, x, y, built_result));
+                assertEqualsInt("wrong number of ids when built", hits, built_result->number_of_ids);
+                assertEqualsInt("rect query failed", QUADTREE_SUCCESS, quadtree_query_rect(qt, x, y, 2, 2, result));
+                for (k = 0; k < result->number_of_ids; ++k) {
+                    for (first = 0, i = 0; i < result->ids[k]; ++i) {
+                        first += counts[i];
+                    }
+                    assertTrue("polygon reported for a window it misses",
+                               collide_polygon_rectangle(counts[i], xs + first, ys + first, x, y, 2, 2));
+                }
+            }
+        }
+        assertEqualsInt("compact failed", QUADTREE_SUCCESS, quadtree_compact(qt));
+        quadtree_destroy(qt);
+        quadtree_destroy(built);
+    }
+    quadtree_query_result_free(result);
+    quadtree_query_result_free(built_result);
+}
+
+/* sets the int at offset of the snapshot file at path to value and
+ * makes the checksum match again */
+static void patch_snapshot(const char *path, long offset, int value) {
+    static char content[65536];
+    long i, size;
+    unsigned int word;
+    unsigned long long checksum = 0xcbf29ce484222325ull;
+    FILE *file = fopen(path, "r+b");
+    assertTrue("could not open snapshot", file != NULL);
+    size = (long) fread(content, 1, sizeof(content), file);
+    assertTrue("snapshot too large", size < (long) sizeof(content));
+    memcpy(content + offset, &value, sizeof(int));
+    /* the checksum covers everything after the 40 byte header */
+    for (i = 40; i + 4 <= size; i += 4) {
+        memcpy(&word, content + i, sizeof(word));
+        checksum ^= word;
+        checksum *= 0x100000001b3ull;
+    }
+    memcpy(content + 32, &checksum, sizeof(checksum));
+    fseek(file, 0, SEEK_SET);
+    fwrite(content, 1, size, file);
+    fclose(file);
+}
+
+void test_save_load() {
+    int i, x, y;
+    int xs[] = { 0, 80, 0, 1, 9, 1, 10, 70, 70, 10, 30, 50, 40 };
+    int ys[] = { 0, 0, 60, 1, 1, 9, 10, 10, 50, 50, 20, 20, 55 };
+    int offsets[] = { 0, 3, 6, 10 };
+    int counts[] = { 3, 3, 4, 3 };
+    long ids[] = { 1, 2, 3, 1 };
+    char *path = "test_snapshot.qt";
+    FILE *file;
+    quadtree_t qt = quadtree_create(0, 0, 80, 60);
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    quadtree_query_result_t *loaded_result = quadtree_query_result_allocate();
+    quadtree_frozen_t loaded;
+    for (i = 0; i < 4; ++i) {
+        assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, ids[i], counts[i], xs + offsets[i], ys + offsets[i]));
+    }
+    assertEqualsInt("save failed", QUADTREE_SUCCESS, quadtree_save(qt, path));
+    loaded = quadtree_load(path);
+    assertTrue("load failed", loaded != NULL);
+    for (x = 0; x < 80; ++x) {
+        for (y = 0; y < 60; ++y) {
+            assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, x, y, result));
+            assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_frozen_query(loaded, x, y, loaded_result));
+            assertEqualsInt("wrong number of ids", result->number_of_ids, loaded_result->number_of_ids);
+            for (i = 0; i < result->number_of_ids; ++i) {
+                assertEqualsInt("wrong id", (int) result->ids[i], (int) loaded_result->ids[i]);
+            }
+        }
+    }
+    assertEqualsInt("out of bounds", QUADTREE_ERROR_OUT_OF_BOUNDS, quadtree_frozen_query(loaded, -1, 0, loaded_result));
+    quadtree_frozen_destroy(loaded);
+    /* indices outside of the file are refused even with a matching
+     * checksum.  The nodes follow the two headers of 40 and 32 bytes,
+     * the entries follow the nodes. */
+    patch_snapshot(path, 72, 1000);
+    assertTrue("snapshot with a bad node index loaded", quadtree_load(path) == NULL);
+    assertEqualsInt("save failed", QUADTREE_SUCCESS, quadtree_save(qt, path));
+    /* the number of nodes is the fifth int of the second header */
+    file = fopen(path, "rb");
+    assertTrue("could not open snapshot", file != NULL);
+    fseek(file, 56, SEEK_SET);
+    assertTrue("could not read snapshot", fread(&i, sizeof(int), 1, file) == 1);
+    fclose(file);
+    patch_snapshot(path, 72 + 8 * i + sizeof(long), 1000);
+    assertTrue("snapshot with a bad point index loaded", quadtree_load(path) == NULL);
+    assertEqualsInt("save failed", QUADTREE_SUCCESS, quadtree_save(qt, path));
+    /* a damaged snapshot is refused */
+    file = fopen(path, "r+b");
+    assertTrue("could not open snapshot", file != NULL);
+    fseek(file, -5, SEEK_END);
+    i = fgetc(file);
+    fseek(file, -5, SEEK_END);
+    fputc(i ^ 1, file);
+    fclose(file);
+    assertTrue("damaged snapshot loaded", quadtree_load(path) == NULL);
+    remove(path);
+    assertTrue("missing snapshot loaded", quadtree_load(path) == NULL);
+    quadtree_query_result_free(result);
+    quadtree_query_result_free(loaded_result);
+    quadtree_destroy(qt);
+}
+
+void test_stats() {
+    int i;
+    long sum;
+    int square_xs[] = { 0, 63, 63, 0 };
+    int square_ys[] = { 0, 0, 63, 63 };
+    int triangle_xs[] = { 1, 30, 1 };
+    int triangle_ys[] = { 1, 1, 30 };
+    int circle_xs[20], circle_ys[20];
+    quadtree_stats_t stats;
+    quadtree_t qt = quadtree_create(0, 0, 64, 64);
+    for (i = 0; i < 20; ++i) {
+        circle_xs[i] = 48 + (int) (10 * cos(i * 6.283185307179586 / 20));
+        circle_ys[i] = 48 + (int) (10 * sin(i * 6.283185307179586 / 20));
+    }
+
+    assertEqualsInt("stats failed", QUADTREE_SUCCESS, quadtree_get_stats(qt, &stats));
+    assertEqualsULong("wrong number of nodes", 1ul, (unsigned long) stats.number_of_nodes);
+    assertEqualsULong("wrong number of leaves", 1ul, (unsigned long) stats.number_of_leaves);
+    assertEqualsULong("wrong number of empty leaves", 1ul, (unsigned long) stats.leaves_per_size[0]);
+    assertEqualsULong("wrong number of entries", 0ul, (unsigned long) stats.number_of_entries);
+    assertEqualsInt("wrong id", -1, (int) stats.max_polygon_entries_id);
+    assertTrue("no bytes", stats.total_bytes > 0);
+
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 7, 4, square_xs, square_ys));
+    quadtree_get_stats(qt, &stats);
+    assertEqualsULong("wrong number of polygons", 1ul, (unsigned long) stats.number_of_polygons);
+    assertEqualsULong("wrong fan-out", (unsigned long) stats.number_of_entries, (unsigned long) stats.max_polygon_entries);
+    assertEqualsInt("wrong id", 7, (int) stats.max_polygon_entries_id);
+    assertEqualsULong("wrong number of points", 4ul, (unsigned long) stats.number_of_points);
+    assertEqualsULong("wrong point bytes", 8 * sizeof(unsigned short), (unsigned long) stats.point_bytes);
+
+    quadtree_set_edge_index(qt, 1);
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 8, 3, triangle_xs, triangle_ys));
+    assertEqualsInt("add failed", QUADTREE_SUCCESS, quadtree_add(qt, 9, 20, circle_xs, circle_ys));
+    quadtree_get_stats(qt, &stats);
+    assertEqualsULong("wrong number of polygons", 3ul, (unsigned long) stats.number_of_polygons);
+    assertEqualsULong("wrong number of points", 27ul, (unsigned long) stats.number_of_points);
+    assertTrue("no edge index", stats.edge_index_bytes > 0);
+    assertTrue("tree did not split", stats.number_of_nodes > 1 && stats.max_depth > 0);
+    assertEqualsULong("nodes are not leaves or parents of four", (unsigned long) stats.number_of_nodes,
+                      (unsigned long) (4 * (stats.number_of_nodes - stats.number_of_leaves) + 1));
+    for (i = 0, sum = 0; i < QUADTREE_STATS_BUCKETS; ++i) {
+        sum += stats.nodes_per_depth[i];
+    }
+    assertEqualsULong("depth histogram", (unsigned long) stats.number_of_nodes, (unsigned long) sum);
+    for (i = 0, sum = 0; i < QUADTREE_STATS_BUCKETS; ++i) {
+        sum += stats.leaves_per_size[i];
+    }
+    assertEqualsULong("size histogram", (unsigned long) stats.number_of_leaves, (unsigned long) sum);
+    assertTrue("wrong fan-out", stats.max_polygon_entries > 0 && stats.max_polygon_entries < stats.number_of_entries);
+    assertTrue("wrong max leaf", stats.max_leaf_polygons >= 2 && stats.max_leaf_polygons <= 3);
+    assertTrue("wrong total", stats.total_bytes > stats.node_bytes + stats.entry_bytes + stats.leaf_array_bytes +
+                                                  stats.polygon_bytes + stats.point_bytes + stats.edge_index_bytes +
+                                                  stats.id_map_bytes);
+
+    /* removing everything leaves a single empty leaf */
+    quadtree_remove(qt, 7);
+    quadtree_remove(qt, 8);
+    quadtree_remove(qt, 9);
+    quadtree_get_stats(qt, &stats);
+    assertEqualsULong("wrong number of nodes", 1ul, (unsigned long) stats.number_of_nodes);
+    assertEqualsULong("wrong number of polygons", 0ul, (unsigned long) stats.number_of_polygons);
+    assertEqualsULong("wrong number of entries", 0ul, (unsigned long) stats.number_of_entries);
+    quadtree_destroy(qt);
+}
+
+#ifdef QUADTREE_COUNTERS
+void assert_counters_equal(quadtree_counters_t *expected, quadtree_counters_t *actual) {
+    assertEqualsULong("wrong nodes visited", expected->nodes_visited, actual->nodes_visited);
+    assertEqualsULong("wrong entries scanned", expected->entries_scanned, actual->entries_scanned);
+    assertEqualsULong("wrong point in polygon calls", expected->point_in_polygon_calls, actual->point_in_polygon_calls);
+    assertEqualsULong("wrong edges tested", expected->edges_tested, actual->edges_tested);
+    assertEqualsULong("wrong allocations", expected->allocations, actual->allocations);
+}
+
+void test_counters() {
+    int i;
+    int square_xs[] = { 0, 40, 40, 0 };
+    int square_ys[] = { 0, 0, 40, 40 };
+    int triangle_xs[] = { 20, 60, 60 };
+    int triangle_ys[] = { 20, 20, 60 };
+    int xs[32], ys[32];
+    quadtree_counters_t call, total, sum;
+    quadtree_t qt = quadtree_create(0, 0, 64, 64);
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    quadtree_batch_result_t *batch_result = quadtree_batch_result_allocate();
+    quadtree_worker_pool_t worker_pool = quadtree_worker_pool_create(2);
+    memset(&sum, 0, sizeof(sum));
+
+    assertEqualsInt("counters failed", QUADTREE_SUCCESS, quadtree_get_counters(qt, &total));
+    assert_counters_equal(&sum, &total);
+
+    quadtree_add(qt, 1, 4, square_xs, square_ys);
+    assertEqualsInt("call counters failed", QUADTREE_SUCCESS, quadtree_get_call_counters(&call));
+    assertTrue("no nodes visited", call.nodes_visited > 0);
+    assertTrue("no edges tested", call.edges_tested >= 4);
+    assertTrue("no allocations", call.allocations > 0);
+    quadtree_get_counters(qt, &total);
+    assert_counters_equal(&call, &total);
+
+    quadtree_add(qt, 2, 3, triangle_xs, triangle_ys);
+    quadtree_reset_counters(qt);
+    quadtree_get_counters(qt, &total);
+    assert_counters_equal(&sum, &total);
+
+    /* a warmed up query looks at one leaf, does not allocate and only
+     * tests polygons whose bounding box contains the point */
+    quadtree_query(qt, 5, 5, result);
+    quadtree_query(qt, 5, 5, result);
+    quadtree_get_call_counters(&call);
+    assertTrue("no nodes visited", call.nodes_visited > 0);
+    assertTrue("no entries scanned", call.entries_scanned > 0);
+    assertEqualsULong("wrong point in polygon calls", 1ul, call.point_in_polygon_calls);
+    assertEqualsULong("wrong edges tested", 4ul, call.edges_tested);
+    assertEqualsULong("query allocated", 0ul, call.allocations);
+    quadtree_get_counters(qt, &total);
+    assertEqualsULong("calls not summed up", 2 * call.nodes_visited, total.nodes_visited);
+    assertEqualsULong("calls not summed up", 2ul, total.point_in_polygon_calls);
+
+    /* the parallel batch counts the work of all workers for the call */
+    for (i = 0; i < 32; ++i) {
+        xs[i] = i * 2;
+        ys[i] = 30;
+    }
+    quadtree_query_batch(qt, 32, xs, ys, batch_result);
+    quadtree_get_call_counters(&sum);
+    assertTrue("no point in polygon calls", sum.point_in_polygon_calls > 0);
+    quadtree_reset_counters(qt);
+    quadtree_query_batch_parallel(qt, worker_pool, 32, xs, ys, batch_result);
+    quadtree_get_call_counters(&call);
+    quadtree_get_counters(qt, &total);
+    assert_counters_equal(&call, &total);
+    assertEqualsULong("wrong point in polygon calls", sum.point_in_polygon_calls, call.point_in_polygon_calls);
+    assertEqualsULong("wrong edges tested", sum.edges_tested, call.edges_tested);
+
+    assertEqualsInt("reset failed", QUADTREE_SUCCESS, quadtree_reset_counters(qt));
+    quadtree_worker_pool_destroy(worker_pool);
+    quadtree_batch_result_free(batch_result);
+    quadtree_query_result_free(result);
+    quadtree_destroy(qt);
+}
+#else
+void test_counters() {
+    quadtree_counters_t counters;
+    quadtree_t qt = quadtree_create(0, 0, 64, 64);
+    assertEqualsInt("counters are compiled out", QUADTREE_ERROR, quadtree_get_counters(qt, &counters));
+    assertEqualsULong("counters not cleared", 0ul, counters.nodes_visited);
+    assertEqualsInt("counters are compiled out", QUADTREE_ERROR, quadtree_get_call_counters(&counters));
+    assertEqualsInt("counters are compiled out", QUADTREE_ERROR, quadtree_reset_counters(qt));
+    quadtree_destroy(qt);
+}
+#endif
+
+typedef struct {
+    int number_of_errors;
+    long line_numbers[8];
+    int error_codes[8];
+} ingest_errors_t;
+
+void collect_ingest_error(long line_number, int error_code, const char *message, void *context) {
+    ingest_errors_t *errors = (ingest_errors_t*) context;
+    assertTrue("missing message", message != NULL && message[0] != '\0');
+    if (errors->number_of_errors < 8) {
+        errors->line_numbers[errors->number_of_errors] = line_number;
+        errors->error_codes[errors->number_of_errors] = error_code;
+    }
+    errors->number_of_errors++;
+}
+
+int ingest_file(quadtree_t qt, const char *content, quadtree_ingest_options_t *options, quadtree_ingest_stats_t *stats) {
+    int fd, error_code;
+    char *path = "test_ingest.txt";
+    FILE *file = fopen(path, "wb");
+    assertTrue("could not write input", file != NULL);
+    fputs(content, file);
+    fclose(file);
+    fd = open(path, O_RDONLY);
+    assertTrue("could not open input", fd >= 0);
+    error_code = quadtree_ingest(qt, fd, options, stats);
+    close(fd);
+    remove(path);
+    return error_code;
+}
+
+void assert_query_ids(quadtree_t qt, int x, int y, int number_of_ids, long id) {
+    quadtree_query_result_t *result = quadtree_query_result_allocate();
+    assertEqualsInt("query failed", QUADTREE_SUCCESS, quadtree_query(qt, x, y, result));
+    assertEqualsInt("wrong number of ids", number_of_ids, result->number_of_ids);
+    if (number_of_ids > 0) {
+        assertEqualsInt("wrong id", (int) id, (int) result->ids[0]);
+    }
+    quadtree_query_result_free(result);
+}
+
+void test_ingest() {
+    int i;
+    char *content;
+    size_t length;
+    quadtree_ingest_options_t options;
+    quadtree_ingest_stats_t stats;
+    ingest_errors_t errors;
+    quadtree_t qt = quadtree_create(0, 0, 100, 100);
+
+    quadtree_ingest_options_initialize(&options);
+    options.error_handler = collect_ingest_error;
+    options.context = &errors;
+    memset(&errors, 0, sizeof(ingest_errors_t));
+    assertEqualsInt("wkt ingest failed", QUADTREE_SUCCESS, ingest_file(qt,
+        "# comment\n"
+        "1 POLYGON ((0 0, 10 0, 10 10, 0 10, 0 0))\n"
+        "\n"
+        "2,\"MULTIPOLYGON (((20 0, 30 0, 30 10)), ((40 0, 50 0, 50 10, 40 10)))\"\r\n"
+        "3 POLYGON ((0 0, 10 0, 10\n"
+        "4 polygon z ((60 60 1, 70 60 1, 70 70 1, 60 70 1))\n"
+        "5 POLYGON ((0 0, 500 0, 500 10))\n"
+        "6 POLYGON ((0 0, 10 0, 10 10), (1 1, 2 1, 2 2))\n"
+        "7 MULTIPOLYGON (((80 80, 90 80, 90 90)), ((0 0, 200 0, 0 200)))",
+        &options, &stats));
+    assertEqualsULong("wrong number of records", 7ul, (unsigned long) stats.number_of_records);
+    assertEqualsULong("wrong number of polygons", 4ul, (unsigned long) stats.number_of_polygons);
+    assertEqualsULong("wrong number of errors", 4ul, (unsigned long) stats.number_of_errors);
+    assertEqualsInt("wrong number of errors", 4, errors.number_of_errors);
+    assertEqualsInt("wrong line", 5, (int) errors.line_numbers[0]);
+    assertEqualsInt("wrong error", QUADTREE_ERROR, errors.error_codes[0]);
+    assertEqualsInt("wrong line", 7, (int) errors.line_numbers[1]);
+    assertEqualsInt("wrong error", QUADTREE_ERROR_OUT_OF_BOUNDS, errors.error_codes[1]);
+    assertEqualsInt("wrong line", 8, (int) errors.line_numbers[2]);
+    assertEqualsInt("wrong error", QUADTREE_ERROR, errors.error_codes[2]);
+    assertEqualsInt("wrong line", 9, (int) errors.line_numbers[3]);
+    assertEqualsInt("wrong error", QUADTREE_ERROR_OUT_OF_BOUNDS, errors.error_codes[3]);
+    assert_query_ids(qt, 5, 5, 1, 1);
+    assert_query_ids(qt, 28, 2, 1, 2);
+    assert_query_ids(qt, 45, 5, 1, 2);
+    assert_query_ids(qt, 35, 5, 0, 0);
+    assert_query_ids(qt, 65, 65, 1, 4);
+    /* no part of a bad multipolygon is added */
+    assert_query_ids(qt, 88, 82, 0, 0);
+    quadtree_destroy(qt);
+
+    /* GeoJSON with scaled coordinates */
+    qt = quadtree_create(0, 0, 100, 100);
+    options.format = QUADTREE_FORMAT_GEOJSON;
+    options.origin_x = 10.;
+    options.origin_y = -5.;
+    options.scale_x = 10.;
+    options.scale_y = 10.;
+    memset(&errors, 0, sizeof(ingest_errors_t));
+    assertEqualsInt("geojson ingest failed", QUADTREE_SUCCESS, ingest_file(qt,
+        "{\"type\": \"Feature\", \"id\": 11, \"properties\": {\"name\": \"a \\\"b\\\"\", \"tags\": [1, {}]},"
+        " \"geometry\": {\"coordinates\": [[[10, -5], [11, -5], [11, -4], [10, -4], [10, -5]]], \"type\": \"Polygon\"}},\n"
+        "\x1e{\"type\":\"Feature\",\"geometry\":{\"type\":\"MultiPolygon\",\"coordinates\":[[[[12,-5],[13,-5,7],[13,-4]]],[[[14,-5],[15,-5],[15,-4]]]]},\"id\":\"12\"}\n"
+        "{\"type\": \"Feature\", \"id\": 13, \"geometry\": {\"type\": \"Point\", \"coordinates\": [10, -5]}}\n"
+        "{\"type\": \"Feature\", \"id\": 14, \"geometry\": null}\n"
+        "{\"type\": \"Feature\", \"geometry\": {\"type\": \"Polygon\", \"coordinates\": [[[10, -5], [11, -5], [11, -4]]]}}\n"
+        "{\"type\": \"Feature\", \"id\": 16, \"geometry\": {\"type\": \"Polygon\", \"coordinates\": [[[10, -5], [11, -5]\n",
+        &options, &stats));
+    assertEqualsULong("wrong number of records", 6ul, (unsigned long) stats.number_of_records);
+    assertEqualsULong("wrong number of polygons", 3ul, (unsigned long) stats.number_of_polygons);
+    assertEqualsInt("wrong number of errors", 4, errors.number_of_errors);
+    for (i = 0; i < 4; ++i) {
+        assertEqualsInt("wrong line", 3 + i, (int) errors.line_numbers[i]);
+        assertEqualsInt("wrong error", QUADTREE_ERROR, errors.error_codes[i]);
+    }
+    assert_query_ids(qt, 5, 5, 1, 11);
+    assert_query_ids(qt, 29, 1, 1, 12);
+    assert_query_ids(qt, 49, 1, 1, 12);
+    assert_query_ids(qt, 35, 1, 0, 0);
+    quadtree_destroy(qt);
+
+    /* CSV with a header */
+    qt = quadtree_create(0, 0, 100, 100);
+    quadtree_ingest_options_initialize(&options);
+    options.format = QUADTREE_FORMAT_CSV;
+    options.skip_lines = 1;
+    assertEqualsInt("csv ingest failed", QUADTREE_SUCCESS, ingest_file(qt,
+        "id,coordinates\n"
+        "21, 0, 0, 10, 0, 10, 10, 0, 10\n"
+        "22,20,0,30,0,30\n"
+        "23,20.4,0,29.6,0,29.6,9.5\n",
+        &options, &stats));
+    assertEqualsULong("wrong number of records", 3ul, (unsigned long) stats.number_of_records);
+    assertEqualsULong("wrong number of polygons", 2ul, (unsigned long) stats.number_of_polygons);
+    assertEqualsULong("wrong number of errors", 1ul, (unsigned long) stats.number_of_errors);
+    assert_query_ids(qt, 5, 5, 1, 21);
+    assert_query_ids(qt, 29, 1, 1, 23);
+    quadtree_destroy(qt);
+
+    /* records spanning several chunks and records that are too long */
+    qt = quadtree_create(0, 0, 100, 100);
+    length = 0;
+    content = (char*) malloc(2 * 40000 * 8 + 64);
+    assertTrue("out of memory", content != NULL);
+    for (i = 0; i < 2; ++i) {
+        int j;
+        length += sprintf(content + length, "%d POLYGON ((%d 0, ", 31 + i, 40 * i);
+        for (j = 0; j < 40000; ++j) {
+            length += sprintf(content + length, "%d 30, ", 40 * i + j / 1000);
+        }
+        length += sprintf(content + length, "%d 0))\n", 40 * i + 39);
+    }
+    quadtree_ingest_options_initialize(&options);
+    memset(&errors, 0, sizeof(ingest_errors_t));
+    options.error_handler = collect_ingest_error;
+    options.context = &errors;
+    assertEqualsInt("long ingest failed", QUADTREE_SUCCESS, ingest_file(qt, content, &options, &stats));
+    assertEqualsULong("wrong number of polygons", 2ul, (unsigned long) stats.number_of_polygons);
+    assert_query_ids(qt, 20, 10, 1, 31);
+    assert_query_ids(qt, 60, 10, 1, 32);
+    quadtree_destroy(qt);
+    qt = quadtree_create(0, 0, 100, 100);
+    options.max_record_length = 1000;
+    assertEqualsInt("long ingest failed", QUADTREE_SUCCESS, ingest_file(qt, content, &options, &stats));
+    assertEqualsULong("wrong number of records", 2ul, (unsigned long) stats.number_of_records);
+    assertEqualsULong("wrong number of polygons", 0ul, (unsigned long) stats.number_of_polygons);
+    assertEqualsInt("wrong line", 2, (int) errors.line_numbers[1]);
+    free(content);
+
+    /* reading from a bad file descriptor fails */
+    assertEqualsInt("read from bad fd", QUADTREE_ERROR, quadtree_ingest(qt, -1, NULL, NULL));
+    quadtree_destroy(qt);
+}
+
 int main() {
     test_point_in_polygon();
+    test_point_in_polygon_simd();
+    test_edge_index();
+    test_compact_points();
     test_lines_intersect();
     test_collide_polygon_rectangle();
     test_rectangle_inside_polygon();
+    test_classify_polygon_rectangle();
     test_next_power_of_2();
+    test_pool();
+    test_query_result_reuse();
+    test_interleave_bits();
+    test_query_batch();
+    test_query_batch_large_polygons();
+    test_query_batch_parallel();
+    test_idmap();
+    test_remove();
+    test_build();
+    test_build_out_of_memory();
+    test_add_batch();
+    test_freeze();
+    test_save_load();
+    test_ingest();
+    test_bounding_boxes();
+    test_query_rect();
+    test_query_nearest();
+    test_query_nearest_slivers();
+    test_update();
+    test_compact();
+    test_concurrent_readers();
+    test_snapshot_queries();
+    test_config();
+    test_stats();
+    test_counters();
+    test_compact_quadtree();
 
     int i;
     quadtree_t qt = quadtree_create(0, 0, 80, 60);